@@ -0,0 +1,171 @@
+#if !defined(ACCUMULATE_H)
+#define ACCUMULATE_H
+
+#include <cstddef>
+#include <cstdint> // int64_t, uint64_t
+#include <type_traits>
+
+#include "util.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+
+/* Accumulation policies of dot products, norms and other reductions
+
+Reductions take the policy as their first template argument:
+    Native      - sums in the element type, the default. float runs at full SIMD width, integers stay exact
+    Compensated - sums in the element type with a TwoSum error term (Kahan-Neumaier), so the error doesn't
+                  grow with the length, for about twice the arithmetic and the same memory traffic
+    Widened     - sums float in double and integers in 64 bits, the result has the wider type. Storage (and
+                  memory traffic) stays float, the accuracy is close to double
+Example:
+    float a = dot(x, y);                            // x, y DynMat<float>
+    double b = dot<accumulate::Widened>(x, y);      // same loads, double lanes
+    float c = dot<accumulate::Compensated>(x, y);
+Contiguous float / double operands go through the kernels of Simd.h, everything else through Accumulator.
+Compensation needs strict IEEE arithmetic, under -ffast-math it's optimized away.
+*/
+
+namespace accumulate
+{
+    struct Native
+    {
+    };
+
+    struct Compensated
+    {
+    };
+
+    struct Widened
+    {
+    };
+
+    /// Type Widened sums T in
+    template <typename T, bool = std::is_integral<T>::value && !std::is_same<T, bool>::value>
+    struct wide
+    {
+        using Type = T;
+    };
+
+    template <>
+    struct wide<float, false>
+    {
+        using Type = double;
+    };
+
+    template <typename T>
+    struct wide<T, true>
+    {
+        using Type = typename std::conditional<std::is_signed<T>::value, int64_t, uint64_t>::type;
+    };
+
+    /* Running sum of T under Policy
+    add(x) / add_product(x, y) take terms, merge() another partial sum (e.g. of another thread), value() is the sum.
+    */
+    template <typename Policy, typename T>
+    class Accumulator;
+
+    template <typename T>
+    class Accumulator<Native, T>
+    {
+    private:
+        T sum_ = T();
+
+    public:
+        using Type = T;
+
+        inline void add(const T &x) { sum_ += x; }
+        inline void add_product(const T &x, const T &y) { sum_ += x * y; }
+        inline void merge(const Accumulator &other) { sum_ += other.sum_; }
+        inline Type value() const { return sum_; }
+    };
+
+    template <typename T>
+    class Accumulator<Widened, T>
+    {
+    public:
+        using Type = typename wide<T>::Type;
+
+    private:
+        Type sum_ = Type();
+
+    public:
+        inline void add(const Type &x) { sum_ += x; }
+        inline void add_product(const T &x, const T &y) { sum_ += Type(x) * Type(y); }
+        inline void merge(const Accumulator &other) { sum_ += other.sum_; }
+        inline Type value() const { return sum_; }
+    };
+
+    // integers have no rounding error, the error term just stays zero for them
+    template <typename T>
+    class Accumulator<Compensated, T>
+    {
+    private:
+        T sum_ = T();
+        T error_ = T();
+
+    public:
+        using Type = T;
+
+        inline void add(const T &x)
+        {
+            T s, e;
+            simd::two_sum(s, e, sum_, x);
+            sum_ = s;
+            error_ += e;
+        }
+
+        // not contracted, the error term is only exact for a rounded product
+        MATRAC_NO_CONTRACT inline void add_product(const T &x, const T &y) { add(x * y); }
+
+        inline void merge(const Accumulator &other)
+        {
+            add(other.sum_);
+            error_ += other.error_;
+        }
+
+        inline Type value() const { return sum_ + error_; }
+    };
+
+    template <typename Policy, typename T>
+    using result_t = typename Accumulator<Policy, T>::Type;
+
+    /// sum of a[i] * b[i] over contiguous storage
+    template <typename Policy, typename T>
+    inline result_t<Policy, T> dot(const T *a, const T *b, size_t n)
+    {
+        if constexpr (simd::is_vectorizable<T>::value && std::is_same<Policy, Compensated>::value)
+            return simd::dot_compensated(a, b, n);
+        else if constexpr (simd::is_vectorizable<T>::value && std::is_same<Policy, Widened>::value)
+            return simd::dot_wide(a, b, n);
+        else if constexpr (simd::is_vectorizable<T>::value)
+            return simd::dot(a, b, n);
+        else
+        {
+            auto acc = Accumulator<Policy, T>();
+            for (size_t i = 0; i < n; ++i)
+                acc.add_product(a[i], b[i]);
+            return acc.value();
+        }
+    }
+
+    /// Sums partial(begin, end) over chunks of [0, n) on the threads of `policy`, the chunks' sums are merged under Policy
+    template <typename Policy, typename T, typename F>
+    inline result_t<Policy, T> reduce(const parallel::Policy &policy, size_t n, const F &partial)
+    {
+        using A = Accumulator<Policy, T>;
+        return parallel::reduce(
+                   policy, n, A(),
+                   [&](size_t begin, size_t end) {
+                       auto a = A();
+                       a.add(partial(begin, end));
+                       return a;
+                   },
+                   [](A acc, const A &p) {
+                       acc.merge(p);
+                       return acc;
+                   })
+            .value();
+    }
+} // namespace accumulate
+
+#endif // ACCUMULATE_H
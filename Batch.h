@@ -0,0 +1,567 @@
+#if !defined(BATCH_H)
+#define BATCH_H
+
+#include <algorithm> // min
+#include <cmath>     // isfinite
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+
+#include "util.h"
+#include "Memory.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Transpose.h"
+#include "Matrix.h"
+
+/* Structure of arrays batches of small static matrices
+
+A MatBatch<T, R, C> holds N R x C matrices as R * C planes: plane k holds element k (row major) of every
+matrix, one after the other. Operations on the batch work on W matrices at once, W being the number of
+elements per SIMD register, so a 4x4 product does the same 64 multiply-adds as Mat's but for 8 or 16
+matrices per instruction and without any shuffles. The kernels are compiled once per instruction set and
+dispatched at runtime like the ones in Simd.h, ranges of matrices are spread across the threads of a
+parallel::Policy. Matrices at the end of a batch that don't fill a register go through the same
+expressions one at a time, contraction into FMAs is disabled so results don't depend on where in the batch
+a matrix sits.
+
+Moving matrices in and out is a transpose of the (N x R * C) array of Mats, batches are built from and
+scattered back to arrays of Mats with the tiled kernel from Transpose.h. get(n) and set(n, m) move single
+matrices.
+*/
+
+namespace internal
+{
+    namespace batch
+    {
+        /* Every batch operation is an Op with a static apply(op, a, b, c) working on the elements of one
+        matrix (T) or one register of matrices (a SIMD pack of T). A, B and C are the number of planes read
+        from the two inputs and written to the output, SHARED_A / SHARED_B mark inputs that are a single
+        matrix used for every matrix of the batch.
+        */
+
+        /// c = a * b for M x K matrices a and K x N matrices b
+        template <size_t M, size_t K, size_t N, bool SHARED_A_ = false, bool SHARED_B_ = false>
+        struct Multiply
+        {
+            static const size_t A = M * K, B = K * N, C = M * N;
+            static const bool SHARED_A = SHARED_A_, SHARED_B = SHARED_B_;
+
+            template <typename V>
+            static MATRAC_ALWAYS_INLINE void apply(const Multiply &, const V *a, const V *b, V *c)
+            {
+                for (size_t i = 0; i < M; ++i)
+                    for (size_t j = 0; j < N; ++j)
+                    {
+                        V sum = a[i * K] * b[j];
+                        for (size_t p = 1; p < K; ++p)
+                            sum += a[i * K + p] * b[p * N + j];
+                        c[i * N + j] = sum;
+                    }
+            }
+        };
+
+        /// c = a + b
+        template <size_t S>
+        struct Add
+        {
+            static const size_t A = S, B = S, C = S;
+            static const bool SHARED_A = false, SHARED_B = false;
+
+            template <typename V>
+            static MATRAC_ALWAYS_INLINE void apply(const Add &, const V *a, const V *b, V *c)
+            {
+                for (size_t k = 0; k < S; ++k)
+                    c[k] = a[k] + b[k];
+            }
+        };
+
+        /// c = a - b
+        template <size_t S>
+        struct Sub
+        {
+            static const size_t A = S, B = S, C = S;
+            static const bool SHARED_A = false, SHARED_B = false;
+
+            template <typename V>
+            static MATRAC_ALWAYS_INLINE void apply(const Sub &, const V *a, const V *b, V *c)
+            {
+                for (size_t k = 0; k < S; ++k)
+                    c[k] = a[k] - b[k];
+            }
+        };
+
+        /// c = a * s, b is unused
+        template <typename T, size_t S>
+        struct Scale
+        {
+            static const size_t A = S, B = 0, C = S;
+            static const bool SHARED_A = false, SHARED_B = false;
+            T s;
+
+            template <typename V>
+            static MATRAC_ALWAYS_INLINE void apply(const Scale &op, const V *a, const V *, V *c)
+            {
+                for (size_t k = 0; k < S; ++k)
+                    c[k] = a[k] * op.s;
+            }
+        };
+
+        /// c = det(a) for N x N matrices a, b is unused
+        template <size_t N>
+        struct Determinant
+        {
+            static const size_t A = N * N, B = 0, C = 1;
+            static const bool SHARED_A = false, SHARED_B = false;
+
+            template <typename V>
+            static MATRAC_ALWAYS_INLINE void apply(const Determinant &, const V *a, const V *, V *c)
+            {
+                if constexpr (N == 2)
+                    c[0] = a[0] * a[3] - a[1] * a[2];
+                else if constexpr (N == 3)
+                    c[0] = a[0] * (a[4] * a[8] - a[5] * a[7]) + a[1] * (a[5] * a[6] - a[3] * a[8]) +
+                           a[2] * (a[3] * a[7] - a[4] * a[6]);
+                else
+                {
+                    // 2x2 minors of the upper and lower two rows, Laplace expansion along them
+                    const V s0 = a[0] * a[5] - a[4] * a[1], s1 = a[0] * a[6] - a[4] * a[2];
+                    const V s2 = a[0] * a[7] - a[4] * a[3], s3 = a[1] * a[6] - a[5] * a[2];
+                    const V s4 = a[1] * a[7] - a[5] * a[3], s5 = a[2] * a[7] - a[6] * a[3];
+                    const V c5 = a[10] * a[15] - a[14] * a[11], c4 = a[9] * a[15] - a[13] * a[11];
+                    const V c3 = a[9] * a[14] - a[13] * a[10], c2 = a[8] * a[15] - a[12] * a[11];
+                    const V c1 = a[8] * a[14] - a[12] * a[10], c0 = a[8] * a[13] - a[12] * a[9];
+                    c[0] = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+                }
+            }
+        };
+
+        /// c = a^-1 for N x N matrices a, singular matrices end up with non finite elements, b is unused
+        template <typename T, size_t N>
+        struct Inverse
+        {
+            static const size_t A = N * N, B = 0, C = N * N;
+            static const bool SHARED_A = false, SHARED_B = false;
+
+            template <typename V>
+            static MATRAC_ALWAYS_INLINE void apply(const Inverse &, const V *a, const V *, V *c)
+            {
+                if constexpr (N == 2)
+                {
+                    const V inv = T(1) / (a[0] * a[3] - a[1] * a[2]);
+                    const V a0 = a[0];
+                    c[0] = a[3] * inv;
+                    c[1] = -a[1] * inv;
+                    c[2] = -a[2] * inv;
+                    c[3] = a0 * inv;
+                }
+                else if constexpr (N == 3)
+                {
+                    // cofactors, transposed into the adjugate
+                    const V b0 = a[4] * a[8] - a[5] * a[7], b1 = a[2] * a[7] - a[1] * a[8], b2 = a[1] * a[5] - a[2] * a[4];
+                    const V b3 = a[5] * a[6] - a[3] * a[8], b4 = a[0] * a[8] - a[2] * a[6], b5 = a[2] * a[3] - a[0] * a[5];
+                    const V b6 = a[3] * a[7] - a[4] * a[6], b7 = a[1] * a[6] - a[0] * a[7], b8 = a[0] * a[4] - a[1] * a[3];
+                    const V inv = T(1) / (a[0] * b0 + a[1] * b3 + a[2] * b6);
+                    c[0] = b0 * inv, c[1] = b1 * inv, c[2] = b2 * inv;
+                    c[3] = b3 * inv, c[4] = b4 * inv, c[5] = b5 * inv;
+                    c[6] = b6 * inv, c[7] = b7 * inv, c[8] = b8 * inv;
+                }
+                else
+                {
+                    // the adjugate from the same 2x2 minors as the determinant
+                    const V s0 = a[0] * a[5] - a[4] * a[1], s1 = a[0] * a[6] - a[4] * a[2];
+                    const V s2 = a[0] * a[7] - a[4] * a[3], s3 = a[1] * a[6] - a[5] * a[2];
+                    const V s4 = a[1] * a[7] - a[5] * a[3], s5 = a[2] * a[7] - a[6] * a[3];
+                    const V c5 = a[10] * a[15] - a[14] * a[11], c4 = a[9] * a[15] - a[13] * a[11];
+                    const V c3 = a[9] * a[14] - a[13] * a[10], c2 = a[8] * a[15] - a[12] * a[11];
+                    const V c1 = a[8] * a[14] - a[12] * a[10], c0 = a[8] * a[13] - a[12] * a[9];
+                    const V inv = T(1) / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+                    V b[16];
+                    b[0] = a[5] * c5 - a[6] * c4 + a[7] * c3;
+                    b[1] = -a[1] * c5 + a[2] * c4 - a[3] * c3;
+                    b[2] = a[13] * s5 - a[14] * s4 + a[15] * s3;
+                    b[3] = -a[9] * s5 + a[10] * s4 - a[11] * s3;
+                    b[4] = -a[4] * c5 + a[6] * c2 - a[7] * c1;
+                    b[5] = a[0] * c5 - a[2] * c2 + a[3] * c1;
+                    b[6] = -a[12] * s5 + a[14] * s2 - a[15] * s1;
+                    b[7] = a[8] * s5 - a[10] * s2 + a[11] * s1;
+                    b[8] = a[4] * c4 - a[5] * c2 + a[7] * c0;
+                    b[9] = -a[0] * c4 + a[1] * c2 - a[3] * c0;
+                    b[10] = a[12] * s4 - a[13] * s2 + a[15] * s0;
+                    b[11] = -a[8] * s4 + a[9] * s2 - a[11] * s0;
+                    b[12] = -a[4] * c3 + a[5] * c1 - a[6] * c0;
+                    b[13] = a[0] * c3 - a[1] * c1 + a[2] * c0;
+                    b[14] = -a[12] * s3 + a[13] * s1 - a[14] * s0;
+                    b[15] = a[8] * s3 - a[9] * s1 + a[10] * s0;
+                    for (size_t k = 0; k < 16; ++k)
+                        c[k] = b[k] * inv;
+                }
+            }
+        };
+
+        /* Runs op on the matrices [begin, end). Element k of matrix n of an input is at a[k * sa + n], or at
+        a[k] for shared inputs, element k of output matrix n at c[k * sc + n]. Outputs may alias inputs of
+        the same layout, every register of matrices is read completely before it is written.
+        */
+        template <typename T, size_t W, typename Op>
+        MATRAC_ALWAYS_INLINE void run(const Op &op, const T *a, size_t sa, const T *b, size_t sb, T *c, size_t sc,
+                                      size_t begin, size_t end)
+        {
+            using P = simd::Pack<T, W>;
+            // at least one element, ops with unused inputs still get a valid pointer
+            typename P::Vec va[Op::A], vb[Op::B + 1], vc[Op::C];
+            size_t n = begin;
+            if constexpr (W > 1)
+            {
+                for (size_t k = 0; Op::SHARED_A && k < Op::A; ++k)
+                    P::broadcast(va[k], a[k]);
+                for (size_t k = 0; Op::SHARED_B && k < Op::B; ++k)
+                    P::broadcast(vb[k], b[k]);
+                for (; n + W <= end; n += W)
+                {
+                    for (size_t k = 0; !Op::SHARED_A && k < Op::A; ++k)
+                        P::load(va[k], a + k * sa + n);
+                    for (size_t k = 0; !Op::SHARED_B && k < Op::B; ++k)
+                        P::load(vb[k], b + k * sb + n);
+                    Op::apply(op, va, vb, vc);
+                    for (size_t k = 0; k < Op::C; ++k)
+                        P::store(c + k * sc + n, vc[k]);
+                }
+            }
+            T ta[Op::A], tb[Op::B + 1], tc[Op::C];
+            for (; n < end; ++n)
+            {
+                for (size_t k = 0; k < Op::A; ++k)
+                    ta[k] = Op::SHARED_A ? a[k] : a[k * sa + n];
+                for (size_t k = 0; k < Op::B; ++k)
+                    tb[k] = Op::SHARED_B ? b[k] : b[k * sb + n];
+                Op::apply(op, ta, tb, tc);
+                for (size_t k = 0; k < Op::C; ++k)
+                    c[k * sc + n] = tc[k];
+            }
+        }
+
+        /// run() compiled once per instruction set, see Simd.h
+        template <typename T, typename Op>
+        struct Kernel
+        {
+            using Fn = void (*)(const Op &, const T *, size_t, const T *, size_t, T *, size_t, size_t, size_t);
+
+            MATRAC_NO_CONTRACT static void scalar(const Op &op, const T *a, size_t sa, const T *b, size_t sb, T *c,
+                                                  size_t sc, size_t begin, size_t end)
+            {
+                run<T, 1>(op, a, sa, b, sb, c, sc, begin, end);
+            }
+#if MATRAC_SIMD_X86
+            MATRAC_TARGET("sse2")
+            MATRAC_NO_CONTRACT static void sse2(const Op &op, const T *a, size_t sa, const T *b, size_t sb, T *c,
+                                                size_t sc, size_t begin, size_t end)
+            {
+                run<T, 16 / sizeof(T)>(op, a, sa, b, sb, c, sc, begin, end);
+            }
+            MATRAC_TARGET("avx2")
+            MATRAC_NO_CONTRACT static void avx2(const Op &op, const T *a, size_t sa, const T *b, size_t sb, T *c,
+                                                size_t sc, size_t begin, size_t end)
+            {
+                run<T, 32 / sizeof(T)>(op, a, sa, b, sb, c, sc, begin, end);
+            }
+            MATRAC_TARGET("avx512f")
+            MATRAC_NO_CONTRACT static void avx512(const Op &op, const T *a, size_t sa, const T *b, size_t sb, T *c,
+                                                  size_t sc, size_t begin, size_t end)
+            {
+                run<T, 64 / sizeof(T)>(op, a, sa, b, sb, c, sc, begin, end);
+            }
+#endif
+
+            static Fn select()
+            {
+#if MATRAC_SIMD_X86
+                if constexpr (simd::is_vectorizable<T>::value)
+                {
+                    switch (simd::active_isa())
+                    {
+                    case simd::Isa::AVX512:
+                        return avx512;
+                    case simd::Isa::AVX2:
+                        return avx2;
+                    case simd::Isa::SSE2:
+                        return sse2;
+                    default:
+                        break;
+                    }
+                }
+#endif
+                return scalar;
+            }
+        };
+
+        /// Runs op over `count` matrices, split into ranges across the threads of `policy`
+        template <typename T, typename Op>
+        void apply(const Op &op, const T *a, size_t sa, const T *b, size_t sb, T *c, size_t sc, size_t count,
+                   const parallel::Policy &policy)
+        {
+            const auto kernel = Kernel<T, Op>::select();
+            // a range is at least one AVX-512 register of matrices for every plane
+            parallel::for_chunks(policy, count, 64, [&](size_t begin, size_t end) {
+                kernel(op, a, sa, b, sb, c, sc, begin, end);
+            }, Op::A + Op::B + Op::C);
+        }
+    } // namespace batch
+} // namespace internal
+
+template <typename T, size_t _ROWS, size_t _COLS>
+class MatBatch
+{
+private:
+    size_t count_;
+    size_t stride_;       // length of a plane, count_ rounded up so every plane starts on a cache line
+    AlignedBuffer<T> raw_; // ROWS * COLS planes of stride_ elements
+
+    static size_t stride_for(size_t count)
+    {
+        const size_t line = sizeof(T) < memory::ALIGNMENT ? memory::ALIGNMENT / sizeof(T) : 1;
+        return (count + line - 1) / line * line;
+    }
+
+public:
+    static const size_t ROWS = _ROWS;
+    static const size_t COLS = _COLS;
+    static const size_t SIZE = _ROWS * _COLS;
+
+    /// `count` zero matrices
+    inline explicit MatBatch(size_t count = 0) : count_(count), stride_(stride_for(count)), raw_(SIZE, stride_) {}
+
+    // Leaves the elements uninitialized, for results that are fully overwritten
+    inline MatBatch(size_t count, memory::Uninitialized)
+        : count_(count), stride_(stride_for(count)), raw_(SIZE, stride_, memory::uninitialized) {}
+
+    /// Gathers `count` matrices from an array of Mats
+    inline MatBatch(const Mat<T, ROWS, COLS> *mats, size_t count, const parallel::Policy &policy = parallel::global_policy())
+        : MatBatch(count, memory::uninitialized)
+    {
+        static_assert(sizeof(Mat<T, ROWS, COLS>) == SIZE * sizeof(T), "Mat has to be a plain array of its elements");
+        if (count_ > 0)
+            internal::transpose::transpose(mats[0].as_raw(), count_, SIZE, SIZE, raw_.data(), stride_, policy);
+    }
+
+    inline MatBatch(const std::vector<Mat<T, ROWS, COLS>> &mats, const parallel::Policy &policy = parallel::global_policy())
+        : MatBatch(mats.data(), mats.size(), policy) {}
+
+    inline size_t size() const { return count_; }
+
+    /// Distance between two planes in elements
+    inline size_t stride() const { return stride_; }
+
+    /// All planes, plane k starts at data() + k * stride()
+    inline T *data() { return raw_.data(); }
+    inline const T *data() const { return raw_.data(); }
+
+    /// Element (i, j) of every matrix, `size()` consecutive values
+    inline T *plane(size_t i, size_t j)
+    {
+        if (i >= ROWS || j >= COLS)
+            PANIC("Invalid Matrix index, tried to access plane: ", i, 'x', j);
+        return raw_.data() + (i * COLS + j) * stride_;
+    }
+
+    inline const T *plane(size_t i, size_t j) const
+    {
+        if (i >= ROWS || j >= COLS)
+            PANIC("Invalid Matrix index, tried to access plane: ", i, 'x', j);
+        return raw_.data() + (i * COLS + j) * stride_;
+    }
+
+    /// Copy of matrix n
+    inline Mat<T, ROWS, COLS> get(size_t n) const
+    {
+        if constexpr (BOUNDS_CHECKED)
+        {
+            if (n >= count_)
+                PANIC("Invalid batch index, tried to access matrix: ", n);
+        }
+        auto m = Mat<T, ROWS, COLS>();
+        for (size_t k = 0; k < SIZE; ++k)
+            m.as_raw_mut()[k] = raw_.data()[k * stride_ + n];
+        return m;
+    }
+
+    /// Overwrites matrix n with m
+    inline void set(size_t n, const Mat<T, ROWS, COLS> &m)
+    {
+        if constexpr (BOUNDS_CHECKED)
+        {
+            if (n >= count_)
+                PANIC("Invalid batch index, tried to access matrix: ", n);
+        }
+        for (size_t k = 0; k < SIZE; ++k)
+            raw_.data()[k * stride_ + n] = m.as_raw()[k];
+    }
+
+    /// Writes all matrices to `mats`, which has room for size() of them
+    inline void scatter(Mat<T, ROWS, COLS> *mats, const parallel::Policy &policy = parallel::global_policy()) const
+    {
+        if (count_ > 0)
+            internal::transpose::transpose(raw_.data(), SIZE, count_, stride_, mats[0].as_raw_mut(), SIZE, policy);
+    }
+
+    inline std::vector<Mat<T, ROWS, COLS>> to_vector(const parallel::Policy &policy = parallel::global_policy()) const
+    {
+        auto mats = std::vector<Mat<T, ROWS, COLS>>(count_);
+        scatter(mats.data(), policy);
+        return mats;
+    }
+
+    inline MatBatch add(const MatBatch &other, const parallel::Policy &policy = parallel::global_policy()) const
+    {
+        check_size(other, " + ");
+        auto m = MatBatch(count_, memory::uninitialized);
+        internal::batch::apply(internal::batch::Add<SIZE>(), raw_.data(), stride_, other.raw_.data(), stride_,
+                               m.data(), stride_, count_, policy);
+        return m;
+    }
+
+    inline MatBatch sub(const MatBatch &other, const parallel::Policy &policy = parallel::global_policy()) const
+    {
+        check_size(other, " - ");
+        auto m = MatBatch(count_, memory::uninitialized);
+        internal::batch::apply(internal::batch::Sub<SIZE>(), raw_.data(), stride_, other.raw_.data(), stride_,
+                               m.data(), stride_, count_, policy);
+        return m;
+    }
+
+    inline MatBatch scale(T s, const parallel::Policy &policy = parallel::global_policy()) const
+    {
+        auto m = MatBatch(count_, memory::uninitialized);
+        internal::batch::apply(internal::batch::Scale<T, SIZE>{s}, raw_.data(), stride_, raw_.data(), stride_,
+                               m.data(), stride_, count_, policy);
+        return m;
+    }
+
+    inline MatBatch operator+(const MatBatch &other) const { return add(other); }
+    inline MatBatch operator-(const MatBatch &other) const { return sub(other); }
+    inline MatBatch operator*(T s) const { return scale(s); }
+    inline MatBatch operator/(T s) const { return scale(T(1) / s); }
+
+    inline MatBatch &operator+=(const MatBatch &other)
+    {
+        check_size(other, " += ");
+        internal::batch::apply(internal::batch::Add<SIZE>(), raw_.data(), stride_, other.raw_.data(), stride_,
+                               raw_.data(), stride_, count_, parallel::global_policy());
+        return *this;
+    }
+
+    inline MatBatch &operator-=(const MatBatch &other)
+    {
+        check_size(other, " -= ");
+        internal::batch::apply(internal::batch::Sub<SIZE>(), raw_.data(), stride_, other.raw_.data(), stride_,
+                               raw_.data(), stride_, count_, parallel::global_policy());
+        return *this;
+    }
+
+    inline MatBatch &operator*=(T s)
+    {
+        internal::batch::apply(internal::batch::Scale<T, SIZE>{s}, raw_.data(), stride_, raw_.data(), stride_,
+                               raw_.data(), stride_, count_, parallel::global_policy());
+        return *this;
+    }
+
+    inline MatBatch &operator/=(T s) { return *this *= T(1) / s; }
+
+    /// Determinants of all matrices, for 2x2 to 4x4 float / double batches
+    template <size_t R = ROWS, typename S = T>
+    inline typename std::enable_if<R == COLS && internal::small::is_small<S, R>::value, std::vector<T>>::type
+    determinant(const parallel::Policy &policy = parallel::global_policy()) const
+    {
+        auto det = std::vector<T>(count_);
+        internal::batch::apply(internal::batch::Determinant<ROWS>(), raw_.data(), stride_, raw_.data(), stride_,
+                               det.data(), count_, count_, policy);
+        return det;
+    }
+
+    /// Inverses of all matrices, PANICs if one of them is singular
+    template <size_t R = ROWS, typename S = T>
+    inline typename std::enable_if<R == COLS && internal::small::is_small<S, R>::value, MatBatch>::type
+    inverse(const parallel::Policy &policy = parallel::global_policy()) const
+    {
+        auto m = MatBatch(count_, memory::uninitialized);
+        internal::batch::apply(internal::batch::Inverse<T, ROWS>(), raw_.data(), stride_, raw_.data(), stride_,
+                               m.data(), stride_, count_, policy);
+        // a zero determinant turns every element of the inverse into inf or nan, the first plane is enough
+        for (size_t n = 0; n < count_; ++n)
+            if (!std::isfinite(m.data()[n]))
+                PANIC("Matrix is singular, batch index: ", n);
+        return m;
+    }
+
+private:
+    inline void check_size(const MatBatch &other, const char *op) const
+    {
+        if (count_ != other.count_)
+            PANIC("Incompatible batch sizes: ", count_, op, other.count_);
+    }
+};
+
+/// Products a[n] * b[n] of all matrices
+template <typename T, size_t R, size_t K, size_t C>
+MatBatch<T, R, C> multiply(const MatBatch<T, R, K> &a, const MatBatch<T, K, C> &b,
+                           const parallel::Policy &policy = parallel::global_policy())
+{
+    if (a.size() != b.size())
+        PANIC("Incompatible batch sizes: ", a.size(), " * ", b.size());
+    auto c = MatBatch<T, R, C>(a.size(), memory::uninitialized);
+    internal::batch::apply(internal::batch::Multiply<R, K, C>(), a.data(), a.stride(), b.data(), b.stride(),
+                           c.data(), c.stride(), a.size(), policy);
+    return c;
+}
+
+/// Products a * b[n], one matrix applied to the whole batch
+template <typename T, size_t R, size_t K, size_t C>
+MatBatch<T, R, C> multiply(const Mat<T, R, K> &a, const MatBatch<T, K, C> &b,
+                           const parallel::Policy &policy = parallel::global_policy())
+{
+    auto c = MatBatch<T, R, C>(b.size(), memory::uninitialized);
+    internal::batch::apply(internal::batch::Multiply<R, K, C, true, false>(), a.as_raw(), 0, b.data(), b.stride(),
+                           c.data(), c.stride(), b.size(), policy);
+    return c;
+}
+
+/// Products a[n] * b
+template <typename T, size_t R, size_t K, size_t C>
+MatBatch<T, R, C> multiply(const MatBatch<T, R, K> &a, const Mat<T, K, C> &b,
+                           const parallel::Policy &policy = parallel::global_policy())
+{
+    auto c = MatBatch<T, R, C>(a.size(), memory::uninitialized);
+    internal::batch::apply(internal::batch::Multiply<R, K, C, false, true>(), a.data(), a.stride(), b.as_raw(), 0,
+                           c.data(), c.stride(), a.size(), policy);
+    return c;
+}
+
+template <typename T, size_t R, size_t K, size_t C>
+MatBatch<T, R, C> operator*(const MatBatch<T, R, K> &a, const MatBatch<T, K, C> &b) { return multiply(a, b); }
+
+template <typename T, size_t R, size_t K, size_t C>
+MatBatch<T, R, C> operator*(const Mat<T, R, K> &a, const MatBatch<T, K, C> &b) { return multiply(a, b); }
+
+template <typename T, size_t R, size_t K, size_t C>
+MatBatch<T, R, C> operator*(const MatBatch<T, R, K> &a, const Mat<T, K, C> &b) { return multiply(a, b); }
+
+template <typename T, size_t R, size_t C>
+MatBatch<T, R, C> operator*(T s, const MatBatch<T, R, C> &a) { return a.scale(s); }
+
+/// Transforms a batch of column vectors, v[n] -> m[n] * v[n]
+template <typename T, size_t R, size_t C>
+MatBatch<T, R, 1> transform(const MatBatch<T, R, C> &m, const MatBatch<T, C, 1> &v,
+                            const parallel::Policy &policy = parallel::global_policy())
+{
+    return multiply(m, v, policy);
+}
+
+/// Transforms a batch of column vectors by one matrix, v[n] -> m * v[n]
+template <typename T, size_t R, size_t C>
+MatBatch<T, R, 1> transform(const Mat<T, R, C> &m, const MatBatch<T, C, 1> &v,
+                            const parallel::Policy &policy = parallel::global_policy())
+{
+    return multiply(m, v, policy);
+}
+
+#endif // BATCH_H
@@ -0,0 +1,557 @@
+#if !defined(BINARY_H)
+#define BINARY_H
+
+#include <algorithm> // copy, min
+#include <cerrno>
+#include <cstdint>
+#include <cstring> // memcmp, memcpy, strerror
+#include <fstream>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility> // move, swap
+#include <vector>
+
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap, munmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close
+
+#include "util.h"
+#include "DynMat.h"
+#include "Memory.h"
+#include "Sparse.h"
+
+/* Versioned binary file format for dense and compressed sparse matrices, and memory mapped loading
+
+A file is a 64 byte header followed by the raw arrays in native byte order, each starting at a multiple of
+64 bytes so a mapped file is as aligned as an AlignedBuffer:
+    dense  values, rows * cols elements in row major order
+    CSR    pointers (rows + 1 uint64), column indices (nnz uint64), values (nnz elements)
+    CSC    the same with columns and row indices
+The header records the format version, byte order, element type and size, layout, shape and nonzero count,
+files written on a machine of the other byte order or for another element type are rejected with a PANIC.
+
+Dense files are mapped instead of read, so loading one costs an mmap call and pages come in as they're
+touched:
+    binary::write("a.mat", a);                          // streams the buffer straight to disk
+    const MappedMat<double> m = binary::map<double>("a.mat");
+    MappedMat<double> y = m * x;                        // a regular contiguous matrix in every operation
+binary::Mapping::CopyOnWrite (the default) gives a private, writable copy of the pages that are written to,
+the file itself never changes. binary::Mapping::ReadOnly maps the pages read only, keep that matrix const,
+writes to it fault. Results of
+operations on MappedMats are MappedMats on ordinary (pooled) heap storage, as are copies.
+Sparse files are mapped and their arrays copied into a CsrMat / CscMat in one pass (binary::load_csr,
+binary::load_csc), there's no parsing involved either way. binary::Writer streams a dense matrix that
+never exists in memory as a whole, a few rows at a time. The mapping is POSIX only.
+*/
+
+namespace binary
+{
+    const uint32_t VERSION = 1;
+
+    enum class DType : uint32_t
+    {
+        Int8 = 1,
+        UInt8,
+        Int16,
+        UInt16,
+        Int32,
+        UInt32,
+        Int64,
+        UInt64,
+        Float32,
+        Float64,
+    };
+
+    enum class Layout : uint32_t
+    {
+        Dense = 0,
+        Csr,
+        Csc,
+    };
+
+    enum class Mapping
+    {
+        ReadOnly,
+        CopyOnWrite,
+    };
+
+    /// The on disk header, 64 bytes
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order; // 0x01020304 as written by the machine that wrote the file
+        DType dtype;
+        uint32_t element_size;
+        Layout layout;
+        uint32_t reserved0;
+        uint64_t rows;
+        uint64_t cols;
+        uint64_t nnz; // rows * cols for dense files
+        uint64_t reserved1;
+    };
+    static_assert(sizeof(Header) == 64, "binary::Header has to be 64 bytes");
+
+    /// DType of an element type, only the fixed size integers and floating point types can be stored
+    template <typename T>
+    constexpr DType dtype()
+    {
+        static_assert(std::is_arithmetic<T>::value && !std::is_same<T, bool>::value && sizeof(T) <= 8 &&
+                          (std::is_integral<T>::value || sizeof(T) == 4 || sizeof(T) == 8),
+                      "Binary files hold integers and float / double elements");
+        if constexpr (std::is_floating_point<T>::value)
+            return sizeof(T) == 4 ? DType::Float32 : DType::Float64;
+        else
+        {
+            const uint32_t log = sizeof(T) == 1 ? 0 : sizeof(T) == 2 ? 1 : sizeof(T) == 4 ? 2 : 3;
+            return static_cast<DType>(1 + 2 * log + (std::is_signed<T>::value ? 0 : 1));
+        }
+    }
+} // namespace binary
+
+namespace internal
+{
+    namespace binary
+    {
+        const char MAGIC[8] = {'M', 'A', 'T', 'R', 'A', 'C', '\r', '\n'};
+        const uint32_t ORDER_MARK = 0x01020304;
+        const size_t ALIGNMENT = 64;
+
+        // Sizes computed from a header saturate here instead of wrapping, no file is that large
+        const uint64_t SATURATED = std::numeric_limits<uint64_t>::max();
+
+        inline uint64_t add(uint64_t a, uint64_t b) { return a > SATURATED - b ? SATURATED : a + b; }
+        inline uint64_t mul(uint64_t a, uint64_t b) { return b != 0 && a > SATURATED / b ? SATURATED : a * b; }
+        inline uint64_t align(uint64_t offset) { return add(offset, ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; }
+
+        template <typename T>
+        ::binary::Header header(::binary::Layout layout, size_t rows, size_t cols, size_t nnz)
+        {
+            auto h = ::binary::Header();
+            std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+            h.version = ::binary::VERSION;
+            h.byte_order = ORDER_MARK;
+            h.dtype = ::binary::dtype<T>();
+            h.element_size = sizeof(T);
+            h.layout = layout;
+            h.rows = rows;
+            h.cols = cols;
+            h.nnz = nnz;
+            return h;
+        }
+
+        /// Byte offsets of the arrays of a file, and where it ends
+        struct Sections
+        {
+            uint64_t pointers;
+            uint64_t indices;
+            uint64_t values;
+            uint64_t end;
+        };
+
+        /// The offsets of a corrupt header saturate, so they're past the end of any file
+        inline Sections sections(const ::binary::Header &h)
+        {
+            auto s = Sections();
+            s.pointers = s.indices = sizeof(::binary::Header);
+            if (h.layout != ::binary::Layout::Dense)
+            {
+                const uint64_t majors = h.layout == ::binary::Layout::Csr ? h.rows : h.cols;
+                s.indices = align(add(s.pointers, mul(add(majors, 1), sizeof(uint64_t))));
+                s.values = align(add(s.indices, mul(h.nnz, sizeof(uint64_t))));
+            }
+            else
+                s.values = s.pointers;
+            s.end = add(s.values, mul(h.nnz, h.element_size));
+            return s;
+        }
+
+        /// PANICs unless h is the header of a file this build can read as elements of type T
+        template <typename T>
+        void check(const ::binary::Header &h, const std::string &path)
+        {
+            if (std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0)
+                PANIC("Not a MatraC binary file: ", path);
+            if (h.version != ::binary::VERSION)
+                PANIC("Unsupported binary file version ", h.version, " (expected ", ::binary::VERSION, "): ", path);
+            if (h.byte_order != ORDER_MARK)
+                PANIC("Binary file was written with the other byte order: ", path);
+            if (h.dtype != ::binary::dtype<T>() || h.element_size != sizeof(T))
+                PANIC("Binary file holds elements of another type (dtype ", static_cast<uint32_t>(h.dtype), "): ", path);
+            if (h.layout > ::binary::Layout::Csc)
+                PANIC("Unknown layout ", static_cast<uint32_t>(h.layout), " in binary file: ", path);
+            const uint64_t size = mul(h.rows, h.cols);
+            if (size == SATURATED || size > std::numeric_limits<size_t>::max())
+                PANIC("Corrupt binary file, a ", h.rows, 'x', h.cols, " matrix has too many elements: ", path);
+            if (h.layout == ::binary::Layout::Dense && h.nnz != size)
+                PANIC("Corrupt binary file, ", h.nnz, " elements for a ", h.rows, 'x', h.cols, " matrix: ", path);
+        }
+
+        /// A whole file mapped into memory, unmapped on destruction
+        class Map
+        {
+        private:
+            void *base_ = nullptr;
+            size_t bytes_ = 0;
+
+        public:
+            Map() = default;
+
+            inline Map(const std::string &path, ::binary::Mapping mapping)
+            {
+                const int fd = ::open(path.c_str(), O_RDONLY);
+                if (fd < 0)
+                    PANIC("Failed to open ", path, ": ", std::strerror(errno));
+                struct stat st;
+                if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(::binary::Header)))
+                {
+                    ::close(fd);
+                    PANIC("Not a MatraC binary file: ", path);
+                }
+                bytes_ = static_cast<size_t>(st.st_size);
+                const int protection = mapping == ::binary::Mapping::ReadOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+                base_ = ::mmap(nullptr, bytes_, protection, MAP_PRIVATE, fd, 0);
+                // the mapping keeps the file alive
+                ::close(fd);
+                if (base_ == MAP_FAILED)
+                {
+                    base_ = nullptr;
+                    PANIC("Failed to map ", path, ": ", std::strerror(errno));
+                }
+            }
+
+            Map(const Map &) = delete;
+            Map &operator=(const Map &) = delete;
+
+            inline Map(Map &&other) noexcept : base_(other.base_), bytes_(other.bytes_)
+            {
+                other.base_ = nullptr;
+                other.bytes_ = 0;
+            }
+
+            inline Map &operator=(Map &&other) noexcept
+            {
+                std::swap(base_, other.base_);
+                std::swap(bytes_, other.bytes_);
+                return *this;
+            }
+
+            inline ~Map()
+            {
+                if (base_ != nullptr)
+                    ::munmap(base_, bytes_);
+            }
+
+            inline size_t size() const { return bytes_; }
+            inline char *data() const { return static_cast<char *>(base_); }
+            inline const ::binary::Header &header() const { return *reinterpret_cast<const ::binary::Header *>(base_); }
+
+            /// The header, checked against T and the size of the file
+            template <typename T>
+            const ::binary::Header &checked(const std::string &path) const
+            {
+                check<T>(header(), path);
+                if (sections(header()).end > bytes_)
+                    PANIC("Truncated binary file, ", bytes_, " bytes: ", path);
+                return header();
+            }
+        };
+
+        /// Opens path for writing, PANICs on failure
+        inline void open(std::ofstream &out, const std::string &path)
+        {
+            out.open(path, std::ios::binary | std::ios::trunc);
+            if (!out)
+                PANIC("Failed to open ", path, " for writing: ", std::strerror(errno));
+        }
+
+        inline void write_bytes(std::ofstream &out, const void *data, size_t bytes, const std::string &path)
+        {
+            if (!out.write(static_cast<const char *>(data), static_cast<std::streamsize>(bytes)))
+                PANIC("Failed to write ", path, ": ", std::strerror(errno));
+        }
+
+        /// Zeroes up to the next multiple of ALIGNMENT, `offset` is the position in the file
+        inline void pad(std::ofstream &out, uint64_t &offset, const std::string &path)
+        {
+            const char zeros[ALIGNMENT] = {};
+            const uint64_t next = align(offset);
+            write_bytes(out, zeros, next - offset, path);
+            offset = next;
+        }
+
+        /// Writes size_t indices as uint64, converting a chunk at a time where the two differ
+        inline void write_indices(std::ofstream &out, const std::vector<size_t> &indices, uint64_t &offset,
+                                  const std::string &path)
+        {
+            if constexpr (sizeof(size_t) == sizeof(uint64_t))
+                write_bytes(out, indices.data(), indices.size() * sizeof(uint64_t), path);
+            else
+            {
+                uint64_t chunk[512];
+                for (size_t begin = 0; begin < indices.size(); begin += 512)
+                {
+                    const size_t n = std::min<size_t>(512, indices.size() - begin);
+                    std::copy(indices.begin() + begin, indices.begin() + begin + n, chunk);
+                    write_bytes(out, chunk, n * sizeof(uint64_t), path);
+                }
+            }
+            offset += indices.size() * sizeof(uint64_t);
+        }
+
+        template <typename T, bool ROW_MAJOR>
+        void write_compressed(const std::string &path, const CompressedBuffer<T, ROW_MAJOR> &buffer, size_t rows, size_t cols)
+        {
+            const auto h = header<T>(ROW_MAJOR ? ::binary::Layout::Csr : ::binary::Layout::Csc, rows, cols, buffer.nnz());
+            auto out = std::ofstream();
+            open(out, path);
+            uint64_t offset = sizeof(h);
+            write_bytes(out, &h, sizeof(h), path);
+            write_indices(out, buffer.pointers(), offset, path);
+            pad(out, offset, path);
+            write_indices(out, buffer.indices(), offset, path);
+            pad(out, offset, path);
+            write_bytes(out, buffer.values().data(), buffer.nnz() * sizeof(T), path);
+            out.close();
+            if (!out)
+                PANIC("Failed to write ", path, ": ", std::strerror(errno));
+        }
+
+        /* The arrays of a mapped sparse file, copied into a CsrBuffer / CscBuffer of the layout they were written in
+        Validated while they're copied: the pointers run from 0 to nnz without decreasing, and the minor indices of
+        every major index are strictly increasing and within the minor dimension.
+        */
+        template <typename Buf, typename T = typename std::decay<decltype(std::declval<Buf>().values()[0])>::type>
+        Buf read_compressed(const Map &map, const ::binary::Header &h)
+        {
+            const auto s = sections(h);
+            const bool row_major = h.layout == ::binary::Layout::Csr;
+            const size_t majors = row_major ? h.rows : h.cols;
+            const uint64_t minors = row_major ? h.cols : h.rows;
+            const auto *ptr = reinterpret_cast<const uint64_t *>(map.data() + s.pointers);
+            const auto *minor = reinterpret_cast<const uint64_t *>(map.data() + s.indices);
+            const auto *values = reinterpret_cast<const T *>(map.data() + s.values);
+            if (ptr[0] != 0 || ptr[majors] != h.nnz)
+                PANIC("Corrupt binary file, the pointers don't run from 0 to ", h.nnz, " nonzeros");
+            auto pointers = std::vector<size_t>(majors + 1);
+            auto indices = std::vector<size_t>(h.nnz);
+            pointers[0] = 0;
+            for (size_t major = 0; major < majors; ++major)
+            {
+                const uint64_t begin = ptr[major];
+                const uint64_t end = ptr[major + 1];
+                if (end < begin || end > h.nnz)
+                    PANIC("Corrupt binary file, pointer ", major + 1, " is ", end, " after ", begin);
+                for (uint64_t k = begin; k < end; ++k)
+                {
+                    if (minor[k] >= minors || (k > begin && minor[k] <= minor[k - 1]))
+                        PANIC("Corrupt binary file, index ", minor[k], " at ", k, " is out of range or out of order");
+                    indices[k] = minor[k];
+                }
+                pointers[major + 1] = end;
+            }
+            return Buf(h.rows, h.cols, std::move(pointers), std::move(indices), std::vector<T>(values, values + h.nnz));
+        }
+    } // namespace binary
+} // namespace internal
+
+/* MemBuf over a mapped binary file (see binary::map) or, for results and copies, pooled heap storage
+Contiguous like DynBuffer, so mapped matrices take every SIMD, GEMM and threaded path.
+*/
+template <typename T>
+class MappedBuffer
+{
+private:
+    AlignedBuffer<T> heap_;
+    internal::binary::Map map_;
+    T *raw_;
+    size_t size_;
+
+public:
+    inline MappedBuffer(size_t rows, size_t cols) : heap_(rows, cols), raw_(heap_.data()), size_(rows * cols) {}
+
+    inline MappedBuffer(size_t rows, size_t cols, memory::Uninitialized)
+        : heap_(rows, cols, memory::uninitialized), raw_(heap_.data()), size_(rows * cols) {}
+
+    /// Takes over a mapping whose elements start at byte `offset`
+    inline MappedBuffer(internal::binary::Map &&map, size_t offset, size_t size)
+        : heap_(0, 0), map_(std::move(map)), raw_(reinterpret_cast<T *>(map_.data() + offset)), size_(size) {}
+
+    // Copies never share the mapping
+    inline MappedBuffer(const MappedBuffer &other)
+        : heap_(other.size_, 1, memory::uninitialized), raw_(heap_.data()), size_(other.size_)
+    {
+        std::copy(other.raw_, other.raw_ + size_, raw_);
+    }
+
+    inline MappedBuffer(MappedBuffer &&other) noexcept
+        : heap_(std::move(other.heap_)), map_(std::move(other.map_)), raw_(other.raw_), size_(other.size_)
+    {
+        other.raw_ = nullptr;
+        other.size_ = 0;
+    }
+
+    inline MappedBuffer &operator=(const MappedBuffer &other)
+    {
+        if (this == &other)
+            return *this;
+        if (size_ == other.size_)
+        {
+            std::copy(other.raw_, other.raw_ + size_, raw_);
+            return *this;
+        }
+        return *this = MappedBuffer(other);
+    }
+
+    inline MappedBuffer &operator=(MappedBuffer &&other) noexcept
+    {
+        std::swap(heap_, other.heap_);
+        std::swap(map_, other.map_);
+        std::swap(raw_, other.raw_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    inline T operator[](size_t i) const
+    {
+        return raw_[i];
+    }
+    inline T &operator[](size_t i)
+    {
+        return raw_[i];
+    }
+
+    /// True if the elements live in a mapped file
+    inline bool mapped() const { return map_.data() != nullptr; }
+
+    inline size_t size() const { return size_; }
+    inline T *data() { return raw_; }
+    inline const T *data() const { return raw_; }
+};
+
+// Dense matrix that can live in a memory mapped binary file, see binary::map
+template <typename T>
+using MappedMat = internal::AbstractDynMat<T, MappedBuffer>;
+
+namespace binary
+{
+    /// The header of a binary file, to look at its type and shape before loading it
+    inline Header info(const std::string &path)
+    {
+        auto in = std::ifstream(path, std::ios::binary);
+        auto h = Header();
+        if (!in.read(reinterpret_cast<char *>(&h), sizeof(h)))
+            PANIC("Not a MatraC binary file: ", path);
+        if (std::memcmp(h.magic, internal::binary::MAGIC, sizeof(internal::binary::MAGIC)) != 0)
+            PANIC("Not a MatraC binary file: ", path);
+        return h;
+    }
+
+    /// Maps a dense binary file, see the top of the file. PANICs if it holds another type or a sparse matrix
+    template <typename T>
+    MappedMat<T> map(const std::string &path, Mapping mapping = Mapping::CopyOnWrite)
+    {
+        auto file = internal::binary::Map(path, mapping);
+        const auto h = file.checked<T>(path);
+        if (h.layout != Layout::Dense)
+            PANIC("Binary file holds a sparse matrix, use load_csr() / load_csc(): ", path);
+        const size_t offset = internal::binary::sections(h).values;
+        return MappedMat<T>(h.rows, h.cols, MappedBuffer<T>(std::move(file), offset, h.rows * h.cols));
+    }
+
+    /// Loads a sparse binary file as CSR, converting if it was written as CSC
+    template <typename T>
+    CsrMat<T> load_csr(const std::string &path)
+    {
+        const auto file = internal::binary::Map(path, Mapping::ReadOnly);
+        const auto h = file.checked<T>(path);
+        if (h.layout == Layout::Dense)
+            PANIC("Binary file holds a dense matrix, use map(): ", path);
+        if (h.layout == Layout::Csc)
+            return to_csr(CscMat<T>(h.rows, h.cols, internal::binary::read_compressed<CscBuffer<T>>(file, h)));
+        return CsrMat<T>(h.rows, h.cols, internal::binary::read_compressed<CsrBuffer<T>>(file, h));
+    }
+
+    /// Loads a sparse binary file as CSC, converting if it was written as CSR
+    template <typename T>
+    CscMat<T> load_csc(const std::string &path)
+    {
+        const auto file = internal::binary::Map(path, Mapping::ReadOnly);
+        const auto h = file.checked<T>(path);
+        if (h.layout == Layout::Dense)
+            PANIC("Binary file holds a dense matrix, use map(): ", path);
+        if (h.layout == Layout::Csr)
+            return to_csc(CsrMat<T>(h.rows, h.cols, internal::binary::read_compressed<CsrBuffer<T>>(file, h)));
+        return CscMat<T>(h.rows, h.cols, internal::binary::read_compressed<CscBuffer<T>>(file, h));
+    }
+
+    /* Streams a rows x cols dense matrix to a binary file in row major order, for matrices that never exist
+    in memory as a whole:
+        auto w = binary::Writer<double>("a.mat", rows, cols);
+        for (...)
+            w.write(block, block_rows * cols);
+        w.close();   // PANICs unless exactly rows * cols elements were written
+    */
+    template <typename T>
+    class Writer
+    {
+    private:
+        std::string path_;
+        std::ofstream out_;
+        size_t expected_;
+        size_t written_ = 0;
+
+    public:
+        inline Writer(std::string path, size_t rows, size_t cols) : path_(std::move(path)), expected_(rows * cols)
+        {
+            internal::binary::open(out_, path_);
+            const auto h = internal::binary::header<T>(Layout::Dense, rows, cols, expected_);
+            internal::binary::write_bytes(out_, &h, sizeof(h), path_);
+        }
+
+        /// The next n elements
+        inline void write(const T *values, size_t n)
+        {
+            if (written_ + n > expected_)
+                PANIC("Binary writer got ", written_ + n, " elements for a file of ", expected_, ": ", path_);
+            internal::binary::write_bytes(out_, values, n * sizeof(T), path_);
+            written_ += n;
+        }
+
+        /// Flushes and closes the file
+        inline void close()
+        {
+            if (written_ != expected_)
+                PANIC("Binary writer got ", written_, " elements for a file of ", expected_, ": ", path_);
+            out_.close();
+            if (!out_)
+                PANIC("Failed to write ", path_, ": ", std::strerror(errno));
+        }
+    };
+
+    /// Writes a dense matrix (DynMat, AlignedMat, MappedMat, ...), the buffer goes to disk as it is
+    template <typename T, template <class> typename MemBuf>
+    void write(const std::string &path, const internal::AbstractDynMat<T, MemBuf> &m)
+    {
+        static_assert(is_contiguous<MemBuf<T>>::value, "Use to_csr() to write a SparseMat");
+        auto w = Writer<T>(path, m.ROWS_, m.COLS_);
+        w.write(m.as_raw(), m.SIZE);
+        w.close();
+    }
+
+    template <typename T>
+    void write(const std::string &path, const CsrMat<T> &m)
+    {
+        internal::binary::write_compressed(path, m.buffer(), m.ROWS_, m.COLS_);
+    }
+
+    template <typename T>
+    void write(const std::string &path, const CscMat<T> &m)
+    {
+        internal::binary::write_compressed(path, m.buffer(), m.ROWS_, m.COLS_);
+    }
+} // namespace binary
+
+#endif // BINARY_H
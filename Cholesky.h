@@ -0,0 +1,262 @@
+#if !defined(CHOLESKY_H)
+#define CHOLESKY_H
+
+#include <algorithm> // copy, fill, min
+#include <cmath>     // log, sqrt
+#include <cstddef>
+#include <type_traits>
+#include <utility> // move
+#include <vector>
+
+#include "util.h"
+#include "DynMat.h"
+#include "Gemm.h"
+#include "ThreadPool.h"
+#include "Triangular.h"
+
+/* Cholesky factorization A = L L^T of symmetric positive definite matrices
+
+Blocked and right looking like the LU in Lu.h: a BLOCK x BLOCK diagonal block is factored with dot
+products along its rows, the rows below it are solved against it one row at a time (spread across the
+threads of the policy) and the trailing matrix gets L21 L21^T subtracted through GEMM calls, one per block
+column, covering only the lower triangle. Only the lower triangle of A is read.
+
+The factor can be updated in O(n^2) when A changes by a rank one term, instead of refactoring in O(n^3):
+    auto f = Cholesky<double>(cov);
+    f.update(x);      // factor of cov + x x^T
+    f.downdate(y);    // factor of cov + x x^T - y y^T, PANICs if that isn't positive definite anymore
+    f.solve_in_place(b);
+*/
+
+namespace internal
+{
+    namespace cholesky
+    {
+        /// Rows and columns per block
+        const size_t BLOCK = 64;
+
+        /// Factors the diagonal block [j0, j0 + nb) of the n x n row major matrix at a, false if it isn't positive definite
+        template <typename T>
+        bool diagonal(T *a, size_t n, size_t j0, size_t nb)
+        {
+            for (size_t j = j0; j < j0 + nb; ++j)
+            {
+                const T *lj = a + j * n + j0;
+                const T d = a[j * n + j] - triangular::dot(lj, 1, lj, 1, j - j0);
+                // also false for nan
+                if (!(d > T()))
+                    return false;
+                const T l = std::sqrt(d);
+                a[j * n + j] = l;
+                for (size_t i = j + 1; i < j0 + nb; ++i)
+                {
+                    const T *li = a + i * n + j0;
+                    a[i * n + j] = (a[i * n + j] - triangular::dot(li, 1, lj, 1, j - j0)) / l;
+                }
+            }
+            return true;
+        }
+
+        /// Overwrites the lower triangle of the n x n matrix at a with L, see the top of the file
+        template <typename T>
+        bool factorize(T *a, size_t n, const parallel::Policy &policy)
+        {
+            for (size_t j = 0; j < n; j += BLOCK)
+            {
+                const size_t nb = std::min(BLOCK, n - j);
+                if (!diagonal(a, n, j, nb))
+                    return false;
+                const size_t rest = n - j - nb;
+                if (rest == 0)
+                    break;
+                // L21 = A21 L11^-T, every row of L21 is a forward substitution with L11
+                const T *l11 = a + j * n + j;
+                T *l21 = a + (j + nb) * n + j;
+                parallel::for_chunks(policy, rest, 16, [&](size_t begin, size_t end) {
+                    for (size_t r = begin; r < end; ++r)
+                        triangular::lower_vector(nb, l11, n, 1, false, l21 + r * n, 1);
+                }, nb * nb);
+                // A22 -= L21 L21^T on and below the diagonal
+                for (size_t c = 0; c < rest; c += BLOCK)
+                {
+                    const size_t cb = std::min(BLOCK, rest - c);
+                    const T *lc = l21 + c * n;
+                    gemm::gemm<T>(rest - c, cb, nb, T(-1), lc, n, 1, lc, 1, n,
+                                  T(1), a + (j + nb + c) * n + j + nb + c, n, 1, policy);
+                }
+            }
+            return true;
+        }
+
+        /* L L^T + sign x x^T for the lower triangular n x n L at l, x is overwritten, cs holds 2n elements of
+        workspace. Row i takes the rotations of all columns before it, four rows at a time so the rotations
+        of different rows overlap. Returns false if a downdate left a diagonal element that isn't positive.
+        */
+        template <typename T>
+        bool rank_one(T *l, size_t n, T *x, T sign, T *cs)
+        {
+            T *c = cs;
+            T *s = cs + n;
+            const size_t ROWS = 4;
+            for (size_t i0 = 0; i0 < n; i0 += ROWS)
+            {
+                const size_t rows = std::min(ROWS, n - i0);
+                T xr[ROWS] = {};
+                for (size_t r = 0; r < rows; ++r)
+                    xr[r] = x[i0 + r];
+                // the columns all of these rows share
+                for (size_t k = 0; k < i0; ++k)
+                    for (size_t r = 0; r < rows; ++r)
+                    {
+                        T &lik = l[(i0 + r) * n + k];
+                        lik = (lik + sign * s[k] * xr[r]) / c[k];
+                        xr[r] = c[k] * xr[r] - s[k] * lik;
+                    }
+                // then the triangle of the group, each row needs the diagonals of the ones above it
+                for (size_t r = 0; r < rows; ++r)
+                {
+                    const size_t i = i0 + r;
+                    T *li = l + i * n;
+                    for (size_t k = i0; k < i; ++k)
+                    {
+                        li[k] = (li[k] + sign * s[k] * xr[r]) / c[k];
+                        xr[r] = c[k] * xr[r] - s[k] * li[k];
+                    }
+                    const T d2 = li[i] * li[i] + sign * xr[r] * xr[r];
+                    if (!(d2 > T()))
+                        return false;
+                    const T d = std::sqrt(d2);
+                    c[i] = d / li[i];
+                    s[i] = xr[r] / li[i];
+                    li[i] = d;
+                }
+            }
+            return true;
+        }
+    } // namespace cholesky
+} // namespace internal
+
+/// Cholesky factorization of a symmetric positive definite floating point matrix, see the top of the file
+template <typename T>
+class Cholesky
+{
+private:
+    static_assert(std::is_floating_point<T>::value, "Cholesky factorization needs a floating point type");
+
+    DynMat<T> l_;         // lower triangular, the strict upper triangle is zero
+    std::vector<T> work_; // rank one updates, a copy of x and the rotations
+    bool positive_;
+
+public:
+    /// Factors a, pass it as an rvalue to factor in its storage instead of a copy
+    inline explicit Cholesky(DynMat<T> a, const parallel::Policy &policy = parallel::global_policy()) : l_(std::move(a))
+    {
+        const size_t n = l_.ROWS_;
+        if (n != l_.COLS_)
+            PANIC("Cholesky factorization needs a square matrix, got: ", n, 'x', l_.COLS_);
+        T *l = l_.as_raw_mut();
+        positive_ = internal::cholesky::factorize(l, n, policy);
+        for (size_t i = 0; i < n; ++i)
+            std::fill(l + i * n + i + 1, l + i * n + n, T());
+    }
+
+    /// Factors any dense matrix (AlignedMat, ...) through a copy
+    template <template <class> typename MemBuf, typename = typename std::enable_if<is_contiguous<MemBuf<T>>::value>::type>
+    inline explicit Cholesky(const internal::AbstractDynMat<T, MemBuf> &a, const parallel::Policy &policy = parallel::global_policy())
+        : Cholesky(copy(a), policy) {}
+
+    inline size_t size() const { return l_.ROWS_; }
+
+    /// False if the matrix turned out not to be positive definite, the factor is incomplete then and solves PANIC
+    inline bool positive_definite() const { return positive_; }
+
+    /// L, lower triangular with a positive diagonal
+    inline const DynMat<T> &factor() const { return l_; }
+
+    /// b = A^-1 b for an n x m matrix b of right hand sides, without allocating
+    template <template <class> typename MemBuf>
+    void solve_in_place(internal::AbstractDynMat<T, MemBuf> &b, const parallel::Policy &policy = parallel::global_policy()) const
+    {
+        if (!positive_)
+            PANIC("Matrix is not positive definite");
+        solve_lower(l_, b, policy);
+        solve_upper(l_.view().transpose(), b, policy);
+    }
+
+    /// A^-1 b for an n x m matrix b of right hand sides
+    template <template <class> typename MemBuf>
+    internal::AbstractDynMat<T, MemBuf> solve(const internal::AbstractDynMat<T, MemBuf> &b,
+                                              const parallel::Policy &policy = parallel::global_policy()) const
+    {
+        auto x = b;
+        solve_in_place(x, policy);
+        return x;
+    }
+
+    inline T determinant() const
+    {
+        T det = T(1);
+        for (size_t i = 0; i < size(); ++i)
+            det *= l_.as_raw()[i * size() + i];
+        return det * det;
+    }
+
+    /// log(det(A)), which doesn't overflow for large matrices like determinant() does
+    inline T log_determinant() const
+    {
+        T sum = T();
+        for (size_t i = 0; i < size(); ++i)
+            sum += std::log(l_.as_raw()[i * size() + i]);
+        return 2 * sum;
+    }
+
+    /// A^-1, PANICs if the matrix isn't positive definite
+    inline DynMat<T> inverse(const parallel::Policy &policy = parallel::global_policy()) const
+    {
+        auto x = DynMat<T>::identity(size(), size());
+        solve_in_place(x, policy);
+        return x;
+    }
+
+    /// Turns the factor of A into the one of A + x x^T, x is an n x 1 or 1 x n matrix
+    template <template <class> typename MemBuf>
+    void update(const internal::AbstractDynMat<T, MemBuf> &x)
+    {
+        if (!rank_one(x, T(1)))
+            PANIC("Matrix is not positive definite");
+    }
+
+    /// Turns the factor of A into the one of A - x x^T, PANICs if that isn't positive definite, the factor is lost then
+    template <template <class> typename MemBuf>
+    void downdate(const internal::AbstractDynMat<T, MemBuf> &x)
+    {
+        if (!rank_one(x, T(-1)))
+            PANIC("Downdated matrix is not positive definite");
+    }
+
+private:
+    template <template <class> typename MemBuf>
+    static DynMat<T> copy(const internal::AbstractDynMat<T, MemBuf> &a)
+    {
+        auto d = DynMat<T>(a.ROWS_, a.COLS_);
+        std::copy(a.as_raw(), a.as_raw() + a.SIZE, d.as_raw_mut());
+        return d;
+    }
+
+    template <template <class> typename MemBuf>
+    bool rank_one(const internal::AbstractDynMat<T, MemBuf> &x, T sign)
+    {
+        static_assert(is_contiguous<MemBuf<T>>::value, "Rank one updates need a dense vector");
+        const size_t n = size();
+        if (x.SIZE != n || (x.ROWS_ != 1 && x.COLS_ != 1))
+            PANIC("Incompatible matrix dimensions: ", n, 'x', n, " +- ", x.ROWS_, 'x', x.COLS_, " outer product");
+        if (!positive_)
+            PANIC("Matrix is not positive definite");
+        work_.resize(3 * n);
+        std::copy(x.as_raw(), x.as_raw() + n, work_.data());
+        positive_ = internal::cholesky::rank_one(l_.as_raw_mut(), n, work_.data(), sign, work_.data() + n);
+        return positive_;
+    }
+};
+
+#endif // CHOLESKY_H
@@ -1,6 +1,7 @@
 #if !defined(DYN_MATRIX_H)
 #define DYN_MATRIX_H
 
+#include <algorithm> // max
 #include <memory>
 #include <iostream>
 #include <cstdarg> // va_start, va_end
@@ -11,15 +12,34 @@
 #include <cmath>
 
 #include "util.h"
+#include "Format.h"
 #include "Range.h"
 
 #include "Matrix.h"
+#include "Gemm.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Expr.h"
+#include "View.h"
+#include "Memory.h"
+#include "Transpose.h"
+#include "Profile.h"
+#include "Accumulate.h"
+#include "Functional.h"
 
 namespace internal
 {
+    /// True if T has SIMD kernels and all of the buffers are contiguous
+    template <typename T, typename... Bufs>
+    struct use_simd : std::integral_constant<bool, simd::is_vectorizable<T>::value && (is_contiguous<Bufs>::value && ...)>
+    {
+    };
+
     /* Membuf has to be a template of kind * -> *, that if instantiated with T has a constructor of
     type (size_t, size_t) -> MemBuf<T>, as well as implementations of T operator[](size_t) const
         / T& operator[](size_t)
+    The non-const operator[] may return a proxy that converts to T and can be assigned to instead of T&,
+    as CsrBuffer / CscBuffer do, the non-const accessors of the matrix pass it through.
     */
     template <typename T, template <class> typename MemBuf>
     class AbstractDynMat
@@ -29,13 +49,52 @@ namespace internal
 
         MemBuf<T> raw_; // raw data in row major order
 
+        template <typename, template <class> typename>
+        friend class AbstractDynMat;
+
+        // the scope is open before the buffer is allocated, so the allocation counts as elementwise (see Profile.h)
+        template <typename E>
+        inline AbstractDynMat(const E &e, const ::profile::Scope &) : AbstractDynMat(e.rows(), e.cols(), memory::uninitialized)
+        {
+            expr::assign(*this, e);
+        }
+
     public:
-        const size_t SIZE;
-        const size_t ROWS_;
-        const size_t COLS_;
+        // the shape changes only when a whole matrix is assigned or moved in, don't write these directly
+        size_t SIZE;
+        size_t ROWS_;
+        size_t COLS_;
 
         inline AbstractDynMat(size_t rows, size_t cols) : SIZE(rows * cols), ROWS_(rows), COLS_(cols), raw_(rows, cols) {}
 
+        inline AbstractDynMat(const AbstractDynMat &other) = default;
+        inline AbstractDynMat &operator=(const AbstractDynMat &other) = default;
+
+        // A moved from matrix is left empty (0x0)
+        inline AbstractDynMat(AbstractDynMat &&other) noexcept
+            : raw_(std::move(other.raw_)), SIZE(other.SIZE), ROWS_(other.ROWS_), COLS_(other.COLS_)
+        {
+            other.SIZE = other.ROWS_ = other.COLS_ = 0;
+        }
+
+        inline AbstractDynMat &operator=(AbstractDynMat &&other) noexcept
+        {
+            raw_ = std::move(other.raw_);
+            SIZE = other.SIZE;
+            ROWS_ = other.ROWS_;
+            COLS_ = other.COLS_;
+            if (this != &other)
+                other.SIZE = other.ROWS_ = other.COLS_ = 0;
+            return *this;
+        }
+
+        // Leaves the elements uninitialized if MemBuf supports that (see Memory.h), for results that are fully overwritten
+        inline AbstractDynMat(size_t rows, size_t cols, memory::Uninitialized)
+            : raw_(memory::make_buffer<MemBuf<T>>(rows, cols, memory::uninitialized)), SIZE(rows * cols), ROWS_(rows), COLS_(cols) {}
+
+        // Takes over an already filled buffer of the given shape
+        inline AbstractDynMat(size_t rows, size_t cols, MemBuf<T> &&raw) : raw_(std::move(raw)), SIZE(rows * cols), ROWS_(rows), COLS_(cols) {}
+
         inline AbstractDynMat(size_t rows, size_t cols, T a11, ...) : AbstractDynMat(rows, cols)
         {
             raw_ = MemBuf<T>(rows, cols);
@@ -47,47 +106,170 @@ namespace internal
             va_end(vl);
         }
 
+        // Evaluates an elementwise expression (see Expr.h), e.g. DynMat<double> d = a + b - 2.0 * c;
+        template <typename E, typename = typename std::enable_if<expr::is_node<E>::value>::type>
+        inline AbstractDynMat(const E &e)
+            : AbstractDynMat(e, ::profile::Scope(::profile::Op::Elementwise, e.rows() * e.cols(), e.rows() * e.cols() * E::OPS)) {}
+
+        // Evaluates an elementwise expression into this matrix' buffer, or into a new one if the shapes differ
+        template <typename E>
+        inline typename std::enable_if<expr::is_node<E>::value, AbstractDynMat &>::type operator=(const E &e)
+        {
+            if (e.rows() != ROWS_ || e.cols() != COLS_)
+                return *this = AbstractDynMat(e);
+            expr::assign(*this, e);
+            return *this;
+        }
+
+        // In place elementwise addition of a matrix, view or expression, never allocates
+        template <typename X, typename S = T, typename = expr::enable_operand<X>,
+                  typename = typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value>::type>
+        inline AbstractDynMat &operator+=(const X &x)
+        {
+            expr::assign(*this, *this + x);
+            return *this;
+        }
+
+        // In place elementwise subtraction of a matrix, view or expression, never allocates
+        template <typename X, typename S = T, typename = expr::enable_operand<X>,
+                  typename = typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value>::type>
+        inline AbstractDynMat &operator-=(const X &x)
+        {
+            expr::assign(*this, *this - x);
+            return *this;
+        }
+
+        // In place scalar multiplication
+        template <typename S = T, typename = typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value>::type>
+        inline AbstractDynMat &operator*=(const T factor)
+        {
+            expr::assign(*this, factor * *this);
+            return *this;
+        }
+
+        // In place scalar division
+        template <typename S = T, typename = typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value>::type>
+        inline AbstractDynMat &operator/=(const T divisor)
+        {
+            expr::assign(*this, *this / divisor);
+            return *this;
+        }
+
         static AbstractDynMat identity(size_t rows, size_t cols)
         {
             auto m = AbstractDynMat(rows, cols);
-            for (auto &&i : Range(cols))
+            for (auto &&i : Range(std::min(rows, cols)))
             {
-                m(i, i) = 1;
+                m.unchecked(i, i) = 1;
             }
             return m;
         }
 
-        inline AbstractDynMat transpose()
+        inline AbstractDynMat transpose(const parallel::Policy &policy = parallel::global_policy()) const
         {
-            auto m1 = *this;
+            const auto scope = ::profile::Scope(::profile::Op::Transpose, SIZE, 0);
+            if constexpr (is_contiguous<MemBuf<T>>::value)
+            {
+                auto m2 = AbstractDynMat(COLS_, ROWS_, memory::uninitialized);
+                internal::transpose::transpose(as_raw(), ROWS_, COLS_, COLS_, m2.as_raw_mut(), ROWS_, policy);
+                return m2;
+            }
             auto m2 = AbstractDynMat(COLS_, ROWS_);
             for (auto &&i : Range(ROWS_))
                 for (auto &&j : Range(COLS_))
-                    m2(j, i) = m1(i, j);
+                    m2.unchecked(j, i) = unchecked(i, j);
             return m2;
         };
 
-        inline T &operator()(size_t i, size_t j)
+        /* Transposes the matrix in its own buffer, only available for contiguous MemBufs
+        Square matrices are transposed tile by tile (in parallel under `policy`), rectangular ones by
+        following the permutation cycles on one thread, see Transpose.h.
+        */
+        template <typename Buf = MemBuf<T>>
+        inline typename std::enable_if<is_contiguous<Buf>::value>::type transpose_in_place(
+            const parallel::Policy &policy = parallel::global_policy())
+        {
+            const auto scope = ::profile::Scope(::profile::Op::Transpose, SIZE, 0);
+            internal::transpose::in_place(as_raw_mut(), ROWS_, COLS_, policy);
+            std::swap(ROWS_, COLS_);
+        }
+
+        /// Pointer to the row major elements, only available for contiguous MemBufs
+        template <typename Buf = MemBuf<T>>
+        inline typename std::enable_if<is_contiguous<Buf>::value, T *>::type as_raw_mut()
+        {
+            return raw_.data();
+        }
+
+        template <typename Buf = MemBuf<T>>
+        inline typename std::enable_if<is_contiguous<Buf>::value, const T *>::type as_raw() const
         {
-            if (i >= ROWS_)
-                PANIC("Invalid Matrix index, tried to access row: ", i);
-            if (j >= COLS_)
-                PANIC("Invalid Matrix index, tried to access column: ", j);
+            return raw_.data();
+        }
+
+        /// The underlying MemBuf, e.g. for the nonzero iteration of sparse buffers
+        inline const MemBuf<T> &buffer() const { return raw_; }
+
+        inline decltype(auto) operator()(size_t i, size_t j)
+        {
+            if constexpr (BOUNDS_CHECKED)
+            {
+                if (i >= ROWS_)
+                    PANIC("Invalid Matrix index, tried to access row: ", i);
+                if (j >= COLS_)
+                    PANIC("Invalid Matrix index, tried to access column: ", j);
+            }
             return raw_[j + i * COLS_];
         }
 
-        template <template <class> typename MemBufOut = MemBuf, typename S = T>
-        typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value, AbstractDynMat<T *, MemBufOut>>::type
+        /// View of the whole matrix, see View.h
+        template <typename Buf = MemBuf<T>>
+        inline typename std::enable_if<is_contiguous<Buf>::value, DynMatView<T>>::type view()
+        {
+            return DynMatView<T>(as_raw_mut(), ROWS_, COLS_, COLS_, 1);
+        }
+
+        template <typename Buf = MemBuf<T>>
+        inline typename std::enable_if<is_contiguous<Buf>::value, DynMatView<const T>>::type view() const
+        {
+            return DynMatView<const T>(as_raw(), ROWS_, COLS_, COLS_, 1);
+        }
+
+        /// View of rows start_row, start_row + step_row, ... up to and including stop_row, same for the columns
+        template <typename Buf = MemBuf<T>>
+        inline typename std::enable_if<is_contiguous<Buf>::value, DynMatView<T>>::type
         slice(size_t start_row, size_t stop_row, size_t start_col, size_t stop_col, size_t step_row = 1, size_t step_col = 1)
         {
-            auto m = AbstractDynMat<T *, MemBufOut>((stop_row - start_row + 1) / step_row, (stop_col - start_col + 1) / step_col);
+            return view().slice(start_row, stop_row, start_col, stop_col, step_row, step_col);
+        }
+
+        template <typename Buf = MemBuf<T>>
+        inline typename std::enable_if<is_contiguous<Buf>::value, DynMatView<const T>>::type
+        slice(size_t start_row, size_t stop_row, size_t start_col, size_t stop_col, size_t step_row = 1, size_t step_col = 1) const
+        {
+            return view().slice(start_row, stop_row, start_col, stop_col, step_row, step_col);
+        }
+
+        /* Buffers without contiguous storage can't be viewed, their slices hold a pointer per element instead
+        Only for buffers whose elements are references (SparseBuffer), not proxies (CsrBuffer / CscBuffer).
+        */
+        template <template <class> typename MemBufOut = MemBuf, typename S = T, typename Buf = MemBuf<T>>
+        typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value && !is_contiguous<Buf>::value &&
+                                    std::is_lvalue_reference<decltype(std::declval<Buf &>()[0])>::value,
+                                AbstractDynMat<T *, MemBufOut>>::type
+        slice(size_t start_row, size_t stop_row, size_t start_col, size_t stop_col, size_t step_row = 1, size_t step_col = 1)
+        {
+            const size_t rows = slice_length(start_row, stop_row, step_row, ROWS_);
+            const size_t cols = slice_length(start_col, stop_col, step_col, COLS_);
+            const auto scope = ::profile::Scope(::profile::Op::Slice, rows * cols, 0);
+            auto m = AbstractDynMat<T *, MemBufOut>(rows, cols);
             size_t i_m = 0;
             for (auto &&i : Range(start_row, stop_row + 1, step_row))
             {
                 size_t j_m = 0;
                 for (auto &&j : Range(start_col, stop_col + 1, step_col))
                 {
-                    m(i_m, j_m) = &this->operator()(i, j);
+                    m.unchecked(i_m, j_m) = &unchecked(i, j);
                     j_m += 1;
                 }
                 i_m += 1;
@@ -97,57 +279,71 @@ namespace internal
 
         inline T operator()(size_t i, size_t j) const
         {
-            if (i >= ROWS_)
-                PANIC("Invalid Matrix index, tried to access row: ", i);
-            if (j >= COLS_)
-                PANIC("Invalid Matrix index, tried to access column: ", j);
+            if constexpr (BOUNDS_CHECKED)
+            {
+                if (i >= ROWS_)
+                    PANIC("Invalid Matrix index, tried to access row: ", i);
+                if (j >= COLS_)
+                    PANIC("Invalid Matrix index, tried to access column: ", j);
+            }
             return raw_[j + i * COLS_];
         }
 
-        inline T &operator[](size_t i)
+        inline decltype(auto) operator[](size_t i)
         {
-            if (i >= SIZE)
-                PANIC("Invalid Matrix index, tried to access index: ", i);
+            if constexpr (BOUNDS_CHECKED)
+            {
+                if (i >= SIZE)
+                    PANIC("Invalid Matrix index, tried to access index: ", i);
+            }
             return raw_[i];
         }
 
         inline T operator[](size_t i) const
         {
-            if (i >= SIZE)
-                PANIC("Invalid Matrix index, tried to access index: ", i);
+            if constexpr (BOUNDS_CHECKED)
+            {
+                if (i >= SIZE)
+                    PANIC("Invalid Matrix index, tried to access index: ", i);
+            }
             return raw_[i];
         }
 
-        // Matrix addition
+        /// Element (i, j) without bounds checking in any build mode, for loops that stay within the shape
+        inline decltype(auto) unchecked(size_t i, size_t j) { return raw_[j + i * COLS_]; }
+        inline T unchecked(size_t i, size_t j) const { return raw_[j + i * COLS_]; }
+
+        // Matrix addition, evaluated right away and split across the threads of `policy`
+        // (the + operator builds a lazy expression instead, see Expr.h)
         template <template <class> typename MemBufOther = MemBuf, template <class> typename MemBufOut = MemBuf, typename S = T>
-        inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value,
-                                       AbstractDynMat<T, MemBufOut>>::type
-        operator+(const AbstractDynMat<T, MemBufOther> &other) const
+        typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value,
+                                AbstractDynMat<T, MemBufOut>>::type
+        add(const AbstractDynMat<T, MemBufOther> &other, const parallel::Policy &policy) const
         {
-            auto m3 = AbstractDynMat<T, MemBufOut>(ROWS_, COLS_);
+            if (ROWS_ != other.ROWS_ || COLS_ != other.COLS_)
+                PANIC("Incompatible matrix dimensions: ", ROWS_, 'x', COLS_, " + ", other.ROWS_, 'x', other.COLS_);
+            auto m3 = AbstractDynMat<T, MemBufOut>(ROWS_, COLS_, memory::uninitialized);
+            if constexpr (use_simd<T, MemBuf<T>, MemBufOther<T>, MemBufOut<T>>::value)
+            {
+                const T *x = as_raw();
+                const T *y = other.as_raw();
+                T *out = m3.as_raw_mut();
+                parallel::for_chunks(policy, SIZE, MIN_CHUNK, [&](size_t begin, size_t end) {
+                    simd::add(x + begin, y + begin, out + begin, end - begin);
+                });
+                return m3;
+            }
             for (auto &&i : Range(ROWS_))
             {
                 for (auto &&j : Range(COLS_))
                 {
-                    m3(i, j) = (*this)(i, j) + other(i, j);
+                    m3.unchecked(i, j) = unchecked(i, j) + other.unchecked(i, j);
                 }
             }
             return m3;
         }
 
 
-        // Matrix addition with static
-        template <size_t ROWS, size_t COLS, template <class> typename MemBufOther = MemBuf, template <class> typename MemBufOut = MemBuf, typename S = T>
-        inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value,
-                                       AbstractDynMat<T, MemBufOut>>::type
-        operator+(const Mat<T, ROWS, COLS> &other) const
-        {
-            assert(ROWS == ROWS_ && COLS == COLS_);
-            auto m3 = AbstractDynMat<T, MemBufOut>(ROWS_, COLS_);
-            m3 += other;
-            return m3;
-        }
-
         // compound matrix addition with static
         template <size_t ROWS, size_t COLS, template <class> typename MemBufOther = MemBuf, typename S = T, typename Ptr = to_raw_pointer<S>>
         typename std::enable_if<std::is_pointer<typename Ptr::Raw>::value, AbstractDynMat<T, MemBuf> &>::type operator+=(const Mat<typename Ptr::Element, ROWS, COLS> &other) 
@@ -157,43 +353,117 @@ namespace internal
             }
             for (auto &&i : Range(SIZE))
             {
-                *(this->raw_[i]) += other[i];
+                *(this->raw_[i]) += other.as_raw()[i];
             }
             return *this;
         }
 
-        // Matrix subtraction
+        // Matrix subtraction, evaluated right away and split across the threads of `policy`
         template <template <class> typename MemBufOther = MemBuf, template <class> typename MemBufOut = MemBuf, typename S = T>
-        inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value,
-                                       AbstractDynMat<T, MemBufOut>>::type
-        operator-(const AbstractDynMat<T, MemBufOther> &other) const
+        typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value,
+                                AbstractDynMat<T, MemBufOut>>::type
+        sub(const AbstractDynMat<T, MemBufOther> &other, const parallel::Policy &policy) const
         {
-            assert(ROWS_ == other.ROWS_ && COLS_ == other.COLS_);
-            auto m3 = AbstractDynMat<T, MemBufOut>(ROWS_, COLS_);
+            if (ROWS_ != other.ROWS_ || COLS_ != other.COLS_)
+                PANIC("Incompatible matrix dimensions: ", ROWS_, 'x', COLS_, " - ", other.ROWS_, 'x', other.COLS_);
+            auto m3 = AbstractDynMat<T, MemBufOut>(ROWS_, COLS_, memory::uninitialized);
+            if constexpr (use_simd<T, MemBuf<T>, MemBufOther<T>, MemBufOut<T>>::value)
+            {
+                const T *x = as_raw();
+                const T *y = other.as_raw();
+                T *out = m3.as_raw_mut();
+                parallel::for_chunks(policy, SIZE, MIN_CHUNK, [&](size_t begin, size_t end) {
+                    simd::sub(x + begin, y + begin, out + begin, end - begin);
+                });
+                return m3;
+            }
             for (auto &&i : Range(ROWS_))
             {
                 for (auto &&j : Range(COLS_))
                 {
-                    m3(i, j) = (*this)(i, j) - other(i, j);
+                    m3.unchecked(i, j) = unchecked(i, j) - other.unchecked(i, j);
                 }
             }
             return m3;
         }
 
-        template <typename U, template <class> typename MemBufOut = MemBuf>
-        AbstractDynMat<U, MemBufOut> map(U f(T)) const
+        /// New matrix of f(x) for every element x, f is any callable and U defaults to its result (see Functional.h)
+        template <typename U = void, template <class> typename MemBufOut = MemBuf, typename F>
+        AbstractDynMat<functional::result_t<U, F, T>, MemBufOut>
+        map(const F &f, const parallel::Policy &policy = parallel::global_policy()) const
         {
-            auto m = AbstractDynMat<U, MemBufOut>(ROWS_, COLS_);
-            for (auto &&i : Range(ROWS_))
+            using V = functional::result_t<U, F, T>;
+            auto m = AbstractDynMat<V, MemBufOut>(ROWS_, COLS_, memory::uninitialized);
+            // writes into a non-contiguous buffer may restructure it, those have to stay on one thread
+            if constexpr (is_contiguous<MemBuf<T>>::value && is_contiguous<MemBufOut<V>>::value)
             {
-                for (auto &&j : Range(COLS_))
-                {
-                    m(i, j) = f((*this)(i, j));
-                }
+                functional::map(as_raw(), m.as_raw_mut(), SIZE, f, policy);
+                return m;
             }
+            for (size_t i = 0; i < SIZE; ++i)
+                m.raw_[i] = f(raw_[i]);
             return m;
         }
 
+        /// New matrix of f(x, y) for the elements x of this and y of other at the same position
+        template <typename U = void, typename F, typename S, template <class> typename MemBufOther>
+        AbstractDynMat<functional::result_t<U, F, T, S>, MemBuf>
+        zip_with(const AbstractDynMat<S, MemBufOther> &other, const F &f,
+                 const parallel::Policy &policy = parallel::global_policy()) const
+        {
+            if (ROWS_ != other.ROWS_ || COLS_ != other.COLS_)
+                PANIC("Incompatible matrix dimensions: ", ROWS_, 'x', COLS_, " zip ", other.ROWS_, 'x', other.COLS_);
+            using V = functional::result_t<U, F, T, S>;
+            auto m = AbstractDynMat<V, MemBuf>(ROWS_, COLS_, memory::uninitialized);
+            if constexpr (is_contiguous<MemBuf<T>>::value && is_contiguous<MemBufOther<S>>::value &&
+                          is_contiguous<MemBuf<V>>::value)
+            {
+                functional::zip(as_raw(), other.as_raw(), m.as_raw_mut(), SIZE, f, policy);
+                return m;
+            }
+            for (size_t i = 0; i < SIZE; ++i)
+                m.raw_[i] = f(raw_[i], other.raw_[i]);
+            return m;
+        }
+
+        /// Replaces every element x by f(x)
+        template <typename F>
+        AbstractDynMat &apply(const F &f, const parallel::Policy &policy = parallel::global_policy())
+        {
+            if constexpr (is_contiguous<MemBuf<T>>::value)
+            {
+                functional::map(as_raw(), as_raw_mut(), SIZE, f, policy);
+                return *this;
+            }
+            const auto &in = raw_;
+            for (size_t i = 0; i < SIZE; ++i)
+            {
+                // only changed elements are written, a sparse buffer doesn't fill up with zeros that stay zeros
+                const T y = f(in[i]);
+                if (!(y == in[i]))
+                    raw_[i] = y;
+            }
+            return *this;
+        }
+
+        /// init combined with all elements by op, which has to be associative and commutative (see Functional.h)
+        template <typename R, typename Op>
+        R reduce(R init, const Op &op, const parallel::Policy &policy = parallel::global_policy()) const
+        {
+            return transform_reduce(init, op, [](const T &x) { return x; }, policy);
+        }
+
+        /// init combined with f(x) of all elements x by op, which has to be associative and commutative
+        template <typename R, typename Op, typename F>
+        R transform_reduce(R init, const Op &op, const F &f, const parallel::Policy &policy = parallel::global_policy()) const
+        {
+            if constexpr (is_contiguous<MemBuf<T>>::value)
+                return functional::transform_reduce(as_raw(), SIZE, init, op, f, policy);
+            for (size_t i = 0; i < SIZE; ++i)
+                init = op(init, f(raw_[i]));
+            return init;
+        }
+
         template <template <class> typename MemBufOut, typename S = T, typename Ptr = to_raw_pointer<S>>
         inline typename std::enable_if<std::is_pointer<typename Ptr::Raw>::value,
                                        AbstractDynMat<typename Ptr::Element, MemBufOut>>::type
@@ -202,41 +472,24 @@ namespace internal
             return this->map<typename Ptr::Element>([](T x) { return *x; });
         }
 
-        template <typename S = T>
-        typename std::enable_if<std::is_pointer<typename to_raw_pointer<S>::Raw>::value, String>::type show()
+        // Elements in std::to_string's notation, a space after each and rows on separate lines (see Format.h for more control)
+        inline String show() const
         {
-            auto s = String();
-            for (auto &&i : Range(ROWS_))
-            {
-                for (auto &&j : Range(COLS_))
-                    s.append(std::to_string(*((*this)(i, j))) + " ");
-                s.append("\n");
-            }
-            s.pop_back();
+            auto s = ::format::to_string(*this, ::format::Options::show());
+            if (!s.empty())
+                s.pop_back();
             return s;
-        };
-
-        template <typename S = T>
-        typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value, String>::type show()
-        {
-            auto s = String();
-            for (auto &&i : Range(ROWS_))
-            {
-                for (auto &&j : Range(COLS_))
-                    s.append(std::to_string((*this)(i, j)) + " ");
-                s.append("\n");
-            }
-            s.pop_back();
-            return s;
-        };
+        }
 
         template <template <class> typename MemBufOther = MemBuf, typename S = T, typename Ptr = to_raw_pointer<S>>
         typename std::enable_if<std::is_pointer<typename Ptr::Raw>::value, AbstractDynMat<T, MemBuf> &>::type
         operator=(const AbstractDynMat<typename Ptr::Element, MemBufOther> other)
         {
+            if (ROWS_ != other.ROWS_ || COLS_ != other.COLS_)
+                PANIC("Incompatible matrix dimensions: ", ROWS_, 'x', COLS_, " = ", other.ROWS_, 'x', other.COLS_);
             for (auto &&i : Range(SIZE))
             {
-                *(this->raw_[i]) = other[i];
+                *(this->raw_[i]) = other.unchecked(i / COLS_, i % COLS_);
             }
             return *this;
         }
@@ -256,64 +509,144 @@ namespace internal
         inline auto end() const { return raw_.end(); }
     };
 
-    // Scalar multiplication
+    // Scalar multiplication, evaluated right away and split across the threads of `policy`
     template <typename T, template <class> typename MemBuf, template <class> typename MemBufOut = MemBuf>
-    inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<T>::Raw>::value,
-                                   AbstractDynMat<T, MemBufOut>>::type
-    operator*(const T factor, const AbstractDynMat<T, MemBuf> &mat)
+    typename std::enable_if<!std::is_pointer<typename to_raw_pointer<T>::Raw>::value,
+                            AbstractDynMat<T, MemBufOut>>::type
+    scale(const T factor, const AbstractDynMat<T, MemBuf> &mat, const parallel::Policy &policy)
     {
-        auto m3 = AbstractDynMat<T, MemBufOut>(mat.ROWS_, mat.COLS_);
+        auto m3 = AbstractDynMat<T, MemBufOut>(mat.ROWS_, mat.COLS_, memory::uninitialized);
+        if constexpr (use_simd<T, MemBuf<T>, MemBufOut<T>>::value)
+        {
+            const T *x = mat.as_raw();
+            T *out = m3.as_raw_mut();
+            parallel::for_chunks(policy, mat.SIZE, MIN_CHUNK, [&](size_t begin, size_t end) {
+                simd::scale(x + begin, factor, out + begin, end - begin);
+            });
+            return m3;
+        }
         for (auto &&i : Range(mat.ROWS_))
         {
             for (auto &&j : Range(mat.COLS_))
             {
-                m3(i, j) = factor * mat(i, j);
+                m3.unchecked(i, j) = factor * mat.unchecked(i, j);
             }
         }
         return m3;
     }
 
-    // Matrix multiplication
+    // Matrix multiplication, split across the threads of `policy`
     template <typename T, template <class> typename MemBuf, template <class> typename MemBufOther = MemBuf, template <class> typename MemBufOut = MemBuf>
-    inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<T>::Raw>::value,
-                                   AbstractDynMat<T, MemBufOut>>::type
-    operator*(const AbstractDynMat<T, MemBuf> &self, const AbstractDynMat<T, MemBufOther> &other)
+    typename std::enable_if<!std::is_pointer<typename to_raw_pointer<T>::Raw>::value,
+                            AbstractDynMat<T, MemBufOut>>::type
+    multiply(const AbstractDynMat<T, MemBuf> &self, const AbstractDynMat<T, MemBufOther> &other, const parallel::Policy &policy)
     {
-        assert(self.COLS_ == other.ROWS_);
-        auto m3 = AbstractDynMat<T, MemBufOut>(self.ROWS_, other.COLS_);
+        if (self.COLS_ != other.ROWS_)
+            PANIC("Incompatible matrix dimensions: ", self.ROWS_, 'x', self.COLS_, " * ", other.ROWS_, 'x', other.COLS_);
+        const auto scope = ::profile::Scope(::profile::Op::Gemm, self.ROWS_ * other.COLS_, 2 * self.ROWS_ * other.COLS_ * self.COLS_);
+        auto m3 = AbstractDynMat<T, MemBufOut>(self.ROWS_, other.COLS_, memory::uninitialized);
+        // dense floating point operands go through the packed and blocked kernel
+        if constexpr (std::is_floating_point<T>::value && is_contiguous<MemBuf<T>>::value &&
+                      is_contiguous<MemBufOther<T>>::value && is_contiguous<MemBufOut<T>>::value)
+        {
+            gemm::gemm<T>(self.ROWS_, other.COLS_, self.COLS_, T(1),
+                          self.as_raw(), self.COLS_, 1,
+                          other.as_raw(), other.COLS_, 1,
+                          T(), m3.as_raw_mut(), m3.COLS_, 1, policy);
+            return m3;
+        }
         for (auto &&i : Range(self.ROWS_))
         {
-            auto j = 0;
             for (auto &&j : Range(other.COLS_))
             {
-                auto sum = 0.0;
+                T sum = T();
                 for (auto &&k : Range(self.COLS_))
                 {
-                    sum += self(static_cast<size_t>(i), static_cast<size_t>(k)) *
-                           other(static_cast<size_t>(k), static_cast<size_t>(j));
+                    sum += self.unchecked(static_cast<size_t>(i), static_cast<size_t>(k)) *
+                           other.unchecked(static_cast<size_t>(k), static_cast<size_t>(j));
                 }
-                m3(i, j) = sum;
+                m3.unchecked(i, j) = sum;
             }
         }
         return m3;
     }
 
-    // Dot product
-    template <typename T, template <class> typename MemBuf, template <class> typename MemBufOther = MemBuf>
+    // Matrix multiplication
+    template <typename T, template <class> typename MemBuf, template <class> typename MemBufOther = MemBuf, template <class> typename MemBufOut = MemBuf>
     inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<T>::Raw>::value,
-                                   T>::type
+                                   AbstractDynMat<T, MemBufOut>>::type
     operator*(const AbstractDynMat<T, MemBuf> &self, const AbstractDynMat<T, MemBufOther> &other)
     {
-        assert(self.COLS_ == other.ROWS_ && self.ROWS_ == 1 && other.COLS_ == 1);
-        auto scal_prod = 0.0;
-        for (auto &&i : Range(self.COLS_))
+        return multiply<T, MemBuf, MemBufOther, MemBufOut>(self, other, parallel::global_policy());
+    }
+
+    /* Dot product of a row and a column vector
+    (a named function, as an operator* overload would be ambiguous with the matrix multiplication)
+    Acc picks the accumulation, e.g. dot<accumulate::Widened>(x, y) sums float vectors in double, see Accumulate.h.
+    */
+    template <typename Acc = accumulate::Native, typename T, template <class> typename MemBuf, template <class> typename MemBufOther = MemBuf>
+    inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<T>::Raw>::value,
+                                   accumulate::result_t<Acc, T>>::type
+    dot(const AbstractDynMat<T, MemBuf> &self, const AbstractDynMat<T, MemBufOther> &other,
+        const parallel::Policy &policy = parallel::global_policy())
+    {
+        if (self.COLS_ != other.ROWS_ || self.ROWS_ != 1 || other.COLS_ != 1)
+            PANIC("Incompatible matrix dimensions: ", self.ROWS_, 'x', self.COLS_, " . ", other.ROWS_, 'x', other.COLS_);
+        if constexpr (use_simd<T, MemBuf<T>, MemBufOther<T>>::value)
         {
-            scal_prod += self[static_cast<size_t>(i)] * other[static_cast<size_t>(i)];
+            const T *x = self.as_raw();
+            const T *y = other.as_raw();
+            return accumulate::reduce<Acc, T>(policy, self.COLS_, [&](size_t begin, size_t end) {
+                return accumulate::dot<Acc>(x + begin, y + begin, end - begin);
+            });
         }
-        return scal_prod;
+        auto acc = accumulate::Accumulator<Acc, T>();
+        for (auto &&i : Range(self.COLS_))
+            acc.add_product(self.unchecked(0, i), other.unchecked(i, 0));
+        return acc.value();
     }
 } // namespace internal
 
+/* c += alpha * a * b in place, c's storage is reused and nothing is allocated besides GEMM's packing buffers
+Any mix of Mat, DynMat and views works, floating point operands with strided storage go through the
+blocked GEMM kernel. c must not overlap a or b.
+*/
+template <typename C, typename L, typename R, typename CC = typename std::decay<C>::type,
+          typename = typename std::enable_if<expr::Leaf<CC>::IS_LEAF && expr::Leaf<L>::IS_LEAF && expr::Leaf<R>::IS_LEAF>::type>
+void multiply_add(C &&c, const typename expr::Leaf<CC>::Type alpha, const L &a, const R &b,
+                  const parallel::Policy &policy = parallel::global_policy())
+{
+    using T = typename expr::Leaf<CC>::Type;
+    using LC = expr::Leaf<CC>;
+    using LA = expr::Leaf<L>;
+    using LB = expr::Leaf<R>;
+    static_assert(std::is_same<typename LA::Type, T>::value && std::is_same<typename LB::Type, T>::value, "Operands need the same element type");
+    const size_t m = LA::rows(a);
+    const size_t k = LA::cols(a);
+    const size_t n = LB::cols(b);
+    if (LB::rows(b) != k || LC::rows(c) != m || LC::cols(c) != n)
+        PANIC("Incompatible matrix dimensions: ", LC::rows(c), 'x', LC::cols(c), " += ", m, 'x', k, " * ", LB::rows(b), 'x', n);
+    const auto scope = ::profile::Scope(::profile::Op::Gemm, m * n, 2 * m * n * k);
+    if constexpr (std::is_floating_point<T>::value && LC::STRIDED && LA::STRIDED && LB::STRIDED)
+    {
+        internal::gemm::gemm<T>(m, n, k, alpha,
+                                LA::data(a), LA::row_stride(a), LA::col_stride(a),
+                                LB::data(b), LB::row_stride(b), LB::col_stride(b),
+                                T(1), LC::data_mut(c), LC::row_stride(c), LC::col_stride(c), policy);
+        return;
+    }
+    const auto ta = expr::Terminal<L>(a);
+    const auto tb = expr::Terminal<R>(b);
+    for (size_t i = 0; i < m; ++i)
+        for (size_t j = 0; j < n; ++j)
+        {
+            T sum = T();
+            for (size_t p = 0; p < k; ++p)
+                sum += ta.at(i, p) * tb.at(p, j);
+            c.unchecked(i, j) += alpha * sum;
+        }
+}
+
 template <typename T>
 class SparseBuffer
 {
@@ -328,20 +661,15 @@ public:
     inline SparseBuffer(size_t rows, size_t cols) : raw_(), potentially_zero_(), cnt_(), max_size_(rows * cols), treshold_(ceil(0.05 * max_size_)) {}
     inline T operator[](size_t i) const
     {
-        try
-        {
-            return raw_.at(i);
-        }
-        catch (const std::exception &e)
-        {
-            return T();
-        }
+        auto it = raw_.find(i);
+        return it == raw_.end() ? T() : it->second;
     }
     inline T &operator[](size_t i)
     {
         cnt_++;
         if (cnt_ > treshold_)
         {
+            const auto scope = ::profile::Scope(::profile::Op::SparseCompact, potentially_zero_.size(), 0);
             auto zero = T();
             for (auto &&x : potentially_zero_)
             {
@@ -359,6 +687,9 @@ public:
 
     inline auto begin() const { return raw_.begin(); }
     inline auto end() const { return raw_.end(); }
+
+    /// Number of stored elements, including ones set to zero since the last compaction
+    inline size_t size() const { return raw_.size(); }
 };
 
 template <typename T>
@@ -368,7 +699,11 @@ private:
     std::vector<T> raw_;
 
 public:
-    inline DynBuffer(size_t rows, size_t cols) : raw_(rows * cols) {}
+    inline DynBuffer(size_t rows, size_t cols) : raw_(rows * cols) { ::profile::allocated(raw_.size() * sizeof(T)); }
+    inline DynBuffer(const DynBuffer &other) : raw_(other.raw_) { ::profile::allocated(raw_.size() * sizeof(T)); }
+    inline DynBuffer(DynBuffer &&other) = default;
+    inline DynBuffer &operator=(const DynBuffer &other) = default;
+    inline DynBuffer &operator=(DynBuffer &&other) = default;
     inline T operator[](size_t i) const
     {
         return raw_[i];
@@ -377,27 +712,116 @@ public:
     {
         return raw_[i];
     }
+
+    inline T *data() { return raw_.data(); }
+    inline const T *data() const { return raw_.data(); }
 };
 
 template <typename T>
 using DynMat = internal::AbstractDynMat<T, DynBuffer>;
 
+// Dense matrix on 64 byte aligned, pooled storage (see Memory.h)
 template <typename T>
-using SparseMat = internal::AbstractDynMat<T, SparseBuffer>;
+using AlignedMat = internal::AbstractDynMat<T, AlignedBuffer>;
 
 template <typename T>
-typename std::enable_if<!std::is_pointer<typename to_raw_pointer<T>::Raw>::value, String>::type show_sparse(const SparseMat<T>& m)
+using SparseMat = internal::AbstractDynMat<T, SparseBuffer>;
+
+namespace internal
 {
-    auto s = String();
-    for (auto &&x : m)
+    /* y += A x, or A^T x if `transposed`, over the stored elements of a SparseMat A, x and y are row major
+    with k columns. The elements are unordered, so on one thread they're visited where they are. With more,
+    they're first grouped by the row of y they add to, in one counting pass, and the rows of y are split
+    across the threads of `policy`, each written by one thread.
+    */
+    template <typename T>
+    void sparse_product(const SparseMat<T> &a, const T *x, size_t k, T *y, bool transposed, const parallel::Policy &policy)
     {
-        // we know that the index x.first = j + i * COLS_ with row index i and column index j < COLS_
-        auto j = x.first % m.COLS_;
-        auto i = (x.first - j) / m.COLS_;
-        assert(j + i*m.COLS_ == x.first);
-        s.append(/*std::to_string(x.first) + */'(' + std::to_string(i) + ',' + std::to_string(j) + ')' + std::to_string(x.second) + " ");
+        const size_t rows = transposed ? a.COLS_ : a.ROWS_;
+        const size_t nnz = a.buffer().size();
+        if (parallel::threads_for(policy, nnz * k + rows, policy.serial_cutoff) <= 1)
+        {
+            for (auto &&e : a)
+            {
+                const size_t i = e.first / a.COLS_;
+                const size_t j = e.first % a.COLS_;
+                const size_t r = transposed ? j : i;
+                const T *in = x + (transposed ? i : j) * k;
+                for (size_t c = 0; c < k; ++c)
+                    y[r * k + c] += e.second * in[c];
+            }
+            return;
+        }
+        auto ptr = std::vector<size_t>(rows + 1, 0);
+        for (auto &&e : a)
+            ++ptr[(transposed ? e.first % a.COLS_ : e.first / a.COLS_) + 1];
+        for (size_t r = 0; r < rows; ++r)
+            ptr[r + 1] += ptr[r];
+        auto next = std::vector<size_t>(ptr.begin(), ptr.end() - 1);
+        auto in = std::vector<size_t>(nnz);
+        auto values = std::vector<T>(nnz);
+        for (auto &&e : a)
+        {
+            const size_t i = e.first / a.COLS_;
+            const size_t j = e.first % a.COLS_;
+            const size_t p = next[transposed ? j : i]++;
+            in[p] = transposed ? i : j;
+            values[p] = e.second;
+        }
+        parallel::for_chunks(policy, rows, 1, [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; ++r)
+            {
+                T *out = y + r * k;
+                for (size_t p = ptr[r]; p < ptr[r + 1]; ++p)
+                {
+                    const T v = values[p];
+                    const T *row = x + in[p] * k;
+                    for (size_t c = 0; c < k; ++c)
+                        out[c] += v * row[c];
+                }
+            }
+        }, nnz * k / std::max<size_t>(rows, 1) + 1);
+    }
+
+    /// Sparse times dense, e.g. a matrix times a vector, visiting only the stored elements, see sparse_product()
+    template <typename T>
+    DynMat<T> multiply(const SparseMat<T> &self, const DynMat<T> &other, const parallel::Policy &policy = parallel::global_policy())
+    {
+        if (self.COLS_ != other.ROWS_)
+            PANIC("Incompatible matrix dimensions: ", self.ROWS_, 'x', self.COLS_, " * ", other.ROWS_, 'x', other.COLS_);
+        const size_t k = other.COLS_;
+        const auto scope = ::profile::Scope(::profile::Op::SparseMultiply, self.buffer().size() * k, 2 * self.buffer().size() * k);
+        auto m3 = DynMat<T>(self.ROWS_, k);
+        sparse_product(self, other.as_raw(), k, m3.as_raw_mut(), false, policy);
+        return m3;
+    }
+
+    /// self^T * other without forming the transpose
+    template <typename T>
+    DynMat<T> multiply_transposed(const SparseMat<T> &self, const DynMat<T> &other, const parallel::Policy &policy = parallel::global_policy())
+    {
+        if (self.ROWS_ != other.ROWS_)
+            PANIC("Incompatible matrix dimensions: (", self.ROWS_, 'x', self.COLS_, ")^T * ", other.ROWS_, 'x', other.COLS_);
+        const size_t k = other.COLS_;
+        const auto scope = ::profile::Scope(::profile::Op::SparseMultiply, self.buffer().size() * k, 2 * self.buffer().size() * k);
+        auto m3 = DynMat<T>(self.COLS_, k);
+        sparse_product(self, other.as_raw(), k, m3.as_raw_mut(), true, policy);
+        return m3;
     }
-    return s;
+
+    // Sparse times dense matrix multiplication, the result is dense
+    template <typename T>
+    inline DynMat<T> operator*(const SparseMat<T> &self, const DynMat<T> &other)
+    {
+        return multiply(self, other, parallel::global_policy());
+    }
+} // namespace internal
+
+// Lists the stored elements of a sparse matrix (SparseMat, CsrMat, CscMat) as (i,j)value
+template <typename T, template <class> typename MemBuf>
+typename std::enable_if<!std::is_pointer<typename to_raw_pointer<T>::Raw>::value, String>::type show_sparse(const internal::AbstractDynMat<T, MemBuf>& m)
+{
+    return format::to_string_sparse(m, format::Options::show());
 };
 
 #endif // DYN_MATRIX_H
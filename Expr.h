@@ -0,0 +1,511 @@
+#if !defined(EXPR_H)
+#define EXPR_H
+
+#include <cstddef> // ptrdiff_t
+#include <type_traits>
+#include <utility> // declval
+
+#include "util.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Profile.h"
+
+/* Expression templates for elementwise arithmetic on Mat and DynMat
+
+`a + b - 2.0 * c` doesn't compute anything, it builds a tree of small nodes that only reference a, b and c.
+The tree is evaluated in a single pass over the elements once it's assigned to or used to construct a
+matrix, so there's no temporary per operator. Example:
+    DynMat<double> d = a + b - 2.0 * c; // one allocation, one loop
+    d = a - b;                          // no allocation, writes into d's buffer
+    auto e = a + b;                     // e is a node that references a and b, e.eval() computes it
+
+Nodes only hold references to the matrices at their leaves, so an expression must not outlive them.
+When all leaves are contiguous float / double storage the pass runs on SIMD registers with runtime
+ISA dispatch (see Simd.h). FMA contraction is disabled there, so the fused result is the same as computing
+the expression one operator at a time.
+*/
+
+template <typename T, size_t _ROWS, size_t _COLS>
+class Mat;
+
+namespace internal
+{
+    template <typename T, template <class> typename MemBuf>
+    class AbstractDynMat;
+}
+
+namespace expr
+{
+    /* Uniform access to the matrix types that can be leaves of an expression
+    Only matrices of values qualify, pointer matrices can't take part in arithmetic.
+    STRIDED leaves expose element (i, j) at data + i * row_stride + j * col_stride, the others are read
+    through their operator(). Owned is the matrix type an expression with this leftmost leaf evaluates to.
+    View.h adds the specializations for views.
+    */
+    template <typename M>
+    struct Leaf
+    {
+        static const bool IS_LEAF = false;
+    };
+
+    template <typename T, size_t ROWS, size_t COLS>
+    struct Leaf<Mat<T, ROWS, COLS>>
+    {
+        static const bool IS_LEAF = !std::is_pointer<typename to_raw_pointer<T>::Raw>::value;
+        static const bool STRIDED = true;
+        using Type = T;
+        using M = Mat<T, ROWS, COLS>;
+        using Owned = M;
+
+        static size_t rows(const M &) { return ROWS; }
+        static size_t cols(const M &) { return COLS; }
+        static ptrdiff_t row_stride(const M &) { return COLS; }
+        static ptrdiff_t col_stride(const M &) { return 1; }
+        static const T *data(const M &m) { return m.as_raw(); }
+        static T *data_mut(M &m) { return m.as_raw_mut(); }
+    };
+
+    template <typename T, template <class> typename MemBuf>
+    struct Leaf<internal::AbstractDynMat<T, MemBuf>>
+    {
+        static const bool IS_LEAF = !std::is_pointer<typename to_raw_pointer<T>::Raw>::value;
+        static const bool STRIDED = is_contiguous<MemBuf<T>>::value;
+        using Type = T;
+        using M = internal::AbstractDynMat<T, MemBuf>;
+        using Owned = M;
+
+        static size_t rows(const M &m) { return m.ROWS_; }
+        static size_t cols(const M &m) { return m.COLS_; }
+        static ptrdiff_t row_stride(const M &m) { return m.COLS_; }
+        static ptrdiff_t col_stride(const M &) { return 1; }
+        static const T *data(const M &m) { return m.as_raw(); }
+        static T *data_mut(M &m) { return m.as_raw_mut(); }
+    };
+
+    /// Base of all nodes, used to recognize them
+    struct Node
+    {
+    };
+
+    template <typename E>
+    struct is_node : std::is_base_of<Node, E>
+    {
+    };
+
+    template <typename X>
+    struct is_operand : std::integral_constant<bool, is_node<X>::value || Leaf<X>::IS_LEAF>
+    {
+    };
+
+    /* Leaf of an expression tree, references one matrix
+    Every node offers
+        at(i, j)            - element (i, j)
+        load<W>(v, i, j)    - elements (i, j) .. (i, j + W - 1) into a pack, only if unit_stride()
+        unit_stride()       - all leaves have unit column stride
+        dense()             - all leaves are densely packed, so row 0 can be indexed past its end
+        OPS                 - arithmetic operations per element, for the FLOP counts of Profile.h
+    */
+    template <typename M, bool STRIDED = Leaf<M>::STRIDED>
+    class Terminal
+    {
+    private:
+        const M &m_;
+
+    public:
+        using Type = typename Leaf<M>::Type;
+        using Result = typename Leaf<M>::Owned;
+        static const bool VECTORIZABLE = false;
+        static const size_t OPS = 0;
+
+        inline explicit Terminal(const M &m) : m_(m) {}
+        inline size_t rows() const { return Leaf<M>::rows(m_); }
+        inline size_t cols() const { return Leaf<M>::cols(m_); }
+        inline bool unit_stride() const { return false; }
+        inline bool dense() const { return false; }
+        MATRAC_ALWAYS_INLINE Type at(size_t i, size_t j) const { return m_.unchecked(i, j); }
+    };
+
+    template <typename M>
+    class Terminal<M, true>
+    {
+    private:
+        using T = typename Leaf<M>::Type;
+        const T *data_;
+        size_t rows_;
+        size_t cols_;
+        ptrdiff_t row_stride_;
+        ptrdiff_t col_stride_;
+
+    public:
+        using Type = T;
+        using Result = typename Leaf<M>::Owned;
+        static const bool VECTORIZABLE = simd::is_vectorizable<T>::value;
+        static const size_t OPS = 0;
+
+        inline explicit Terminal(const M &m)
+            : data_(Leaf<M>::data(m)), rows_(Leaf<M>::rows(m)), cols_(Leaf<M>::cols(m)),
+              row_stride_(Leaf<M>::row_stride(m)), col_stride_(Leaf<M>::col_stride(m)) {}
+        inline size_t rows() const { return rows_; }
+        inline size_t cols() const { return cols_; }
+        inline bool unit_stride() const { return col_stride_ == 1; }
+        inline bool dense() const { return col_stride_ == 1 && (row_stride_ == ptrdiff_t(cols_) || rows_ <= 1); }
+        MATRAC_ALWAYS_INLINE T at(size_t i, size_t j) const { return data_[i * row_stride_ + j * col_stride_]; }
+
+        template <size_t W>
+        MATRAC_ALWAYS_INLINE void load(typename simd::Pack<T, W>::Vec &v, size_t i, size_t j) const
+        {
+            simd::Pack<T, W>::load(v, data_ + i * row_stride_ + j);
+        }
+    };
+
+    /// Wraps matrices into terminals and passes nodes through
+    template <typename X, bool = is_node<X>::value>
+    struct Operand
+    {
+        using Type = X;
+        static const X &wrap(const X &x) { return x; }
+    };
+
+    template <typename X>
+    struct Operand<X, false>
+    {
+        using Type = Terminal<X>;
+        static Terminal<X> wrap(const X &x) { return Terminal<X>(x); }
+    };
+
+    template <typename E>
+    class Expression : public Node
+    {
+    public:
+        inline size_t size() const { return self().rows() * self().cols(); }
+
+        inline auto operator[](size_t i) const
+        {
+            if constexpr (BOUNDS_CHECKED)
+            {
+                if (i >= size())
+                    PANIC("Invalid Matrix index, tried to access index: ", i);
+            }
+            return self().at(i / self().cols(), i % self().cols());
+        }
+
+        inline auto operator()(size_t i, size_t j) const
+        {
+            if constexpr (BOUNDS_CHECKED)
+            {
+                if (i >= self().rows())
+                    PANIC("Invalid Matrix index, tried to access row: ", i);
+                if (j >= self().cols())
+                    PANIC("Invalid Matrix index, tried to access column: ", j);
+            }
+            return self().at(i, j);
+        }
+
+        /// Element (i, j) without bounds checking in any build mode, for loops that stay within the shape
+        inline auto unchecked(size_t i, size_t j) const { return self().at(i, j); }
+
+        /// Computes the expression into a new matrix of the type of its leftmost leaf
+        template <typename Out = void>
+        inline auto eval() const
+        {
+            using Result = typename std::conditional<std::is_void<Out>::value, typename E::Result, Out>::type;
+            return Result(self());
+        }
+
+    private:
+        inline const E &self() const { return static_cast<const E &>(*this); }
+    };
+
+    /// l op r elementwise, Op is one of the operations of Simd.h
+    template <typename Op, typename L, typename R>
+    class Binary : public Expression<Binary<Op, L, R>>
+    {
+    private:
+        L l_;
+        R r_;
+
+    public:
+        using Type = typename L::Type;
+        using Result = typename L::Result;
+        static const bool VECTORIZABLE = L::VECTORIZABLE && R::VECTORIZABLE;
+        static const size_t OPS = L::OPS + R::OPS + 1;
+
+        inline Binary(const L &l, const R &r) : l_(l), r_(r)
+        {
+            static_assert(std::is_same<typename L::Type, typename R::Type>::value, "Operands need the same element type");
+            if (l.rows() != r.rows() || l.cols() != r.cols())
+                PANIC("Incompatible matrix dimensions: ", l.rows(), 'x', l.cols(), " and ", r.rows(), 'x', r.cols());
+        }
+
+        inline size_t rows() const { return l_.rows(); }
+        inline size_t cols() const { return l_.cols(); }
+        inline bool unit_stride() const { return l_.unit_stride() && r_.unit_stride(); }
+        inline bool dense() const { return l_.dense() && r_.dense(); }
+
+        MATRAC_ALWAYS_INLINE Type at(size_t i, size_t j) const
+        {
+            Type x = l_.at(i, j);
+            Op::apply(x, r_.at(i, j));
+            return x;
+        }
+
+        template <size_t W>
+        MATRAC_ALWAYS_INLINE void load(typename simd::Pack<Type, W>::Vec &v, size_t i, size_t j) const
+        {
+            typename simd::Pack<Type, W>::Vec y;
+            l_.template load<W>(v, i, j);
+            r_.template load<W>(y, i, j);
+            Op::apply(v, y);
+        }
+    };
+
+    /// e op s elementwise for a scalar s
+    template <typename Op, typename E>
+    class Scalar : public Expression<Scalar<Op, E>>
+    {
+    private:
+        E e_;
+        typename E::Type s_;
+
+    public:
+        using Type = typename E::Type;
+        using Result = typename E::Result;
+        static const bool VECTORIZABLE = E::VECTORIZABLE;
+        static const size_t OPS = E::OPS + 1;
+
+        inline Scalar(const E &e, Type s) : e_(e), s_(s) {}
+
+        inline size_t rows() const { return e_.rows(); }
+        inline size_t cols() const { return e_.cols(); }
+        inline bool unit_stride() const { return e_.unit_stride(); }
+        inline bool dense() const { return e_.dense(); }
+
+        MATRAC_ALWAYS_INLINE Type at(size_t i, size_t j) const
+        {
+            Type x = e_.at(i, j);
+            Op::apply(x, s_);
+            return x;
+        }
+
+        template <size_t W>
+        MATRAC_ALWAYS_INLINE void load(typename simd::Pack<Type, W>::Vec &v, size_t i, size_t j) const
+        {
+            typename simd::Pack<Type, W>::Vec s;
+            simd::Pack<Type, W>::broadcast(s, s_);
+            e_.template load<W>(v, i, j);
+            Op::apply(v, s);
+        }
+    };
+
+    /* The fused loop, compiled once per instruction set like the kernels of Simd.h
+    Computes rows [r0, r1) x columns [c0, c1) into out, whose rows are `stride` apart and whose columns
+    are contiguous. Dense expressions are run as a single row [0, size) instead.
+    */
+    template <typename E>
+    struct Evaluator
+    {
+        using T = typename E::Type;
+
+        template <size_t W>
+        static MATRAC_ALWAYS_INLINE void run(const E &e, T *out, ptrdiff_t stride, size_t r0, size_t r1, size_t c0, size_t c1)
+        {
+            typename simd::Pack<T, W>::Vec v;
+            for (size_t r = r0; r < r1; ++r)
+            {
+                T *row = out + r * stride;
+                size_t c = c0;
+                for (; c + W <= c1; c += W)
+                {
+                    e.template load<W>(v, r, c);
+                    simd::Pack<T, W>::store(row + c, v);
+                }
+                for (; c < c1; ++c)
+                    row[c] = e.at(r, c);
+            }
+        }
+
+        using Fn = void (*)(const E &, T *, ptrdiff_t, size_t, size_t, size_t, size_t);
+
+        MATRAC_NO_CONTRACT static void scalar(const E &e, T *out, ptrdiff_t stride, size_t r0, size_t r1, size_t c0, size_t c1)
+        {
+            run<1>(e, out, stride, r0, r1, c0, c1);
+        }
+#if MATRAC_SIMD_X86
+        MATRAC_TARGET("sse2")
+        MATRAC_NO_CONTRACT static void sse2(const E &e, T *out, ptrdiff_t stride, size_t r0, size_t r1, size_t c0, size_t c1)
+        {
+            run<16 / sizeof(T)>(e, out, stride, r0, r1, c0, c1);
+        }
+        MATRAC_TARGET("avx2")
+        MATRAC_NO_CONTRACT static void avx2(const E &e, T *out, ptrdiff_t stride, size_t r0, size_t r1, size_t c0, size_t c1)
+        {
+            run<32 / sizeof(T)>(e, out, stride, r0, r1, c0, c1);
+        }
+        MATRAC_TARGET("avx512f")
+        MATRAC_NO_CONTRACT static void avx512(const E &e, T *out, ptrdiff_t stride, size_t r0, size_t r1, size_t c0, size_t c1)
+        {
+            run<64 / sizeof(T)>(e, out, stride, r0, r1, c0, c1);
+        }
+#endif
+
+        static Fn select(size_t row_length)
+        {
+            if (row_length < simd::DISPATCH_MIN_SIZE)
+                return scalar;
+#if MATRAC_SIMD_X86
+            switch (simd::active_isa())
+            {
+            case simd::Isa::AVX512:
+                return avx512;
+            case simd::Isa::AVX2:
+                return avx2;
+            case simd::Isa::SSE2:
+                return sse2;
+            default:
+                break;
+            }
+#endif
+            return scalar;
+        }
+    };
+
+    /* Writes the expression into dst's existing storage, dst must already have the expression's shape
+    Elementwise expressions may alias their destination as long as every element is read from the same
+    position it's written to, e.g. assign(a, a + b). Views that partially overlap the destination aren't safe.
+    */
+    template <typename Dst, typename E>
+    void assign(Dst &dst, const E &e, const parallel::Policy &policy = parallel::global_policy())
+    {
+        using T = typename E::Type;
+        static_assert(std::is_same<typename Leaf<Dst>::Type, T>::value, "Destination needs the expression's element type");
+        const size_t rows = e.rows();
+        const size_t cols = e.cols();
+        if (Leaf<Dst>::rows(dst) != rows || Leaf<Dst>::cols(dst) != cols)
+            PANIC("Incompatible matrix dimensions: ", Leaf<Dst>::rows(dst), 'x', Leaf<Dst>::cols(dst), " = ", rows, 'x', cols);
+        const auto scope = ::profile::Scope(::profile::Op::Elementwise, rows * cols, rows * cols * E::OPS);
+
+        if constexpr (Leaf<Dst>::STRIDED)
+        {
+            T *out = Leaf<Dst>::data_mut(dst);
+            const ptrdiff_t rs = Leaf<Dst>::row_stride(dst);
+            const ptrdiff_t cs = Leaf<Dst>::col_stride(dst);
+            if constexpr (E::VECTORIZABLE)
+            {
+                if (cs == 1 && (rs == ptrdiff_t(cols) || rows <= 1) && e.dense())
+                {
+                    const auto kernel = Evaluator<E>::select(rows * cols);
+                    parallel::for_chunks(policy, rows * cols, internal::MIN_CHUNK, [&](size_t begin, size_t end) {
+                        kernel(e, out, 0, 0, 1, begin, end);
+                    });
+                    return;
+                }
+                if (cs == 1 && e.unit_stride())
+                {
+                    const auto kernel = Evaluator<E>::select(cols);
+                    parallel::for_chunks(policy, rows, 1, [&](size_t begin, size_t end) {
+                        kernel(e, out, rs, begin, end, 0, cols);
+                    }, cols);
+                    return;
+                }
+            }
+            parallel::for_chunks(policy, rows, 1, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i)
+                    for (size_t j = 0; j < cols; ++j)
+                        out[i * rs + j * cs] = e.at(i, j);
+            }, cols);
+        }
+        else
+        {
+            for (size_t i = 0; i < rows; ++i)
+                for (size_t j = 0; j < cols; ++j)
+                    dst.unchecked(i, j) = e.at(i, j);
+        }
+    }
+
+    template <typename X>
+    using enable_operand = typename std::enable_if<is_operand<X>::value>::type;
+
+    template <typename S, typename T, typename = void>
+    struct converts_exactly : std::false_type
+    {
+    };
+
+    template <typename S, typename T>
+    struct converts_exactly<S, T, decltype(void(T{std::declval<S>()}))> : std::true_type
+    {
+    };
+
+    /* Scalars an expression with elements of type T can be scaled by: any arithmetic type for floating point
+    elements, integers that convert without narrowing for the others, so 2.5 * DynMat<int> doesn't compile
+    instead of computing 2 * a
+    */
+    template <typename S, typename T>
+    struct is_scalar_for : std::integral_constant<bool, std::is_arithmetic<S>::value &&
+                                                            (std::is_floating_point<T>::value ||
+                                                             (std::is_integral<S>::value && converts_exactly<S, T>::value))>
+    {
+    };
+
+    template <typename S, typename X>
+    using enable_scalar = typename std::enable_if<is_scalar_for<S, typename Operand<X>::Type::Type>::value>::type;
+
+    // Matrix addition
+    template <typename L, typename R, typename = enable_operand<L>, typename = enable_operand<R>>
+    inline Binary<simd::AddOp, typename Operand<L>::Type, typename Operand<R>::Type> operator+(const L &l, const R &r)
+    {
+        return {Operand<L>::wrap(l), Operand<R>::wrap(r)};
+    }
+
+    // Matrix subtraction
+    template <typename L, typename R, typename = enable_operand<L>, typename = enable_operand<R>>
+    inline Binary<simd::SubOp, typename Operand<L>::Type, typename Operand<R>::Type> operator-(const L &l, const R &r)
+    {
+        return {Operand<L>::wrap(l), Operand<R>::wrap(r)};
+    }
+
+    // Scalar multiplication
+    template <typename S, typename X, typename = enable_operand<X>, typename = enable_scalar<S, X>>
+    inline Scalar<simd::MulOp, typename Operand<X>::Type> operator*(const S factor, const X &x)
+    {
+        auto e = Operand<X>::wrap(x);
+        return {e, static_cast<typename decltype(e)::Type>(factor)};
+    }
+
+    // Scalar division
+    template <typename X, typename S, typename = enable_operand<X>, typename = enable_scalar<S, X>>
+    inline Scalar<simd::DivOp, typename Operand<X>::Type> operator/(const X &x, const S divisor)
+    {
+        auto e = Operand<X>::wrap(x);
+        return {e, static_cast<typename decltype(e)::Type>(divisor)};
+    }
+
+    template <typename X>
+    inline const X &materialize(const X &x, typename std::enable_if<!is_node<X>::value>::type * = nullptr) { return x; }
+
+    template <typename E>
+    inline auto materialize(const E &e, typename std::enable_if<is_node<E>::value>::type * = nullptr) { return e.eval(); }
+
+    // Matrix multiplication with an expression operand, the expression is evaluated first
+    template <typename L, typename R, typename = enable_operand<L>, typename = enable_operand<R>,
+              typename = typename std::enable_if<is_node<L>::value || is_node<R>::value>::type>
+    inline auto operator*(const L &l, const R &r)
+    {
+        return materialize(l) * materialize(r);
+    }
+} // namespace expr
+
+// the operators have to be visible next to Mat (global namespace) and AbstractDynMat (internal)
+using expr::operator+;
+using expr::operator-;
+using expr::operator*;
+using expr::operator/;
+
+namespace internal
+{
+    using expr::operator+;
+    using expr::operator-;
+    using expr::operator*;
+    using expr::operator/;
+} // namespace internal
+
+#endif // EXPR_H
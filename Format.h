@@ -0,0 +1,308 @@
+#if !defined(FORMAT_H)
+#define FORMAT_H
+
+#include <algorithm> // min
+#include <charconv>  // to_chars
+#include <cstring>   // memcpy
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "util.h"
+
+/* Text output of matrices without per element allocations
+
+Elements are formatted with std::to_chars into a 64 KiB buffer that is handed to the destination whenever
+it fills up: an std::ostream, a String or a caller's char buffer. Any matrix works, DynMats of every
+MemBuf (pointer matrices print what they point to), Mats and views, without copying it first:
+    format::write(std::cout, m);                              // shortest round trip form, ' ' and '\n'
+    format::write(file, m.slice(...), format::Options::csv());
+    auto o = format::Options();
+    o.notation = format::Notation::Fixed;
+    o.precision = 3;
+    String s = format::to_string(m, o);
+    size_t n = format::write(buffer, size, m, o);             // snprintf like, returns the length needed
+show() and show_sparse() are format::to_string with the fixed 6 digit notation of std::to_string.
+*/
+
+namespace format
+{
+    enum class Notation
+    {
+        Shortest,   // the fewest digits that read back to the same value
+        Fixed,      // `precision` digits after the point, like printf's %f
+        Scientific, // `precision` digits after the point with an exponent, like %e
+        General,    // `precision` significant digits, like %g
+    };
+
+    struct Options
+    {
+        Notation notation = Notation::Shortest;
+        int precision = 6; // for the notations other than Shortest, at most 100
+        String delimiter = " ";
+        String row_delimiter = "\n";
+        bool trailing_delimiter = false; // a delimiter after the last element of a row, too
+
+        /// Comma separated values, one row per line
+        static Options csv()
+        {
+            auto o = Options();
+            o.delimiter = ",";
+            return o;
+        }
+
+        /// Tab separated values, one row per line
+        static Options tsv()
+        {
+            auto o = Options();
+            o.delimiter = "\t";
+            return o;
+        }
+
+        /// What show() prints, std::to_string's fixed notation with 6 digits and a space after every element
+        static Options show()
+        {
+            auto o = Options();
+            o.notation = Notation::Fixed;
+            o.trailing_delimiter = true;
+            return o;
+        }
+    };
+} // namespace format
+
+namespace internal
+{
+    namespace format
+    {
+        /// Bytes buffered before they're handed to the destination
+        const size_t BUFFER = size_t(1) << 16;
+
+        /// Room reserved for one element, fixed notation of the largest double with 100 digits fits, larger long doubles are written in scientific notation
+        const size_t MAX_ELEMENT = 512;
+
+        /// Buffers output for a destination called as target(data, size)
+        template <typename Target>
+        class Sink
+        {
+        private:
+            Target target_;
+            std::vector<char> buffer_;
+            size_t used_ = 0;
+
+        public:
+            inline explicit Sink(Target target) : target_(target), buffer_(BUFFER) {}
+            inline ~Sink() { flush(); }
+
+            Sink(const Sink &) = delete;
+            Sink &operator=(const Sink &) = delete;
+
+            /// Room for n more bytes, written ones are committed with commit(end)
+            inline char *reserve(size_t n)
+            {
+                if (BUFFER - used_ < n)
+                    flush();
+                return buffer_.data() + used_;
+            }
+
+            inline void commit(char *end) { used_ = end - buffer_.data(); }
+
+            inline void put(const String &s)
+            {
+                for (size_t k = 0; k < s.size();)
+                {
+                    const size_t n = std::min(s.size() - k, BUFFER - used_);
+                    std::memcpy(buffer_.data() + used_, s.data() + k, n);
+                    used_ += n;
+                    k += n;
+                    if (used_ == BUFFER)
+                        flush();
+                }
+            }
+
+            inline void flush()
+            {
+                if (used_ != 0)
+                    target_(buffer_.data(), used_);
+                used_ = 0;
+            }
+        };
+
+        template <typename T>
+        char *element(char *p, char *end, const T &value, const ::format::Options &options)
+        {
+            if constexpr (std::is_pointer<T>::value)
+                return element(p, end, *value, options);
+            else if constexpr (std::is_floating_point<T>::value)
+            {
+                const int precision = std::max(0, std::min(options.precision, 100));
+                std::to_chars_result r;
+                switch (options.notation)
+                {
+                case ::format::Notation::Fixed:
+                    r = std::to_chars(p, end, value, std::chars_format::fixed, precision);
+                    break;
+                case ::format::Notation::Scientific:
+                    r = std::to_chars(p, end, value, std::chars_format::scientific, precision);
+                    break;
+                case ::format::Notation::General:
+                    r = std::to_chars(p, end, value, std::chars_format::general, precision);
+                    break;
+                default:
+                    r = std::to_chars(p, end, value);
+                }
+                // only fixed notation of huge long doubles doesn't fit, scientific always does
+                if (r.ec != std::errc())
+                    r = std::to_chars(p, end, value, std::chars_format::scientific, precision);
+                return r.ptr;
+            }
+            else if constexpr (std::is_same<T, bool>::value)
+            {
+                *p = value ? '1' : '0';
+                return p + 1;
+            }
+            else
+            {
+                static_assert(std::is_integral<T>::value, "Only arithmetic elements can be formatted");
+                return std::to_chars(p, end, value).ptr;
+            }
+        }
+
+        // Shape of a matrix: rows() / cols() of views, ROWS_ / COLS_ of dynamic and ROWS / COLS of static matrices
+        template <size_t N>
+        struct Priority : Priority<N - 1>
+        {
+        };
+        template <>
+        struct Priority<0>
+        {
+        };
+
+        template <typename M>
+        auto rows(const M &m, Priority<2>) -> decltype(m.rows()) { return m.rows(); }
+        template <typename M>
+        auto rows(const M &m, Priority<1>) -> decltype(m.ROWS_) { return m.ROWS_; }
+        template <typename M>
+        size_t rows(const M &, Priority<0>) { return M::ROWS; }
+
+        template <typename M>
+        auto cols(const M &m, Priority<2>) -> decltype(m.cols()) { return m.cols(); }
+        template <typename M>
+        auto cols(const M &m, Priority<1>) -> decltype(m.COLS_) { return m.COLS_; }
+        template <typename M>
+        size_t cols(const M &, Priority<0>) { return M::COLS; }
+
+        template <typename Target, typename M>
+        void write(Sink<Target> &sink, const M &m, const ::format::Options &options)
+        {
+            const size_t r = rows(m, Priority<2>());
+            const size_t c = cols(m, Priority<2>());
+            for (size_t i = 0; i < r; ++i)
+            {
+                for (size_t j = 0; j < c; ++j)
+                {
+                    char *p = sink.reserve(MAX_ELEMENT);
+                    sink.commit(element(p, p + MAX_ELEMENT, m.unchecked(i, j), options));
+                    if (j + 1 < c || options.trailing_delimiter)
+                        sink.put(options.delimiter);
+                }
+                sink.put(options.row_delimiter);
+            }
+        }
+
+        /// (i,j)value for every stored element of a sparse matrix, followed by the delimiter
+        template <typename Target, typename M>
+        void write_sparse(Sink<Target> &sink, const M &m, const ::format::Options &options)
+        {
+            for (auto &&x : m)
+            {
+                const size_t i = x.first / m.COLS_;
+                const size_t j = x.first % m.COLS_;
+                char *p = sink.reserve(MAX_ELEMENT + 48);
+                *p++ = '(';
+                p = std::to_chars(p, p + 20, i).ptr;
+                *p++ = ',';
+                p = std::to_chars(p, p + 20, j).ptr;
+                *p++ = ')';
+                sink.commit(element(p, p + MAX_ELEMENT, x.second, options));
+                sink.put(options.delimiter);
+            }
+        }
+
+        inline auto stream_target(std::ostream &out)
+        {
+            return [&out](const char *data, size_t n) { out.write(data, static_cast<std::streamsize>(n)); };
+        }
+
+        inline auto string_target(String &s)
+        {
+            return [&s](const char *data, size_t n) { s.append(data, n); };
+        }
+
+        /// Copies what fits into [buffer, buffer + size) and counts everything
+        inline auto buffer_target(char *buffer, size_t size, size_t &written)
+        {
+            return [buffer, size, &written](const char *data, size_t n) {
+                if (written < size)
+                    std::memcpy(buffer + written, data, std::min(n, size - written));
+                written += n;
+            };
+        }
+    } // namespace format
+} // namespace internal
+
+namespace format
+{
+    /// Writes m to out, see the top of the file
+    template <typename M>
+    void write(std::ostream &out, const M &m, const Options &options = Options())
+    {
+        auto sink = internal::format::Sink<decltype(internal::format::stream_target(out))>(internal::format::stream_target(out));
+        internal::format::write(sink, m, options);
+    }
+
+    /// Writes at most `size` characters of m to buffer (not null terminated), returns the length of all of it
+    template <typename M>
+    size_t write(char *buffer, size_t size, const M &m, const Options &options = Options())
+    {
+        size_t written = 0;
+        {
+            auto target = internal::format::buffer_target(buffer, size, written);
+            auto sink = internal::format::Sink<decltype(target)>(target);
+            internal::format::write(sink, m, options);
+        }
+        return written;
+    }
+
+    template <typename M>
+    String to_string(const M &m, const Options &options = Options())
+    {
+        auto s = String();
+        {
+            auto sink = internal::format::Sink<decltype(internal::format::string_target(s))>(internal::format::string_target(s));
+            internal::format::write(sink, m, options);
+        }
+        return s;
+    }
+
+    /// Writes the stored elements of a sparse matrix (SparseMat, CsrMat, CscMat) as (i,j)value
+    template <typename M>
+    void write_sparse(std::ostream &out, const M &m, const Options &options = Options())
+    {
+        auto sink = internal::format::Sink<decltype(internal::format::stream_target(out))>(internal::format::stream_target(out));
+        internal::format::write_sparse(sink, m, options);
+    }
+
+    template <typename M>
+    String to_string_sparse(const M &m, const Options &options = Options())
+    {
+        auto s = String();
+        {
+            auto sink = internal::format::Sink<decltype(internal::format::string_target(s))>(internal::format::string_target(s));
+            internal::format::write_sparse(sink, m, options);
+        }
+        return s;
+    }
+} // namespace format
+
+#endif // FORMAT_H
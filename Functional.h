@@ -0,0 +1,147 @@
+#if !defined(FUNCTIONAL_H)
+#define FUNCTIONAL_H
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+#include <utility> // index_sequence
+
+#include "util.h"
+#include "ThreadPool.h"
+
+/* Elementwise kernels for any callable
+
+map, zip_with, apply, reduce and transform_reduce of Mat and DynMat (and map of the views) take lambdas,
+function objects or function pointers. The callable is a template parameter, so it's inlined into a plain loop
+over the contiguous elements, which the compiler can vectorize:
+    auto b = a.map([s](double x) { return s * x + 1.0; });               // capturing lambdas are fine
+    auto c = a.zip_with(b, [](double x, double y) { return x < y ? y : x; });
+    a.apply([](double x) { return x < 0.0 ? 0.0 : x; });                 // in place
+    double sq = a.transform_reduce(0.0, std::plus<>(), [](double x) { return x * x; });
+DynMats split the elements across the threads of a policy (the global one by default), so callables of those
+calls have to be safe to call concurrently. reduce and transform_reduce work like std::reduce: op has to be
+associative and commutative, the elements are folded in lanes<R>() interleaved partial results (so floating point
+sums vectorize), blocks of those pairwise and chunks of the policy left to right, and init is combined exactly once.
+*/
+
+namespace internal
+{
+    namespace functional
+    {
+        /* Independent partial results of a reduction of R, two 64 byte registers of them
+        Fewer than a whole register and GCC vectorizes across iterations with shuffles instead, the second one hides
+        the latency of the additions.
+        */
+        template <typename R>
+        constexpr size_t lanes()
+        {
+            return 128 / sizeof(R) < 4 ? 4 : 128 / sizeof(R) > 32 ? 32 : 128 / sizeof(R);
+        }
+
+        /// out[i] = f(in[i]), out may be in itself (apply) but mustn't overlap it otherwise
+        template <typename T, typename U, typename F>
+        inline void map(const T *in, U *out, size_t n, const F &f)
+        {
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC ivdep
+#endif
+            for (size_t i = 0; i < n; ++i)
+                out[i] = f(in[i]);
+        }
+
+        /// out[i] = f(a[i], b[i]), out may be a or b but mustn't overlap them otherwise
+        template <typename A, typename B, typename U, typename F>
+        inline void zip(const A *a, const B *b, U *out, size_t n, const F &f)
+        {
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC ivdep
+#endif
+            for (size_t i = 0; i < n; ++i)
+                out[i] = f(a[i], b[i]);
+        }
+
+        template <typename R, typename T, typename F, size_t... I>
+        inline std::array<R, sizeof...(I)> first_lanes(const T *x, const F &f, std::index_sequence<I...>)
+        {
+            return {{R(f(x[I]))...}};
+        }
+
+        /// op of f(x[i]) over all i, n has to be at least 1
+        template <typename R, typename T, typename Op, typename F>
+        inline R transform_reduce(const T *x, size_t n, const Op &op, const F &f)
+        {
+            constexpr size_t LANES = lanes<R>();
+            if (n < 2 * LANES)
+            {
+                R acc = f(x[0]);
+                for (size_t i = 1; i < n; ++i)
+                    acc = op(acc, f(x[i]));
+                return acc;
+            }
+            auto lanes = first_lanes<R>(x, f, std::make_index_sequence<LANES>());
+            const size_t whole = n / LANES * LANES;
+            size_t i = LANES;
+            for (; i < whole; i += LANES)
+                for (size_t j = 0; j < LANES; ++j)
+                    lanes[j] = op(lanes[j], f(x[i + j]));
+            for (size_t w = LANES / 2; w > 0; w /= 2)
+                for (size_t j = 0; j < w; ++j)
+                    lanes[j] = op(lanes[j], lanes[j + w]);
+            R acc = lanes[0];
+            for (; i < n; ++i)
+                acc = op(acc, f(x[i]));
+            return acc;
+        }
+
+        // Longer runs are reduced pairwise, in halves down to blocks of at most this many elements
+        const size_t BLOCK = 2048;
+
+        /* transform_reduce() of blocks, combined pairwise, n has to be at least 1
+        The error of a sum grows with BLOCK / lanes + log2(n / BLOCK) instead of n / lanes.
+        */
+        template <typename R, typename T, typename Op, typename F>
+        inline R pairwise(const T *x, size_t n, const Op &op, const F &f)
+        {
+            if (n <= BLOCK)
+                return transform_reduce<R>(x, n, op, f);
+            const size_t half = (n / 2 + BLOCK - 1) / BLOCK * BLOCK;
+            return R(op(pairwise<R>(x, half, op, f), pairwise<R>(x + half, n - half, op, f)));
+        }
+
+        /// map() split across the threads of `policy`
+        template <typename T, typename U, typename F>
+        inline void map(const T *in, U *out, size_t n, const F &f, const parallel::Policy &policy)
+        {
+            parallel::for_chunks(policy, n, MIN_CHUNK, [&](size_t begin, size_t end) {
+                map(in + begin, out + begin, end - begin, f);
+            });
+        }
+
+        /// zip() split across the threads of `policy`
+        template <typename A, typename B, typename U, typename F>
+        inline void zip(const A *a, const B *b, U *out, size_t n, const F &f, const parallel::Policy &policy)
+        {
+            parallel::for_chunks(policy, n, MIN_CHUNK, [&](size_t begin, size_t end) {
+                zip(a + begin, b + begin, out + begin, end - begin, f);
+            });
+        }
+
+        /// init op pairwise() of every chunk, the chunks on the threads of `policy`
+        template <typename R, typename T, typename Op, typename F>
+        inline R transform_reduce(const T *x, size_t n, R init, const Op &op, const F &f, const parallel::Policy &policy)
+        {
+            return parallel::reduce(
+                policy, n, init,
+                [&](size_t begin, size_t end) { return pairwise<R>(x + begin, end - begin, op, f); },
+                [&](const R &acc, const R &partial) { return R(op(acc, partial)); });
+        }
+
+        /// Element type of a map, U unless that's void, then the decayed result of f
+        template <typename U, typename F, typename... Args>
+        using result_t = typename std::conditional<std::is_void<U>::value,
+                                                   typename std::decay<typename std::invoke_result<const F &, const Args &...>::type>::type,
+                                                   U>::type;
+    } // namespace functional
+} // namespace internal
+
+#endif // FUNCTIONAL_H
@@ -0,0 +1,283 @@
+#if !defined(GEMM_H)
+#define GEMM_H
+
+#include <algorithm> // min
+#include <cstddef>   // ptrdiff_t
+#include <memory>
+#include <vector>
+
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Profile.h"
+
+namespace internal
+{
+    namespace gemm
+    {
+        /* Blocking parameters of the packed GEMM below (Goto / BLIS scheme)
+            MR x NR - register tile computed by the micro-kernel
+            KC      - depth of the packed panels, one MR x KC sliver of A and one KC x NR sliver of B stay in L1
+            MC      - rows of the packed block of A, MC x KC is meant to stay in L2
+            NC      - columns of the packed block of B, KC x NC is meant to stay in L3
+        */
+        template <typename T>
+        struct Blocking
+        {
+            static constexpr size_t MR = 4;
+            static constexpr size_t NR = 4;
+            static constexpr size_t KC = 256;
+            static constexpr size_t MC = 128;
+            static constexpr size_t NC = 2048;
+        };
+
+        template <>
+        struct Blocking<double>
+        {
+            static constexpr size_t MR = 6;
+            static constexpr size_t NR = 8;
+            static constexpr size_t KC = 256;
+            static constexpr size_t MC = 96;
+            static constexpr size_t NC = 4096;
+        };
+
+        template <>
+        struct Blocking<float>
+        {
+            static constexpr size_t MR = 6;
+            static constexpr size_t NR = 8;
+            static constexpr size_t KC = 256;
+            static constexpr size_t MC = 96;
+            static constexpr size_t NC = 4096;
+        };
+
+        /* Copies the mc x kc block of A starting at `a` into slivers of MR rows:
+        sliver s holds A(s*MR + i, p) at ap[s*MR*kc + p*MR + i]. Rows past mc are zero padded.
+        */
+        template <typename T, size_t MR>
+        inline void pack_a(size_t mc, size_t kc, const T *a, ptrdiff_t rsa, ptrdiff_t csa, T *ap)
+        {
+            for (size_t ir = 0; ir < mc; ir += MR)
+            {
+                const size_t mr = std::min(MR, mc - ir);
+                for (size_t p = 0; p < kc; ++p)
+                {
+                    const T *col = a + ir * rsa + p * csa;
+                    for (size_t i = 0; i < mr; ++i)
+                        ap[i] = col[i * rsa];
+                    for (size_t i = mr; i < MR; ++i)
+                        ap[i] = T();
+                    ap += MR;
+                }
+            }
+        }
+
+        /* Copies the kc x nc block of B starting at `b` into slivers of NR columns:
+        sliver s holds B(p, s*NR + j) at bp[s*NR*kc + p*NR + j]. Columns past nc are zero padded.
+        */
+        template <typename T, size_t NR>
+        inline void pack_b(size_t kc, size_t nc, const T *b, ptrdiff_t rsb, ptrdiff_t csb, T *bp)
+        {
+            for (size_t jr = 0; jr < nc; jr += NR)
+            {
+                const size_t nr = std::min(NR, nc - jr);
+                for (size_t p = 0; p < kc; ++p)
+                {
+                    const T *row = b + p * rsb + jr * csb;
+                    for (size_t j = 0; j < nr; ++j)
+                        bp[j] = row[j * csb];
+                    for (size_t j = nr; j < NR; ++j)
+                        bp[j] = T();
+                    bp += NR;
+                }
+            }
+        }
+
+        /* ab = a * b for one packed MR x kc sliver of A and one packed kc x NR sliver of B
+        The accumulator tile is small enough to live in registers, the fixed trip counts let the compiler
+        unroll and vectorize the two inner loops.
+        */
+        template <typename T, size_t MR, size_t NR>
+        MATRAC_ALWAYS_INLINE void micro_kernel(size_t kc, const T *__restrict a, const T *__restrict b, T *__restrict ab)
+        {
+            T acc[MR * NR] = {};
+            for (size_t p = 0; p < kc; ++p)
+            {
+                for (size_t i = 0; i < MR; ++i)
+                {
+                    const T a_ip = a[i];
+                    for (size_t j = 0; j < NR; ++j)
+                        acc[i * NR + j] += a_ip * b[j];
+                }
+                a += MR;
+                b += NR;
+            }
+            for (size_t i = 0; i < MR * NR; ++i)
+                ab[i] = acc[i];
+        }
+
+        /// C = alpha * AB + beta * C for the top left mr x nr part of a register tile
+        template <typename T, size_t NR>
+        MATRAC_ALWAYS_INLINE void update_tile(size_t mr, size_t nr, T alpha, const T *ab, T beta, T *c, ptrdiff_t rsc, ptrdiff_t csc)
+        {
+            if (beta == T())
+            {
+                for (size_t i = 0; i < mr; ++i)
+                    for (size_t j = 0; j < nr; ++j)
+                        c[i * rsc + j * csc] = alpha * ab[i * NR + j];
+            }
+            else
+            {
+                for (size_t i = 0; i < mr; ++i)
+                    for (size_t j = 0; j < nr; ++j)
+                        c[i * rsc + j * csc] = alpha * ab[i * NR + j] + beta * c[i * rsc + j * csc];
+            }
+        }
+
+        /// Multiplies a packed mc x kc block of A with a packed kc x nc block of B into C
+        template <typename T>
+        MATRAC_ALWAYS_INLINE void macro_kernel(size_t mc, size_t nc, size_t kc, T alpha, const T *ap, const T *bp,
+                                               T beta, T *c, ptrdiff_t rsc, ptrdiff_t csc)
+        {
+            const size_t MR = Blocking<T>::MR;
+            const size_t NR = Blocking<T>::NR;
+            T ab[MR * NR];
+            for (size_t jr = 0; jr < nc; jr += NR)
+            {
+                const size_t nr = std::min(NR, nc - jr);
+                for (size_t ir = 0; ir < mc; ir += MR)
+                {
+                    const size_t mr = std::min(MR, mc - ir);
+                    micro_kernel<T, MR, NR>(kc, ap + ir * kc, bp + jr * kc, ab);
+                    update_tile<T, NR>(mr, nr, alpha, ab, beta, c + ir * rsc + jr * csc, rsc, csc);
+                }
+            }
+        }
+
+        /* The macro kernel compiled for each instruction set, see Simd.h
+        FMA contraction is welcome here, GEMM doesn't promise results independent of the ISA.
+        */
+        template <typename T>
+        struct MacroKernel
+        {
+            using Fn = void (*)(size_t, size_t, size_t, T, const T *, const T *, T, T *, ptrdiff_t, ptrdiff_t);
+
+            static void scalar(size_t mc, size_t nc, size_t kc, T alpha, const T *ap, const T *bp,
+                               T beta, T *c, ptrdiff_t rsc, ptrdiff_t csc)
+            {
+                macro_kernel<T>(mc, nc, kc, alpha, ap, bp, beta, c, rsc, csc);
+            }
+#if MATRAC_SIMD_X86
+            MATRAC_TARGET("avx2,fma")
+            static void avx2(size_t mc, size_t nc, size_t kc, T alpha, const T *ap, const T *bp,
+                             T beta, T *c, ptrdiff_t rsc, ptrdiff_t csc)
+            {
+                macro_kernel<T>(mc, nc, kc, alpha, ap, bp, beta, c, rsc, csc);
+            }
+
+            MATRAC_TARGET("avx512f")
+            static void avx512(size_t mc, size_t nc, size_t kc, T alpha, const T *ap, const T *bp,
+                               T beta, T *c, ptrdiff_t rsc, ptrdiff_t csc)
+            {
+                macro_kernel<T>(mc, nc, kc, alpha, ap, bp, beta, c, rsc, csc);
+            }
+#endif
+
+            static Fn select(simd::Isa isa)
+            {
+#if MATRAC_SIMD_X86
+                if (isa == simd::Isa::AVX512)
+                    return avx512;
+                if (isa == simd::Isa::AVX2)
+                    return avx2;
+#endif
+                return scalar;
+            }
+        };
+
+        /* C = alpha * A * B + beta * C
+        A is m x k, B is k x n and C is m x n. Every operand is addressed as X[i * rs + j * cs], so row major,
+        column major and transposed operands all work without copies.
+        If beta is zero C is never read, so it may be uninitialized.
+        With a pool in `policy` the tiles of C are spread over its threads, every tile is still computed by a
+        single thread in the same order, so the result doesn't depend on the number of threads.
+        */
+        template <typename T>
+        void gemm(size_t m, size_t n, size_t k, T alpha,
+                  const T *a, ptrdiff_t rsa, ptrdiff_t csa,
+                  const T *b, ptrdiff_t rsb, ptrdiff_t csb,
+                  T beta, T *c, ptrdiff_t rsc, ptrdiff_t csc,
+                  const parallel::Policy &policy = parallel::Policy())
+        {
+            using B = Blocking<T>;
+            if (m == 0 || n == 0)
+                return;
+            const auto scope = ::profile::Scope(::profile::Op::Gemm, m * n, 2 * m * n * k);
+            if (k == 0 || alpha == T())
+            {
+                for (size_t i = 0; i < m; ++i)
+                    for (size_t j = 0; j < n; ++j)
+                        c[i * rsc + j * csc] = beta == T() ? T() : beta * c[i * rsc + j * csc];
+                return;
+            }
+
+            // both buffers are fully overwritten before use, so there's no need to initialize them
+            const size_t kc_max = std::min(B::KC, k);
+            const size_t mc_max = std::min(B::MC, (m + B::MR - 1) / B::MR * B::MR);
+            const size_t nc_max = std::min(B::NC, (n + B::NR - 1) / B::NR * B::NR);
+            std::unique_ptr<T[]> bp(new T[kc_max * nc_max]);
+            const auto kernel = MacroKernel<T>::select(simd::active_isa());
+            const size_t threads = parallel::threads_for(policy, m * n * k, policy.gemm_cutoff);
+            std::unique_ptr<T[]> ap(threads > 1 ? nullptr : new T[mc_max * kc_max]);
+            ::profile::allocated(kc_max * nc_max * sizeof(T));
+            if (threads <= 1)
+                ::profile::allocated(mc_max * kc_max * sizeof(T));
+
+            for (size_t jc = 0; jc < n; jc += B::NC)
+            {
+                const size_t nc = std::min(B::NC, n - jc);
+                for (size_t pc = 0; pc < k; pc += B::KC)
+                {
+                    const size_t kc = std::min(B::KC, k - pc);
+                    // only the first panel of k may scale C, the following ones accumulate onto it
+                    const T beta_pc = pc == 0 ? beta : T(1);
+                    pack_b<T, B::NR>(kc, nc, b + pc * rsb + jc * csb, rsb, csb, bp.get());
+                    if (threads <= 1)
+                    {
+                        for (size_t ic = 0; ic < m; ic += B::MC)
+                        {
+                            const size_t mc = std::min(B::MC, m - ic);
+                            pack_a<T, B::MR>(mc, kc, a + ic * rsa + pc * csa, rsa, csa, ap.get());
+                            kernel(mc, nc, kc, alpha, ap.get(), bp.get(), beta_pc, c + ic * rsc + jc * csc, rsc, csc);
+                        }
+                        continue;
+                    }
+
+                    // tiles are one MC block of rows by a slice of the panel's columns, when there are fewer
+                    // row blocks than threads the columns are split as well, each tile packs its own A block
+                    const size_t row_blocks = (m + B::MC - 1) / B::MC;
+                    const size_t slivers = (nc + B::NR - 1) / B::NR;
+                    const size_t col_slices = std::min(slivers, std::max<size_t>(1, (2 * threads + row_blocks - 1) / row_blocks));
+                    const size_t slice_width = (slivers + col_slices - 1) / col_slices * B::NR;
+                    policy.pool->parallel_for(0, row_blocks * col_slices, 1, [&](size_t begin, size_t end) {
+                        thread_local std::vector<T> ap_local;
+                        ap_local.resize(mc_max * kc_max);
+                        for (size_t t = begin; t < end; ++t)
+                        {
+                            const size_t ic = t / col_slices * B::MC;
+                            const size_t js = t % col_slices * slice_width;
+                            if (js >= nc)
+                                continue;
+                            const size_t mc = std::min(B::MC, m - ic);
+                            const size_t ns = std::min(slice_width, nc - js);
+                            pack_a<T, B::MR>(mc, kc, a + ic * rsa + pc * csa, rsa, csa, ap_local.data());
+                            kernel(mc, ns, kc, alpha, ap_local.data(), bp.get() + js * kc, beta_pc,
+                                   c + ic * rsc + (jc + js) * csc, rsc, csc);
+                        }
+                    });
+                }
+            }
+        }
+    } // namespace gemm
+} // namespace internal
+
+#endif // GEMM_H
@@ -0,0 +1,619 @@
+#if !defined(KRYLOV_H)
+#define KRYLOV_H
+
+#include <algorithm> // copy, fill, min
+#include <cmath>     // abs, sqrt
+#include <cstddef>
+#include <type_traits>
+#include <utility> // move
+#include <vector>
+
+#include "util.h"
+#include "DynMat.h"
+#include "Simd.h"
+#include "Sparse.h"
+#include "ThreadPool.h"
+
+/* Krylov subspace solvers for large sparse systems A x = b: conjugate gradient (symmetric positive definite
+A), BiCGSTAB and restarted GMRES (general A)
+
+A never has to be a matrix. The solvers only apply it to vectors, through krylov::Operator<A>:
+CsrMat / CscMat only touch their nonzeros, dense matrices work too, and anything with
+    using Type = double;
+    size_t size() const;
+    void apply(const double *x, double *y, const parallel::Policy &policy) const;   // y = A x
+is an operator, krylov::function_operator(n, f) wraps a lambda f(x, y). A SparseMat goes through to_csr()
+first. Preconditioners M have the same apply(r, z, policy), meaning z = M^-1 r: krylov::Identity,
+krylov::Jacobi (the inverse diagonal) and krylov::Ilu0 (incomplete LU without fill in, on the pattern of a
+CsrMat). CG is preconditioned the usual way, BiCGSTAB and GMRES from the right, so all of them report and
+test the true residual ||b - A x|| / ||b||.
+
+All vectors of a solve, and the partial sums of its threaded dot products, live in one krylov::Workspace
+that's sized before the first iteration, nothing is allocated while iterating. Keep a Workspace around to
+reuse it across solves. Example:
+    auto a = to_csr(sparse);
+    auto m = krylov::Ilu0<double>(a);
+    auto result = krylov::gmres(a, b, x, m);   // x holds the initial guess and ends up with the solution
+    if (!result.converged) ...                 // result.iterations, result.residual, result.history
+*/
+
+namespace krylov
+{
+    struct Options
+    {
+        double tolerance = 1e-8;      // converged once ||b - A x|| <= tolerance * ||b||
+        size_t max_iterations = 1000; // applications of A for CG / GMRES, half of them for BiCGSTAB
+        size_t restart = 30;          // GMRES only, length of a cycle
+        bool history = true;          // record the relative residual of every iteration
+    };
+
+    struct Result
+    {
+        bool converged = false;
+        size_t iterations = 0;
+        double residual = 0;         // relative residual at the end
+        std::vector<double> history; // relative residual before the first and after every iteration
+    };
+
+    /// Vectors of a solve, grown to the largest solve it's used for and never shrunk
+    template <typename T>
+    class Workspace
+    {
+    private:
+        std::vector<T> raw_;
+        std::vector<T> partials_;
+
+    public:
+        /// At least `size` elements, the contents are left over from earlier solves
+        inline T *reserve(size_t size)
+        {
+            if (raw_.size() < size)
+                raw_.resize(size);
+            return raw_.data();
+        }
+
+        /// Partial results of the threaded dot products (see parallel::reduce), grown by the first ones
+        inline std::vector<T> &partials() { return partials_; }
+    };
+
+    /// How the solvers apply A, see the top of the file
+    template <typename A>
+    struct Operator
+    {
+        using Type = typename A::Type;
+        static size_t size(const A &a) { return a.size(); }
+        static void apply(const A &a, const Type *x, Type *y, const parallel::Policy &policy) { a.apply(x, y, policy); }
+    };
+
+    template <typename T>
+    struct Operator<CsrMat<T>>
+    {
+        using Type = T;
+        static size_t size(const CsrMat<T> &a)
+        {
+            if (a.ROWS_ != a.COLS_)
+                PANIC("Krylov solvers need a square matrix, got: ", a.ROWS_, 'x', a.COLS_);
+            return a.ROWS_;
+        }
+        static void apply(const CsrMat<T> &a, const T *x, T *y, const parallel::Policy &policy)
+        {
+            internal::spmv::gather(a.buffer(), x, 1, y, policy);
+        }
+    };
+
+    template <typename T>
+    struct Operator<CscMat<T>>
+    {
+        using Type = T;
+        static size_t size(const CscMat<T> &a)
+        {
+            if (a.ROWS_ != a.COLS_)
+                PANIC("Krylov solvers need a square matrix, got: ", a.ROWS_, 'x', a.COLS_);
+            return a.ROWS_;
+        }
+        static void apply(const CscMat<T> &a, const T *x, T *y, const parallel::Policy &policy)
+        {
+            std::fill(y, y + a.ROWS_, T());
+            internal::spmv::scatter(a.buffer(), x, 1, y, policy);
+        }
+    };
+
+    /// Dense matrices, one dot product per row
+    template <typename T, template <class> typename MemBuf>
+    struct Operator<internal::AbstractDynMat<T, MemBuf>>
+    {
+        static_assert(is_contiguous<MemBuf<T>>::value, "Use to_csr() to solve with a SparseMat");
+        using Type = T;
+        using M = internal::AbstractDynMat<T, MemBuf>;
+        static size_t size(const M &a)
+        {
+            if (a.ROWS_ != a.COLS_)
+                PANIC("Krylov solvers need a square matrix, got: ", a.ROWS_, 'x', a.COLS_);
+            return a.ROWS_;
+        }
+        static void apply(const M &a, const T *x, T *y, const parallel::Policy &policy)
+        {
+            const size_t n = a.ROWS_;
+            const T *raw = a.as_raw();
+            parallel::for_chunks(policy, n, 16, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i)
+                {
+                    if constexpr (simd::is_vectorizable<T>::value)
+                        y[i] = simd::dot(raw + i * n, x, n);
+                    else
+                    {
+                        T sum = T();
+                        for (size_t j = 0; j < n; ++j)
+                            sum += raw[i * n + j] * x[j];
+                        y[i] = sum;
+                    }
+                }
+            }, n);
+        }
+    };
+
+    /// A matrix free operator of size n, f(x, y) computes y = A x
+    template <typename T, typename F>
+    class FunctionOperator
+    {
+    private:
+        size_t n_;
+        F f_;
+
+    public:
+        using Type = T;
+        inline FunctionOperator(size_t n, F f) : n_(n), f_(std::move(f)) {}
+        inline size_t size() const { return n_; }
+        inline void apply(const T *x, T *y, const parallel::Policy &) const { f_(x, y); }
+    };
+
+    template <typename T, typename F>
+    FunctionOperator<T, F> function_operator(size_t n, F f)
+    {
+        return FunctionOperator<T, F>(n, std::move(f));
+    }
+
+    /// No preconditioning, the solvers fill in the size
+    template <typename T>
+    class Identity
+    {
+    private:
+        size_t n_;
+
+    public:
+        inline explicit Identity(size_t n = 0) : n_(n) {}
+        inline void apply(const T *r, T *z, const parallel::Policy &) const { std::copy(r, r + n_, z); }
+    };
+
+    /// Jacobi preconditioner, z = D^-1 r with the diagonal D of A. PANICs on a zero on the diagonal
+    template <typename T>
+    class Jacobi
+    {
+    private:
+        std::vector<T> inverse_;
+
+    public:
+        inline explicit Jacobi(const CsrMat<T> &a) : inverse_(a.ROWS_)
+        {
+            for (size_t i = 0; i < a.ROWS_; ++i)
+            {
+                T d = T();
+                for (auto &&e : a.buffer().row(i))
+                    if (e.first == i)
+                        d = e.second;
+                if (d == T())
+                    PANIC("Jacobi preconditioner needs a nonzero diagonal, row: ", i);
+                inverse_[i] = T(1) / d;
+            }
+        }
+
+        inline void apply(const T *r, T *z, const parallel::Policy &policy) const
+        {
+            const T *d = inverse_.data();
+            parallel::for_chunks(policy, inverse_.size(), internal::MIN_CHUNK, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i)
+                    z[i] = d[i] * r[i];
+            });
+        }
+    };
+
+    /* Incomplete LU factorization without fill in, L U ~ A with L and U restricted to the nonzeros of A
+    Stored in one CSR with A's pattern, L below the diagonal (unit diagonal not stored) and U on and above
+    it. Applying it is a forward and a backward substitution, which are sequential, so it runs on one thread.
+    PANICs if a pivot is zero or A doesn't store its whole diagonal.
+    */
+    template <typename T>
+    class Ilu0
+    {
+    private:
+        std::vector<size_t> ptr_;
+        std::vector<size_t> cols_;
+        std::vector<T> values_;
+        std::vector<size_t> diagonal_; // position of (i, i) in values_
+
+    public:
+        inline explicit Ilu0(const CsrMat<T> &a)
+            : ptr_(a.buffer().pointers()), cols_(a.buffer().indices()), values_(a.buffer().values()), diagonal_(a.ROWS_)
+        {
+            const size_t n = a.ROWS_;
+            if (n != a.COLS_)
+                PANIC("ILU(0) needs a square matrix, got: ", n, 'x', a.COLS_);
+            for (size_t i = 0; i < n; ++i)
+            {
+                const auto first = cols_.begin() + ptr_[i];
+                const auto last = cols_.begin() + ptr_[i + 1];
+                const auto d = std::lower_bound(first, last, i);
+                if (d == last || *d != i)
+                    PANIC("ILU(0) needs every diagonal element stored, missing row: ", i);
+                diagonal_[i] = d - cols_.begin();
+            }
+            // IKJ elimination, where[j] is the position of (i, j) in the current row or NONE
+            const size_t NONE = size_t(-1);
+            auto where = std::vector<size_t>(n, NONE);
+            for (size_t i = 0; i < n; ++i)
+            {
+                for (size_t p = ptr_[i]; p < ptr_[i + 1]; ++p)
+                    where[cols_[p]] = p;
+                for (size_t p = ptr_[i]; p < diagonal_[i]; ++p)
+                {
+                    const size_t k = cols_[p];
+                    const T pivot = values_[diagonal_[k]];
+                    if (pivot == T())
+                        PANIC("ILU(0) hit a zero pivot in row: ", k);
+                    const T l = values_[p] /= pivot;
+                    for (size_t q = diagonal_[k] + 1; q < ptr_[k + 1]; ++q)
+                        if (where[cols_[q]] != NONE)
+                            values_[where[cols_[q]]] -= l * values_[q];
+                }
+                if (values_[diagonal_[i]] == T())
+                    PANIC("ILU(0) hit a zero pivot in row: ", i);
+                for (size_t p = ptr_[i]; p < ptr_[i + 1]; ++p)
+                    where[cols_[p]] = NONE;
+            }
+        }
+
+        inline void apply(const T *r, T *z, const parallel::Policy &) const
+        {
+            const size_t n = diagonal_.size();
+            for (size_t i = 0; i < n; ++i)
+            {
+                T sum = r[i];
+                for (size_t p = ptr_[i]; p < diagonal_[i]; ++p)
+                    sum -= values_[p] * z[cols_[p]];
+                z[i] = sum;
+            }
+            for (size_t i = n; i-- > 0;)
+            {
+                T sum = z[i];
+                for (size_t p = diagonal_[i] + 1; p < ptr_[i + 1]; ++p)
+                    sum -= values_[p] * z[cols_[p]];
+                z[i] = sum / values_[diagonal_[i]];
+            }
+        }
+    };
+} // namespace krylov
+
+namespace internal
+{
+    namespace krylov
+    {
+        template <typename T>
+        T dot(const T *a, const T *b, size_t n, const parallel::Policy &policy, std::vector<T> &partials)
+        {
+            return parallel::reduce(
+                policy, n, T(),
+                [&](size_t begin, size_t end) {
+                    if constexpr (simd::is_vectorizable<T>::value)
+                        return simd::dot(a + begin, b + begin, end - begin);
+                    else
+                    {
+                        T sum = T();
+                        for (size_t i = begin; i < end; ++i)
+                            sum += a[i] * b[i];
+                        return sum;
+                    }
+                },
+                [](T acc, T partial) { return acc + partial; }, partials);
+        }
+
+        template <typename T>
+        double norm(const T *a, size_t n, const parallel::Policy &policy, std::vector<T> &partials)
+        {
+            return std::sqrt(static_cast<double>(dot(a, a, n, policy, partials)));
+        }
+
+        /// Calls f(i) for every i < n, split across the threads of `policy`
+        template <typename F>
+        void each(size_t n, const parallel::Policy &policy, const F &f)
+        {
+            parallel::for_chunks(policy, n, MIN_CHUNK, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i)
+                    f(i);
+            });
+        }
+
+        /// r = b - A x, returns ||b|| with b = 0 counting as 1, so residuals relative to it stay finite
+        template <typename A, typename T>
+        double residual(const A &a, const T *b, const T *x, T *r, size_t n, const parallel::Policy &policy,
+                        std::vector<T> &partials)
+        {
+            ::krylov::Operator<A>::apply(a, x, r, policy);
+            each(n, policy, [&](size_t i) { r[i] = b[i] - r[i]; });
+            const double nb = norm(b, n, policy, partials);
+            return nb == 0 ? 1 : nb;
+        }
+
+        /// Appends to the history if it's recorded, true once the relative residual is small enough
+        inline bool record(::krylov::Result &result, const ::krylov::Options &options, double relative)
+        {
+            result.residual = relative;
+            if (options.history)
+                result.history.push_back(relative);
+            result.converged = relative <= options.tolerance;
+            return result.converged;
+        }
+
+        inline ::krylov::Result start(const ::krylov::Options &options)
+        {
+            auto result = ::krylov::Result();
+            if (options.history)
+                result.history.reserve(options.max_iterations + 1);
+            return result;
+        }
+
+        /// The Identity preconditioner needs the size, the others know it
+        template <typename M>
+        const M &sized(const M &m, size_t) { return m; }
+
+        template <typename T>
+        ::krylov::Identity<T> sized(const ::krylov::Identity<T> &, size_t n) { return ::krylov::Identity<T>(n); }
+
+        /// PANICs unless v is a vector of n elements
+        template <typename T, template <class> typename MemBuf>
+        void check_vector(const AbstractDynMat<T, MemBuf> &v, size_t n, const char *name)
+        {
+            static_assert(is_contiguous<MemBuf<T>>::value, "Krylov solvers need dense vectors");
+            if (v.SIZE != n || (v.ROWS_ != 1 && v.COLS_ != 1))
+                PANIC("Incompatible matrix dimensions: ", n, 'x', n, " system with ", name, ": ", v.ROWS_, 'x', v.COLS_);
+        }
+    } // namespace krylov
+} // namespace internal
+
+namespace krylov
+{
+    /* Preconditioned conjugate gradient for symmetric positive definite A (and M), x holds the initial guess
+    and is overwritten with the solution. Uses 4 vectors of workspace.
+    */
+    template <typename A, typename M, typename T = typename Operator<A>::Type>
+    Result cg(const A &a, const T *b, T *x, const M &m, const Options &options, Workspace<T> &workspace,
+              const parallel::Policy &policy = parallel::global_policy())
+    {
+        using namespace internal::krylov;
+        const size_t n = Operator<A>::size(a);
+        const auto &pre = sized(m, n);
+        auto &partials = workspace.partials();
+        T *r = workspace.reserve(4 * n);
+        T *z = r + n, *p = z + n, *q = p + n;
+        auto result = start(options);
+        const double nb = residual(a, b, x, r, n, policy, partials);
+        if (record(result, options, norm(r, n, policy, partials) / nb))
+            return result;
+        pre.apply(r, z, policy);
+        std::copy(z, z + n, p);
+        T rz = dot(r, z, n, policy, partials);
+        while (result.iterations < options.max_iterations)
+        {
+            Operator<A>::apply(a, p, q, policy);
+            const T alpha = rz / dot(p, q, n, policy, partials);
+            each(n, policy, [&](size_t i) {
+                x[i] += alpha * p[i];
+                r[i] -= alpha * q[i];
+            });
+            ++result.iterations;
+            if (record(result, options, norm(r, n, policy, partials) / nb))
+                break;
+            pre.apply(r, z, policy);
+            const T rz_next = dot(r, z, n, policy, partials);
+            const T beta = rz_next / rz;
+            rz = rz_next;
+            each(n, policy, [&](size_t i) { p[i] = z[i] + beta * p[i]; });
+        }
+        return result;
+    }
+
+    /* BiCGSTAB with right preconditioning for general A, uses 8 vectors of workspace
+    Stops without converging if the method breaks down (rho or omega become zero).
+    */
+    template <typename A, typename M, typename T = typename Operator<A>::Type>
+    Result bicgstab(const A &a, const T *b, T *x, const M &m, const Options &options, Workspace<T> &workspace,
+                    const parallel::Policy &policy = parallel::global_policy())
+    {
+        using namespace internal::krylov;
+        const size_t n = Operator<A>::size(a);
+        const auto &pre = sized(m, n);
+        auto &partials = workspace.partials();
+        T *r = workspace.reserve(8 * n);
+        T *r0 = r + n, *p = r0 + n, *v = p + n, *ph = v + n, *s = ph + n, *sh = s + n, *t = sh + n;
+        auto result = start(options);
+        const double nb = residual(a, b, x, r, n, policy, partials);
+        if (record(result, options, norm(r, n, policy, partials) / nb))
+            return result;
+        std::copy(r, r + n, r0);
+        std::fill(p, p + n, T());
+        std::fill(v, v + n, T());
+        T rho = 1, alpha = 1, omega = 1;
+        // every iteration applies A twice
+        while (result.iterations + 2 <= options.max_iterations)
+        {
+            const T rho_next = dot(r0, r, n, policy, partials);
+            if (rho_next == T())
+                break;
+            const T beta = rho_next / rho * (alpha / omega);
+            rho = rho_next;
+            each(n, policy, [&](size_t i) { p[i] = r[i] + beta * (p[i] - omega * v[i]); });
+            pre.apply(p, ph, policy);
+            Operator<A>::apply(a, ph, v, policy);
+            alpha = rho / dot(r0, v, n, policy, partials);
+            each(n, policy, [&](size_t i) { s[i] = r[i] - alpha * v[i]; });
+            result.iterations += 2;
+            const double ns = norm(s, n, policy, partials) / nb;
+            if (ns <= options.tolerance)
+            {
+                each(n, policy, [&](size_t i) { x[i] += alpha * ph[i]; });
+                record(result, options, ns);
+                break;
+            }
+            pre.apply(s, sh, policy);
+            Operator<A>::apply(a, sh, t, policy);
+            omega = dot(t, s, n, policy, partials) / dot(t, t, n, policy, partials);
+            each(n, policy, [&](size_t i) {
+                x[i] += alpha * ph[i] + omega * sh[i];
+                r[i] = s[i] - omega * t[i];
+            });
+            if (record(result, options, norm(r, n, policy, partials) / nb) || omega == T())
+                break;
+        }
+        return result;
+    }
+
+    /* Restarted GMRES(options.restart) with right preconditioning for general A
+    Arnoldi with modified Gram-Schmidt, the least squares problem is kept triangular with Givens rotations,
+    so the residual of every iteration is known without forming x. Uses restart + 3 vectors of workspace
+    and (restart + 1) * (restart + 4) scalars besides.
+    */
+    template <typename A, typename M, typename T = typename Operator<A>::Type>
+    Result gmres(const A &a, const T *b, T *x, const M &m, const Options &options, Workspace<T> &workspace,
+                 const parallel::Policy &policy = parallel::global_policy())
+    {
+        using namespace internal::krylov;
+        const size_t n = Operator<A>::size(a);
+        const size_t k = std::max<size_t>(options.restart, 1);
+        const auto &pre = sized(m, n);
+        auto &partials = workspace.partials();
+        // basis, a vector for M^-1 v_j, the residual, then the Hessenberg matrix, rotations and right hand side
+        T *v = workspace.reserve((k + 3) * n + (k + 1) * (k + 4));
+        T *z = v + (k + 1) * n, *r = z + n;
+        T *h = r + n, *c = h + (k + 1) * k, *sn = c + (k + 1), *g = sn + (k + 1), *y = g + (k + 1);
+        auto result = start(options);
+        const double nb = residual(a, b, x, r, n, policy, partials);
+        double beta = norm(r, n, policy, partials);
+        if (record(result, options, beta / nb))
+            return result;
+        while (result.iterations < options.max_iterations)
+        {
+            each(n, policy, [&](size_t i) { v[i] = r[i] / T(beta); });
+            std::fill(g, g + k + 1, T());
+            g[0] = T(beta);
+            size_t j = 0;
+            bool done = false;
+            for (; j < k && result.iterations < options.max_iterations; ++j)
+            {
+                T *w = v + (j + 1) * n;
+                pre.apply(v + j * n, z, policy);
+                Operator<A>::apply(a, z, w, policy);
+                for (size_t i = 0; i <= j; ++i)
+                {
+                    const T hij = dot(w, v + i * n, n, policy, partials);
+                    h[i * k + j] = hij;
+                    const T *vi = v + i * n;
+                    each(n, policy, [&](size_t e) { w[e] -= hij * vi[e]; });
+                }
+                const T hn = T(norm(w, n, policy, partials));
+                h[(j + 1) * k + j] = hn;
+                if (hn != T())
+                    each(n, policy, [&](size_t e) { w[e] /= hn; });
+                // the earlier rotations, then one that zeroes h(j + 1, j)
+                for (size_t i = 0; i < j; ++i)
+                {
+                    const T h0 = h[i * k + j], h1 = h[(i + 1) * k + j];
+                    h[i * k + j] = c[i] * h0 + sn[i] * h1;
+                    h[(i + 1) * k + j] = -sn[i] * h0 + c[i] * h1;
+                }
+                const T h0 = h[j * k + j];
+                const T d = std::sqrt(h0 * h0 + hn * hn);
+                c[j] = d == T() ? T(1) : h0 / d;
+                sn[j] = d == T() ? T() : hn / d;
+                h[j * k + j] = d;
+                h[(j + 1) * k + j] = T();
+                g[j + 1] = -sn[j] * g[j];
+                g[j] = c[j] * g[j];
+                ++result.iterations;
+                // a zero hn means the Krylov space is invariant and the solution exact
+                if (record(result, options, std::abs(static_cast<double>(g[j + 1])) / nb) || hn == T())
+                {
+                    ++j;
+                    done = true;
+                    break;
+                }
+            }
+            // x += M^-1 V y with the triangular H y = g
+            for (size_t i = j; i-- > 0;)
+            {
+                T sum = g[i];
+                for (size_t l = i + 1; l < j; ++l)
+                    sum -= h[i * k + l] * y[l];
+                y[i] = sum / h[i * k + i];
+            }
+            each(n, policy, [&](size_t e) {
+                T sum = T();
+                for (size_t i = 0; i < j; ++i)
+                    sum += y[i] * v[i * n + e];
+                r[e] = sum;
+            });
+            pre.apply(r, z, policy);
+            each(n, policy, [&](size_t e) { x[e] += z[e]; });
+            if (done || result.iterations >= options.max_iterations)
+                break;
+            // restart from the true residual, which can drift from the rotated estimate
+            residual(a, b, x, r, n, policy, partials);
+            beta = norm(r, n, policy, partials);
+            result.residual = beta / nb;
+            if (options.history)
+                result.history.back() = result.residual;
+            result.converged = result.residual <= options.tolerance;
+            if (result.converged)
+                break;
+        }
+        return result;
+    }
+
+    // The same on vectors stored in dense matrices (n x 1 or 1 x n), with a workspace of their own
+
+    template <typename A, typename T, template <class> typename BufB, template <class> typename BufX,
+              typename M = Identity<T>>
+    Result cg(const A &a, const internal::AbstractDynMat<T, BufB> &b, internal::AbstractDynMat<T, BufX> &x,
+              const M &m = M(), const Options &options = Options(), const parallel::Policy &policy = parallel::global_policy())
+    {
+        const size_t n = Operator<A>::size(a);
+        internal::krylov::check_vector(b, n, "b");
+        internal::krylov::check_vector(x, n, "x");
+        auto workspace = Workspace<T>();
+        return cg(a, b.as_raw(), x.as_raw_mut(), m, options, workspace, policy);
+    }
+
+    template <typename A, typename T, template <class> typename BufB, template <class> typename BufX,
+              typename M = Identity<T>>
+    Result bicgstab(const A &a, const internal::AbstractDynMat<T, BufB> &b, internal::AbstractDynMat<T, BufX> &x,
+                    const M &m = M(), const Options &options = Options(), const parallel::Policy &policy = parallel::global_policy())
+    {
+        const size_t n = Operator<A>::size(a);
+        internal::krylov::check_vector(b, n, "b");
+        internal::krylov::check_vector(x, n, "x");
+        auto workspace = Workspace<T>();
+        return bicgstab(a, b.as_raw(), x.as_raw_mut(), m, options, workspace, policy);
+    }
+
+    template <typename A, typename T, template <class> typename BufB, template <class> typename BufX,
+              typename M = Identity<T>>
+    Result gmres(const A &a, const internal::AbstractDynMat<T, BufB> &b, internal::AbstractDynMat<T, BufX> &x,
+                 const M &m = M(), const Options &options = Options(), const parallel::Policy &policy = parallel::global_policy())
+    {
+        const size_t n = Operator<A>::size(a);
+        internal::krylov::check_vector(b, n, "b");
+        internal::krylov::check_vector(x, n, "x");
+        auto workspace = Workspace<T>();
+        return gmres(a, b.as_raw(), x.as_raw_mut(), m, options, workspace, policy);
+    }
+} // namespace krylov
+
+#endif // KRYLOV_H
@@ -0,0 +1,215 @@
+#if !defined(LU_H)
+#define LU_H
+
+#include <algorithm> // copy, min, swap_ranges
+#include <cmath>     // abs
+#include <cstddef>
+#include <type_traits>
+#include <utility> // move
+#include <vector>
+
+#include "util.h"
+#include "DynMat.h"
+#include "Gemm.h"
+#include "ThreadPool.h"
+#include "Triangular.h"
+
+/* LU factorization with partial pivoting, P A = L U, and the solves, determinants and inverses built on it
+
+The factorization is blocked and right looking: a panel of BLOCK columns is factored with plain row
+operations, the rows to its right are solved against the panel's unit lower triangle and the trailing
+matrix is updated with a single GEMM call, which is where almost all of the 2/3 n^3 flops go. Rows are
+swapped across the whole matrix as soon as their pivot is found, so L and U end up packed in one DynMat
+the way LAPACK's getrf leaves them.
+
+Factorize once and solve many times:
+    auto f = Lu<double>(a);            // O(n^3), a can be moved in to factor in its storage
+    auto x = f.solve(b);               // O(n^2 m) for an n x m right hand side
+    f.solve_in_place(y);               // same without allocating
+    double d = f.determinant();
+solve(a, b), determinant(a) and inverse(a) factor and throw the factorization away.
+*/
+
+namespace internal
+{
+    namespace lu
+    {
+        /// Columns per panel
+        const size_t BLOCK = 64;
+
+        /* Factors columns [j0, j0 + nb) of the n x n row major matrix at a, rows j0 and below, pivots are
+        recorded in piv. Returns false if one of the pivots is zero, the columns after it are still factored.
+        */
+        template <typename T>
+        bool panel(T *a, size_t n, size_t j0, size_t nb, size_t *piv)
+        {
+            bool regular = true;
+            for (size_t j = j0; j < j0 + nb; ++j)
+            {
+                // the largest element on or below the diagonal becomes the pivot
+                size_t p = j;
+                T best = std::abs(a[j * n + j]);
+                for (size_t i = j + 1; i < n; ++i)
+                    if (std::abs(a[i * n + j]) > best)
+                    {
+                        best = std::abs(a[i * n + j]);
+                        p = i;
+                    }
+                piv[j] = p;
+                if (p != j)
+                    std::swap_ranges(a + j * n, a + j * n + n, a + p * n);
+                if (best == T())
+                {
+                    regular = false;
+                    continue;
+                }
+                const T inv = T(1) / a[j * n + j];
+                const T *uj = a + j * n + j + 1;
+                for (size_t i = j + 1; i < n; ++i)
+                {
+                    T *ai = a + i * n;
+                    ai[j] *= inv;
+                    if (ai[j] != T())
+                        triangular::axpy(ai + j + 1, ai[j], uj, j0 + nb - j - 1);
+                }
+            }
+            return regular;
+        }
+
+        /// Factors the n x n row major matrix at a in place, see the top of the file. Returns false if it's singular
+        template <typename T>
+        bool factorize(T *a, size_t n, size_t *piv, const parallel::Policy &policy)
+        {
+            bool regular = true;
+            for (size_t j = 0; j < n; j += BLOCK)
+            {
+                const size_t nb = std::min(BLOCK, n - j);
+                regular = panel(a, n, j, nb, piv) && regular;
+                const size_t rest = n - j - nb;
+                if (rest == 0)
+                    break;
+                // U12 = L11^-1 A12, then A22 -= L21 U12
+                triangular::solve_lower(nb, rest, a + j * n + j, n, 1, true, a + j * n + j + nb, n, policy);
+                gemm::gemm<T>(rest, rest, nb, T(-1), a + (j + nb) * n + j, n, 1, a + j * n + j + nb, n, 1,
+                              T(1), a + (j + nb) * n + j + nb, n, 1, policy);
+            }
+            return regular;
+        }
+    } // namespace lu
+} // namespace internal
+
+/// LU factorization of a square floating point matrix, see the top of the file
+template <typename T>
+class Lu
+{
+private:
+    static_assert(std::is_floating_point<T>::value, "LU factorization needs a floating point type");
+
+    DynMat<T> lu_;            // L below the diagonal (its unit diagonal isn't stored), U on and above it
+    std::vector<size_t> piv_; // row i was swapped with row piv_[i] in step i
+    bool regular_;
+
+public:
+    /// Factors a, pass it as an rvalue to factor in its storage instead of a copy
+    inline explicit Lu(DynMat<T> a, const parallel::Policy &policy = parallel::global_policy())
+        : lu_(std::move(a)), piv_(lu_.ROWS_)
+    {
+        if (lu_.ROWS_ != lu_.COLS_)
+            PANIC("LU factorization needs a square matrix, got: ", lu_.ROWS_, 'x', lu_.COLS_);
+        regular_ = internal::lu::factorize(lu_.as_raw_mut(), lu_.ROWS_, piv_.data(), policy);
+    }
+
+    /// Factors any dense matrix (AlignedMat, ...) through a copy
+    template <template <class> typename MemBuf, typename = typename std::enable_if<is_contiguous<MemBuf<T>>::value>::type>
+    inline explicit Lu(const internal::AbstractDynMat<T, MemBuf> &a, const parallel::Policy &policy = parallel::global_policy())
+        : Lu(copy(a), policy) {}
+
+    inline size_t size() const { return lu_.ROWS_; }
+
+    /// False if U has a zero on its diagonal, the matrix is singular then and solve() / inverse() PANIC
+    inline bool regular() const { return regular_; }
+
+    /// L and U packed into one matrix, L's unit diagonal isn't stored
+    inline const DynMat<T> &factors() const { return lu_; }
+
+    /// Row swaps of the factorization, row i was swapped with row pivots()[i] in step i
+    inline const std::vector<size_t> &pivots() const { return piv_; }
+
+    /// b = A^-1 b for an n x m matrix b of right hand sides, without allocating
+    template <template <class> typename MemBuf>
+    void solve_in_place(internal::AbstractDynMat<T, MemBuf> &b, const parallel::Policy &policy = parallel::global_policy()) const
+    {
+        static_assert(is_contiguous<MemBuf<T>>::value, "Right hand sides need contiguous storage");
+        const size_t n = size();
+        if (b.ROWS_ != n)
+            PANIC("Incompatible matrix dimensions: ", n, 'x', n, " \\ ", b.ROWS_, 'x', b.COLS_);
+        if (!regular_)
+            PANIC("Matrix is singular");
+        const size_t m = b.COLS_;
+        T *x = b.as_raw_mut();
+        for (size_t i = 0; i < n; ++i)
+            if (piv_[i] != i)
+                std::swap_ranges(x + i * m, x + i * m + m, x + piv_[i] * m);
+        internal::triangular::solve_lower(n, m, lu_.as_raw(), n, 1, true, x, m, policy);
+        internal::triangular::solve_upper(n, m, lu_.as_raw(), n, 1, false, x, m, policy);
+    }
+
+    /// A^-1 b for an n x m matrix b of right hand sides
+    template <template <class> typename MemBuf>
+    internal::AbstractDynMat<T, MemBuf> solve(const internal::AbstractDynMat<T, MemBuf> &b,
+                                              const parallel::Policy &policy = parallel::global_policy()) const
+    {
+        auto x = b;
+        solve_in_place(x, policy);
+        return x;
+    }
+
+    inline T determinant() const
+    {
+        T det = T(1);
+        for (size_t i = 0; i < size(); ++i)
+            det *= piv_[i] == i ? lu_.as_raw()[i * size() + i] : -lu_.as_raw()[i * size() + i];
+        return det;
+    }
+
+    /// A^-1, PANICs if the matrix is singular
+    inline DynMat<T> inverse(const parallel::Policy &policy = parallel::global_policy()) const
+    {
+        auto x = DynMat<T>::identity(size(), size());
+        solve_in_place(x, policy);
+        return x;
+    }
+
+private:
+    template <template <class> typename MemBuf>
+    static DynMat<T> copy(const internal::AbstractDynMat<T, MemBuf> &a)
+    {
+        auto d = DynMat<T>(a.ROWS_, a.COLS_);
+        std::copy(a.as_raw(), a.as_raw() + a.SIZE, d.as_raw_mut());
+        return d;
+    }
+};
+
+/// A^-1 b, factors a for this one solve, keep an Lu around to solve with the same matrix again
+template <typename T, template <class> typename MemBuf, template <class> typename MemBufB>
+internal::AbstractDynMat<T, MemBufB> solve(const internal::AbstractDynMat<T, MemBuf> &a, const internal::AbstractDynMat<T, MemBufB> &b,
+                                           const parallel::Policy &policy = parallel::global_policy())
+{
+    return Lu<T>(a, policy).solve(b, policy);
+}
+
+/// Determinant of a square dense matrix through its LU factorization
+template <typename T, template <class> typename MemBuf>
+T determinant(const internal::AbstractDynMat<T, MemBuf> &a, const parallel::Policy &policy = parallel::global_policy())
+{
+    return Lu<T>(a, policy).determinant();
+}
+
+/// Inverse of a square dense matrix, PANICs if it's singular
+template <typename T, template <class> typename MemBuf>
+DynMat<T> inverse(const internal::AbstractDynMat<T, MemBuf> &a, const parallel::Policy &policy = parallel::global_policy())
+{
+    return Lu<T>(a, policy).inverse(policy);
+}
+
+#endif // LU_H
@@ -1,6 +1,7 @@
 #if !defined(MATRIX_H)
 #define MATRIX_H
 
+#include <algorithm> // min
 #include <memory>
 #include <iostream>
 #include <cstdarg> //va_start, va_end
@@ -8,7 +9,15 @@
 #include <cmath>
 
 #include "util.h"
+#include "Format.h"
 #include "Range.h"
+#include "Simd.h"
+#include "Accumulate.h"
+#include "Functional.h"
+#include "Expr.h"
+#include "View.h"
+#include "Transpose.h"
+#include "Small.h"
 
 template <typename T, size_t _ROWS, size_t _COLS>
 class Mat
@@ -34,6 +43,20 @@ public:
         va_end(vl);
     }
 
+    // Evaluates an elementwise expression (see Expr.h), e.g. Mat4x4 m = a + 2.0 * b;
+    template <typename E, typename = typename std::enable_if<expr::is_node<E>::value>::type>
+    inline Mat(const E &e) : raw_()
+    {
+        expr::assign(*this, e);
+    }
+
+    template <typename E>
+    inline typename std::enable_if<expr::is_node<E>::value, Mat &>::type operator=(const E &e)
+    {
+        expr::assign(*this, e);
+        return *this;
+    }
+
     inline T * as_raw_mut() {
         return raw_;
     }
@@ -45,76 +68,124 @@ public:
     static Mat identity()
     {
         auto m = Mat();
-        for (auto &&i : Range(COLS))
+        for (auto &&i : Range(std::min(ROWS, COLS)))
         {
-            m(i, i) = 1;
+            m.unchecked(i, i) = 1;
         }
         return m;
     }
 
-    inline Mat transpose()
+    inline Mat<T, COLS, ROWS> transpose() const
     {
-        auto m1 = *this;
-        auto m2 = Mat();
-        for (auto &&i : Range(ROWS))
-            for (auto &&j : Range(COLS))
-                m2(j, i) = m1(i, j);
+        auto m2 = Mat<T, COLS, ROWS>();
+        // small matrices aren't worth the dispatch
+        if constexpr (ROWS == COLS && internal::small::is_small<T, ROWS>::value)
+            internal::small::transpose<T, ROWS>(raw_, m2.as_raw_mut());
+        else if constexpr (SIZE < 64)
+            internal::transpose::tile_scalar(raw_, COLS, m2.as_raw_mut(), ROWS, ROWS, COLS);
+        else
+            internal::transpose::transpose(raw_, ROWS, COLS, COLS, m2.as_raw_mut(), ROWS);
         return m2;
     };
 
-    inline T &operator()(size_t i, size_t j)
+    /// Transposes a square matrix without a copy
+    template <size_t R = ROWS>
+    inline typename std::enable_if<R == COLS>::type transpose_in_place()
     {
-        if (i >= ROWS)
-            PANIC("Invalid Matrix index, tried to access row: ", i);
-        if (j >= COLS)
-            PANIC("Invalid Matrix index, tried to access column: ", j);
-        return raw_[j + i * COLS];
+        if constexpr (internal::small::is_small<T, ROWS>::value)
+            internal::small::transpose<T, ROWS>(raw_, raw_);
+        else
+            internal::transpose::square_in_place(raw_, ROWS);
+    }
+
+    /// Determinant, written out for 2x2 to 4x4 float / double matrices (see Small.h), by elimination otherwise
+    template <size_t R = ROWS, typename S = T>
+    inline typename std::enable_if<R == COLS && std::is_floating_point<S>::value, T>::type determinant() const
+    {
+        if constexpr (internal::small::is_small<T, ROWS>::value)
+            return internal::small::determinant<T, ROWS>(raw_);
+        else
+            return internal::small::generic_determinant(raw_, ROWS);
+    }
+
+    /// Inverse, PANICs if the matrix is singular
+    template <size_t R = ROWS, typename S = T>
+    inline typename std::enable_if<R == COLS && std::is_floating_point<S>::value, Mat>::type inverse() const
+    {
+        auto m = Mat();
+        if constexpr (internal::small::is_small<T, ROWS>::value)
+            internal::small::inverse<T, ROWS>(raw_, m.raw_);
+        else
+            internal::small::generic_inverse(raw_, m.raw_, ROWS);
+        return m;
     }
 
-    template <size_t START_ROW, size_t STOP_ROW, size_t START_COL, size_t STOP_COL, size_t STEP_ROW = 1, size_t STEP_COL = 1, typename S = T>
-    typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value,
-                            Mat<T *, (STOP_ROW - START_ROW + 1) / STEP_ROW, (STOP_COL - START_COL + 1) / STEP_COL>>::type
-    slice()
+    inline T &operator()(size_t i, size_t j)
     {
-        auto m = Mat<T *, (STOP_ROW - START_ROW + 1) / STEP_ROW, (STOP_COL - START_COL + 1) / STEP_COL>();
-        size_t i_m = 0;
-        for (auto &&i : Range(START_ROW, STOP_ROW + 1, STEP_ROW))
+        if constexpr (BOUNDS_CHECKED)
         {
-            size_t j_m = 0;
-            for (auto &&j : Range(START_COL, STOP_COL + 1, STEP_COL))
-            {
-                m(i_m, j_m) = &this->operator()(i, j);
-                j_m += 1;
-            }
-            i_m += 1;
+            if (i >= ROWS)
+                PANIC("Invalid Matrix index, tried to access row: ", i);
+            if (j >= COLS)
+                PANIC("Invalid Matrix index, tried to access column: ", j);
         }
-        return m;
+        return raw_[j + i * COLS];
+    }
+
+    /// View of the whole matrix, see View.h
+    inline MatView<T, ROWS, COLS> view() { return MatView<T, ROWS, COLS>(raw_, COLS, 1); }
+    inline MatView<const T, ROWS, COLS> view() const { return MatView<const T, ROWS, COLS>(raw_, COLS, 1); }
+
+    /// View of rows START_ROW, START_ROW + STEP_ROW, ... up to and including STOP_ROW, same for the columns
+    template <size_t START_ROW, size_t STOP_ROW, size_t START_COL, size_t STOP_COL, size_t STEP_ROW = 1, size_t STEP_COL = 1>
+    inline MatView<T, (STOP_ROW - START_ROW) / STEP_ROW + 1, (STOP_COL - START_COL) / STEP_COL + 1> slice()
+    {
+        return view().template slice<START_ROW, STOP_ROW, START_COL, STOP_COL, STEP_ROW, STEP_COL>();
+    }
+
+    template <size_t START_ROW, size_t STOP_ROW, size_t START_COL, size_t STOP_COL, size_t STEP_ROW = 1, size_t STEP_COL = 1>
+    inline MatView<const T, (STOP_ROW - START_ROW) / STEP_ROW + 1, (STOP_COL - START_COL) / STEP_COL + 1> slice() const
+    {
+        return view().template slice<START_ROW, STOP_ROW, START_COL, STOP_COL, STEP_ROW, STEP_COL>();
     }
 
     inline T
     operator()(size_t i, size_t j) const
     {
-        if (i >= ROWS)
-            PANIC("Invalid Matrix index, tried to access row: ", i);
-        if (j >= COLS)
-            PANIC("Invalid Matrix index, tried to access column: ", j);
+        if constexpr (BOUNDS_CHECKED)
+        {
+            if (i >= ROWS)
+                PANIC("Invalid Matrix index, tried to access row: ", i);
+            if (j >= COLS)
+                PANIC("Invalid Matrix index, tried to access column: ", j);
+        }
         return raw_[j + i * COLS];
     }
 
     inline T &operator[](size_t i)
     {
-        if (i >= SIZE)
-            PANIC("Invalid Matrix index, tried to access index: ", i);
+        if constexpr (BOUNDS_CHECKED)
+        {
+            if (i >= SIZE)
+                PANIC("Invalid Matrix index, tried to access index: ", i);
+        }
         return raw_[i];
     }
 
     inline T operator[](size_t i) const
     {
-        if (i >= SIZE)
-            PANIC("Invalid Matrix index, tried to access index: ", i);
+        if constexpr (BOUNDS_CHECKED)
+        {
+            if (i >= SIZE)
+                PANIC("Invalid Matrix index, tried to access index: ", i);
+        }
         return raw_[i];
     }
 
+    /// Element (i, j) without bounds checking in any build mode, for loops that stay within the shape
+    inline T &unchecked(size_t i, size_t j) { return raw_[j + i * COLS]; }
+    inline T unchecked(size_t i, size_t j) const { return raw_[j + i * COLS]; }
+
     /// Indices of elements in column `column`
     inline static Range column_indices(size_t column)
     {
@@ -138,7 +209,7 @@ public:
         auto i = 0;
         for (auto &&idx : this->column_indices(column))
         {
-            m[i] = (*this)[idx];
+            m.as_raw_mut()[i] = raw_[idx];
             i++;
         }
         return m;
@@ -150,58 +221,50 @@ public:
         auto i = 0;
         for (auto &&idx : this->row_indices(row))
         {
-            m[i] = (*this)[idx];
+            m.as_raw_mut()[i] = raw_[idx];
             i++;
         }
         return m;
     }
 
-    // Matrix addition
-    template <typename S = T>
-    inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value,
-                                   Mat<T, ROWS, COLS>>::type
-    operator+(const Mat<T, ROWS, COLS> &other) const
+    /// New matrix of f(x) for every element x, f is any callable and U defaults to its result (see Functional.h)
+    template <typename U = void, typename F>
+    Mat<internal::functional::result_t<U, F, T>, ROWS, COLS> map(const F &f) const
     {
-        auto m3 = Mat<T, ROWS, COLS>();
-        for (auto &&i : Range(ROWS))
-        {
-            for (auto &&j : Range(COLS))
-            {
-                m3(i, j) = (*this)(i, j) + other(i, j);
-            }
-        }
-        return m3;
+        auto m = Mat<internal::functional::result_t<U, F, T>, ROWS, COLS>();
+        internal::functional::map(raw_, m.as_raw_mut(), SIZE, f);
+        return m;
     }
 
-    // Matrix subtraction
-    template <typename S = T>
-    inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value,
-                                   Mat<T, ROWS, COLS>>::type
-    operator-(const Mat<T, ROWS, COLS> &other) const
+    /// New matrix of f(x, y) for the elements x of this and y of other at the same position
+    template <typename U = void, typename F, typename S>
+    Mat<internal::functional::result_t<U, F, T, S>, ROWS, COLS> zip_with(const Mat<S, ROWS, COLS> &other, const F &f) const
     {
-        auto m3 = Mat<T, ROWS, COLS>();
-        for (auto &&i : Range(ROWS))
-        {
-            for (auto &&j : Range(COLS))
-            {
-                m3(i, j) = (*this)(i, j) - other(i, j);
-            }
-        }
-        return m3;
+        auto m = Mat<internal::functional::result_t<U, F, T, S>, ROWS, COLS>();
+        internal::functional::zip(raw_, other.as_raw(), m.as_raw_mut(), SIZE, f);
+        return m;
     }
 
-    template <typename U>
-    Mat<U, ROWS, COLS> map(U f(T)) const
+    /// Replaces every element x by f(x)
+    template <typename F>
+    Mat<T, ROWS, COLS> &apply(const F &f)
     {
-        auto m = Mat<U, ROWS, COLS>();
-        for (auto &&i : Range(ROWS))
-        {
-            for (auto &&j : Range(COLS))
-            {
-                m(i, j) = f((*this)(i, j));
-            }
-        }
-        return m;
+        internal::functional::map(raw_, raw_, SIZE, f);
+        return *this;
+    }
+
+    /// init combined with all elements by op, which has to be associative and commutative (see Functional.h)
+    template <typename R, typename Op>
+    R reduce(R init, const Op &op) const
+    {
+        return transform_reduce(init, op, [](const T &x) { return x; });
+    }
+
+    /// init combined with f(x) of all elements x by op, which has to be associative and commutative
+    template <typename R, typename Op, typename F>
+    R transform_reduce(R init, const Op &op, const F &f) const
+    {
+        return op(init, internal::functional::pairwise<R>(raw_, SIZE, op, f));
     }
 
     template <typename S = T, typename Ptr = to_raw_pointer<S>>
@@ -212,33 +275,14 @@ public:
         return this->map<typename Ptr::Element>([](T x) { return *x; });
     }
 
-    template <typename S = T>
-    typename std::enable_if<std::is_pointer<typename to_raw_pointer<S>::Raw>::value, String>::type show() const
-    {
-        auto s = String();
-        for (auto &&i : Range(ROWS))
-        {
-            for (auto &&j : Range(COLS))
-                s.append(std::to_string(*((*this)(i, j))) + " ");
-            s.append("\n");
-        }
-        s.pop_back();
-        return s;
-    };
-
-    template <typename S = T>
-    typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value, String>::type show() const
+    // Elements in std::to_string's notation, a space after each and rows on separate lines (see Format.h for more control)
+    inline String show() const
     {
-        auto s = String();
-        for (auto &&i : Range(ROWS))
-        {
-            for (auto &&j : Range(COLS))
-                s.append(std::to_string((*this)(i, j)) + " ");
-            s.append("\n");
-        }
-        s.pop_back();
+        auto s = format::to_string(*this, format::Options::show());
+        if (!s.empty())
+            s.pop_back();
         return s;
-    };
+    }
 
     // compound matrix multiplication with static matrix no pointer
     template <typename S = T>
@@ -254,6 +298,11 @@ public:
     typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value, Mat<T, ROWS, COLS> &>::type
     operator/=(const T &other) 
     {
+        if constexpr (simd::is_vectorizable<T>::value)
+        {
+            simd::divide(raw_, other, raw_, SIZE);
+            return *this;
+        }
         for (auto &&i : Range(SIZE))
         {
             this->raw_[i] /= other;
@@ -267,7 +316,7 @@ public:
     {
         for (auto &&i : Range(SIZE))
         {
-            *(this->raw_[i]) = other[i];
+            *(this->raw_[i]) = other.as_raw()[i];
         }
         return *this;
     }
@@ -283,63 +332,19 @@ public:
         return *this;
     }
 
-    // Frobenius norm
-    template <typename S = T>
-    inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value, T>::type
+    // Frobenius norm, the square root of the sum of the squared elements, accumulated under Acc (see Accumulate.h)
+    template <typename Acc = accumulate::Native, typename S = T>
+    inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<S>::Raw>::value, accumulate::result_t<Acc, S>>::type
     frobenius_norm() const
     {
-        auto sum = 0;
-        for (auto &&i : Range(ROWS))
-        {
-            for (auto &&j : Range(COLS))
-            {
-                sum += (*this)(i, j);
-            }
-        }
-        return sqrt(sum);
-    }    
+        using R = accumulate::result_t<Acc, S>;
+        return static_cast<R>(std::sqrt(accumulate::dot<Acc>(as_raw(), as_raw(), SIZE)));
+    }
 
     inline auto begin() const { return raw_; }
     inline auto end() const { return raw_; }
 };
 
-// Scalar multiplication
-template <typename T, size_t ROWS, size_t COLS>
-inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<T>::Raw>::value,
-                               Mat<T, ROWS, COLS>>::type
-operator*(const T factor, const Mat<T, ROWS, COLS> &mat)
-{
-    return mat.map([&factor](T x) { return factor * x; });
-    /*
-    auto m3 = Mat<T, ROWS, COLS>();
-    for (auto &&i : Range(ROWS))
-    {
-        for (auto &&j : Range(COLS))
-        {
-            m3(i, j) = factor * mat(i, j);
-        }
-    }
-    return m3;
-    */
-}
-
-// Scalar division
-template <typename T, size_t ROWS, size_t COLS>
-inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<T>::Raw>::value,
-                               Mat<T, ROWS, COLS>>::type
-operator/(const Mat<T, ROWS, COLS> &mat, const T divisor)
-{
-    auto m3 = Mat<T, ROWS, COLS>();
-    for (auto &&i : Range(ROWS))
-    {
-        for (auto &&j : Range(COLS))
-        {
-            m3(i, j) = mat(i, j) / divisor;
-        }
-    }
-    return m3;
-}
-
 // Matrix multiplication
 template <typename T, size_t ROWS, size_t COLS, size_t COLS2>
 inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<T>::Raw>::value,
@@ -347,35 +352,44 @@ inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<T>::Raw>
 operator*(const Mat<T, ROWS, COLS> &self, const Mat<T, COLS, COLS2> &other)
 {
     auto m3 = Mat<T, ROWS, COLS2>();
+    // products of transforms, up to 4x4 times 4x4, are unrolled, see Small.h
+    if constexpr (internal::small::is_small<T, COLS2>::value && ROWS <= 4 && COLS <= 4)
+    {
+        internal::small::multiply<T, ROWS, COLS, COLS2>(self.as_raw(), other.as_raw(), m3.as_raw_mut());
+        return m3;
+    }
     for (auto &&i : Range(ROWS))
     {
-        auto j = 0;
         for (auto &&j : Range(COLS2))
         {
-            auto sum = 0.0;
+            T sum = T();
             for (auto &&k : Range(COLS))
             {
-                sum += self(static_cast<size_t>(i), static_cast<size_t>(k)) *
-                       other(static_cast<size_t>(k), static_cast<size_t>(j));
+                sum += self.unchecked(static_cast<size_t>(i), static_cast<size_t>(k)) *
+                       other.unchecked(static_cast<size_t>(k), static_cast<size_t>(j));
             }
-            m3(i, j) = sum;
+            m3.unchecked(i, j) = sum;
         }
     }
     return m3;
 }
 
+// Dot product with the accumulation picked by Acc, e.g. dot<accumulate::Compensated>(x, y), see Accumulate.h
+template <typename Acc = accumulate::Native, typename T, size_t VEC_LENGTH>
+inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<T>::Raw>::value,
+                               accumulate::result_t<Acc, T>>::type
+dot(const Mat<T, 1, VEC_LENGTH> &self, const Mat<T, VEC_LENGTH, 1> &other)
+{
+    return accumulate::dot<Acc>(self.as_raw(), other.as_raw(), VEC_LENGTH);
+}
+
 // Dot product
 template <typename T, size_t VEC_LENGTH>
 inline typename std::enable_if<!std::is_pointer<typename to_raw_pointer<T>::Raw>::value,
                                T>::type
 operator*(const Mat<T, 1, VEC_LENGTH> &self, const Mat<T, VEC_LENGTH, 1> &other)
 {
-    auto scal_prod = 0.0;
-    for (auto &&i : Range(VEC_LENGTH))
-    {
-        scal_prod += self[static_cast<size_t>(i)] * other[static_cast<size_t>(i)];
-    }
-    return scal_prod;
+    return dot(self, other);
 }
 
 using Mat4x4 = Mat<double, 4, 4>;
@@ -0,0 +1,643 @@
+#if !defined(MATRIX_MARKET_H)
+#define MATRIX_MARKET_H
+
+#include <algorithm> // find, min, upper_bound
+#include <cctype>    // tolower
+#include <charconv>  // from_chars, to_chars
+#include <cstdint>
+#include <cstdlib> // abort
+#include <cstring> // memmove
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "util.h"
+#include "DynMat.h"
+#include "Sparse.h"
+#include "ThreadPool.h"
+
+/* Matrix Market (.mtx) reading and writing
+
+Files are read CHUNK bytes at a time, cut at the last complete line, and every chunk is split into pieces
+at line boundaries that are parsed with std::from_chars on the threads of the policy, so the text never
+has to fit in memory and large files parse at a multiple of the single thread speed. Coordinate files go
+straight into a TripletBuilder, one batch per piece, array files straight into the DynMat.
+    auto a = matrix_market::read_csr<double>("a.mtx");      // also read_csc, read_sparse
+    auto d = matrix_market::read_dense<double>("d.mtx");    // array files, coordinate ones are scattered
+    matrix_market::write("out.mtx", a);                     // CsrMat, CscMat, SparseMat, dense matrices
+Coordinate and array formats with real, integer and pattern (every entry is 1) fields are supported, as
+are general, symmetric, skew-symmetric and (for real fields) hermitian files, whose mirrored half is filled
+in on reading. Complex files are rejected, as are entries with anything but blanks after their last field
+(a fraction in an integer file, a fourth field). Duplicate coordinate entries are summed.
+
+Writing formats blocks of entries on the threads of the policy with std::to_chars (the shortest form that
+reads back to the same value) and streams them to the file in order, sparse matrices as coordinate files,
+dense ones as array files in the format's column major order. Matrix Market indices are 1 based.
+*/
+
+namespace matrix_market
+{
+    enum class Format
+    {
+        Coordinate,
+        Array,
+    };
+
+    enum class Field
+    {
+        Real,
+        Integer,
+        Pattern,
+    };
+
+    enum class Symmetry
+    {
+        General,
+        Symmetric,
+        SkewSymmetric,
+    };
+
+    /// What the banner and size line of a file say
+    struct Info
+    {
+        Format format;
+        Field field;
+        Symmetry symmetry;
+        size_t rows;
+        size_t cols;
+        size_t entries; // lines of data in the file, the mirrored half of symmetric files isn't counted
+    };
+} // namespace matrix_market
+
+namespace internal
+{
+    namespace matrix_market
+    {
+        using ::matrix_market::Field;
+        using ::matrix_market::Format;
+        using ::matrix_market::Info;
+        using ::matrix_market::Symmetry;
+
+        /// Bytes of text read and parsed per round
+        const size_t CHUNK = size_t(1) << 24;
+
+        /// Entries formatted per piece and round when writing
+        const size_t WRITE_BLOCK = size_t(1) << 14;
+
+        /// Upper bound on the characters of one formatted entry, two indices and a value
+        const size_t MAX_ENTRY = 96;
+
+        inline std::string lower(std::string s)
+        {
+            for (auto &&c : s)
+                c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            return s;
+        }
+
+        /// Reads the banner, comments and size line, `in` is left at the first line of data
+        inline Info header(std::istream &in, const std::string &path)
+        {
+            auto line = std::string();
+            if (!std::getline(in, line))
+                PANIC("Empty Matrix Market file: ", path);
+            auto banner = std::istringstream(line);
+            std::string tag, object, format, field, symmetry;
+            banner >> tag >> object >> format >> field >> symmetry;
+            if (tag != "%%MatrixMarket" || lower(object) != "matrix")
+                PANIC("Not a Matrix Market matrix file: ", path);
+            auto info = Info();
+            format = lower(format);
+            field = lower(field);
+            symmetry = lower(symmetry);
+            if (format == "coordinate")
+                info.format = Format::Coordinate;
+            else if (format == "array")
+                info.format = Format::Array;
+            else
+                PANIC("Unknown Matrix Market format '", format, "': ", path);
+            if (field == "real" || field == "double")
+                info.field = Field::Real;
+            else if (field == "integer")
+                info.field = Field::Integer;
+            else if (field == "pattern" && info.format == Format::Coordinate)
+                info.field = Field::Pattern;
+            else
+                PANIC("Unsupported Matrix Market field '", field, "': ", path);
+            if (symmetry == "general")
+                info.symmetry = Symmetry::General;
+            else if (symmetry == "symmetric" || symmetry == "hermitian")
+                info.symmetry = Symmetry::Symmetric;
+            else if (symmetry == "skew-symmetric")
+                info.symmetry = Symmetry::SkewSymmetric;
+            else
+                PANIC("Unknown Matrix Market symmetry '", symmetry, "': ", path);
+
+            while (std::getline(in, line))
+                if (line.find_first_not_of(" \t\r") != std::string::npos && line[line.find_first_not_of(" \t")] != '%')
+                    break;
+            auto size = std::istringstream(line);
+            size >> info.rows >> info.cols;
+            if (info.format == Format::Coordinate)
+                size >> info.entries;
+            else if (info.symmetry == Symmetry::General)
+                info.entries = info.rows * info.cols;
+            else
+                info.entries = info.symmetry == Symmetry::Symmetric ? info.rows * (info.rows + 1) / 2 : info.rows * (info.rows - 1) / 2;
+            if (!size)
+                PANIC("Malformed Matrix Market size line '", line, "': ", path);
+            if (info.symmetry != Symmetry::General && info.rows != info.cols)
+                PANIC("Symmetric Matrix Market file of a non square ", info.rows, 'x', info.cols, " matrix: ", path);
+            return info;
+        }
+
+        /// Hands out the data of a stream in chunks of complete lines, a line may be longer than CHUNK
+        class Chunks
+        {
+        private:
+            std::istream &in_;
+            std::vector<char> buffer_;
+            size_t filled_ = 0; // bytes in buffer_, the last `rest_` of them start the next chunk
+            size_t rest_ = 0;
+
+        public:
+            inline explicit Chunks(std::istream &in) : in_(in), buffer_(CHUNK) {}
+
+            /// The next chunk in [begin, end), false at the end of the stream
+            inline bool next(const char *&begin, const char *&end)
+            {
+                std::memmove(buffer_.data(), buffer_.data() + filled_ - rest_, rest_);
+                filled_ = rest_;
+                for (;;)
+                {
+                    in_.read(buffer_.data() + filled_, static_cast<std::streamsize>(buffer_.size() - filled_));
+                    filled_ += static_cast<size_t>(in_.gcount());
+                    const bool last = filled_ < buffer_.size();
+                    // everything up to the last newline, or all of it at the end of the stream
+                    size_t cut = filled_;
+                    while (!last && cut > 0 && buffer_[cut - 1] != '\n')
+                        --cut;
+                    if (cut > 0 || last)
+                    {
+                        rest_ = filled_ - cut;
+                        begin = buffer_.data();
+                        end = begin + cut;
+                        return cut > 0;
+                    }
+                    buffer_.resize(2 * buffer_.size());
+                }
+            }
+        };
+
+        /// Splits [begin, end) into up to `pieces` ranges of whole lines, boundaries[p] to boundaries[p + 1]
+        inline void split(const char *begin, const char *end, size_t pieces, std::vector<const char *> &boundaries)
+        {
+            boundaries.assign(1, begin);
+            const size_t bytes = end - begin;
+            for (size_t p = 1; p < pieces; ++p)
+            {
+                const char *at = std::max(boundaries.back(), begin + bytes * p / pieces);
+                at = std::find(at, end, '\n');
+                boundaries.push_back(at == end ? end : at + 1);
+            }
+            boundaries.push_back(end);
+        }
+
+        /// Calls f(p, begin, end) for the pieces of a chunk, on the threads of the policy
+        template <typename F>
+        void pieces(const char *begin, const char *end, std::vector<const char *> &boundaries,
+                    const parallel::Policy &policy, const F &f)
+        {
+            const size_t bytes = end - begin;
+            const size_t pieces = 4 * parallel::threads_for(policy, bytes, policy.serial_cutoff);
+            split(begin, end, pieces, boundaries);
+            parallel::for_chunks(policy, boundaries.size() - 1, 1, [&](size_t p0, size_t p1) {
+                for (size_t p = p0; p < p1; ++p)
+                    f(p, boundaries[p], boundaries[p + 1]);
+            }, bytes / pieces);
+        }
+
+        inline void skip_blanks(const char *&p, const char *end)
+        {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+                ++p;
+        }
+
+        /// Moves p to the start of the next line that holds data, false if there is none before end
+        inline bool next_entry(const char *&p, const char *end)
+        {
+            for (;;)
+            {
+                skip_blanks(p, end);
+                if (p == end)
+                    return false;
+                if (*p == '\n')
+                    ++p;
+                else if (*p == '%')
+                    p = std::find(p, end, '\n');
+                else
+                    return true;
+            }
+        }
+
+        [[noreturn]] inline void malformed(const char *p, const char *end)
+        {
+            const char *line_end = std::find(p, end, '\n');
+            PANIC("Malformed Matrix Market entry: '", std::string(p, line_end), "'");
+            std::abort();
+        }
+
+        inline size_t parse_index(const char *&p, const char *end, const char *line)
+        {
+            skip_blanks(p, end);
+            size_t i = 0;
+            const auto r = std::from_chars(p, end, i);
+            if (r.ec != std::errc() || i == 0)
+                malformed(line, end);
+            p = r.ptr;
+            return i - 1;
+        }
+
+        template <typename T>
+        T parse_value(const char *&p, const char *end, Field field, const char *line)
+        {
+            if (field == Field::Pattern)
+                return T(1);
+            skip_blanks(p, end);
+            if (p < end && *p == '+')
+                ++p;
+            std::from_chars_result r;
+            T value;
+            if (field == Field::Integer)
+            {
+                int64_t v = 0;
+                r = std::from_chars(p, end, v);
+                value = static_cast<T>(v);
+            }
+            else
+            {
+                double v = 0;
+                r = std::from_chars(p, end, v);
+                value = static_cast<T>(v);
+            }
+            if (r.ec != std::errc())
+                malformed(line, end);
+            p = r.ptr;
+            return value;
+        }
+
+        /// Moves p past the blanks after the last field of an entry, to its newline, anything else is malformed
+        inline void end_entry(const char *&p, const char *end, const char *line)
+        {
+            skip_blanks(p, end);
+            if (p < end && *p != '\n')
+                malformed(line, end);
+        }
+
+        /// Number of data lines in [p, end)
+        inline size_t count_entries(const char *p, const char *end)
+        {
+            size_t n = 0;
+            while (next_entry(p, end))
+            {
+                ++n;
+                p = std::find(p, end, '\n');
+            }
+            return n;
+        }
+
+        /// Feeds the entries of a coordinate file into `builder`, mirrored entries of symmetric files included
+        template <typename T>
+        void read_coordinate(std::istream &in, const Info &info, TripletBuilder<T> &builder, const parallel::Policy &policy)
+        {
+            using Triplet = typename TripletBuilder<T>::Triplet;
+            auto chunks = Chunks(in);
+            auto boundaries = std::vector<const char *>();
+            auto counts = std::vector<size_t>();
+            size_t entries = 0;
+            const char *begin, *end;
+            while (chunks.next(begin, end))
+            {
+                counts.assign(4 * parallel::threads_for(policy, end - begin, policy.serial_cutoff) + 1, 0);
+                pieces(begin, end, boundaries, policy, [&](size_t piece, const char *p, const char *last) {
+                    auto batch = std::vector<Triplet>();
+                    batch.reserve((last - p) / 8);
+                    while (next_entry(p, last))
+                    {
+                        const char *line = p;
+                        const size_t i = parse_index(p, last, line);
+                        const size_t j = parse_index(p, last, line);
+                        const T v = parse_value<T>(p, last, info.field, line);
+                        if (i >= info.rows || j >= info.cols)
+                            PANIC("Invalid Matrix index, entry (", i + 1, ", ", j + 1, ") of a ", info.rows, 'x', info.cols, " matrix");
+                        batch.push_back(Triplet{i, j, v});
+                        if (info.symmetry != Symmetry::General && i != j)
+                            batch.push_back(Triplet{j, i, info.symmetry == Symmetry::Symmetric ? v : T() - v});
+                        ++counts[piece];
+                        end_entry(p, last, line);
+                    }
+                    builder.add(std::move(batch));
+                });
+                for (auto &&c : counts)
+                    entries += c;
+            }
+            if (entries != info.entries)
+                PANIC("Matrix Market file has ", entries, " entries, its size line says ", info.entries);
+        }
+
+        /* Walks the positions of an array file in its column major order, the lower triangle of symmetric
+        files, the strict lower triangle of skew-symmetric ones
+        */
+        struct Cursor
+        {
+            size_t i;
+            size_t j;
+            size_t rows;
+            size_t skip; // rows above the diagonal a column starts at, 0 for general files
+
+            inline Cursor(const Info &info, size_t k) : i(0), j(0), rows(info.rows), skip(0)
+            {
+                if (info.symmetry == Symmetry::General)
+                {
+                    i = rows == 0 ? 0 : k % rows;
+                    j = rows == 0 ? 0 : k / rows;
+                    skip = size_t(-1);
+                    return;
+                }
+                skip = info.symmetry == Symmetry::Symmetric ? 0 : 1;
+                while (j < rows && k >= rows - j - skip)
+                {
+                    k -= rows - j - skip;
+                    ++j;
+                }
+                i = j + skip + k;
+            }
+
+            inline void advance()
+            {
+                if (++i < rows)
+                    return;
+                ++j;
+                i = skip == size_t(-1) ? 0 : j + skip;
+            }
+        };
+
+        /// Reads the values of an array file into the row major n x m buffer at out
+        template <typename T>
+        void read_array(std::istream &in, const Info &info, T *out, const parallel::Policy &policy)
+        {
+            auto chunks = Chunks(in);
+            auto boundaries = std::vector<const char *>();
+            auto offsets = std::vector<size_t>();
+            size_t entries = 0;
+            const size_t cols = info.cols;
+            const char *begin, *end;
+            while (chunks.next(begin, end))
+            {
+                // where every piece starts in the file's order, then the values
+                const size_t pieces = 4 * parallel::threads_for(policy, end - begin, policy.serial_cutoff);
+                split(begin, end, pieces, boundaries);
+                offsets.assign(boundaries.size(), 0);
+                parallel::for_chunks(policy, boundaries.size() - 1, 1, [&](size_t p0, size_t p1) {
+                    for (size_t p = p0; p < p1; ++p)
+                        offsets[p + 1] = count_entries(boundaries[p], boundaries[p + 1]);
+                }, (end - begin) / pieces);
+                offsets[0] = entries;
+                for (size_t p = 1; p < offsets.size(); ++p)
+                    offsets[p] += offsets[p - 1];
+                if (offsets.back() > info.entries)
+                    PANIC("Matrix Market file has more than the ", info.entries, " entries its size line says");
+                parallel::for_chunks(policy, boundaries.size() - 1, 1, [&](size_t p0, size_t p1) {
+                    for (size_t p = p0; p < p1; ++p)
+                    {
+                        const char *at = boundaries[p];
+                        const char *last = boundaries[p + 1];
+                        auto c = Cursor(info, offsets[p]);
+                        while (next_entry(at, last))
+                        {
+                            const char *line = at;
+                            const T v = parse_value<T>(at, last, info.field, line);
+                            out[c.i * cols + c.j] = v;
+                            if (info.symmetry != Symmetry::General)
+                                out[c.j * cols + c.i] = info.symmetry == Symmetry::Symmetric ? v : T() - v;
+                            c.advance();
+                            end_entry(at, last, line);
+                        }
+                    }
+                }, (end - begin) / pieces);
+                entries = offsets.back();
+            }
+            if (entries != info.entries)
+                PANIC("Matrix Market file has ", entries, " entries, its size line says ", info.entries);
+        }
+
+        inline void open(std::ifstream &in, const std::string &path)
+        {
+            in.open(path, std::ios::binary);
+            if (!in)
+                PANIC("Failed to open ", path);
+        }
+
+        template <typename T>
+        char *format_value(char *p, T value)
+        {
+            return std::to_chars(p, p + MAX_ENTRY / 2, value).ptr;
+        }
+
+        inline char *format_index(char *p, size_t i)
+        {
+            return std::to_chars(p, p + 24, i + 1).ptr;
+        }
+
+        template <typename T>
+        const char *field_name()
+        {
+            return std::is_integral<T>::value ? "integer" : "real";
+        }
+
+        /* Writes n entries, format(begin, end, out) formats entries [begin, end) into out and returns the end
+        of what it wrote, at most MAX_ENTRY characters per entry. Blocks of entries are formatted in parallel
+        and written in order.
+        */
+        template <typename F>
+        void write_entries(std::ostream &out, size_t n, const parallel::Policy &policy, const F &format)
+        {
+            const size_t pieces = parallel::threads_for(policy, n, policy.serial_cutoff);
+            auto buffers = std::vector<std::vector<char>>(pieces, std::vector<char>(WRITE_BLOCK * MAX_ENTRY));
+            auto ends = std::vector<char *>(pieces);
+            for (size_t round = 0; round < n; round += pieces * WRITE_BLOCK)
+            {
+                parallel::for_chunks(policy, pieces, 1, [&](size_t p0, size_t p1) {
+                    for (size_t p = p0; p < p1; ++p)
+                    {
+                        const size_t begin = std::min(n, round + p * WRITE_BLOCK);
+                        ends[p] = format(begin, std::min(n, begin + WRITE_BLOCK), buffers[p].data());
+                    }
+                }, policy.serial_cutoff);
+                for (size_t p = 0; p < pieces; ++p)
+                    out.write(buffers[p].data(), ends[p] - buffers[p].data());
+            }
+            if (!out)
+                PANIC("Failed to write Matrix Market entries");
+        }
+
+        template <typename T, bool ROW_MAJOR>
+        void write_compressed(std::ostream &out, const CompressedBuffer<T, ROW_MAJOR> &buffer, size_t rows, size_t cols,
+                              const parallel::Policy &policy)
+        {
+            out << "%%MatrixMarket matrix coordinate " << field_name<T>() << " general\n"
+                << rows << ' ' << cols << ' ' << buffer.nnz() << '\n';
+            const auto &ptr = buffer.pointers();
+            const size_t *minor = buffer.indices().data();
+            const T *values = buffer.values().data();
+            write_entries(out, buffer.nnz(), policy, [&](size_t begin, size_t end, char *p) {
+                size_t major = std::upper_bound(ptr.begin(), ptr.end(), begin) - ptr.begin() - 1;
+                for (size_t k = begin; k < end; ++k)
+                {
+                    while (ptr[major + 1] <= k)
+                        ++major;
+                    p = format_index(p, ROW_MAJOR ? major : minor[k]);
+                    *p++ = ' ';
+                    p = format_index(p, ROW_MAJOR ? minor[k] : major);
+                    *p++ = ' ';
+                    p = format_value(p, values[k]);
+                    *p++ = '\n';
+                }
+                return p;
+            });
+        }
+
+        template <template <class> typename Buf, typename T>
+        AbstractDynMat<T, Buf> read_compressed(const std::string &path, const parallel::Policy &policy)
+        {
+            auto in = std::ifstream();
+            open(in, path);
+            const auto info = header(in, path);
+            if (info.format == Format::Array)
+            {
+                auto d = DynMat<T>(info.rows, info.cols);
+                read_array(in, info, d.as_raw_mut(), policy);
+                if constexpr (std::is_same<Buf<T>, CsrBuffer<T>>::value)
+                    return to_csr(d);
+                else
+                    return to_csc(d);
+            }
+            auto builder = TripletBuilder<T>(info.rows, info.cols, Duplicates::Sum);
+            read_coordinate(in, info, builder, policy);
+            return builder.template finalize<Buf>(policy);
+        }
+    } // namespace matrix_market
+} // namespace internal
+
+namespace matrix_market
+{
+    /// Banner and size line of a file
+    inline Info info(const std::string &path)
+    {
+        auto in = std::ifstream();
+        internal::matrix_market::open(in, path);
+        return internal::matrix_market::header(in, path);
+    }
+
+    /// Reads a coordinate file (or an array file, keeping its nonzeros) as a CsrMat
+    template <typename T>
+    CsrMat<T> read_csr(const std::string &path, const parallel::Policy &policy = parallel::global_policy())
+    {
+        return internal::matrix_market::read_compressed<CsrBuffer, T>(path, policy);
+    }
+
+    /// Reads a coordinate (or array) file as a CscMat
+    template <typename T>
+    CscMat<T> read_csc(const std::string &path, const parallel::Policy &policy = parallel::global_policy())
+    {
+        return internal::matrix_market::read_compressed<CscBuffer, T>(path, policy);
+    }
+
+    /// Reads a coordinate (or array) file as a SparseMat
+    template <typename T>
+    SparseMat<T> read_sparse(const std::string &path, const parallel::Policy &policy = parallel::global_policy())
+    {
+        const auto a = read_csr<T>(path, policy);
+        auto m = SparseMat<T>(a.ROWS_, a.COLS_);
+        for (size_t i = 0; i < a.ROWS_; ++i)
+            for (auto &&e : a.buffer().row(i))
+                m.unchecked(i, e.first) = e.second;
+        return m;
+    }
+
+    /// Reads an array file (or a coordinate file, scattering its entries into zeros) as a DynMat
+    template <typename T>
+    DynMat<T> read_dense(const std::string &path, const parallel::Policy &policy = parallel::global_policy())
+    {
+        auto in = std::ifstream();
+        internal::matrix_market::open(in, path);
+        const auto info = internal::matrix_market::header(in, path);
+        if (info.format == Format::Coordinate)
+        {
+            auto builder = TripletBuilder<T>(info.rows, info.cols, Duplicates::Sum);
+            internal::matrix_market::read_coordinate(in, info, builder, policy);
+            return to_dense(builder.finalize(policy));
+        }
+        auto d = DynMat<T>(info.rows, info.cols);
+        internal::matrix_market::read_array(in, info, d.as_raw_mut(), policy);
+        return d;
+    }
+
+    /// Writes a sparse matrix as a general coordinate file
+    template <typename T>
+    void write(std::ostream &out, const CsrMat<T> &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        internal::matrix_market::write_compressed(out, m.buffer(), m.ROWS_, m.COLS_, policy);
+    }
+
+    template <typename T>
+    void write(std::ostream &out, const CscMat<T> &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        internal::matrix_market::write_compressed(out, m.buffer(), m.ROWS_, m.COLS_, policy);
+    }
+
+    template <typename T>
+    void write(std::ostream &out, const SparseMat<T> &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        write(out, to_csr(m), policy);
+    }
+
+    /// Writes a dense matrix (DynMat, AlignedMat, ...) as a general array file
+    template <typename T, template <class> typename MemBuf,
+              typename = typename std::enable_if<is_contiguous<MemBuf<T>>::value>::type>
+    void write(std::ostream &out, const internal::AbstractDynMat<T, MemBuf> &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        out << "%%MatrixMarket matrix array " << internal::matrix_market::field_name<T>() << " general\n"
+            << m.ROWS_ << ' ' << m.COLS_ << '\n';
+        const T *raw = m.as_raw();
+        const size_t rows = m.ROWS_;
+        const size_t cols = m.COLS_;
+        internal::matrix_market::write_entries(out, m.SIZE, policy, [&](size_t begin, size_t end, char *p) {
+            for (size_t k = begin; k < end; ++k)
+            {
+                p = internal::matrix_market::format_value(p, raw[(k % rows) * cols + k / rows]);
+                *p++ = '\n';
+            }
+            return p;
+        });
+    }
+
+    /// Writes any of the above to a file
+    template <typename M>
+    auto write(const std::string &path, const M &m, const parallel::Policy &policy = parallel::global_policy())
+        -> decltype(write(std::declval<std::ostream &>(), m, policy))
+    {
+        auto out = std::ofstream(path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            PANIC("Failed to open ", path, " for writing");
+        write(out, m, policy);
+        out.close();
+        if (!out)
+            PANIC("Failed to write ", path);
+    }
+} // namespace matrix_market
+
+#endif // MATRIX_MARKET_H
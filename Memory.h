@@ -0,0 +1,295 @@
+#if !defined(MEMORY_H)
+#define MEMORY_H
+
+#include <algorithm> // copy
+#include <cstddef>
+#include <memory> // uninitialized_copy_n, uninitialized_value_construct_n
+#include <new>    // align_val_t
+#include <type_traits>
+#include <utility> // swap
+#include <vector>
+
+#include "util.h"
+#include "Profile.h"
+
+/* Aligned, pooled storage for dynamic matrices
+
+AlignedBuffer is a MemBuf (see DynMat.h) whose storage is 64 byte aligned, so SIMD loads never split a cache
+line, and comes from a per thread pool of size classes. Freed blocks are kept by the thread that frees them
+and handed out again to the next allocation of the same class, so the temporaries of a loop like
+    for (...)
+        x = x + alpha * (b - a * x);
+stop hitting malloc after the first iteration. Size classes are four per power of two, a block is at most
+25% larger than requested. memory::trim() hands the cached blocks of the calling thread back to the system,
+e.g. after a solver run; set_cache_limit() bounds how much a thread keeps.
+
+Buffers constructed with memory::uninitialized skip zeroing their elements, matrix operations use that for
+results that are fully overwritten anyway.
+*/
+
+namespace memory
+{
+    // Tag for constructing a buffer without initializing its elements
+    struct Uninitialized
+    {
+    };
+    constexpr Uninitialized uninitialized{};
+
+    const size_t ALIGNMENT = 64;
+
+    // Bytes of freed blocks a thread keeps cached by default
+    const size_t DEFAULT_CACHE_LIMIT = size_t(256) << 20;
+
+    /* Size class of an allocation of `bytes` and the size of its blocks
+    Class 0 holds blocks of up to ALIGNMENT bytes, after that every power of two (2^e, 2^(e+1)] is split into
+    four classes of 2^e * 1.25, 1.5, 1.75 and 2.
+    */
+    inline size_t size_class(size_t bytes, size_t &block)
+    {
+        if (bytes <= ALIGNMENT)
+        {
+            block = ALIGNMENT;
+            return 0;
+        }
+        size_t e = 0;
+        while ((bytes - 1) >> (e + 1))
+            ++e;
+        const size_t step = size_t(1) << (e - 2);
+        const size_t q = (bytes - (size_t(1) << e) + step - 1) / step;
+        // aligned allocations have to be a multiple of the alignment
+        block = ((size_t(1) << e) + q * step + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        return (e - 6) * 4 + q;
+    }
+
+    inline void *system_allocate(size_t bytes)
+    {
+        return ::operator new(bytes, std::align_val_t(ALIGNMENT));
+    }
+
+    inline void system_free(void *p)
+    {
+        ::operator delete(p, std::align_val_t(ALIGNMENT));
+    }
+
+    /// Free lists of one thread, one per size class
+    class Pool
+    {
+    private:
+        static const size_t CLASSES = 4 * 64;
+        std::vector<void *> free_[CLASSES];
+        size_t cached_;
+        size_t limit_;
+
+    public:
+        inline Pool() : cached_(0), limit_(DEFAULT_CACHE_LIMIT) {}
+
+        Pool(const Pool &) = delete;
+        Pool &operator=(const Pool &) = delete;
+
+        inline ~Pool() { trim(); }
+
+        inline void *allocate(size_t bytes)
+        {
+            size_t block;
+            auto &list = free_[size_class(bytes, block)];
+            if (list.empty())
+                return system_allocate(block);
+            void *p = list.back();
+            list.pop_back();
+            cached_ -= block;
+            return p;
+        }
+
+        inline void deallocate(void *p, size_t bytes)
+        {
+            size_t block;
+            auto &list = free_[size_class(bytes, block)];
+            if (cached_ + block > limit_)
+            {
+                system_free(p);
+                return;
+            }
+            list.push_back(p);
+            cached_ += block;
+        }
+
+        /// Returns all cached blocks to the system
+        inline void trim()
+        {
+            for (auto &&list : free_)
+            {
+                for (auto &&p : list)
+                    system_free(p);
+                std::vector<void *>().swap(list);
+            }
+            cached_ = 0;
+        }
+
+        inline size_t cached() const { return cached_; }
+
+        inline void set_limit(size_t bytes)
+        {
+            limit_ = bytes;
+            if (cached_ > limit_)
+                trim();
+        }
+    };
+
+    /// Pool of the calling thread, nullptr while the thread is shutting down
+    inline Pool *thread_pool()
+    {
+        // stays valid until the very end of the thread, unlike the pool itself
+        thread_local bool dead = false;
+        struct Owner
+        {
+            Pool pool;
+            bool &dead;
+            ~Owner() { dead = true; }
+        };
+        if (dead)
+            return nullptr;
+        thread_local Owner owner{{}, dead};
+        return &owner.pool;
+    }
+
+    /// 64 byte aligned block of at least `bytes` bytes from the calling thread's pool
+    inline void *allocate(size_t bytes)
+    {
+        if (auto pool = thread_pool())
+            return pool->allocate(bytes);
+        size_t block;
+        size_class(bytes, block);
+        return system_allocate(block);
+    }
+
+    /// Gives back a block from allocate(), `bytes` has to be the size it was requested with
+    inline void deallocate(void *p, size_t bytes)
+    {
+        if (p == nullptr)
+            return;
+        if (auto pool = thread_pool())
+            pool->deallocate(p, bytes);
+        else
+            system_free(p);
+    }
+
+    /// Returns the blocks cached by the calling thread to the system
+    inline void trim()
+    {
+        if (auto pool = thread_pool())
+            pool->trim();
+    }
+
+    /// Bounds the bytes the calling thread keeps cached, trims if it's already above
+    inline void set_cache_limit(size_t bytes)
+    {
+        if (auto pool = thread_pool())
+            pool->set_limit(bytes);
+    }
+
+    /// Bytes currently cached by the calling thread
+    inline size_t cached_bytes()
+    {
+        auto pool = thread_pool();
+        return pool == nullptr ? 0 : pool->cached();
+    }
+
+    /// Constructs a buffer, uninitialized if it supports that
+    template <typename Buf>
+    inline Buf make_buffer(size_t rows, size_t cols, Uninitialized)
+    {
+        if constexpr (std::is_constructible<Buf, size_t, size_t, Uninitialized>::value)
+            return Buf(rows, cols, uninitialized);
+        else
+            return Buf(rows, cols);
+    }
+} // namespace memory
+
+template <typename T>
+class AlignedBuffer
+{
+private:
+    T *raw_;
+    size_t size_;
+
+    static inline T *allocate(size_t n)
+    {
+        if (n == 0)
+            return nullptr;
+        ::profile::allocated(n * sizeof(T));
+        return static_cast<T *>(memory::allocate(n * sizeof(T)));
+    }
+
+    inline void release()
+    {
+        if constexpr (!std::is_trivially_destructible<T>::value)
+            for (size_t i = 0; i < size_; ++i)
+                raw_[i].~T();
+        memory::deallocate(raw_, size_ * sizeof(T));
+        raw_ = nullptr;
+        size_ = 0;
+    }
+
+public:
+    inline AlignedBuffer(size_t rows, size_t cols) : raw_(allocate(rows * cols)), size_(rows * cols)
+    {
+        std::uninitialized_value_construct_n(raw_, size_);
+    }
+
+    // Elements of trivial types are left uninitialized, others are still value initialized
+    inline AlignedBuffer(size_t rows, size_t cols, memory::Uninitialized) : raw_(allocate(rows * cols)), size_(rows * cols)
+    {
+        if constexpr (!std::is_trivially_default_constructible<T>::value)
+            std::uninitialized_value_construct_n(raw_, size_);
+    }
+
+    inline AlignedBuffer(const AlignedBuffer &other) : raw_(allocate(other.size_)), size_(other.size_)
+    {
+        std::uninitialized_copy_n(other.raw_, size_, raw_);
+    }
+
+    inline AlignedBuffer(AlignedBuffer &&other) noexcept : raw_(other.raw_), size_(other.size_)
+    {
+        other.raw_ = nullptr;
+        other.size_ = 0;
+    }
+
+    inline AlignedBuffer &operator=(const AlignedBuffer &other)
+    {
+        if (this == &other)
+            return *this;
+        if (size_ == other.size_)
+        {
+            std::copy(other.raw_, other.raw_ + size_, raw_);
+            return *this;
+        }
+        auto copy = AlignedBuffer(other);
+        std::swap(raw_, copy.raw_);
+        std::swap(size_, copy.size_);
+        return *this;
+    }
+
+    inline AlignedBuffer &operator=(AlignedBuffer &&other) noexcept
+    {
+        std::swap(raw_, other.raw_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    inline ~AlignedBuffer() { release(); }
+
+    inline T operator[](size_t i) const
+    {
+        return raw_[i];
+    }
+    inline T &operator[](size_t i)
+    {
+        return raw_[i];
+    }
+
+    inline size_t size() const { return size_; }
+    inline T *data() { return raw_; }
+    inline const T *data() const { return raw_; }
+};
+
+#endif // MEMORY_H
@@ -0,0 +1,391 @@
+#if !defined(PROFILE_H)
+#define PROFILE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint> // uint64_t, uint32_t
+#include <cstdio>  // snprintf
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#include "util.h"
+
+/* Opt-in instrumentation of the hot paths
+
+With -DMATRAC_PROFILE=1 (the same in every translation unit, CMake's MATRAC_PROFILE option sets it) every
+instrumented operation records its calls, the elements it touched, an estimate of its FLOPs, the matrix
+storage it allocated and its wall time into counters of the calling thread:
+    profile::set_tracing(true);          // optional, also keeps one trace event per call
+    run_the_workload();
+    profile::write_report(std::cout, profile::report());
+    profile::write_trace(file);          // trace event JSON for chrome://tracing or Perfetto
+
+Instrumented are GEMM (`*`, multiply_add and the factorizations' updates), elementwise expressions (assigning
+or constructing from `a + b`, `2.0 * a`, ...), transposes, slices and their copies, the compaction of
+SparseBuffer and sparse times dense products. Allocations are attributed to the innermost running operation,
+or to "other" outside of them; they count the storage of DynBuffer and AlignedBuffer (pooled or not) and
+GEMM's packing buffers. Time is inclusive, e.g. a slice copied into a new matrix also counts as elementwise,
+an operation nested in one of the same kind (a GEMM inside a GEMM) isn't counted again.
+
+Without MATRAC_PROFILE the scopes are empty and compile away, report() stays zero.
+*/
+#if !defined(MATRAC_PROFILE)
+#define MATRAC_PROFILE 0
+#endif
+
+constexpr bool PROFILED = MATRAC_PROFILE != 0;
+
+namespace profile
+{
+    enum class Op
+    {
+        Other,
+        Gemm,
+        Elementwise,
+        Transpose,
+        Slice,
+        SparseCompact,
+        SparseMultiply,
+    };
+
+    const size_t OPS = 7;
+
+    inline const char *name(Op op)
+    {
+        static const char *names[OPS] = {"other", "gemm", "elementwise", "transpose", "slice", "sparse_compact", "sparse_multiply"};
+        return names[size_t(op)];
+    }
+
+    struct Counters
+    {
+        uint64_t calls = 0;
+        uint64_t elements = 0;
+        uint64_t flops = 0;
+        uint64_t allocations = 0;
+        uint64_t allocated_bytes = 0;
+        uint64_t nanoseconds = 0;
+    };
+
+    /// Counters of all threads, indexed by Op
+    using Report = std::array<Counters, OPS>;
+} // namespace profile
+
+namespace internal
+{
+    namespace profile
+    {
+        using ::profile::Op;
+        using ::profile::OPS;
+
+        enum Field
+        {
+            CALLS,
+            ELEMENTS,
+            FLOPS,
+            ALLOCATIONS,
+            ALLOCATED_BYTES,
+            NANOSECONDS,
+            FIELDS
+        };
+
+        // Trace events a thread keeps at most, later ones are dropped
+        const size_t TRACE_LIMIT = size_t(1) << 20;
+
+        struct Event
+        {
+            Op op;
+            uint64_t start;
+            uint64_t duration;
+            uint64_t elements;
+            uint64_t flops;
+        };
+
+        inline uint64_t now()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // only the owning thread writes, so a relaxed load and store is enough and much cheaper than fetch_add
+        inline void bump(std::atomic<uint64_t> &x, uint64_t v)
+        {
+            x.store(x.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        }
+
+        inline void add(::profile::Counters &c, const std::atomic<uint64_t> *fields)
+        {
+            c.calls += fields[CALLS].load(std::memory_order_relaxed);
+            c.elements += fields[ELEMENTS].load(std::memory_order_relaxed);
+            c.flops += fields[FLOPS].load(std::memory_order_relaxed);
+            c.allocations += fields[ALLOCATIONS].load(std::memory_order_relaxed);
+            c.allocated_bytes += fields[ALLOCATED_BYTES].load(std::memory_order_relaxed);
+            c.nanoseconds += fields[NANOSECONDS].load(std::memory_order_relaxed);
+        }
+
+        struct ThreadCounters;
+
+        /// Every thread's counters plus the totals of the threads that already exited
+        struct Registry
+        {
+            std::mutex mutex;
+            std::vector<ThreadCounters *> live;
+            ::profile::Report retired{};
+            std::vector<std::pair<uint32_t, Event>> retired_events;
+            uint64_t dropped = 0;
+            uint32_t next_id = 0;
+            std::atomic<bool> tracing{false};
+            const uint64_t epoch = now();
+        };
+
+        // never destroyed, pool workers may exit after the static destructors ran
+        inline Registry &registry()
+        {
+            static Registry *r = new Registry();
+            return *r;
+        }
+
+        struct ThreadCounters
+        {
+            std::atomic<uint64_t> fields[OPS][FIELDS];
+            Op current = Op::Other;
+            uint32_t id;
+            std::mutex events_mutex;
+            std::vector<Event> events;
+            uint64_t dropped = 0;
+
+            inline ThreadCounters()
+            {
+                for (auto &&op : fields)
+                    for (auto &&f : op)
+                        f.store(0, std::memory_order_relaxed);
+                auto &r = registry();
+                auto lock = std::lock_guard<std::mutex>(r.mutex);
+                id = r.next_id++;
+                r.live.push_back(this);
+            }
+
+            inline ~ThreadCounters()
+            {
+                auto &r = registry();
+                auto lock = std::lock_guard<std::mutex>(r.mutex);
+                for (size_t op = 0; op < OPS; ++op)
+                    add(r.retired[op], fields[op]);
+                {
+                    auto events_lock = std::lock_guard<std::mutex>(events_mutex);
+                    for (auto &&e : events)
+                        r.retired_events.emplace_back(id, e);
+                    r.dropped += dropped;
+                }
+                for (auto &&t : r.live)
+                    if (t == this)
+                    {
+                        t = r.live.back();
+                        r.live.pop_back();
+                        break;
+                    }
+            }
+        };
+
+        /// Counters of the calling thread, nullptr while the thread is shutting down
+        inline ThreadCounters *thread_counters()
+        {
+            thread_local bool dead = false;
+            struct Owner
+            {
+                ThreadCounters counters;
+                bool &dead;
+                ~Owner() { dead = true; }
+            };
+            if (dead)
+                return nullptr;
+            thread_local Owner owner{{}, dead};
+            return &owner.counters;
+        }
+    } // namespace profile
+} // namespace internal
+
+namespace profile
+{
+#if MATRAC_PROFILE
+    /// Records one call of `op` from construction to destruction
+    class Scope
+    {
+    private:
+        internal::profile::ThreadCounters *t_;
+        Op op_;
+        Op previous_;
+        uint64_t elements_;
+        uint64_t flops_;
+        uint64_t start_;
+
+    public:
+        inline Scope(Op op, uint64_t elements, uint64_t flops)
+            : t_(internal::profile::thread_counters()), op_(op), elements_(elements), flops_(flops)
+        {
+            if (t_ == nullptr || t_->current == op)
+            {
+                t_ = nullptr;
+                return;
+            }
+            previous_ = t_->current;
+            t_->current = op;
+            start_ = internal::profile::now();
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+        inline ~Scope()
+        {
+            using namespace internal::profile;
+            if (t_ == nullptr)
+                return;
+            const uint64_t duration = now() - start_;
+            auto &f = t_->fields[size_t(op_)];
+            bump(f[CALLS], 1);
+            bump(f[ELEMENTS], elements_);
+            bump(f[FLOPS], flops_);
+            bump(f[NANOSECONDS], duration);
+            t_->current = previous_;
+            if (registry().tracing.load(std::memory_order_relaxed))
+            {
+                auto lock = std::lock_guard<std::mutex>(t_->events_mutex);
+                if (t_->events.size() < TRACE_LIMIT)
+                    t_->events.push_back({op_, start_, duration, elements_, flops_});
+                else
+                    ++t_->dropped;
+            }
+        }
+    };
+
+    /// Attributes an allocation of `bytes` to the operation running on the calling thread
+    inline void allocated(size_t bytes)
+    {
+        using namespace internal::profile;
+        if (bytes == 0)
+            return;
+        if (auto t = thread_counters())
+        {
+            auto &f = t->fields[size_t(t->current)];
+            bump(f[ALLOCATIONS], 1);
+            bump(f[ALLOCATED_BYTES], bytes);
+        }
+    }
+#else
+    class Scope
+    {
+    public:
+        inline Scope(Op, uint64_t, uint64_t) {}
+        // user provided, so unused scopes don't warn
+        inline ~Scope() {}
+    };
+
+    inline void allocated(size_t) {}
+#endif
+
+    /// Sums the counters of all threads, including the ones that already exited
+    inline Report report()
+    {
+        auto result = Report{};
+        if constexpr (PROFILED)
+        {
+            auto &r = internal::profile::registry();
+            auto lock = std::lock_guard<std::mutex>(r.mutex);
+            result = r.retired;
+            for (auto &&t : r.live)
+                for (size_t op = 0; op < OPS; ++op)
+                    internal::profile::add(result[op], t->fields[op]);
+        }
+        return result;
+    }
+
+    /// Zeroes the counters of all threads and drops the trace, exact only while no operation is running
+    inline void reset()
+    {
+        if constexpr (PROFILED)
+        {
+            auto &r = internal::profile::registry();
+            auto lock = std::lock_guard<std::mutex>(r.mutex);
+            r.retired = Report{};
+            r.retired_events.clear();
+            r.dropped = 0;
+            for (auto &&t : r.live)
+            {
+                for (auto &&op : t->fields)
+                    for (auto &&f : op)
+                        f.store(0, std::memory_order_relaxed);
+                auto events_lock = std::lock_guard<std::mutex>(t->events_mutex);
+                t->events.clear();
+                t->dropped = 0;
+            }
+        }
+    }
+
+    /// Starts or stops keeping a trace event per call, has no effect without MATRAC_PROFILE
+    inline void set_tracing(bool on)
+    {
+        if constexpr (PROFILED)
+            internal::profile::registry().tracing.store(on, std::memory_order_relaxed);
+    }
+
+    /// Table of the operations that ran, with GFLOP/s and GB allocated
+    inline void write_report(std::ostream &out, const Report &report)
+    {
+        char line[160];
+        std::snprintf(line, sizeof(line), "%-16s %10s %14s %12s %10s %12s %12s %9s\n",
+                      "operation", "calls", "elements", "GFLOP", "allocs", "MiB alloc", "time [ms]", "GFLOP/s");
+        out << line;
+        for (size_t op = 0; op < OPS; ++op)
+        {
+            const auto &c = report[op];
+            if (c.calls == 0 && c.allocations == 0)
+                continue;
+            const double seconds = c.nanoseconds * 1e-9;
+            std::snprintf(line, sizeof(line), "%-16s %10llu %14llu %12.3f %10llu %12.2f %12.3f %9.3f\n", name(Op(op)),
+                          (unsigned long long)c.calls, (unsigned long long)c.elements, c.flops * 1e-9,
+                          (unsigned long long)c.allocations, c.allocated_bytes / double(1 << 20), seconds * 1e3,
+                          seconds > 0 ? c.flops * 1e-9 / seconds : 0.0);
+            out << line;
+        }
+    }
+
+    /* Writes the recorded calls as trace event JSON (complete "X" events, one track per thread)
+    Load it in chrome://tracing or ui.perfetto.dev, events only exist while set_tracing(true). A thread keeps
+    at most TRACE_LIMIT events, the number of dropped ones is in otherData.
+    */
+    inline void write_trace(std::ostream &out)
+    {
+        uint64_t dropped = 0;
+        out << "{\"traceEvents\":[";
+        if constexpr (PROFILED)
+        {
+            auto &r = internal::profile::registry();
+            auto lock = std::lock_guard<std::mutex>(r.mutex);
+            bool first = true;
+            char line[256];
+            const auto write = [&](uint32_t tid, const internal::profile::Event &e) {
+                std::snprintf(line, sizeof(line),
+                              "%s\n{\"name\":\"%s\",\"cat\":\"matrac\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,"
+                              "\"args\":{\"elements\":%llu,\"flops\":%llu}}",
+                              first ? "" : ",", name(e.op), tid, (e.start - r.epoch) * 1e-3, e.duration * 1e-3,
+                              (unsigned long long)e.elements, (unsigned long long)e.flops);
+                out << line;
+                first = false;
+            };
+            for (auto &&e : r.retired_events)
+                write(e.first, e.second);
+            dropped = r.dropped;
+            for (auto &&t : r.live)
+            {
+                auto events_lock = std::lock_guard<std::mutex>(t->events_mutex);
+                for (auto &&e : t->events)
+                    write(t->id, e);
+                dropped += t->dropped;
+            }
+        }
+        out << "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped_events\":" << dropped << "}}\n";
+    }
+} // namespace profile
+
+#endif // PROFILE_H
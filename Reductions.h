@@ -0,0 +1,724 @@
+#if !defined(REDUCTIONS_H)
+#define REDUCTIONS_H
+
+#include <algorithm> // max, min, sort
+#include <cmath>     // abs, sqrt
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+#include <utility> // declval
+#include <vector>
+
+#include "util.h"
+#include "Matrix.h"
+#include "DynMat.h"
+#include "Sparse.h"
+#include "ThreadPool.h"
+#include "Accumulate.h"
+#include "Functional.h"
+#include "Simd.h"
+
+/* Reductions and norms of Mat, DynMat (MappedMat) and the sparse matrices (SparseMat, CsrMat, CscMat)
+    reduction::sum<Acc>(m)                      sum of the elements under an accumulation policy (see Accumulate.h)
+    reduction::min(m) / max(m)                  smallest / largest element
+    reduction::argmin(m) / argmax(m)            row major index of the first smallest / largest element
+    reduction::norm_1<Acc>(m)                   largest column sum of |x| (sum of |x| of a vector)
+    reduction::norm_inf<Acc>(m)                 largest row sum of |x| (largest |x| of a vector)
+    reduction::norm_2<Acc>(m)                   largest singular value (Euclidean length of a vector)
+    reduction::frobenius_norm<Acc>(m)           square root of the sum of the squared elements
+    reduction::row_sums<Acc>(m) / col_sums      sums of every row / column as a column / row vector
+    reduction::per_row(m, init, op, f) / per_column     transform_reduce (see Functional.h) of every row / column
+Example:
+    double big = reduction::norm_inf(a);
+    auto sums = reduction::col_sums<accumulate::Widened>(x);     // DynMat<double> for a DynMat<float> x
+    auto peaks = reduction::per_row(a, 0.0, [](double x, double y) { return x < y ? y : x; },
+                                    [](double x) { return std::abs(x); });
+Everything takes a parallel::Policy last, the global one by default. Contiguous elements are reduced pairwise
+over blocks, each block in vectorized lanes, so the error of a sum grows with the log of its length. Columns of
+dense matrices are summed down blocks of COLUMN_BLOCK rows, all columns of a chunk at once.
+Sparse matrices only visit their stored elements, missing ones are combined once per row / column / matrix, so
+op(y, f(T())) has to give the same however often it's applied (true for sums with f(T()) = 0, min and max).
+Stored elements of CsrMat / CscMat and their rows / columns run on the threads of the policy, the reductions of
+SparseMat, CSR columns and CSC rows are serial. min, max and the arg versions need ordered elements (no NaN),
+they PANIC on empty matrices.
+norm_2 of a matrix is estimated by power iteration on A^T A, from below, until the residual of A^T A v = s^2 v
+is at the rounding level of s^2 or s stops changing, which needs floating point elements.
+*/
+
+namespace internal
+{
+    namespace reduction
+    {
+        // Columns of a dense matrix are split across threads in chunks of at least this many
+        const size_t COLUMN_CHUNK = 256;
+
+        // Rows summed into a column chunk before the block is added to the total
+        const size_t COLUMN_BLOCK = 128;
+
+        // Power iterations of norm_2 before it gives up converging
+        const size_t MAX_ITERATIONS = 1000;
+        // norm_2 has converged once |A^T A v - s^2 v| <= RESIDUAL * epsilon * s^2
+        const size_t RESIDUAL = 64;
+
+        template <typename T, bool ROW_MAJOR>
+        std::true_type compressed(const CompressedBuffer<T, ROW_MAJOR> *);
+        std::false_type compressed(...);
+
+        template <typename T, bool ROW_MAJOR>
+        std::integral_constant<bool, ROW_MAJOR> row_major(const CompressedBuffer<T, ROW_MAJOR> *);
+        std::false_type row_major(...);
+
+        /// True for CsrBuffer / CscBuffer
+        template <typename Buf>
+        struct is_compressed : decltype(compressed(std::declval<const Buf *>()))
+        {
+        };
+
+        /// True for CsrBuffer
+        template <typename Buf>
+        struct is_row_major : decltype(row_major(std::declval<const Buf *>()))
+        {
+        };
+
+        /// Element type, shape and result vectors of the matrices reductions take
+        template <typename M>
+        struct traits;
+
+        template <typename T, size_t ROWS, size_t COLS>
+        struct traits<Mat<T, ROWS, COLS>>
+        {
+            using Type = T;
+            template <typename U>
+            using Column = Mat<U, ROWS, 1>;
+            template <typename U>
+            using Row = Mat<U, 1, COLS>;
+
+            static inline size_t rows(const Mat<T, ROWS, COLS> &) { return ROWS; }
+            static inline size_t cols(const Mat<T, ROWS, COLS> &) { return COLS; }
+
+            template <typename Line, typename U>
+            static inline Line line(const std::vector<U> &v, bool)
+            {
+                auto m = Line();
+                for (size_t i = 0; i < v.size(); ++i)
+                    m.as_raw_mut()[i] = v[i];
+                return m;
+            }
+        };
+
+        template <typename T, template <class> typename MemBuf>
+        struct traits<AbstractDynMat<T, MemBuf>>
+        {
+            using Type = T;
+            template <typename U>
+            using Column = DynMat<U>;
+            template <typename U>
+            using Row = DynMat<U>;
+
+            static inline size_t rows(const AbstractDynMat<T, MemBuf> &m) { return m.ROWS_; }
+            static inline size_t cols(const AbstractDynMat<T, MemBuf> &m) { return m.COLS_; }
+
+            template <typename Line, typename U>
+            static inline Line line(const std::vector<U> &v, bool column)
+            {
+                auto m = Line(column ? v.size() : 1, column ? 1 : v.size(), memory::uninitialized);
+                U *out = m.as_raw_mut();
+                for (size_t i = 0; i < v.size(); ++i)
+                    out[i] = v[i];
+                return m;
+            }
+        };
+
+        struct Identity
+        {
+            template <typename T>
+            inline const T &operator()(const T &x) const { return x; }
+        };
+
+        /// The larger (MAX) or smaller of two elements, compiles to SIMD max / min of floating point lanes
+        template <bool MAX>
+        struct Extreme
+        {
+            template <typename T>
+            inline T operator()(const T &x, const T &y) const { return MAX ? (x < y ? y : x) : (y < x ? y : x); }
+        };
+
+        /// |x|, unsigned elements are their own magnitude
+        template <typename T>
+        inline T magnitude(const T &x)
+        {
+            if constexpr (std::is_floating_point<T>::value)
+                return std::abs(x);
+            else if constexpr (std::is_unsigned<T>::value)
+                return x;
+            else
+                return x < T() ? T(-x) : x;
+        }
+
+        /// Accumulator (see Accumulate.h) of one term: the element, its square or its magnitude
+        template <typename A, int KIND>
+        struct Term
+        {
+            template <typename T>
+            inline A operator()(const T &x) const
+            {
+                auto a = A();
+                if constexpr (KIND == 0)
+                    a.add(x);
+                else if constexpr (KIND == 1)
+                    a.add_product(x, x);
+                else
+                    a.add(magnitude(x));
+                return a;
+            }
+        };
+
+        template <typename A>
+        using Element = Term<A, 0>;
+        template <typename A>
+        using Square = Term<A, 1>;
+        template <typename A>
+        using Magnitude = Term<A, 2>;
+
+        template <typename A>
+        struct Merge
+        {
+            inline A operator()(A a, const A &b) const
+            {
+                a.merge(b);
+                return a;
+            }
+        };
+
+        /// True if all stored elements are one array: dense matrices and the values of CsrMat / CscMat
+        template <typename M>
+        struct has_run : std::true_type
+        {
+        };
+
+        template <typename T, template <class> typename MemBuf>
+        struct has_run<AbstractDynMat<T, MemBuf>>
+            : std::integral_constant<bool, is_contiguous<MemBuf<T>>::value || is_compressed<MemBuf<T>>::value>
+        {
+        };
+
+        /// The array of stored elements as (first, count), see has_run
+        template <typename T, size_t ROWS, size_t COLS>
+        inline std::pair<const T *, size_t> run(const Mat<T, ROWS, COLS> &m) { return {m.as_raw(), ROWS * COLS}; }
+
+        template <typename T, template <class> typename MemBuf>
+        inline std::pair<const T *, size_t> run(const AbstractDynMat<T, MemBuf> &m)
+        {
+            if constexpr (is_contiguous<MemBuf<T>>::value)
+                return {m.as_raw(), m.SIZE};
+            else
+                return {m.buffer().values().data(), m.buffer().nnz()};
+        }
+
+        template <typename M>
+        inline size_t size(const M &m) { return traits<M>::rows(m) * traits<M>::cols(m); }
+
+        /// init op f(x) over the stored elements x, missing ones once
+        template <typename R, typename M, typename Op, typename F>
+        R fold(const M &m, R init, const Op &op, const F &f, const parallel::Policy &policy)
+        {
+            using T = typename traits<M>::Type;
+            size_t stored = 0;
+            if constexpr (has_run<M>::value)
+            {
+                const auto r = run(m);
+                init = functional::transform_reduce(r.first, r.second, init, op, f, policy);
+                stored = r.second;
+            }
+            else
+            {
+                for (auto &&x : m.buffer())
+                {
+                    init = op(init, f(x.second));
+                    ++stored;
+                }
+            }
+            return stored < size(m) ? R(op(init, f(T()))) : init;
+        }
+
+        /// init op f(x) over every row of a row major rows x cols array, rows on the threads of `policy`
+        template <typename R, typename T, typename Op, typename F>
+        std::vector<R> fold_rows(const T *x, size_t rows, size_t cols, R init, const Op &op, const F &f,
+                                 const parallel::Policy &policy)
+        {
+            auto out = std::vector<R>(rows, init);
+            if (cols == 0)
+                return out;
+            const size_t min_chunk = std::max(size_t(1), MIN_CHUNK / cols);
+            parallel::for_chunks(policy, rows, min_chunk, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i)
+                    out[i] = R(op(init, functional::pairwise<R>(x + i * cols, cols, op, f)));
+            }, cols);
+            return out;
+        }
+
+        /// init op f(x) over every column of a row major rows x cols array, chunks of columns on the threads of `policy`
+        template <typename R, typename T, typename Op, typename F>
+        std::vector<R> fold_columns(const T *x, size_t rows, size_t cols, R init, const Op &op, const F &f,
+                                    const parallel::Policy &policy)
+        {
+            auto out = std::vector<R>(cols, init);
+            if (rows == 0)
+                return out;
+            parallel::for_chunks(policy, cols, COLUMN_CHUNK, [&](size_t begin, size_t end) {
+                const size_t n = end - begin;
+                auto total = std::vector<R>(n, init);
+                auto block = std::vector<R>(n, init);
+                R *t = total.data();
+                R *b = block.data();
+                for (size_t r0 = 0; r0 < rows; r0 += COLUMN_BLOCK)
+                {
+                    const size_t r1 = std::min(rows, r0 + COLUMN_BLOCK);
+                    functional::map(x + r0 * cols + begin, b, n, f);
+                    for (size_t r = r0 + 1; r < r1; ++r)
+                    {
+                        const T *row = x + r * cols + begin;
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC ivdep
+#endif
+                        for (size_t j = 0; j < n; ++j)
+                            b[j] = op(b[j], f(row[j]));
+                    }
+                    if (r0 == 0)
+                    {
+                        std::swap(total, block);
+                        std::swap(t, b);
+                    }
+                    else
+                        functional::zip(t, b, t, n, op);
+                }
+                for (size_t j = 0; j < n; ++j)
+                    out[begin + j] = op(init, t[j]);
+            }, rows);
+            return out;
+        }
+
+        /// init op f(x) over every row (ROWS) or column of a dense matrix
+        template <bool ROWS, typename R, typename T, size_t ROWS_, size_t COLS_, typename Op, typename F>
+        inline std::vector<R> fold_lines(const Mat<T, ROWS_, COLS_> &m, R init, const Op &op, const F &f,
+                                         const parallel::Policy &policy)
+        {
+            if constexpr (ROWS)
+                return fold_rows(m.as_raw(), ROWS_, COLS_, init, op, f, policy);
+            else
+                return fold_columns(m.as_raw(), ROWS_, COLS_, init, op, f, policy);
+        }
+
+        /// init op f(x) over the stored elements x of every row (ROWS) or column, missing ones once per line
+        template <bool ROWS, typename R, typename T, template <class> typename MemBuf, typename Op, typename F>
+        std::vector<R> fold_lines(const AbstractDynMat<T, MemBuf> &m, R init, const Op &op, const F &f,
+                                  const parallel::Policy &policy)
+        {
+            const size_t lines = ROWS ? m.ROWS_ : m.COLS_;
+            const size_t length = ROWS ? m.COLS_ : m.ROWS_;
+            if constexpr (is_contiguous<MemBuf<T>>::value && ROWS)
+                return fold_rows(m.as_raw(), m.ROWS_, m.COLS_, init, op, f, policy);
+            else if constexpr (is_contiguous<MemBuf<T>>::value)
+                return fold_columns(m.as_raw(), m.ROWS_, m.COLS_, init, op, f, policy);
+            else if constexpr (is_compressed<MemBuf<T>>::value && is_row_major<MemBuf<T>>::value == ROWS)
+            {
+                // rows of a CSR / columns of a CSC matrix are runs of the value array
+                const auto &buf = m.buffer();
+                const size_t *ptr = buf.pointers().data();
+                const T *values = buf.values().data();
+                auto out = std::vector<R>(lines, init);
+                const size_t per_line = buf.nnz() / std::max(lines, size_t(1)) + 1;
+                parallel::for_chunks(policy, lines, std::max(size_t(1), MIN_CHUNK / per_line), [&](size_t begin, size_t end) {
+                    for (size_t k = begin; k < end; ++k)
+                    {
+                        const size_t n = ptr[k + 1] - ptr[k];
+                        if (n > 0)
+                            out[k] = R(op(init, functional::pairwise<R>(values + ptr[k], n, op, f)));
+                        if (n < length)
+                            out[k] = R(op(out[k], f(T())));
+                    }
+                }, per_line);
+                return out;
+            }
+            else
+            {
+                // the other sparse layouts scatter their stored elements into the lines
+                auto out = std::vector<R>(lines, init);
+                auto stored = std::vector<size_t>(lines, 0);
+                if constexpr (is_compressed<MemBuf<T>>::value)
+                {
+                    // columns of a CSR / rows of a CSC matrix are its minor indices
+                    const auto &buf = m.buffer();
+                    const size_t *minor = buf.indices().data();
+                    const T *values = buf.values().data();
+                    for (size_t p = 0; p < buf.nnz(); ++p)
+                    {
+                        out[minor[p]] = op(out[minor[p]], f(values[p]));
+                        ++stored[minor[p]];
+                    }
+                }
+                else
+                {
+                    for (auto &&x : m.buffer())
+                    {
+                        const size_t k = ROWS ? x.first / m.COLS_ : x.first % m.COLS_;
+                        out[k] = op(out[k], f(x.second));
+                        ++stored[k];
+                    }
+                }
+                for (size_t k = 0; k < lines; ++k)
+                    if (stored[k] < length)
+                        out[k] = op(out[k], f(T()));
+                return out;
+            }
+        }
+
+        /// Index of the first largest (MAX) or smallest of n > 0 contiguous elements
+        template <bool MAX, typename T>
+        size_t arg_extreme(const T *x, size_t n, const parallel::Policy &policy)
+        {
+            const T best = functional::transform_reduce(x, n, x[0], Extreme<MAX>(), Identity(), policy);
+            return parallel::reduce(
+                policy, n, n,
+                [&](size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; ++i)
+                        if (x[i] == best)
+                            return i;
+                    return n;
+                },
+                [](size_t a, size_t b) { return std::min(a, b); });
+        }
+
+        template <bool MAX, typename T, size_t ROWS, size_t COLS>
+        inline size_t arg_extreme(const Mat<T, ROWS, COLS> &m, const parallel::Policy &policy)
+        {
+            return arg_extreme<MAX>(m.as_raw(), ROWS * COLS, policy);
+        }
+
+        template <bool MAX, typename T, template <class> typename MemBuf>
+        size_t arg_extreme(const AbstractDynMat<T, MemBuf> &m, const parallel::Policy &policy)
+        {
+            if constexpr (is_contiguous<MemBuf<T>>::value)
+                return arg_extreme<MAX>(m.as_raw(), m.SIZE, policy);
+            else
+            {
+                const auto better = [](const T &x, const T &y) { return MAX ? y < x : x < y; };
+                bool found = false;
+                T best = T();
+                size_t index = 0;
+                auto indices = std::vector<size_t>();
+                for (auto &&x : m.buffer())
+                {
+                    if (!found || better(x.second, best) || (!better(best, x.second) && x.first < index))
+                    {
+                        best = x.second;
+                        index = x.first;
+                        found = true;
+                    }
+                    indices.push_back(x.first);
+                }
+                const T zero = T();
+                if (indices.size() == m.SIZE || (found && better(best, zero)))
+                    return index;
+                // a missing element is a zero at least as good, the first one is the first gap in the indices
+                std::sort(indices.begin(), indices.end());
+                size_t missing = 0;
+                while (missing < indices.size() && indices[missing] == missing)
+                    ++missing;
+                return found && !better(zero, best) && index < missing ? index : missing;
+            }
+        }
+
+        /// Some element, the start of min / max
+        template <typename T, size_t ROWS, size_t COLS>
+        inline T any_element(const Mat<T, ROWS, COLS> &m) { return m.as_raw()[0]; }
+
+        template <typename T, template <class> typename MemBuf>
+        inline T any_element(const AbstractDynMat<T, MemBuf> &m)
+        {
+            if constexpr (is_contiguous<MemBuf<T>>::value)
+                return m.as_raw()[0];
+            else
+            {
+                // if nothing is stored, all elements are zeros
+                const auto &buf = m.buffer();
+                return buf.begin() != buf.end() ? T((*buf.begin()).second) : T();
+            }
+        }
+
+        /// DynMat copy of a column vector
+        template <typename T>
+        inline DynMat<T> column_copy(const std::vector<T> &v)
+        {
+            return traits<DynMat<T>>::template line<DynMat<T>>(v, true);
+        }
+
+        /// The matrix norm_2 iterates with, contiguous and compressed matrices as they are
+        template <typename T, template <class> typename MemBuf>
+        inline const AbstractDynMat<T, MemBuf> &operand(const AbstractDynMat<T, MemBuf> &a)
+        {
+            return a;
+        }
+
+        /// Mats are copied into a DynMat once, so the products take the GEMM kernel
+        template <typename T, size_t ROWS, size_t COLS>
+        inline DynMat<T> operand(const Mat<T, ROWS, COLS> &a)
+        {
+            auto d = DynMat<T>(ROWS, COLS, memory::uninitialized);
+            for (size_t i = 0; i < ROWS * COLS; ++i)
+                d.as_raw_mut()[i] = a.as_raw()[i];
+            return d;
+        }
+
+        /// SparseMats are compressed once, so the products take the threaded CSR kernels
+        template <typename T>
+        inline CsrMat<T> operand(const SparseMat<T> &a)
+        {
+            return to_csr(a);
+        }
+
+        /// y = A v and w = A^T y for a dense or compressed A, into the column vectors y and w
+        template <typename T, template <class> typename MemBuf>
+        inline void normal_product(const AbstractDynMat<T, MemBuf> &a, const DynMat<T> &v, DynMat<T> &y, DynMat<T> &w,
+                                   const parallel::Policy &policy)
+        {
+            std::fill(y.as_raw_mut(), y.as_raw_mut() + y.SIZE, T());
+            std::fill(w.as_raw_mut(), w.as_raw_mut() + w.SIZE, T());
+            if constexpr (is_contiguous<MemBuf<T>>::value)
+            {
+                multiply_add(y, T(1), a.view(), v, policy);
+                multiply_add(w, T(1), a.view().transpose(), y, policy);
+            }
+            else
+            {
+                const auto &buf = a.buffer();
+                const auto scope = ::profile::Scope(::profile::Op::SparseMultiply, 2 * buf.nnz(), 4 * buf.nnz());
+                // the rows of a CSR and the columns of a CSC are gathered into, the others scattered from
+                if constexpr (std::is_base_of<CompressedBuffer<T, true>, MemBuf<T>>::value)
+                {
+                    spmv::gather(buf, v.as_raw(), 1, y.as_raw_mut(), policy);
+                    spmv::scatter(buf, y.as_raw(), 1, w.as_raw_mut(), policy);
+                }
+                else
+                {
+                    spmv::scatter(buf, v.as_raw(), 1, y.as_raw_mut(), policy);
+                    spmv::gather(buf, y.as_raw(), 1, w.as_raw_mut(), policy);
+                }
+            }
+        }
+    } // namespace reduction
+} // namespace internal
+
+namespace reduction
+{
+    template <typename M>
+    using element_t = typename internal::reduction::traits<M>::Type;
+
+    /// Sum of all elements, accumulated under Acc
+    template <typename Acc = accumulate::Native, typename M>
+    accumulate::result_t<Acc, element_t<M>> sum(const M &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        using T = element_t<M>;
+        using A = accumulate::Accumulator<Acc, T>;
+        using namespace internal::reduction;
+        if constexpr (std::is_same<Acc, accumulate::Compensated>::value && simd::is_vectorizable<T>::value && has_run<M>::value)
+        {
+            // compensated lanes as a SIMD kernel, the missing elements of sparse matrices add nothing
+            const auto r = run(m);
+            return accumulate::reduce<Acc, T>(policy, r.second, [&](size_t begin, size_t end) {
+                return simd::sum_compensated(r.first + begin, end - begin);
+            });
+        }
+        else
+            return fold(m, A(), Merge<A>(), Element<A>(), policy).value();
+    }
+
+    /// Smallest element
+    template <typename M>
+    element_t<M> min(const M &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        using namespace internal::reduction;
+        if (size(m) == 0)
+            PANIC("Minimum of an empty matrix");
+        return fold(m, any_element(m), Extreme<false>(), Identity(), policy);
+    }
+
+    /// Largest element
+    template <typename M>
+    element_t<M> max(const M &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        using namespace internal::reduction;
+        if (size(m) == 0)
+            PANIC("Maximum of an empty matrix");
+        return fold(m, any_element(m), Extreme<true>(), Identity(), policy);
+    }
+
+    /// Row major index (row * cols + column) of the first smallest element
+    template <typename M>
+    size_t argmin(const M &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        if (internal::reduction::size(m) == 0)
+            PANIC("Minimum of an empty matrix");
+        return internal::reduction::arg_extreme<false>(m, policy);
+    }
+
+    /// Row major index (row * cols + column) of the first largest element
+    template <typename M>
+    size_t argmax(const M &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        if (internal::reduction::size(m) == 0)
+            PANIC("Maximum of an empty matrix");
+        return internal::reduction::arg_extreme<true>(m, policy);
+    }
+
+    /// Square root of the sum of the squared elements, accumulated under Acc
+    template <typename Acc = accumulate::Native, typename M>
+    accumulate::result_t<Acc, element_t<M>> frobenius_norm(const M &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        using T = element_t<M>;
+        using A = accumulate::Accumulator<Acc, T>;
+        using R = accumulate::result_t<Acc, T>;
+        using namespace internal::reduction;
+        if constexpr (!std::is_same<Acc, accumulate::Native>::value && simd::is_vectorizable<T>::value && has_run<M>::value)
+        {
+            // the dot product kernels of the policy per chunk, Native stays pairwise
+            const auto r = run(m);
+            return static_cast<R>(std::sqrt(accumulate::reduce<Acc, T>(policy, r.second, [&](size_t begin, size_t end) {
+                return accumulate::dot<Acc>(r.first + begin, r.first + begin, end - begin);
+            })));
+        }
+        else
+            return static_cast<R>(std::sqrt(fold(m, A(), Merge<A>(), Square<A>(), policy).value()));
+    }
+
+    /// init op f(x) over the elements x of every row as a column vector, op has to be associative and commutative
+    template <typename M, typename R, typename Op, typename F = internal::reduction::Identity>
+    typename internal::reduction::traits<M>::template Column<R>
+    per_row(const M &m, R init, const Op &op, const F &f = F(), const parallel::Policy &policy = parallel::global_policy())
+    {
+        using Tr = internal::reduction::traits<M>;
+        using Line = typename Tr::template Column<R>;
+        const auto v = internal::reduction::fold_lines<true>(m, init, op, f, policy);
+        return Tr::template line<Line>(v, true);
+    }
+
+    /// init op f(x) over the elements x of every column as a row vector, op has to be associative and commutative
+    template <typename M, typename R, typename Op, typename F = internal::reduction::Identity>
+    typename internal::reduction::traits<M>::template Row<R>
+    per_column(const M &m, R init, const Op &op, const F &f = F(), const parallel::Policy &policy = parallel::global_policy())
+    {
+        using Tr = internal::reduction::traits<M>;
+        using Line = typename Tr::template Row<R>;
+        const auto v = internal::reduction::fold_lines<false>(m, init, op, f, policy);
+        return Tr::template line<Line>(v, false);
+    }
+
+    /// Sum of every row as a column vector, accumulated under Acc
+    template <typename Acc = accumulate::Native, typename M>
+    auto row_sums(const M &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        using A = accumulate::Accumulator<Acc, element_t<M>>;
+        using namespace internal::reduction;
+        return per_row(m, A(), Merge<A>(), Element<A>(), policy).map([](const A &a) { return a.value(); });
+    }
+
+    /// Sum of every column as a row vector, accumulated under Acc
+    template <typename Acc = accumulate::Native, typename M>
+    auto col_sums(const M &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        using A = accumulate::Accumulator<Acc, element_t<M>>;
+        using namespace internal::reduction;
+        return per_column(m, A(), Merge<A>(), Element<A>(), policy).map([](const A &a) { return a.value(); });
+    }
+
+    /// Largest column sum of |x|, for vectors the sum of |x|, accumulated under Acc
+    template <typename Acc = accumulate::Native, typename M>
+    accumulate::result_t<Acc, element_t<M>> norm_1(const M &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        using A = accumulate::Accumulator<Acc, element_t<M>>;
+        using R = accumulate::result_t<Acc, element_t<M>>;
+        using namespace internal::reduction;
+        if (traits<M>::rows(m) == 1 || traits<M>::cols(m) == 1)
+            return fold(m, A(), Merge<A>(), Magnitude<A>(), policy).value();
+        auto norm = R();
+        for (auto &&a : fold_lines<false>(m, A(), Merge<A>(), Magnitude<A>(), policy))
+            norm = std::max(norm, a.value());
+        return norm;
+    }
+
+    /// Largest row sum of |x|, for vectors the largest |x|, accumulated under Acc
+    template <typename Acc = accumulate::Native, typename M>
+    accumulate::result_t<Acc, element_t<M>> norm_inf(const M &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        using T = element_t<M>;
+        using A = accumulate::Accumulator<Acc, T>;
+        using R = accumulate::result_t<Acc, T>;
+        using namespace internal::reduction;
+        if (traits<M>::rows(m) == 1 || traits<M>::cols(m) == 1)
+            return static_cast<R>(fold(m, T(), Extreme<true>(), [](const T &x) { return magnitude(x); }, policy));
+        auto norm = R();
+        for (auto &&a : fold_lines<true>(m, A(), Merge<A>(), Magnitude<A>(), policy))
+            norm = std::max(norm, a.value());
+        return norm;
+    }
+
+    /// Largest singular value by power iteration, for vectors the Euclidean length, accumulated under Acc
+    template <typename Acc = accumulate::Native, typename M>
+    accumulate::result_t<Acc, element_t<M>> norm_2(const M &m, const parallel::Policy &policy = parallel::global_policy())
+    {
+        using T = element_t<M>;
+        using R = accumulate::result_t<Acc, T>;
+        using namespace internal::reduction;
+        const size_t rows = traits<M>::rows(m);
+        const size_t cols = traits<M>::cols(m);
+        if (rows == 1 || cols == 1)
+            return frobenius_norm<Acc>(m, policy);
+        if constexpr (!std::is_floating_point<T>::value)
+        {
+            PANIC("norm_2 of a matrix needs floating point elements");
+            return R();
+        }
+        else
+        {
+            if (rows == 0 || cols == 0)
+                return R();
+            // uneven, so a matrix with equal columns isn't annihilated by the start
+            auto start = std::vector<T>(cols);
+            for (size_t j = 0; j < cols; ++j)
+                start[j] = T(1) + T(j % 5) / T(8);
+            const auto &a = operand(m);
+            auto v = column_copy(start);
+            v *= T(1) / T(frobenius_norm<Acc>(v, policy));
+            auto y = DynMat<T>(rows, 1, memory::uninitialized);
+            auto w = DynMat<T>(cols, 1, memory::uninitialized);
+            auto r = DynMat<T>(cols, 1, memory::uninitialized);
+            const R epsilon = std::numeric_limits<T>::epsilon();
+            R sigma = R();
+            for (size_t k = 0; k < MAX_ITERATIONS; ++k)
+            {
+                // |A v| of a unit v is a lower bound that converges to the largest singular value
+                normal_product(a, v, y, w, policy);
+                const R s = frobenius_norm<Acc>(y, policy);
+                if (s == R())
+                    return s;
+                // r = A^T A v - s^2 v vanishes once v is a singular vector, up to the rounding of the products
+                const T s2 = T(s * s);
+                for (size_t j = 0; j < cols; ++j)
+                    r.as_raw_mut()[j] = w.as_raw()[j] - s2 * v.as_raw()[j];
+                const bool converged = frobenius_norm<Acc>(r, policy) <= R(RESIDUAL) * epsilon * s * s ||
+                                       std::abs(s - sigma) <= epsilon * s;
+                sigma = s;
+                if (converged)
+                    break;
+                const R norm = frobenius_norm<Acc>(w, policy);
+                if (norm == R())
+                    return s;
+                std::swap(v, w);
+                v *= T(1) / T(norm);
+            }
+            return sigma;
+        }
+    }
+} // namespace reduction
+
+#endif // REDUCTIONS_H
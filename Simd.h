@@ -0,0 +1,534 @@
+#if !defined(SIMD_H)
+#define SIMD_H
+
+#include <cstddef>
+#include <cstdlib> // getenv
+#include <cstring> // memcpy, strcmp
+#include <type_traits>
+
+#include "util.h"
+
+/* Vectorized kernels for contiguous float / double storage with runtime ISA dispatch
+
+Every kernel has one generic body that is compiled several times, once per instruction set, through the
+target attribute. The widest set the CPU supports is picked on first use, so a single binary runs AVX-512
+on machines that have it and falls back to AVX2 / SSE2 elsewhere. Setting the environment variable
+MATRAC_SIMD to scalar, sse2, avx2 or avx512 (or calling simd::set_isa) caps the choice.
+
+Remainders that don't fill a whole register are handled with the same scalar expression as the scalar
+kernel, so elementwise results don't depend on the selected ISA. dot() always accumulates in 64 / sizeof(T)
+lanes (the width of an AVX-512 register) and reduces them in a fixed order, so its result is identical for
+every ISA as well. The same holds for dot_compensated() / sum_compensated(), which carry a TwoSum error term
+per lane, and dot_wide(), which accumulates float in 32 double lanes (see Accumulate.h for the policies built on them).
+*/
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define MATRAC_SIMD_X86 1
+#define MATRAC_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MATRAC_SIMD_X86 0
+#define MATRAC_TARGET(isa)
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MATRAC_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define MATRAC_ALWAYS_INLINE inline
+#endif
+
+// __builtin_shufflevector, for the register transposes of Transpose.h and Small.h
+#if defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 12)
+#define MATRAC_HAS_SHUFFLEVECTOR 1
+#else
+#define MATRAC_HAS_SHUFFLEVECTOR 0
+#endif
+
+// Keeps the compiler from fusing a * b + c into an FMA, which would make reductions ISA dependent
+#if defined(__GNUC__) && !defined(__clang__)
+#define MATRAC_NO_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define MATRAC_NO_CONTRACT
+#endif
+
+namespace simd
+{
+    enum class Isa
+    {
+        Scalar = 0,
+        SSE2 = 1,
+        AVX2 = 2,
+        AVX512 = 3,
+    };
+
+    inline const char *isa_name(Isa isa)
+    {
+        switch (isa)
+        {
+        case Isa::SSE2:
+            return "sse2";
+        case Isa::AVX2:
+            return "avx2";
+        case Isa::AVX512:
+            return "avx512";
+        default:
+            return "scalar";
+        }
+    }
+
+    /// Widest instruction set supported by the CPU we're running on
+    inline Isa detected_isa()
+    {
+#if MATRAC_SIMD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            return Isa::AVX512;
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            return Isa::AVX2;
+        if (__builtin_cpu_supports("sse2"))
+            return Isa::SSE2;
+#endif
+        return Isa::Scalar;
+    }
+
+    inline Isa &isa_slot()
+    {
+        static Isa isa = [] {
+            auto isa = detected_isa();
+            if (auto env = std::getenv("MATRAC_SIMD"))
+            {
+                for (auto cap : {Isa::Scalar, Isa::SSE2, Isa::AVX2, Isa::AVX512})
+                    if (std::strcmp(env, isa_name(cap)) == 0 && cap < isa)
+                        isa = cap;
+            }
+            return isa;
+        }();
+        return isa;
+    }
+
+    /// Instruction set the kernels currently dispatch to
+    inline Isa active_isa() { return isa_slot(); }
+
+    /// Restricts dispatch to `isa`, requests beyond what the CPU supports are capped
+    inline void set_isa(Isa isa)
+    {
+        auto detected = detected_isa();
+        isa_slot() = isa < detected ? isa : detected;
+    }
+
+    /* W lanes of T. W == 1 is plain scalar code, wider packs use the GCC / Clang vector extension, whose
+    operators compile to the instructions of the enclosing function's target.
+    Packs are only ever passed by reference, so no function signature depends on the vector ABI.
+    */
+    template <typename T, size_t W>
+    struct Pack
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        typedef T Vec __attribute__((vector_size(W * sizeof(T))));
+#endif
+        static MATRAC_ALWAYS_INLINE void load(Vec &v, const T *p) { std::memcpy(&v, p, sizeof(Vec)); }
+        static MATRAC_ALWAYS_INLINE void store(T *p, const Vec &v) { std::memcpy(p, &v, sizeof(Vec)); }
+        static MATRAC_ALWAYS_INLINE void broadcast(Vec &v, T x)
+        {
+            v = Vec{};
+            v += x;
+        }
+    };
+
+    template <typename T>
+    struct Pack<T, 1>
+    {
+        using Vec = T;
+        static MATRAC_ALWAYS_INLINE void load(Vec &v, const T *p) { v = *p; }
+        static MATRAC_ALWAYS_INLINE void store(T *p, const Vec &v) { *p = v; }
+        static MATRAC_ALWAYS_INLINE void broadcast(Vec &v, T x) { v = x; }
+    };
+
+    // x = x op y, for single elements as well as for whole packs
+    struct AddOp
+    {
+        template <typename V>
+        static MATRAC_ALWAYS_INLINE void apply(V &x, const V &y) { x += y; }
+    };
+
+    struct SubOp
+    {
+        template <typename V>
+        static MATRAC_ALWAYS_INLINE void apply(V &x, const V &y) { x -= y; }
+    };
+
+    struct MulOp
+    {
+        template <typename V>
+        static MATRAC_ALWAYS_INLINE void apply(V &x, const V &y) { x *= y; }
+    };
+
+    struct DivOp
+    {
+        template <typename V>
+        static MATRAC_ALWAYS_INLINE void apply(V &x, const V &y) { x /= y; }
+    };
+
+    /// out[i] = a[i] op b[i]
+    template <typename Op, typename T, size_t W>
+    MATRAC_ALWAYS_INLINE void binary_impl(const T *a, const T *b, T *out, size_t n)
+    {
+        using P = Pack<T, W>;
+        typename P::Vec x, y;
+        size_t i = 0;
+        for (; i + W <= n; i += W)
+        {
+            P::load(x, a + i);
+            P::load(y, b + i);
+            Op::apply(x, y);
+            P::store(out + i, x);
+        }
+        for (; i < n; ++i)
+        {
+            T e = a[i];
+            Op::apply(e, b[i]);
+            out[i] = e;
+        }
+    }
+
+    /// out[i] = a[i] op s
+    template <typename Op, typename T, size_t W>
+    MATRAC_ALWAYS_INLINE void scalar_impl(const T *a, T s, T *out, size_t n)
+    {
+        using P = Pack<T, W>;
+        typename P::Vec x, sv;
+        P::broadcast(sv, s);
+        size_t i = 0;
+        for (; i + W <= n; i += W)
+        {
+            P::load(x, a + i);
+            Op::apply(x, sv);
+            P::store(out + i, x);
+        }
+        for (; i < n; ++i)
+        {
+            T e = a[i];
+            Op::apply(e, s);
+            out[i] = e;
+        }
+    }
+
+    /// sum of a[i] * b[i], accumulated in 64 / sizeof(T) lanes independent of W
+    template <typename T, size_t W>
+    MATRAC_ALWAYS_INLINE T dot_impl(const T *a, const T *b, size_t n)
+    {
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+        using P = Pack<T, W>;
+        const size_t L = 64 / sizeof(T);
+        const size_t R = L / W;
+        typename P::Vec acc[R], x, y;
+        for (size_t r = 0; r < R; ++r)
+            P::broadcast(acc[r], T());
+        size_t i = 0;
+        for (; i + L <= n; i += L)
+            for (size_t r = 0; r < R; ++r)
+            {
+                P::load(x, a + i + r * W);
+                P::load(y, b + i + r * W);
+                acc[r] += x * y;
+            }
+
+        T lanes[L];
+        for (size_t r = 0; r < R; ++r)
+            P::store(lanes + r * W, acc[r]);
+        for (size_t w = L / 2; w > 0; w /= 2)
+            for (size_t j = 0; j < w; ++j)
+                lanes[j] += lanes[j + w];
+
+        T sum = lanes[0];
+        for (; i < n; ++i)
+            sum += a[i] * b[i];
+        return sum;
+    }
+
+    /// s + e == a + b exactly, without branches (Knuth's TwoSum), needs strict IEEE semantics
+    template <typename V>
+    MATRAC_ALWAYS_INLINE void two_sum(V &s, V &e, const V &a, const V &b)
+    {
+        s = a + b;
+        const V z = s - a;
+        e = (a - (s - z)) + (b - z);
+    }
+
+    /// sum of a[i] * b[i] (or of a[i] without PRODUCT) with compensated accumulation, a TwoSum error term per lane
+    template <typename T, size_t W, bool PRODUCT = true>
+    MATRAC_ALWAYS_INLINE T dot_compensated_impl(const T *a, const T *b, size_t n)
+    {
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+        using P = Pack<T, W>;
+        const size_t L = 64 / sizeof(T);
+        const size_t R = L / W;
+        typename P::Vec acc[R], comp[R], x, y, e;
+        for (size_t r = 0; r < R; ++r)
+        {
+            P::broadcast(acc[r], T());
+            P::broadcast(comp[r], T());
+        }
+        size_t i = 0;
+        for (; i + L <= n; i += L)
+            for (size_t r = 0; r < R; ++r)
+            {
+                P::load(x, a + i + r * W);
+                if constexpr (PRODUCT)
+                {
+                    P::load(y, b + i + r * W);
+                    x *= y;
+                }
+                two_sum(y, e, acc[r], x);
+                acc[r] = y;
+                comp[r] += e;
+            }
+
+        T lanes[L], errors[L];
+        for (size_t r = 0; r < R; ++r)
+        {
+            P::store(lanes + r * W, acc[r]);
+            P::store(errors + r * W, comp[r]);
+        }
+        T sum = T(), error = T(), t, f;
+        for (size_t j = 0; j < L; ++j)
+        {
+            two_sum(t, f, sum, lanes[j]);
+            sum = t;
+            error += f + errors[j];
+        }
+        for (; i < n; ++i)
+        {
+            two_sum(t, f, sum, PRODUCT ? a[i] * b[i] : a[i]);
+            sum = t;
+            error += f;
+        }
+        return sum + error;
+    }
+
+    /// Converts W floats to W doubles
+    template <size_t W>
+    MATRAC_ALWAYS_INLINE void widen(typename Pack<double, W>::Vec &v, const float *p)
+    {
+        typename Pack<float, W>::Vec x;
+        std::memcpy(&x, p, sizeof(x));
+        v = __builtin_convertvector(x, typename Pack<double, W>::Vec);
+    }
+
+    template <>
+    MATRAC_ALWAYS_INLINE void widen<1>(double &v, const float *p) { v = *p; }
+
+    /// sum of a[i] * b[i] for float storage, accumulated in 32 double lanes (4 AVX-512 registers), W is the number of doubles per register
+    template <typename T, size_t W>
+    MATRAC_ALWAYS_INLINE double dot_wide_impl(const T *a, const T *b, size_t n)
+    {
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+        if constexpr (std::is_same<T, double>::value)
+            return dot_impl<double, W>(a, b, n);
+        else
+        {
+            using P = Pack<double, W>;
+            const size_t L = 32;
+            const size_t R = L / W;
+            typename P::Vec acc[R], x, y;
+            for (size_t r = 0; r < R; ++r)
+                P::broadcast(acc[r], 0.0);
+            size_t i = 0;
+            for (; i + L <= n; i += L)
+            // unrolled, so the accumulators stay in registers
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC unroll 32
+#endif
+                for (size_t r = 0; r < R; ++r)
+                {
+                    widen<W>(x, a + i + r * W);
+                    widen<W>(y, b + i + r * W);
+                    acc[r] += x * y;
+                }
+
+            double lanes[L];
+            for (size_t r = 0; r < R; ++r)
+                P::store(lanes + r * W, acc[r]);
+            for (size_t w = L / 2; w > 0; w /= 2)
+                for (size_t j = 0; j < w; ++j)
+                    lanes[j] += lanes[j + w];
+
+            double sum = lanes[0];
+            for (; i < n; ++i)
+                sum += double(a[i]) * double(b[i]);
+            return sum;
+        }
+    }
+
+    /// Function table of all kernels for one element type and instruction set
+    template <typename T>
+    struct Kernels
+    {
+        void (*add)(const T *, const T *, T *, size_t);
+        void (*sub)(const T *, const T *, T *, size_t);
+        void (*mul)(const T *, const T *, T *, size_t);
+        void (*scale)(const T *, T, T *, size_t);
+        void (*divide)(const T *, T, T *, size_t);
+        T (*dot)(const T *, const T *, size_t);
+        T (*dot_compensated)(const T *, const T *, size_t);
+        double (*dot_wide)(const T *, const T *, size_t);
+        T (*sum_compensated)(const T *, size_t);
+    };
+
+    // Stamps out the kernel table for one instruction set, W is the number of lanes of T in a register
+#define MATRAC_SIMD_KERNELS(NAME, TARGET, W)                                                                     \
+    template <typename T>                                                                                        \
+    struct NAME                                                                                                  \
+    {                                                                                                            \
+        static const size_t WIDTH = W;                                                                           \
+        TARGET static void add(const T *a, const T *b, T *out, size_t n) { binary_impl<AddOp, T, W>(a, b, out, n); } \
+        TARGET static void sub(const T *a, const T *b, T *out, size_t n) { binary_impl<SubOp, T, W>(a, b, out, n); } \
+        TARGET static void mul(const T *a, const T *b, T *out, size_t n) { binary_impl<MulOp, T, W>(a, b, out, n); } \
+        TARGET static void scale(const T *a, T s, T *out, size_t n) { scalar_impl<MulOp, T, W>(a, s, out, n); }     \
+        TARGET static void divide(const T *a, T s, T *out, size_t n) { scalar_impl<DivOp, T, W>(a, s, out, n); }    \
+        TARGET MATRAC_NO_CONTRACT static T dot(const T *a, const T *b, size_t n) { return dot_impl<T, W>(a, b, n); } \
+        TARGET MATRAC_NO_CONTRACT static T dot_compensated(const T *a, const T *b, size_t n)                  \
+        {                                                                                                        \
+            return dot_compensated_impl<T, W>(a, b, n);                                                          \
+        }                                                                                                        \
+        TARGET MATRAC_NO_CONTRACT static double dot_wide(const T *a, const T *b, size_t n)                     \
+        {                                                                                                        \
+            return dot_wide_impl<T, (W * sizeof(T) + 7) / 8>(a, b, n);                                           \
+        }                                                                                                        \
+        TARGET MATRAC_NO_CONTRACT static T sum_compensated(const T *a, size_t n)                                \
+        {                                                                                                        \
+            return dot_compensated_impl<T, W, false>(a, a, n);                                                   \
+        }                                                                                                        \
+        static Kernels<T> table()                                                                                \
+        {                                                                                                        \
+            return Kernels<T>{add, sub, mul, scale, divide, dot, dot_compensated, dot_wide, sum_compensated};   \
+        }                                                                                                        \
+    };
+
+    MATRAC_SIMD_KERNELS(ScalarKernels, , 1)
+#if MATRAC_SIMD_X86
+    MATRAC_SIMD_KERNELS(Sse2Kernels, MATRAC_TARGET("sse2"), 16 / sizeof(T))
+    MATRAC_SIMD_KERNELS(Avx2Kernels, MATRAC_TARGET("avx2"), 32 / sizeof(T))
+    MATRAC_SIMD_KERNELS(Avx512Kernels, MATRAC_TARGET("avx512f"), 64 / sizeof(T))
+#endif
+#undef MATRAC_SIMD_KERNELS
+
+    template <typename T>
+    Kernels<T> kernels_for(Isa isa)
+    {
+#if MATRAC_SIMD_X86
+        switch (isa)
+        {
+        case Isa::AVX512:
+            return Avx512Kernels<T>::table();
+        case Isa::AVX2:
+            return Avx2Kernels<T>::table();
+        case Isa::SSE2:
+            return Sse2Kernels<T>::table();
+        default:
+            break;
+        }
+#endif
+        return ScalarKernels<T>::table();
+    }
+
+    /// Kernel table of the active instruction set
+    template <typename T>
+    inline const Kernels<T> &kernels()
+    {
+        static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value,
+                      "SIMD kernels are only available for float and double");
+        thread_local Isa isa = active_isa();
+        thread_local Kernels<T> table = kernels_for<T>(isa);
+        if (isa != active_isa())
+        {
+            isa = active_isa();
+            table = kernels_for<T>(isa);
+        }
+        return table;
+    }
+
+    /// True for element types that have SIMD kernels
+    template <typename T>
+    struct is_vectorizable : std::integral_constant<bool, std::is_same<T, float>::value || std::is_same<T, double>::value>
+    {
+    };
+
+    // Below this length the call through the table costs more than it saves
+    const size_t DISPATCH_MIN_SIZE = 32;
+
+    template <typename T>
+    inline void add(const T *a, const T *b, T *out, size_t n)
+    {
+        if (n < DISPATCH_MIN_SIZE)
+            return binary_impl<AddOp, T, 1>(a, b, out, n);
+        kernels<T>().add(a, b, out, n);
+    }
+
+    template <typename T>
+    inline void sub(const T *a, const T *b, T *out, size_t n)
+    {
+        if (n < DISPATCH_MIN_SIZE)
+            return binary_impl<SubOp, T, 1>(a, b, out, n);
+        kernels<T>().sub(a, b, out, n);
+    }
+
+    template <typename T>
+    inline void mul(const T *a, const T *b, T *out, size_t n)
+    {
+        if (n < DISPATCH_MIN_SIZE)
+            return binary_impl<MulOp, T, 1>(a, b, out, n);
+        kernels<T>().mul(a, b, out, n);
+    }
+
+    template <typename T>
+    inline void scale(const T *a, T s, T *out, size_t n)
+    {
+        if (n < DISPATCH_MIN_SIZE)
+            return scalar_impl<MulOp, T, 1>(a, s, out, n);
+        kernels<T>().scale(a, s, out, n);
+    }
+
+    template <typename T>
+    inline void divide(const T *a, T s, T *out, size_t n)
+    {
+        if (n < DISPATCH_MIN_SIZE)
+            return scalar_impl<DivOp, T, 1>(a, s, out, n);
+        kernels<T>().divide(a, s, out, n);
+    }
+
+    // no inline shortcut here, the dispatched versions are compiled without FMA contraction
+    template <typename T>
+    inline T dot(const T *a, const T *b, size_t n)
+    {
+        return kernels<T>().dot(a, b, n);
+    }
+
+    /// dot() with an error that doesn't grow with n, about twice the arithmetic for the same memory traffic
+    template <typename T>
+    inline T dot_compensated(const T *a, const T *b, size_t n)
+    {
+        return kernels<T>().dot_compensated(a, b, n);
+    }
+
+    /// sum of a[i] with the error terms of dot_compensated()
+    template <typename T>
+    inline T sum_compensated(const T *a, size_t n)
+    {
+        return kernels<T>().sum_compensated(a, n);
+    }
+
+    /// dot() accumulated and returned in double, float operands are widened in registers
+    template <typename T>
+    inline double dot_wide(const T *a, const T *b, size_t n)
+    {
+        return kernels<T>().dot_wide(a, b, n);
+    }
+} // namespace simd
+
+#endif // SIMD_H
@@ -0,0 +1,330 @@
+#if !defined(SMALL_H)
+#define SMALL_H
+
+#include <algorithm> // copy, fill, swap_ranges
+#include <cmath>     // abs
+#include <cstddef>
+#include <cstring> // memcpy
+#include <memory>  // unique_ptr
+#include <type_traits>
+#include <utility> // index_sequence, swap
+
+#include "util.h"
+#include "Simd.h"
+
+/* Unrolled kernels for the small float / double Mats used for transforms (Mat<double, 4, 4> and friends)
+
+Products, transposes, inverses and determinants of 2x2, 3x3 and 4x4 matrices are written out at compile
+time instead of going through Range loops. Rows are held in GCC / clang vector types, 3 element rows padded
+to 4 lanes, so they live in SSE / AVX registers when the translation unit is compiled for them (there's no
+runtime dispatch, a call costs a few nanoseconds). The 4x4 inverse works on the four 2x2 blocks of the
+matrix as whole registers, following Eric Zhang's block inversion.
+
+Mat picks these automatically, the generic_* functions are the paths for all other shapes and types.
+*/
+
+namespace internal
+{
+    namespace small
+    {
+        /// True for the element types and sizes with unrolled kernels
+        template <typename T, size_t N>
+        struct is_small : std::integral_constant<bool, (std::is_same<T, float>::value || std::is_same<T, double>::value) &&
+                                                           N >= 2 && N <= 4>
+        {
+        };
+
+        /// c = a * b for an m x k matrix a and a k x n matrix b, c must not overlap a or b
+        template <typename T>
+        void generic_multiply(const T *a, const T *b, T *c, size_t m, size_t k, size_t n)
+        {
+            for (size_t i = 0; i < m; ++i)
+                for (size_t j = 0; j < n; ++j)
+                {
+                    auto sum = T();
+                    for (size_t p = 0; p < k; ++p)
+                        sum += a[i * k + p] * b[p * n + j];
+                    c[i * n + j] = sum;
+                }
+        }
+
+        /// Determinant of an n x n matrix by Gaussian elimination with partial pivoting on a copy
+        template <typename T>
+        T generic_determinant(const T *a, size_t n)
+        {
+            auto lu = std::unique_ptr<T[]>(new T[n * n]);
+            std::copy(a, a + n * n, lu.get());
+            T det = T(1);
+            for (size_t k = 0; k < n; ++k)
+            {
+                size_t p = k;
+                for (size_t i = k + 1; i < n; ++i)
+                    if (std::abs(lu[i * n + k]) > std::abs(lu[p * n + k]))
+                        p = i;
+                if (lu[p * n + k] == T(0))
+                    return T(0);
+                if (p != k)
+                {
+                    std::swap_ranges(lu.get() + k * n, lu.get() + (k + 1) * n, lu.get() + p * n);
+                    det = -det;
+                }
+                det *= lu[k * n + k];
+                for (size_t i = k + 1; i < n; ++i)
+                {
+                    const T f = lu[i * n + k] / lu[k * n + k];
+                    for (size_t j = k + 1; j < n; ++j)
+                        lu[i * n + j] -= f * lu[k * n + j];
+                }
+            }
+            return det;
+        }
+
+        /// b = a^-1 for an n x n matrix a by Gauss-Jordan elimination with partial pivoting, b may be a
+        template <typename T>
+        void generic_inverse(const T *a, T *b, size_t n)
+        {
+            auto m = std::unique_ptr<T[]>(new T[n * n]);
+            std::copy(a, a + n * n, m.get());
+            std::fill(b, b + n * n, T(0));
+            for (size_t i = 0; i < n; ++i)
+                b[i * n + i] = T(1);
+            for (size_t k = 0; k < n; ++k)
+            {
+                size_t p = k;
+                for (size_t i = k + 1; i < n; ++i)
+                    if (std::abs(m[i * n + k]) > std::abs(m[p * n + k]))
+                        p = i;
+                if (m[p * n + k] == T(0))
+                    PANIC("Matrix is singular");
+                if (p != k)
+                {
+                    std::swap_ranges(m.get() + k * n, m.get() + (k + 1) * n, m.get() + p * n);
+                    std::swap_ranges(b + k * n, b + (k + 1) * n, b + p * n);
+                }
+                const T pivot = m[k * n + k];
+                for (size_t j = 0; j < n; ++j)
+                {
+                    m[k * n + j] /= pivot;
+                    b[k * n + j] /= pivot;
+                }
+                for (size_t i = 0; i < n; ++i)
+                {
+                    const T f = m[i * n + k];
+                    if (i == k || f == T(0))
+                        continue;
+                    for (size_t j = 0; j < n; ++j)
+                    {
+                        m[i * n + j] -= f * m[k * n + j];
+                        b[i * n + j] -= f * b[k * n + j];
+                    }
+                }
+            }
+        }
+
+        /// A row of N elements in one vector, 3 elements are padded to 4
+        template <typename T, size_t N>
+        struct Row
+        {
+            static constexpr size_t LANES = N == 3 ? 4 : N;
+            typedef T V __attribute__((vector_size(LANES * sizeof(T))));
+        };
+
+        // vectors are only ever passed by reference, by value 32 byte ones would need AVX for a stable ABI
+
+        template <typename T, size_t N>
+        MATRAC_ALWAYS_INLINE void load(typename Row<T, N>::V &v, const T *p)
+        {
+            v = typename Row<T, N>::V{};
+            std::memcpy(&v, p, N * sizeof(T));
+        }
+
+        template <typename T, size_t N>
+        MATRAC_ALWAYS_INLINE void store(T *p, const typename Row<T, N>::V &v)
+        {
+            std::memcpy(p, &v, N * sizeof(T));
+        }
+
+        /// A row of a * b: a(i, 0) * b_0 + a(i, 1) * b_1 + ... over the rows b_k of b
+        template <typename T, size_t N, size_t... P>
+        MATRAC_ALWAYS_INLINE void combine(T *c_row, const T *a_row, const typename Row<T, N>::V *b, std::index_sequence<P...>)
+        {
+            const typename Row<T, N>::V r = ((a_row[P] * b[P]) + ...);
+            store<T, N>(c_row, r);
+        }
+
+        /// c = a * b for an M x K matrix a and a K x N matrix b, c must not overlap a or b
+        template <typename T, size_t M, size_t K, size_t N, size_t... P, size_t... I>
+        MATRAC_ALWAYS_INLINE void multiply(const T *a, const T *b, T *c, std::index_sequence<P...>, std::index_sequence<I...>)
+        {
+            typename Row<T, N>::V rows[K];
+            (load<T, N>(rows[P], b + P * N), ...);
+            (combine<T, N>(c + I * N, a + I * K, rows, std::index_sequence<P...>()), ...);
+        }
+
+        /// Element (i, j) of a * b one multiply-add after the other, for rows that don't fill a register
+        template <typename T, size_t K, size_t N, size_t... P>
+        MATRAC_ALWAYS_INLINE T combine_scalar(const T *a_row, const T *b, size_t j, std::index_sequence<P...>)
+        {
+            return ((a_row[P] * b[P * N + j]) + ...);
+        }
+
+        template <typename T, size_t M, size_t K, size_t N>
+        MATRAC_ALWAYS_INLINE void multiply(const T *a, const T *b, T *c)
+        {
+            // padding 3 element rows costs more in moves than it saves in multiplies
+            if constexpr (N == 3)
+            {
+                for (size_t i = 0; i < M; ++i)
+                    for (size_t j = 0; j < N; ++j)
+                        c[i * N + j] = combine_scalar<T, K, N>(a + i * K, b, j, std::make_index_sequence<K>());
+            }
+            else
+                multiply<T, M, K, N>(a, b, c, std::make_index_sequence<K>(), std::make_index_sequence<M>());
+        }
+
+        /// b = a^T for an N x N matrix a, b may be a
+        template <typename T, size_t N>
+        MATRAC_ALWAYS_INLINE void transpose(const T *a, T *b)
+        {
+            // with constant bounds the compiler turns this into unpack / shuffle instructions on its own
+            T t[N * N];
+            for (size_t i = 0; i < N; ++i)
+                for (size_t j = 0; j < N; ++j)
+                    t[j * N + i] = a[i * N + j];
+            std::memcpy(b, t, sizeof(t));
+        }
+
+#if MATRAC_HAS_SHUFFLEVECTOR
+        /* The 4x4 matrix in a as its 2x2 blocks A B / C D, each one register [x00 x01 x10 x11], with their
+        determinants in det, the products adj(A) B and adj(D) C and det(M)
+        = det(A) det(D) + det(B) det(C) - tr(adj(A) B adj(D) C)
+        */
+        template <typename T>
+        struct Blocks
+        {
+            using V = typename Row<T, 4>::V;
+            V A, B, C, D, det, AB, DC;
+            T det_m;
+
+            MATRAC_ALWAYS_INLINE explicit Blocks(const T *a)
+            {
+                V r0, r1, r2, r3;
+                load<T, 4>(r0, a);
+                load<T, 4>(r1, a + 4);
+                load<T, 4>(r2, a + 8);
+                load<T, 4>(r3, a + 12);
+                A = __builtin_shufflevector(r0, r1, 0, 1, 4, 5);
+                B = __builtin_shufflevector(r0, r1, 2, 3, 6, 7);
+                C = __builtin_shufflevector(r2, r3, 0, 1, 4, 5);
+                D = __builtin_shufflevector(r2, r3, 2, 3, 6, 7);
+                det = __builtin_shufflevector(r0, r2, 0, 2, 4, 6) * __builtin_shufflevector(r1, r3, 1, 3, 5, 7) -
+                      __builtin_shufflevector(r0, r2, 1, 3, 5, 7) * __builtin_shufflevector(r1, r3, 0, 2, 4, 6);
+                adj_mul2(AB, A, B);
+                adj_mul2(DC, D, C);
+                const V tr = AB * __builtin_shufflevector(DC, DC, 0, 2, 1, 3);
+                det_m = det[0] * det[3] + det[1] * det[2] - ((tr[0] + tr[1]) + (tr[2] + tr[3]));
+            }
+
+            // out = a * b, adj(a) * b and a * adj(b) for 2x2 blocks
+            static MATRAC_ALWAYS_INLINE void mul2(V &out, const V &a, const V &b)
+            {
+                out = a * __builtin_shufflevector(b, b, 0, 3, 0, 3) +
+                      __builtin_shufflevector(a, a, 1, 0, 3, 2) * __builtin_shufflevector(b, b, 2, 1, 2, 1);
+            }
+
+            static MATRAC_ALWAYS_INLINE void adj_mul2(V &out, const V &a, const V &b)
+            {
+                out = __builtin_shufflevector(a, a, 3, 3, 0, 0) * b -
+                      __builtin_shufflevector(a, a, 1, 1, 2, 2) * __builtin_shufflevector(b, b, 2, 3, 0, 1);
+            }
+
+            static MATRAC_ALWAYS_INLINE void mul_adj2(V &out, const V &a, const V &b)
+            {
+                out = a * __builtin_shufflevector(b, b, 3, 0, 3, 0) -
+                      __builtin_shufflevector(a, a, 1, 0, 3, 2) * __builtin_shufflevector(b, b, 2, 1, 2, 1);
+            }
+        };
+#endif
+
+        /// Determinant of an N x N matrix
+        template <typename T, size_t N>
+        MATRAC_ALWAYS_INLINE T determinant(const T *a)
+        {
+            if constexpr (N == 2)
+                return a[0] * a[3] - a[1] * a[2];
+            else if constexpr (N == 3)
+                return a[0] * (a[4] * a[8] - a[5] * a[7]) -
+                       a[1] * (a[3] * a[8] - a[5] * a[6]) +
+                       a[2] * (a[3] * a[7] - a[4] * a[6]);
+            else
+            {
+#if MATRAC_HAS_SHUFFLEVECTOR
+                return Blocks<T>(a).det_m;
+#else
+                // Laplace expansion along the first two rows
+                const T s0 = a[0] * a[5] - a[4] * a[1], s1 = a[0] * a[6] - a[4] * a[2], s2 = a[0] * a[7] - a[4] * a[3];
+                const T s3 = a[1] * a[6] - a[5] * a[2], s4 = a[1] * a[7] - a[5] * a[3], s5 = a[2] * a[7] - a[6] * a[3];
+                const T c5 = a[10] * a[15] - a[14] * a[11], c4 = a[9] * a[15] - a[13] * a[11], c3 = a[9] * a[14] - a[13] * a[10];
+                const T c2 = a[8] * a[15] - a[12] * a[11], c1 = a[8] * a[14] - a[12] * a[10], c0 = a[8] * a[13] - a[12] * a[9];
+                return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+#endif
+            }
+        }
+
+        /// b = a^-1 for an N x N matrix a, b may be a. PANICs if a is singular
+        template <typename T, size_t N>
+        MATRAC_ALWAYS_INLINE void inverse(const T *a, T *b)
+        {
+            if constexpr (N == 2)
+            {
+                const T det = determinant<T, 2>(a);
+                if (det == T(0))
+                    PANIC("Matrix is singular");
+                const T a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3];
+                b[0] = a3 / det;
+                b[1] = -a1 / det;
+                b[2] = -a2 / det;
+                b[3] = a0 / det;
+            }
+            else if constexpr (N == 3)
+            {
+                // the columns of the inverse are r1 x r2, r2 x r0 and r0 x r1 over det
+                T c[9] = {a[4] * a[8] - a[5] * a[7], a[2] * a[7] - a[1] * a[8], a[1] * a[5] - a[2] * a[4],
+                          a[5] * a[6] - a[3] * a[8], a[0] * a[8] - a[2] * a[6], a[2] * a[3] - a[0] * a[5],
+                          a[3] * a[7] - a[4] * a[6], a[1] * a[6] - a[0] * a[7], a[0] * a[4] - a[1] * a[3]};
+                const T det = a[0] * c[0] + a[1] * c[3] + a[2] * c[6];
+                if (det == T(0))
+                    PANIC("Matrix is singular");
+                for (size_t i = 0; i < 9; ++i)
+                    b[i] = c[i] / det;
+            }
+            else
+            {
+#if MATRAC_HAS_SHUFFLEVECTOR
+                using M = Blocks<T>;
+                using V = typename M::V;
+                const auto m = M(a);
+                if (m.det_m == T(0))
+                    PANIC("Matrix is singular");
+                // adjugates of the blocks of the inverse, still in [x00 x01 x10 x11] order
+                V X, Y, Z, W;
+                M::mul2(X, m.B, m.DC);
+                M::mul2(W, m.C, m.AB);
+                M::mul_adj2(Y, m.D, m.AB);
+                M::mul_adj2(Z, m.A, m.DC);
+                const V sign = V{T(1), T(-1), T(-1), T(1)} / m.det_m;
+                const V x = (m.det[3] * m.A - X) * sign, y = (m.det[1] * m.C - Y) * sign;
+                const V z = (m.det[2] * m.B - Z) * sign, w = (m.det[0] * m.D - W) * sign;
+                store<T, 4>(b, __builtin_shufflevector(x, y, 3, 1, 7, 5));
+                store<T, 4>(b + 4, __builtin_shufflevector(x, y, 2, 0, 6, 4));
+                store<T, 4>(b + 8, __builtin_shufflevector(z, w, 3, 1, 7, 5));
+                store<T, 4>(b + 12, __builtin_shufflevector(z, w, 2, 0, 6, 4));
+#else
+                generic_inverse(a, b, 4);
+#endif
+            }
+        }
+    } // namespace small
+} // namespace internal
+
+#endif // SMALL_H
@@ -0,0 +1,786 @@
+#if !defined(SPARSE_H)
+#define SPARSE_H
+
+#include <algorithm> // lower_bound
+#include <iterator>
+#include <mutex>
+#include <type_traits>
+#include <utility> // pair, move
+#include <vector>
+
+#include "util.h"
+#include "Range.h"
+#include "DynMat.h"
+#include "ThreadPool.h"
+#include "Profile.h"
+
+/* Compressed sparse row (CSR) and column (CSC) storage
+
+Both plug into AbstractDynMat as its MemBuf, so CsrMat<T> / CscMat<T> support everything the other matrices
+do, but their real use is the nonzero-only iteration and kernels. Example:
+    auto a = to_csr(sparse_mat);             // O(nnz), also from dense DynMats and CSC
+    for (auto &&x : a.buffer().row(3))       // nonzeros of row 3, sorted by column
+        std::cout << x.first << ": " << x.second << std::endl;
+    auto b = to_csc(a);                      // O(nnz + cols)
+    DynMat<double> y = a * x;                // only touches the nonzeros, multiply(a, x, policy) for threads
+    DynMat<double> z = multiply_transposed(a, x); // a^T * x without forming a^T
+
+Reading a missing element gives T(), also through a(i, j) of a non-const matrix, which returns a reference
+proxy that only touches the structure when it's written to. Writing a nonzero to a missing element inserts it
+and shifts all nonzeros behind it, which is fine for the odd edit but not for filling a matrix, that's what
+the conversions and TripletBuilder are for. Writing a zero to a missing element changes nothing.
+*/
+
+namespace internal
+{
+    /// Nonzeros of one row (CSR) or column (CSC) as (index, value) pairs, sorted by index
+    template <typename V>
+    class NonzeroRange
+    {
+    private:
+        const size_t *index_;
+        V *value_;
+        size_t size_;
+
+    public:
+        class Iterator
+        {
+        private:
+            const size_t *index_;
+            V *value_;
+
+        public:
+            inline Iterator(const size_t *index, V *value) : index_(index), value_(value) {}
+            inline std::pair<size_t, V &> operator*() const { return {*index_, *value_}; }
+            inline Iterator &operator++()
+            {
+                ++index_;
+                ++value_;
+                return *this;
+            }
+            inline bool operator!=(const Iterator &other) const { return index_ != other.index_; }
+            inline bool operator==(const Iterator &other) const { return index_ == other.index_; }
+        };
+
+        inline NonzeroRange(const size_t *index, V *value, size_t size) : index_(index), value_(value), size_(size) {}
+        inline size_t size() const { return size_; }
+        inline const size_t *indices() const { return index_; }
+        inline V *values() const { return value_; }
+        inline Iterator begin() const { return Iterator(index_, value_); }
+        inline Iterator end() const { return Iterator(index_ + size_, value_ + size_); }
+    };
+
+    /* Storage shared by CsrBuffer and CscBuffer
+    Elements are grouped by their major index, the row for CSR and the column for CSC. The nonzeros of major
+    index k are minor_[ptr_[k]] / values_[ptr_[k]] up to ptr_[k + 1], sorted by their minor index.
+    */
+    template <typename T, bool ROW_MAJOR>
+    class CompressedBuffer
+    {
+    private:
+        size_t rows_;
+        size_t cols_;
+        std::vector<size_t> ptr_;
+        std::vector<size_t> minor_;
+        std::vector<T> values_;
+
+        inline size_t majors() const { return ROW_MAJOR ? rows_ : cols_; }
+        inline size_t major_of(size_t i) const { return ROW_MAJOR ? i / cols_ : i % cols_; }
+        inline size_t minor_of(size_t i) const { return ROW_MAJOR ? i % cols_ : i / cols_; }
+
+        /// Position of (major, minor) in minor_ / values_, or the position it would have to be inserted at
+        inline size_t find(size_t major, size_t minor) const
+        {
+            auto first = minor_.begin() + ptr_[major];
+            auto last = minor_.begin() + ptr_[major + 1];
+            return std::lower_bound(first, last, minor) - minor_.begin();
+        }
+
+    public:
+        /// Iterates all stored elements as (row major linear index, value) pairs, like SparseBuffer
+        class Iterator
+        {
+        private:
+            const CompressedBuffer *buf_;
+            size_t major_;
+            size_t k_;
+
+        public:
+            inline Iterator(const CompressedBuffer *buf, size_t k) : buf_(buf), major_(0), k_(k)
+            {
+                while (major_ < buf_->majors() && buf_->ptr_[major_ + 1] <= k_)
+                    ++major_;
+            }
+            inline std::pair<size_t, T> operator*() const
+            {
+                const size_t minor = buf_->minor_[k_];
+                const size_t i = ROW_MAJOR ? major_ : minor;
+                const size_t j = ROW_MAJOR ? minor : major_;
+                return {j + i * buf_->cols_, buf_->values_[k_]};
+            }
+            inline Iterator &operator++()
+            {
+                ++k_;
+                while (major_ < buf_->majors() && buf_->ptr_[major_ + 1] <= k_)
+                    ++major_;
+                return *this;
+            }
+            inline bool operator!=(const Iterator &other) const { return k_ != other.k_; }
+            inline bool operator==(const Iterator &other) const { return k_ == other.k_; }
+        };
+
+        inline CompressedBuffer(size_t rows, size_t cols)
+            : rows_(rows), cols_(cols), ptr_((ROW_MAJOR ? rows : cols) + 1, 0), minor_(), values_() {}
+
+        /// Takes over already compressed arrays, the minor indices of every major index have to be sorted
+        inline CompressedBuffer(size_t rows, size_t cols, std::vector<size_t> ptr, std::vector<size_t> minor, std::vector<T> values)
+            : rows_(rows), cols_(cols), ptr_(std::move(ptr)), minor_(std::move(minor)), values_(std::move(values))
+        {
+            if (ptr_.size() != majors() + 1 || minor_.size() != values_.size() || ptr_.back() != values_.size())
+                PANIC("Inconsistent compressed sparse arrays for a ", rows, 'x', cols, " matrix with ", values_.size(), " nonzeros");
+        }
+
+        inline T operator[](size_t i) const
+        {
+            const size_t major = major_of(i);
+            const size_t minor = minor_of(i);
+            const size_t k = find(major, minor);
+            return k < ptr_[major + 1] && minor_[k] == minor ? values_[k] : T();
+        }
+
+        /// Element i of a non-const buffer, reading it never inserts
+        class Reference
+        {
+        private:
+            CompressedBuffer *buf_;
+            size_t i_;
+
+        public:
+            inline Reference(CompressedBuffer *buf, size_t i) : buf_(buf), i_(i) {}
+            Reference(const Reference &) = default;
+
+            inline operator T() const { return static_cast<const CompressedBuffer &>(*buf_)[i_]; }
+
+            inline Reference &operator=(const T &value)
+            {
+                buf_->set(i_, value);
+                return *this;
+            }
+            inline Reference &operator=(const Reference &other) { return *this = T(other); }
+            inline Reference &operator+=(const T &x) { return *this = T(*this) + x; }
+            inline Reference &operator-=(const T &x) { return *this = T(*this) - x; }
+            inline Reference &operator*=(const T &x) { return *this = T(*this) * x; }
+            inline Reference &operator/=(const T &x) { return *this = T(*this) / x; }
+        };
+
+        inline Reference operator[](size_t i)
+        {
+            return Reference(this, i);
+        }
+
+        /// Writes element i, inserting it if it's missing and value isn't zero
+        inline void set(size_t i, const T &value)
+        {
+            const size_t major = major_of(i);
+            const size_t minor = minor_of(i);
+            const size_t k = find(major, minor);
+            if (k < ptr_[major + 1] && minor_[k] == minor)
+            {
+                values_[k] = value;
+                return;
+            }
+            if (value == T())
+                return;
+            minor_.insert(minor_.begin() + k, minor);
+            values_.insert(values_.begin() + k, value);
+            for (size_t m = major + 1; m < ptr_.size(); ++m)
+                ptr_[m] += 1;
+        }
+
+        inline size_t rows() const { return rows_; }
+        inline size_t cols() const { return cols_; }
+        inline size_t nnz() const { return values_.size(); }
+
+        /// The raw arrays, see the class comment
+        inline const std::vector<size_t> &pointers() const { return ptr_; }
+        inline const std::vector<size_t> &indices() const { return minor_; }
+        inline const std::vector<T> &values() const { return values_; }
+        inline std::vector<T> &values() { return values_; }
+
+        /// Nonzeros of major index k
+        inline NonzeroRange<const T> major(size_t k) const
+        {
+            if (k >= majors())
+                PANIC("Invalid Matrix index, tried to access ", ROW_MAJOR ? "row: " : "column: ", k);
+            return NonzeroRange<const T>(minor_.data() + ptr_[k], values_.data() + ptr_[k], ptr_[k + 1] - ptr_[k]);
+        }
+
+        inline NonzeroRange<T> major(size_t k)
+        {
+            if (k >= majors())
+                PANIC("Invalid Matrix index, tried to access ", ROW_MAJOR ? "row: " : "column: ", k);
+            return NonzeroRange<T>(minor_.data() + ptr_[k], values_.data() + ptr_[k], ptr_[k + 1] - ptr_[k]);
+        }
+
+        /// Drops stored elements that are zero, e.g. left behind by writes
+        void prune()
+        {
+            const auto zero = T();
+            size_t out = 0;
+            size_t begin = 0;
+            for (size_t m = 0; m < majors(); ++m)
+            {
+                const size_t end = ptr_[m + 1];
+                for (size_t k = begin; k < end; ++k)
+                {
+                    if (values_[k] == zero)
+                        continue;
+                    minor_[out] = minor_[k];
+                    values_[out] = values_[k];
+                    ++out;
+                }
+                begin = end;
+                ptr_[m + 1] = out;
+            }
+            minor_.resize(out);
+            values_.resize(out);
+        }
+
+        inline Iterator begin() const { return Iterator(this, 0); }
+        inline Iterator end() const { return Iterator(this, nnz()); }
+    };
+
+    /* Compresses unsorted, duplicate free (row, col, value) entries in O(nnz + rows + cols)
+    Two counting sorts, first by the minor index and then stably by the major one, leave every major index
+    with sorted minor indices. Entries are read through entry(k, row, col, value).
+    */
+    template <typename Buf, typename T, typename F>
+    Buf compress(size_t rows, size_t cols, size_t nnz, const F &entry)
+    {
+        const bool row_major = std::is_base_of<CompressedBuffer<T, true>, Buf>::value;
+        const size_t majors = row_major ? rows : cols;
+        const size_t minors = row_major ? cols : rows;
+        auto major_idx = std::vector<size_t>(nnz);
+        auto minor_idx = std::vector<size_t>(nnz);
+        auto vals = std::vector<T>(nnz);
+        auto minor_ptr = std::vector<size_t>(minors + 1, 0);
+        for (size_t k = 0; k < nnz; ++k)
+        {
+            size_t i, j;
+            entry(k, i, j, vals[k]);
+            major_idx[k] = row_major ? i : j;
+            minor_idx[k] = row_major ? j : i;
+            minor_ptr[minor_idx[k] + 1] += 1;
+        }
+        for (size_t m = 0; m < minors; ++m)
+            minor_ptr[m + 1] += minor_ptr[m];
+        auto by_minor = std::vector<size_t>(nnz);
+        for (size_t k = 0; k < nnz; ++k)
+            by_minor[minor_ptr[minor_idx[k]]++] = k;
+
+        auto ptr = std::vector<size_t>(majors + 1, 0);
+        for (size_t k = 0; k < nnz; ++k)
+            ptr[major_idx[k] + 1] += 1;
+        for (size_t m = 0; m < majors; ++m)
+            ptr[m + 1] += ptr[m];
+        auto next = std::vector<size_t>(ptr.begin(), ptr.end() - 1);
+        auto out_minor = std::vector<size_t>(nnz);
+        auto out_vals = std::vector<T>(nnz);
+        for (auto &&k : by_minor)
+        {
+            const size_t pos = next[major_idx[k]]++;
+            out_minor[pos] = minor_idx[k];
+            out_vals[pos] = vals[k];
+        }
+        return Buf(rows, cols, std::move(ptr), std::move(out_minor), std::move(out_vals));
+    }
+
+    /// Re-compresses along the other axis (CSR <-> CSC) in O(nnz + rows + cols)
+    template <typename Out, typename T, bool ROW_MAJOR>
+    Out recompress(const CompressedBuffer<T, ROW_MAJOR> &in)
+    {
+        const size_t majors = ROW_MAJOR ? in.rows() : in.cols();
+        const size_t minors = ROW_MAJOR ? in.cols() : in.rows();
+        const auto &in_ptr = in.pointers();
+        const auto &in_minor = in.indices();
+        const auto &in_vals = in.values();
+        auto ptr = std::vector<size_t>(minors + 1, 0);
+        for (auto &&m : in_minor)
+            ptr[m + 1] += 1;
+        for (size_t m = 0; m < minors; ++m)
+            ptr[m + 1] += ptr[m];
+        auto next = std::vector<size_t>(ptr.begin(), ptr.end() - 1);
+        auto out_minor = std::vector<size_t>(in.nnz());
+        auto out_vals = std::vector<T>(in.nnz());
+        // walking the old major indices in order leaves the new minor indices sorted
+        for (size_t major = 0; major < majors; ++major)
+            for (size_t k = in_ptr[major]; k < in_ptr[major + 1]; ++k)
+            {
+                const size_t pos = next[in_minor[k]]++;
+                out_minor[pos] = major;
+                out_vals[pos] = in_vals[k];
+            }
+        return Out(in.rows(), in.cols(), std::move(ptr), std::move(out_minor), std::move(out_vals));
+    }
+} // namespace internal
+
+template <typename T>
+class CsrBuffer : public internal::CompressedBuffer<T, true>
+{
+public:
+    using internal::CompressedBuffer<T, true>::CompressedBuffer;
+
+    /// Nonzeros of row i as (column, value) pairs
+    inline internal::NonzeroRange<const T> row(size_t i) const { return this->major(i); }
+    inline internal::NonzeroRange<T> row(size_t i) { return this->major(i); }
+};
+
+template <typename T>
+class CscBuffer : public internal::CompressedBuffer<T, false>
+{
+public:
+    using internal::CompressedBuffer<T, false>::CompressedBuffer;
+
+    /// Nonzeros of column j as (row, value) pairs
+    inline internal::NonzeroRange<const T> column(size_t j) const { return this->major(j); }
+    inline internal::NonzeroRange<T> column(size_t j) { return this->major(j); }
+};
+
+template <typename T>
+using CsrMat = internal::AbstractDynMat<T, CsrBuffer>;
+
+template <typename T>
+using CscMat = internal::AbstractDynMat<T, CscBuffer>;
+
+namespace internal
+{
+    template <template <class> typename Buf, typename T>
+    AbstractDynMat<T, Buf> compress_sparse(const SparseMat<T> &m)
+    {
+        // the map may hold zeros that weren't cleaned up yet, those are left out
+        auto entries = std::vector<std::pair<size_t, T>>();
+        const auto zero = T();
+        for (auto &&x : m)
+            if (x.second != zero)
+                entries.emplace_back(x.first, x.second);
+        const size_t cols = m.COLS_;
+        auto buf = compress<Buf<T>, T>(
+            m.ROWS_, m.COLS_, entries.size(),
+            [&](size_t k, size_t &i, size_t &j, T &value) {
+                i = entries[k].first / cols;
+                j = entries[k].first % cols;
+                value = entries[k].second;
+            });
+        return AbstractDynMat<T, Buf>(m.ROWS_, m.COLS_, std::move(buf));
+    }
+} // namespace internal
+
+/// CSR copy of a SparseMat in O(nnz + rows + cols)
+template <typename T>
+CsrMat<T> to_csr(const SparseMat<T> &m)
+{
+    return internal::compress_sparse<CsrBuffer>(m);
+}
+
+/// CSC copy of a SparseMat in O(nnz + rows + cols)
+template <typename T>
+CscMat<T> to_csc(const SparseMat<T> &m)
+{
+    return internal::compress_sparse<CscBuffer>(m);
+}
+
+/// CSR copy of the nonzeros of a dense matrix, one pass over its elements
+template <typename T>
+CsrMat<T> to_csr(const DynMat<T> &m)
+{
+    const T *raw = m.as_raw();
+    const auto zero = T();
+    auto ptr = std::vector<size_t>(m.ROWS_ + 1, 0);
+    auto cols = std::vector<size_t>();
+    auto vals = std::vector<T>();
+    for (size_t i = 0; i < m.ROWS_; ++i)
+    {
+        for (size_t j = 0; j < m.COLS_; ++j)
+            if (raw[i * m.COLS_ + j] != zero)
+            {
+                cols.push_back(j);
+                vals.push_back(raw[i * m.COLS_ + j]);
+            }
+        ptr[i + 1] = vals.size();
+    }
+    return CsrMat<T>(m.ROWS_, m.COLS_, CsrBuffer<T>(m.ROWS_, m.COLS_, std::move(ptr), std::move(cols), std::move(vals)));
+}
+
+/// CSC copy of the nonzeros of a dense matrix, two row major passes over its elements
+template <typename T>
+CscMat<T> to_csc(const DynMat<T> &m)
+{
+    const T *raw = m.as_raw();
+    const auto zero = T();
+    auto ptr = std::vector<size_t>(m.COLS_ + 1, 0);
+    for (size_t k = 0; k < m.SIZE; ++k)
+        if (raw[k] != zero)
+            ptr[k % m.COLS_ + 1] += 1;
+    for (size_t j = 0; j < m.COLS_; ++j)
+        ptr[j + 1] += ptr[j];
+    auto next = std::vector<size_t>(ptr.begin(), ptr.end() - 1);
+    auto rows = std::vector<size_t>(ptr.back());
+    auto vals = std::vector<T>(ptr.back());
+    for (size_t i = 0; i < m.ROWS_; ++i)
+        for (size_t j = 0; j < m.COLS_; ++j)
+            if (raw[i * m.COLS_ + j] != zero)
+            {
+                const size_t pos = next[j]++;
+                rows[pos] = i;
+                vals[pos] = raw[i * m.COLS_ + j];
+            }
+    return CscMat<T>(m.ROWS_, m.COLS_, CscBuffer<T>(m.ROWS_, m.COLS_, std::move(ptr), std::move(rows), std::move(vals)));
+}
+
+/// CSR copy of a CSC matrix in O(nnz + rows)
+template <typename T>
+CsrMat<T> to_csr(const CscMat<T> &m)
+{
+    return CsrMat<T>(m.ROWS_, m.COLS_, internal::recompress<CsrBuffer<T>>(m.buffer()));
+}
+
+/// CSC copy of a CSR matrix in O(nnz + cols)
+template <typename T>
+CscMat<T> to_csc(const CsrMat<T> &m)
+{
+    return CscMat<T>(m.ROWS_, m.COLS_, internal::recompress<CscBuffer<T>>(m.buffer()));
+}
+
+/// Dense copy of a compressed matrix
+template <typename T, template <class> typename MemBuf,
+          typename = typename std::enable_if<std::is_same<MemBuf<T>, CsrBuffer<T>>::value || std::is_same<MemBuf<T>, CscBuffer<T>>::value>::type>
+DynMat<T> to_dense(const internal::AbstractDynMat<T, MemBuf> &m)
+{
+    auto d = DynMat<T>(m.ROWS_, m.COLS_);
+    T *out = d.as_raw_mut();
+    for (auto &&x : m)
+        out[x.first] = x.second;
+    return d;
+}
+
+namespace internal
+{
+    namespace spmv
+    {
+        /* y(r, :) = sum of values[p] * x(indices[p], :) over the nonzeros p of major index r, for r in [begin, end)
+        x and y are row major with k columns. This is CSR * X and CSC^T * X.
+        */
+        template <typename T>
+        void gather(const size_t *ptr, const size_t *indices, const T *values, const T *x, size_t k, T *y, size_t begin, size_t end)
+        {
+            if (k == 1)
+            {
+                for (size_t r = begin; r < end; ++r)
+                {
+                    T sum = T();
+                    for (size_t p = ptr[r]; p < ptr[r + 1]; ++p)
+                        sum += values[p] * x[indices[p]];
+                    y[r] = sum;
+                }
+                return;
+            }
+            for (size_t r = begin; r < end; ++r)
+            {
+                T *out = y + r * k;
+                for (size_t c = 0; c < k; ++c)
+                    out[c] = T();
+                for (size_t p = ptr[r]; p < ptr[r + 1]; ++p)
+                {
+                    const T a = values[p];
+                    const T *in = x + indices[p] * k;
+                    for (size_t c = 0; c < k; ++c)
+                        out[c] += a * in[c];
+                }
+            }
+        }
+
+        /* y(indices[p], c) += values[p] * x(r, c) over all nonzeros p of all majors r, for columns c in [c0, c1)
+        y has to be zeroed. This is CSC * X and CSR^T * X.
+        */
+        template <typename T>
+        void scatter(const size_t *ptr, const size_t *indices, const T *values, size_t majors, const T *x, size_t k, T *y, size_t c0, size_t c1)
+        {
+            for (size_t r = 0; r < majors; ++r)
+            {
+                const T *in = x + r * k;
+                for (size_t p = ptr[r]; p < ptr[r + 1]; ++p)
+                {
+                    const T a = values[p];
+                    T *out = y + indices[p] * k;
+                    for (size_t c = c0; c < c1; ++c)
+                        out[c] += a * in[c];
+                }
+            }
+        }
+
+        /* Gathers into every major index, split across the threads of `policy` into ranges with about the
+        same number of nonzeros. Every row of y is written by one thread, so the result doesn't depend on
+        the number of threads.
+        */
+        template <typename T, bool ROW_MAJOR>
+        void gather(const CompressedBuffer<T, ROW_MAJOR> &a, const T *x, size_t k, T *y, const parallel::Policy &policy)
+        {
+            const auto &ptr = a.pointers();
+            const size_t majors = ptr.size() - 1;
+            const size_t threads = parallel::threads_for(policy, a.nnz() * k + majors, policy.serial_cutoff);
+            if (threads <= 1)
+            {
+                gather(ptr.data(), a.indices().data(), a.values().data(), x, k, y, 0, majors);
+                return;
+            }
+            const size_t parts = 4 * threads;
+            const auto boundary = [&](size_t t) -> size_t {
+                if (t == parts)
+                    return majors;
+                return std::lower_bound(ptr.begin(), ptr.end(), t * a.nnz() / parts) - ptr.begin();
+            };
+            policy.pool->parallel_for(0, parts, 1, [&](size_t begin, size_t end) {
+                for (size_t t = begin; t < end; ++t)
+                    gather(ptr.data(), a.indices().data(), a.values().data(), x, k, y,
+                           std::min(majors, boundary(t)), std::min(majors, boundary(t + 1)));
+            });
+        }
+
+        /* Scatters from every major index. Threads would collide on the rows of y, so only products with
+        several right hand sides are split, by their columns.
+        */
+        template <typename T, bool ROW_MAJOR>
+        void scatter(const CompressedBuffer<T, ROW_MAJOR> &a, const T *x, size_t k, T *y, const parallel::Policy &policy)
+        {
+            const size_t majors = a.pointers().size() - 1;
+            parallel::for_chunks(policy, k, 1, [&](size_t begin, size_t end) {
+                scatter(a.pointers().data(), a.indices().data(), a.values().data(), majors, x, k, y, begin, end);
+            }, a.nnz() + majors);
+        }
+    } // namespace spmv
+
+    /* CSR times dense, e.g. a matrix times a vector (SpMV) or a block of vectors (SpMM)
+    Only the stored nonzeros are visited, the rows are split across the threads of `policy`.
+    */
+    template <typename T>
+    DynMat<T> multiply(const CsrMat<T> &self, const DynMat<T> &other, const parallel::Policy &policy = parallel::global_policy())
+    {
+        if (self.COLS_ != other.ROWS_)
+            PANIC("Incompatible matrix dimensions: ", self.ROWS_, 'x', self.COLS_, " * ", other.ROWS_, 'x', other.COLS_);
+        const auto scope = ::profile::Scope(::profile::Op::SparseMultiply, self.buffer().nnz() * other.COLS_, 2 * self.buffer().nnz() * other.COLS_);
+        auto m3 = DynMat<T>(self.ROWS_, other.COLS_);
+        spmv::gather(self.buffer(), other.as_raw(), other.COLS_, m3.as_raw_mut(), policy);
+        return m3;
+    }
+
+    // CSC times dense, only the stored nonzeros are visited
+    template <typename T>
+    DynMat<T> multiply(const CscMat<T> &self, const DynMat<T> &other, const parallel::Policy &policy = parallel::global_policy())
+    {
+        if (self.COLS_ != other.ROWS_)
+            PANIC("Incompatible matrix dimensions: ", self.ROWS_, 'x', self.COLS_, " * ", other.ROWS_, 'x', other.COLS_);
+        const auto scope = ::profile::Scope(::profile::Op::SparseMultiply, self.buffer().nnz() * other.COLS_, 2 * self.buffer().nnz() * other.COLS_);
+        auto m3 = DynMat<T>(self.ROWS_, other.COLS_);
+        spmv::scatter(self.buffer(), other.as_raw(), other.COLS_, m3.as_raw_mut(), policy);
+        return m3;
+    }
+
+    /// self^T * other without forming the transpose, the CSR is read like a CSC of the transpose
+    template <typename T>
+    DynMat<T> multiply_transposed(const CsrMat<T> &self, const DynMat<T> &other, const parallel::Policy &policy = parallel::global_policy())
+    {
+        if (self.ROWS_ != other.ROWS_)
+            PANIC("Incompatible matrix dimensions: (", self.ROWS_, 'x', self.COLS_, ")^T * ", other.ROWS_, 'x', other.COLS_);
+        const auto scope = ::profile::Scope(::profile::Op::SparseMultiply, self.buffer().nnz() * other.COLS_, 2 * self.buffer().nnz() * other.COLS_);
+        auto m3 = DynMat<T>(self.COLS_, other.COLS_);
+        spmv::scatter(self.buffer(), other.as_raw(), other.COLS_, m3.as_raw_mut(), policy);
+        return m3;
+    }
+
+    /// self^T * other without forming the transpose, the columns of the CSC are split across threads
+    template <typename T>
+    DynMat<T> multiply_transposed(const CscMat<T> &self, const DynMat<T> &other, const parallel::Policy &policy = parallel::global_policy())
+    {
+        if (self.ROWS_ != other.ROWS_)
+            PANIC("Incompatible matrix dimensions: (", self.ROWS_, 'x', self.COLS_, ")^T * ", other.ROWS_, 'x', other.COLS_);
+        const auto scope = ::profile::Scope(::profile::Op::SparseMultiply, self.buffer().nnz() * other.COLS_, 2 * self.buffer().nnz() * other.COLS_);
+        auto m3 = DynMat<T>(self.COLS_, other.COLS_);
+        spmv::gather(self.buffer(), other.as_raw(), other.COLS_, m3.as_raw_mut(), policy);
+        return m3;
+    }
+
+    // Sparse times dense matrix multiplication, the result is dense
+    template <typename T>
+    inline DynMat<T> operator*(const CsrMat<T> &self, const DynMat<T> &other)
+    {
+        return multiply(self, other, parallel::global_policy());
+    }
+
+    template <typename T>
+    inline DynMat<T> operator*(const CscMat<T> &self, const DynMat<T> &other)
+    {
+        return multiply(self, other, parallel::global_policy());
+    }
+} // namespace internal
+
+/// How TripletBuilder merges several values for the same position
+enum class Duplicates
+{
+    Sum,  // add them up, as in finite element assembly
+    Last, // keep the one added last
+    Max,  // keep the largest
+};
+
+/* Assembles a compressed sparse matrix from (row, column, value) triplets
+Triplets are collected in batches without any lookup, all sorting and merging happens once in finalize().
+add() may be called from several threads at the same time, each call only takes a lock to append.
+Example:
+    auto builder = TripletBuilder<double>(n, n, Duplicates::Sum);
+    pool.parallel_for(0, elements, 64, [&](size_t begin, size_t end) {
+        auto batch = std::vector<TripletBuilder<double>::Triplet>();
+        for (size_t e = begin; e < end; ++e)
+            ...; // batch.push_back({i, j, value}) for the element's entries
+        builder.add(std::move(batch));
+    });
+    CsrMat<double> a = builder.finalize();
+"Last" is the order the triplets arrived in: batch by batch in the order of the add() calls, and in order
+within a batch. Merged values are stored even if they are zero.
+*/
+template <typename T>
+class TripletBuilder
+{
+public:
+    struct Triplet
+    {
+        size_t row;
+        size_t col;
+        T value;
+    };
+
+private:
+    struct Entry
+    {
+        size_t key; // position in the major order of the result
+        T value;
+    };
+
+    size_t rows_;
+    size_t cols_;
+    Duplicates duplicates_;
+    std::mutex mutex_;
+    std::vector<std::vector<Triplet>> batches_;
+
+    inline void check(const Triplet &t) const
+    {
+        if (t.row >= rows_ || t.col >= cols_)
+            PANIC("Invalid Matrix index, tried to add (", t.row, ", ", t.col, ") to a ", rows_, 'x', cols_, " matrix");
+    }
+
+    inline void merge(T &into, const T &value) const
+    {
+        switch (duplicates_)
+        {
+        case Duplicates::Sum:
+            into += value;
+            break;
+        case Duplicates::Last:
+            into = value;
+            break;
+        case Duplicates::Max:
+            if (into < value)
+                into = value;
+            break;
+        }
+    }
+
+public:
+    inline TripletBuilder(size_t rows, size_t cols, Duplicates duplicates = Duplicates::Sum)
+        : rows_(rows), cols_(cols), duplicates_(duplicates), mutex_(), batches_() {}
+
+    /// Adds a batch of triplets, thread safe
+    void add(std::vector<Triplet> &&batch)
+    {
+        for (auto &&t : batch)
+            check(t);
+        std::lock_guard<std::mutex> lock(mutex_);
+        batches_.push_back(std::move(batch));
+    }
+
+    void add(const Triplet *batch, size_t n)
+    {
+        add(std::vector<Triplet>(batch, batch + n));
+    }
+
+    /// Adds a single triplet, thread safe but takes the lock every time, prefer batches
+    void add(size_t row, size_t col, T value)
+    {
+        const auto t = Triplet{row, col, value};
+        check(t);
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (batches_.empty())
+            batches_.emplace_back();
+        batches_.back().push_back(t);
+    }
+
+    /// Number of triplets added so far, duplicates included
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t n = 0;
+        for (auto &&batch : batches_)
+            n += batch.size();
+        return n;
+    }
+
+    /* Sorts and merges all triplets into a CsrMat (or CscMat with finalize<CscBuffer>()) and empties the
+    builder. Gathering and sorting are split across the threads of `policy`.
+    */
+    template <template <class> typename Buf = CsrBuffer>
+    internal::AbstractDynMat<T, Buf> finalize(const parallel::Policy &policy = parallel::global_policy())
+    {
+        const bool row_major = std::is_base_of<internal::CompressedBuffer<T, true>, Buf<T>>::value;
+        auto batches = std::vector<std::vector<Triplet>>();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            batches.swap(batches_);
+        }
+
+        auto offsets = std::vector<size_t>(batches.size() + 1, 0);
+        for (size_t b = 0; b < batches.size(); ++b)
+            offsets[b + 1] = offsets[b] + batches[b].size();
+        const size_t minors = row_major ? cols_ : rows_;
+        auto entries = std::vector<Entry>(offsets.back());
+        parallel::for_chunks(policy, batches.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t b = begin; b < end; ++b)
+            {
+                Entry *out = entries.data() + offsets[b];
+                for (auto &&t : batches[b])
+                    *out++ = Entry{row_major ? t.row * minors + t.col : t.col * minors + t.row, t.value};
+                std::vector<Triplet>().swap(batches[b]);
+            }
+        }, offsets.back() / std::max<size_t>(batches.size(), 1));
+
+        // a stable sort keeps duplicates in the order they were added
+        parallel::stable_sort(policy, entries, [](const Entry &a, const Entry &b) { return a.key < b.key; });
+
+        const size_t majors = row_major ? rows_ : cols_;
+        auto ptr = std::vector<size_t>(majors + 1, 0);
+        auto minor = std::vector<size_t>();
+        auto values = std::vector<T>();
+        for (size_t k = 0; k < entries.size();)
+        {
+            const size_t key = entries[k].key;
+            T value = entries[k].value;
+            for (++k; k < entries.size() && entries[k].key == key; ++k)
+                merge(value, entries[k].value);
+            ptr[key / minors + 1] += 1;
+            minor.push_back(key % minors);
+            values.push_back(value);
+        }
+        for (size_t m = 0; m < majors; ++m)
+            ptr[m + 1] += ptr[m];
+        return internal::AbstractDynMat<T, Buf>(rows_, cols_, Buf<T>(rows_, cols_, std::move(ptr), std::move(minor), std::move(values)));
+    }
+};
+
+#endif // SPARSE_H
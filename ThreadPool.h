@@ -0,0 +1,404 @@
+#if !defined(THREAD_POOL_H)
+#define THREAD_POOL_H
+
+#include <algorithm> // min, max, stable_sort, merge
+#include <atomic>
+#include <condition_variable>
+#include <cstdint> // SIZE_MAX
+#include <cstdlib> // getenv, strtoul
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "util.h"
+
+/* Work stealing thread pool
+
+Every worker owns a deque of tasks. A worker pops from the back of its own deque and, once that runs dry,
+steals from the front of the others. parallel_for() splits a range into chunks, hands them out and then
+helps executing tasks until its own chunks are done, so calling it from inside a task doesn't deadlock.
+Tasks only reference the caller's callable and the deques are ring buffers that only grow, so once a pool has
+seen its largest parallel_for() submitting work never allocates.
+*/
+class ThreadPool
+{
+private:
+    struct Job
+    {
+        void (*invoke)(const void *, size_t, size_t);
+        const void *fn;
+        std::atomic<size_t> remaining;
+    };
+
+    struct Task
+    {
+        Job *job;
+        size_t begin;
+        size_t end;
+    };
+
+    /// Deque of tasks on a ring buffer, its capacity is a power of two that doubles when it's full
+    class Ring
+    {
+    private:
+        std::vector<Task> slots_ = std::vector<Task>(64);
+        size_t head_ = 0;
+        size_t size_ = 0;
+
+        Task &at(size_t i) { return slots_[(head_ + i) & (slots_.size() - 1)]; }
+
+    public:
+        bool empty() const { return size_ == 0; }
+
+        void push_back(const Task &task)
+        {
+            if (size_ == slots_.size())
+            {
+                auto grown = std::vector<Task>(2 * slots_.size());
+                for (size_t i = 0; i < size_; ++i)
+                    grown[i] = at(i);
+                slots_.swap(grown);
+                head_ = 0;
+            }
+            at(size_++) = task;
+        }
+
+        Task pop_back() { return at(--size_); }
+
+        Task pop_front()
+        {
+            const Task task = at(0);
+            head_ = (head_ + 1) & (slots_.size() - 1);
+            --size_;
+            return task;
+        }
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        Ring tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    std::atomic<size_t> queued_;
+    std::atomic<size_t> next_queue_;
+    bool stop_;
+
+    /// Index of the calling thread's queue, or SIZE_MAX if it isn't a worker of this pool
+    size_t own_queue() const
+    {
+        return current_pool() == this ? current_index() : SIZE_MAX;
+    }
+
+    static const ThreadPool *&current_pool()
+    {
+        thread_local const ThreadPool *pool = nullptr;
+        return pool;
+    }
+
+    static size_t &current_index()
+    {
+        thread_local size_t index = 0;
+        return index;
+    }
+
+    bool pop(size_t q, Task &task)
+    {
+        auto &queue = *queues_[q];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+            return false;
+        task = queue.tasks.pop_back();
+        queued_.fetch_sub(1);
+        return true;
+    }
+
+    bool steal(size_t thief, Task &task)
+    {
+        const size_t n = queues_.size();
+        const size_t start = thief == SIZE_MAX ? next_queue_.load() : thief + 1;
+        for (size_t k = 0; k < n; ++k)
+        {
+            auto &queue = *queues_[(start + k) % n];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                continue;
+            task = queue.tasks.pop_front();
+            queued_.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
+
+    bool try_run_one(size_t q)
+    {
+        Task task;
+        if ((q != SIZE_MAX && pop(q, task)) || steal(q, task))
+        {
+            task.job->invoke(task.job->fn, task.begin, task.end);
+            task.job->remaining.fetch_sub(1, std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+
+    void work(size_t index)
+    {
+        current_pool() = this;
+        current_index() = index;
+        while (true)
+        {
+            if (try_run_one(index))
+                continue;
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            wake_.wait(lock, [this] { return stop_ || queued_.load() > 0; });
+            if (stop_ && queued_.load() == 0)
+                return;
+        }
+    }
+
+public:
+    /// Starts `threads` workers, the thread calling parallel_for() works along with them
+    inline explicit ThreadPool(size_t threads = std::thread::hardware_concurrency())
+        : queues_(), workers_(), sleep_mutex_(), wake_(), queued_(0), next_queue_(0), stop_(false)
+    {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t i = 0; i < threads; ++i)
+            queues_.emplace_back(new Queue());
+        for (size_t i = 0; i < threads; ++i)
+            workers_.emplace_back([this, i] { work(i); });
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    inline ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto &&worker : workers_)
+            worker.join();
+    }
+
+    inline size_t size() const { return workers_.size(); }
+
+    /* Calls f(chunk_begin, chunk_end) for consecutive chunks of at most `chunk` elements covering [begin, end)
+    and returns once all of them are done.
+    */
+    template <typename F>
+    void parallel_for(size_t begin, size_t end, size_t chunk, const F &f)
+    {
+        if (end <= begin)
+            return;
+        chunk = std::max<size_t>(chunk, 1);
+        const size_t tasks = (end - begin + chunk - 1) / chunk;
+        if (tasks == 1)
+        {
+            f(begin, end);
+            return;
+        }
+
+        Job job;
+        job.invoke = [](const void *fn, size_t b, size_t e) { (*static_cast<const F *>(fn))(b, e); };
+        job.fn = &f;
+        job.remaining.store(tasks);
+
+        // workers keep their own tasks local and let the others steal, outside callers deal them out
+        const size_t own = own_queue();
+        const size_t n = queues_.size();
+        const size_t first = own == SIZE_MAX ? next_queue_.fetch_add(1) % n : own;
+        for (size_t t = 0; t < tasks; ++t)
+        {
+            const size_t b = begin + t * chunk;
+            auto &queue = *queues_[own == SIZE_MAX ? (first + t) % n : own];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(Task{&job, b, std::min(end, b + chunk)});
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            queued_.fetch_add(tasks);
+        }
+        wake_.notify_all();
+
+        while (job.remaining.load(std::memory_order_acquire) != 0)
+        {
+            if (!try_run_one(own))
+                std::this_thread::yield();
+        }
+    }
+};
+
+namespace internal
+{
+    // Elementwise work is never split into chunks shorter than this
+    const size_t MIN_CHUNK = 4096;
+}
+
+namespace parallel
+{
+    /* How an operation may be split across threads
+        pool            - pool to run on, nullptr runs everything on the calling thread
+        serial_cutoff   - operations touching fewer elements than this stay serial
+        gemm_cutoff     - same for matrix multiplications, counted in multiply-adds (m * n * k)
+        deterministic   - reductions use chunk boundaries that don't depend on the number of threads,
+                          so their results are bitwise reproducible between runs and pool sizes
+    */
+    struct Policy
+    {
+        ThreadPool *pool = nullptr;
+        size_t serial_cutoff = size_t(1) << 16;
+        size_t gemm_cutoff = size_t(1) << 21;
+        bool deterministic = false;
+    };
+
+    // Chunk length of reductions in deterministic mode
+    const size_t DETERMINISTIC_CHUNK = 8192;
+
+    inline std::unique_ptr<ThreadPool> &global_pool_slot()
+    {
+        static std::unique_ptr<ThreadPool> pool;
+        return pool;
+    }
+
+    /* Policy used by all operators and by calls that don't pass their own
+    Serial by default, set_threads() or the environment variable MATRAC_THREADS opt in.
+    */
+    inline Policy &global_policy()
+    {
+        static Policy policy = [] {
+            auto p = Policy();
+            if (auto env = std::getenv("MATRAC_THREADS"))
+            {
+                auto threads = std::strtoul(env, nullptr, 10);
+                if (threads > 1)
+                {
+                    global_pool_slot().reset(new ThreadPool(threads));
+                    p.pool = global_pool_slot().get();
+                }
+            }
+            return p;
+        }();
+        return policy;
+    }
+
+    /// Replaces the global pool by one with `threads` workers, 0 or 1 make the global policy serial again
+    inline void set_threads(size_t threads)
+    {
+        auto &policy = global_policy();
+        policy.pool = nullptr;
+        global_pool_slot().reset(threads > 1 ? new ThreadPool(threads) : nullptr);
+        policy.pool = global_pool_slot().get();
+    }
+
+    /// Number of threads an operation on `work` elements would use under `policy`
+    inline size_t threads_for(const Policy &policy, size_t work, size_t cutoff)
+    {
+        if (policy.pool == nullptr || work < cutoff)
+            return 1;
+        return policy.pool->size();
+    }
+
+    /* Calls f(begin, end) on chunks covering [0, n), in parallel if the elements touched (n * item_size)
+    reach the policy's serial cutoff. Chunks are at least `min_chunk` long and there are a few per thread
+    to even out the load.
+    */
+    template <typename F>
+    void for_chunks(const Policy &policy, size_t n, size_t min_chunk, const F &f, size_t item_size = 1)
+    {
+        const size_t threads = threads_for(policy, n * item_size, policy.serial_cutoff);
+        if (threads <= 1)
+        {
+            f(size_t(0), n);
+            return;
+        }
+        const size_t chunk = std::max(min_chunk, (n + 4 * threads - 1) / (4 * threads));
+        policy.pool->parallel_for(0, n, chunk, f);
+    }
+
+    /* Reduces [0, n): partial(begin, end) is evaluated per chunk, the results are folded left to right
+    with combine, starting from init. In deterministic mode the chunks are always DETERMINISTIC_CHUNK long,
+    even when running serially. The partial results of the chunks are kept in `partials`, which is only ever
+    grown, so callers that hold on to it reduce without allocating.
+    */
+    template <typename R, typename F, typename C>
+    R reduce(const Policy &policy, size_t n, R init, const F &partial, const C &combine, std::vector<R> &partials)
+    {
+        const size_t threads = threads_for(policy, n, policy.serial_cutoff);
+        size_t chunk;
+        if (policy.deterministic)
+            chunk = DETERMINISTIC_CHUNK;
+        else if (threads <= 1)
+            return n == 0 ? init : combine(init, partial(size_t(0), n));
+        else
+            chunk = (n + 4 * threads - 1) / (4 * threads);
+
+        const size_t chunks = (n + chunk - 1) / chunk;
+        if (partials.size() < chunks)
+            partials.resize(chunks);
+        auto body = [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c)
+                partials[c] = partial(c * chunk, std::min(n, (c + 1) * chunk));
+        };
+        if (threads <= 1)
+            body(0, chunks);
+        else
+            policy.pool->parallel_for(0, chunks, 1, body);
+        for (size_t c = 0; c < chunks; ++c)
+            init = combine(init, partials[c]);
+        return init;
+    }
+
+    /// reduce() with partial results of its own
+    template <typename R, typename F, typename C>
+    R reduce(const Policy &policy, size_t n, R init, const F &partial, const C &combine)
+    {
+        auto partials = std::vector<R>();
+        return reduce(policy, n, init, partial, combine, partials);
+    }
+
+    /* Stable sort of v by less, split across the threads of `policy`
+    Every thread stable sorts one run, then neighbouring runs are merged pairwise until one is left. Merging
+    keeps elements of the left run first, so equal elements stay in their original order.
+    */
+    template <typename V, typename Less>
+    void stable_sort(const Policy &policy, std::vector<V> &v, const Less &less)
+    {
+        const size_t n = v.size();
+        const size_t threads = threads_for(policy, n, policy.serial_cutoff);
+        if (threads <= 1)
+        {
+            std::stable_sort(v.begin(), v.end(), less);
+            return;
+        }
+        const size_t run = (n + threads - 1) / threads;
+        policy.pool->parallel_for(0, threads, 1, [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; ++r)
+                std::stable_sort(v.begin() + std::min(n, r * run), v.begin() + std::min(n, (r + 1) * run), less);
+        });
+        auto other = std::vector<V>(n);
+        for (size_t width = run; width < n; width *= 2)
+        {
+            const size_t pairs = (n + 2 * width - 1) / (2 * width);
+            policy.pool->parallel_for(0, pairs, 1, [&](size_t begin, size_t end) {
+                for (size_t p = begin; p < end; ++p)
+                {
+                    const size_t lo = p * 2 * width;
+                    const size_t mid = std::min(n, lo + width);
+                    const size_t hi = std::min(n, lo + 2 * width);
+                    std::merge(v.begin() + lo, v.begin() + mid, v.begin() + mid, v.begin() + hi, other.begin() + lo, less);
+                }
+            });
+            v.swap(other);
+        }
+    }
+} // namespace parallel
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,282 @@
+#if !defined(TRANSPOSE_H)
+#define TRANSPOSE_H
+
+#include <algorithm> // min
+#include <cstddef>   // ptrdiff_t
+#include <cstdint>   // uint32_t, uint64_t
+#include <cstring>   // memcpy
+#include <type_traits>
+#include <utility> // index_sequence, swap
+#include <vector>
+
+#include "Simd.h"
+#include "ThreadPool.h"
+
+/* Transposition kernels behind Mat::transpose(), AbstractDynMat::transpose() and transpose_in_place()
+
+Out of place, the matrix is split recursively along its longer side until a tile fits into L2 (cache
+oblivious: no parameter depends on the cache sizes besides the tile). Tiles are transposed in W x W blocks
+held in SIMD registers, W being the number of elements per register, with log2(W) rounds of lane shuffles,
+into a buffer that is then copied out row by row. Writing the destination in whole rows instead of W rows
+at a time keeps large transposes from stalling on stores. Elements are only moved, so any 4 or 8 byte
+trivially copyable type takes the SIMD path.
+
+In place, square matrices swap pairs of tiles through one tile sized buffer, rectangular ones follow the
+cycles of the permutation p -> p * rows mod (size - 1), with one bit per element to mark visited ones.
+*/
+
+namespace internal
+{
+    namespace transpose
+    {
+        /// Side of the tiles the recursion stops at, 64 KiB per tile for floats, 32 KiB for doubles
+        template <typename T>
+        struct Tile
+        {
+            static constexpr size_t SIDE = sizeof(T) <= 4 ? 128 : sizeof(T) <= 8 ? 64 : 16;
+        };
+
+        /// dst(j, i) = src(i, j) for a rows x cols block, the plain loop used for edges and other types
+        template <typename T>
+        MATRAC_ALWAYS_INLINE void tile_scalar(const T *src, ptrdiff_t rs, T *dst, ptrdiff_t rd, size_t rows, size_t cols)
+        {
+            for (size_t j = 0; j < cols; ++j)
+                for (size_t i = 0; i < rows; ++i)
+                    dst[j * rd + i] = src[i * rs + j];
+        }
+
+#if MATRAC_HAS_SHUFFLEVECTOR
+        template <typename B, size_t W>
+        struct Bits
+        {
+            typedef B Vec __attribute__((vector_size(W * sizeof(B))));
+        };
+
+        /* One round of the block swap transpose: within every 2S x 2S block the upper right and lower left
+        S x S blocks trade places, x and y are rows i and i + S
+        */
+        template <typename Vec, size_t W, size_t S, size_t... L>
+        MATRAC_ALWAYS_INLINE void swap_blocks(Vec &x, Vec &y, std::index_sequence<L...>)
+        {
+            const Vec a = __builtin_shufflevector(x, y, ((L & S) ? W + L - S : L)...);
+            const Vec b = __builtin_shufflevector(x, y, ((L & S) ? W + L : L + S)...);
+            x = a;
+            y = b;
+        }
+
+        template <typename Vec, size_t W, size_t S>
+        MATRAC_ALWAYS_INLINE void swap_round(Vec *r)
+        {
+            for (size_t i = 0; i < W; ++i)
+                if ((i & S) == 0)
+                    swap_blocks<Vec, W, S>(r[i], r[i + S], std::make_index_sequence<W>());
+        }
+
+        template <typename Vec, size_t W, size_t S = 1>
+        MATRAC_ALWAYS_INLINE void transpose_registers(Vec *r)
+        {
+            if constexpr (S < W)
+            {
+                swap_round<Vec, W, S>(r);
+                transpose_registers<Vec, W, 2 * S>(r);
+            }
+        }
+
+        /// tile_scalar with the full W x W blocks transposed in registers, B is an unsigned type of T's size
+        template <typename T, typename B, size_t W>
+        MATRAC_ALWAYS_INLINE void tile_simd(const T *src, ptrdiff_t rs, T *dst, ptrdiff_t rd, size_t rows, size_t cols)
+        {
+            using Vec = typename Bits<B, W>::Vec;
+            const size_t rows_w = rows / W * W;
+            const size_t cols_w = cols / W * W;
+            Vec r[W];
+            // down the columns of src, so the rows of dst are written front to back
+            for (size_t j = 0; j < cols_w; j += W)
+                for (size_t i = 0; i < rows_w; i += W)
+                {
+                    for (size_t k = 0; k < W; ++k)
+                        std::memcpy(&r[k], src + (i + k) * rs + j, sizeof(Vec));
+                    transpose_registers<Vec, W>(r);
+                    for (size_t k = 0; k < W; ++k)
+                        std::memcpy(dst + (j + k) * rd + i, &r[k], sizeof(Vec));
+                }
+            if (cols_w < cols)
+                tile_scalar(src + cols_w, rs, dst + cols_w * rd, rd, rows, cols - cols_w);
+            if (rows_w < rows)
+                tile_scalar(src + rows_w * rs, rs, dst + rows_w, rd, rows - rows_w, cols_w);
+        }
+#endif
+
+        /// The tile kernel compiled once per instruction set, see Simd.h
+        template <typename T>
+        struct TileKernel
+        {
+            using Fn = void (*)(const T *, ptrdiff_t, T *, ptrdiff_t, size_t, size_t);
+            using B = typename std::conditional<sizeof(T) == 8, uint64_t, uint32_t>::type;
+            static const bool SHUFFLED = MATRAC_HAS_SHUFFLEVECTOR && std::is_trivially_copyable<T>::value &&
+                                         (sizeof(T) == 4 || sizeof(T) == 8);
+
+            static void scalar(const T *src, ptrdiff_t rs, T *dst, ptrdiff_t rd, size_t rows, size_t cols)
+            {
+                tile_scalar(src, rs, dst, rd, rows, cols);
+            }
+#if MATRAC_SIMD_X86 && MATRAC_HAS_SHUFFLEVECTOR
+            MATRAC_TARGET("sse2")
+            static void sse2(const T *src, ptrdiff_t rs, T *dst, ptrdiff_t rd, size_t rows, size_t cols)
+            {
+                tile_simd<T, B, 16 / sizeof(T)>(src, rs, dst, rd, rows, cols);
+            }
+            MATRAC_TARGET("avx2")
+            static void avx2(const T *src, ptrdiff_t rs, T *dst, ptrdiff_t rd, size_t rows, size_t cols)
+            {
+                tile_simd<T, B, 32 / sizeof(T)>(src, rs, dst, rd, rows, cols);
+            }
+            MATRAC_TARGET("avx512f")
+            static void avx512(const T *src, ptrdiff_t rs, T *dst, ptrdiff_t rd, size_t rows, size_t cols)
+            {
+                tile_simd<T, B, 64 / sizeof(T)>(src, rs, dst, rd, rows, cols);
+            }
+#endif
+
+            static Fn select()
+            {
+#if MATRAC_SIMD_X86 && MATRAC_HAS_SHUFFLEVECTOR
+                if constexpr (SHUFFLED)
+                {
+                    switch (simd::active_isa())
+                    {
+                    case simd::Isa::AVX512:
+                        return avx512;
+                    case simd::Isa::AVX2:
+                        return avx2;
+                    case simd::Isa::SSE2:
+                        return sse2;
+                    default:
+                        break;
+                    }
+                }
+#endif
+                return scalar;
+            }
+        };
+
+        template <typename T>
+        void recurse(const T *src, ptrdiff_t rs, T *dst, ptrdiff_t rd, size_t rows, size_t cols,
+                     typename TileKernel<T>::Fn tile, T *buf)
+        {
+            const size_t SIDE = Tile<T>::SIDE;
+            if (rows <= SIDE && cols <= SIDE)
+            {
+                // through a buffer that stays in cache, so dst is written one whole row of the tile at a time
+                tile(src, rs, buf, SIDE, rows, cols);
+                for (size_t j = 0; j < cols; ++j)
+                    std::copy(buf + j * SIDE, buf + j * SIDE + rows, dst + j * rd);
+                return;
+            }
+            // halves are rounded to whole tiles, so every tile but the last in a row / column is full
+            if (rows >= cols)
+            {
+                const size_t half = (rows / 2 + SIDE - 1) / SIDE * SIDE;
+                recurse(src, rs, dst, rd, half, cols, tile, buf);
+                recurse(src + half * rs, rs, dst + half, rd, rows - half, cols, tile, buf);
+            }
+            else
+            {
+                const size_t half = (cols / 2 + SIDE - 1) / SIDE * SIDE;
+                recurse(src, rs, dst, rd, rows, half, tile, buf);
+                recurse(src + half, rs, dst + half * rd, rd, rows, cols - half, tile, buf);
+            }
+        }
+
+        /* dst = src^T for a rows x cols matrix src, row i of src starts at src + i * rs and row j of dst at
+        dst + j * rd. The rows of src are split into bands across the threads of `policy`.
+        */
+        template <typename T>
+        void transpose(const T *src, size_t rows, size_t cols, ptrdiff_t rs, T *dst, ptrdiff_t rd,
+                       const parallel::Policy &policy = parallel::global_policy())
+        {
+            const auto tile = TileKernel<T>::select();
+            if (rows <= Tile<T>::SIDE && cols <= Tile<T>::SIDE)
+            {
+                tile(src, rs, dst, rd, rows, cols);
+                return;
+            }
+            parallel::for_chunks(policy, rows, Tile<T>::SIDE, [&](size_t begin, size_t end) {
+                auto buf = std::vector<T>(Tile<T>::SIDE * Tile<T>::SIDE);
+                recurse(src + begin * rs, rs, dst + begin, rd, end - begin, cols, tile, buf.data());
+            }, cols);
+        }
+
+        /// Transposes the n x n row major matrix at data in place, tile pairs are spread over the threads of `policy`
+        template <typename T>
+        void square_in_place(T *data, size_t n, const parallel::Policy &policy = parallel::global_policy())
+        {
+            if (n == 0)
+                return;
+            const size_t SIDE = std::min(Tile<T>::SIDE, n);
+            const auto tile = TileKernel<T>::select();
+            const size_t tiles = (n + SIDE - 1) / SIDE;
+            parallel::for_chunks(policy, tiles, 1, [&](size_t begin, size_t end) {
+                auto buf = std::vector<T>(SIDE * SIDE);
+                for (size_t ti = begin; ti < end; ++ti)
+                {
+                    const size_t i = ti * SIDE;
+                    const size_t h = std::min(SIDE, n - i);
+                    // diagonal tile through the buffer
+                    tile(data + i * n + i, n, buf.data(), SIDE, h, h);
+                    for (size_t r = 0; r < h; ++r)
+                        std::copy(buf.data() + r * SIDE, buf.data() + r * SIDE + h, data + (i + r) * n + i);
+                    // A(i, j) and A(j, i) trade places transposed, A(i, j) waits in the buffer
+                    for (size_t j = i + SIDE; j < n; j += SIDE)
+                    {
+                        const size_t w = std::min(SIDE, n - j);
+                        tile(data + i * n + j, n, buf.data(), SIDE, h, w);
+                        tile(data + j * n + i, n, data + i * n + j, n, w, h);
+                        for (size_t r = 0; r < w; ++r)
+                            std::copy(buf.data() + r * SIDE, buf.data() + r * SIDE + h, data + (j + r) * n + i);
+                    }
+                }
+            }, n * SIDE);
+        }
+
+        /* Transposes the rows x cols row major matrix at data in place, so it holds the cols x rows transpose
+        Square matrices go through square_in_place(), others follow the cycles of the permutation
+        element p moves to p * rows mod (size - 1), on one thread.
+        */
+        template <typename T>
+        void in_place(T *data, size_t rows, size_t cols, const parallel::Policy &policy = parallel::global_policy())
+        {
+            if (rows == cols)
+            {
+                square_in_place(data, rows, policy);
+                return;
+            }
+            const size_t size = rows * cols;
+            if (rows <= 1 || cols <= 1)
+                return;
+            const size_t last = size - 1;
+            auto visited = std::vector<bool>(size, false);
+            for (size_t start = 1; start < last; ++start)
+            {
+                if (visited[start])
+                    continue;
+                // walk the cycle forwards, the element from p (carry) moves to p * rows mod (size - 1) and
+                // the one displaced there is carried on, the last one lands back in start
+                T carry = data[start];
+                size_t p = start;
+                while (true)
+                {
+                    const size_t next = static_cast<size_t>((static_cast<unsigned __int128>(p) * rows) % last);
+                    visited[p] = true;
+                    if (next == start)
+                        break;
+                    std::swap(carry, data[next]);
+                    p = next;
+                }
+                data[start] = carry;
+            }
+        }
+    } // namespace transpose
+} // namespace internal
+
+#endif // TRANSPOSE_H
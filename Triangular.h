@@ -0,0 +1,234 @@
+#if !defined(TRIANGULAR_H)
+#define TRIANGULAR_H
+
+#include <algorithm> // min
+#include <cstddef>   // ptrdiff_t
+#include <type_traits>
+
+#include "util.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "Gemm.h"
+#include "Expr.h"
+#include "View.h"
+
+/* Triangular solves with many right hand sides, the building block of the factorizations
+
+A is an n x n triangular matrix addressed as A[i * rs + j * cs] (like the GEMM operands, so a transposed
+factor is just swapped strides), B an n x m row major block that is overwritten with A^-1 B. Blocks of
+BLOCK rows are solved with row updates, everything below / above a block is updated with one GEMM call,
+so most of the work of a large solve runs in the GEMM kernel. A single right hand side takes dot products
+along the rows of A instead.
+
+solve_lower(a, b) and solve_upper(a, b) are the in place TRSV / TRSM for any dense matrix or view, only the
+triangle they're named after is read. A transposed view flips the triangle, so both solves with a lower
+triangular factor l are
+    solve_lower(l, b);                      // b = l^-1 b
+    solve_upper(l.view().transpose(), b);   // b = l^-T b
+*/
+
+namespace internal
+{
+    namespace triangular
+    {
+        /// Rows solved per block before the rest of B is updated through GEMM
+        const size_t BLOCK = 64;
+
+        /// b -= s * x for n elements
+        template <typename T>
+        MATRAC_ALWAYS_INLINE void axpy(T *b, T s, const T *x, size_t n)
+        {
+            for (size_t j = 0; j < n; ++j)
+                b[j] -= s * x[j];
+        }
+
+        /// Rows [begin, end) of a lower triangular solve on columns [c0, c1) of B, earlier rows are already solved
+        template <typename T>
+        void lower_rows(size_t begin, size_t end, const T *a, ptrdiff_t rs, ptrdiff_t cs, bool unit,
+                        T *b, ptrdiff_t ldb, size_t c0, size_t c1)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                T *bi = b + i * ldb + c0;
+                for (size_t k = begin; k < i; ++k)
+                {
+                    const T l = a[i * rs + k * cs];
+                    if (l != T())
+                        axpy(bi, l, b + k * ldb + c0, c1 - c0);
+                }
+                if (!unit)
+                {
+                    const T d = T(1) / a[i * rs + i * cs];
+                    for (size_t j = 0; j < c1 - c0; ++j)
+                        bi[j] *= d;
+                }
+            }
+        }
+
+        /// Same for an upper triangular A, rows are solved from end - 1 down to begin
+        template <typename T>
+        void upper_rows(size_t begin, size_t end, const T *a, ptrdiff_t rs, ptrdiff_t cs, bool unit,
+                        T *b, ptrdiff_t ldb, size_t c0, size_t c1)
+        {
+            for (size_t i = end; i-- > begin;)
+            {
+                T *bi = b + i * ldb + c0;
+                for (size_t k = i + 1; k < end; ++k)
+                {
+                    const T u = a[i * rs + k * cs];
+                    if (u != T())
+                        axpy(bi, u, b + k * ldb + c0, c1 - c0);
+                }
+                if (!unit)
+                {
+                    const T d = T(1) / a[i * rs + i * cs];
+                    for (size_t j = 0; j < c1 - c0; ++j)
+                        bi[j] *= d;
+                }
+            }
+        }
+
+        /// sum of a[k * sa] * x[k * sx] for k < n, through the SIMD dot product when both are contiguous
+        template <typename T>
+        T dot(const T *a, ptrdiff_t sa, const T *x, ptrdiff_t sx, size_t n)
+        {
+            if constexpr (simd::is_vectorizable<T>::value)
+            {
+                if (sa == 1 && sx == 1)
+                    return simd::dot(a, x, n);
+            }
+            T sum = T();
+            for (size_t k = 0; k < n; ++k)
+                sum += a[k * sa] * x[k * sx];
+            return sum;
+        }
+
+        /* x = A^-1 x for lower triangular A, x has stride sx
+        Dot products along the rows of A, or axpys down its columns when those are the contiguous ones
+        (a transposed view of an upper triangular factor).
+        */
+        template <typename T>
+        void lower_vector(size_t n, const T *a, ptrdiff_t rs, ptrdiff_t cs, bool unit, T *x, ptrdiff_t sx)
+        {
+            if (rs == 1 && cs != 1 && sx == 1)
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    if (!unit)
+                        x[i] /= a[i + i * cs];
+                    axpy(x + i + 1, x[i], a + i + 1 + i * cs, n - i - 1);
+                }
+                return;
+            }
+            for (size_t i = 0; i < n; ++i)
+            {
+                const T xi = x[i * sx] - dot(a + i * rs, cs, x, sx, i);
+                x[i * sx] = unit ? xi : xi / a[i * rs + i * cs];
+            }
+        }
+
+        /// x = A^-1 x for upper triangular A, the same two ways
+        template <typename T>
+        void upper_vector(size_t n, const T *a, ptrdiff_t rs, ptrdiff_t cs, bool unit, T *x, ptrdiff_t sx)
+        {
+            if (rs == 1 && cs != 1 && sx == 1)
+            {
+                for (size_t i = n; i-- > 0;)
+                {
+                    if (!unit)
+                        x[i] /= a[i + i * cs];
+                    axpy(x, x[i], a + i * cs, i);
+                }
+                return;
+            }
+            for (size_t i = n; i-- > 0;)
+            {
+                const T xi = x[i * sx] - dot(a + i * rs + (i + 1) * cs, cs, x + (i + 1) * sx, sx, n - i - 1);
+                x[i * sx] = unit ? xi : xi / a[i * rs + i * cs];
+            }
+        }
+
+        /* B = A^-1 B for a lower triangular n x n A and an n x m B, see the top of the file
+        unit - the diagonal of A is taken to be 1 and never read
+        The row updates within a block are split by columns of B across the threads of `policy`, as is the GEMM.
+        */
+        template <typename T>
+        void solve_lower(size_t n, size_t m, const T *a, ptrdiff_t rs, ptrdiff_t cs, bool unit, T *b, ptrdiff_t ldb,
+                         const parallel::Policy &policy = parallel::global_policy())
+        {
+            if (m == 1)
+                return lower_vector(n, a, rs, cs, unit, b, ldb);
+            for (size_t i = 0; i < n; i += BLOCK)
+            {
+                const size_t nb = std::min(BLOCK, n - i);
+                parallel::for_chunks(policy, m, 64, [&](size_t c0, size_t c1) {
+                    lower_rows(i, i + nb, a, rs, cs, unit, b, ldb, c0, c1);
+                }, nb * nb / 2);
+                if (i + nb < n)
+                    gemm::gemm<T>(n - i - nb, m, nb, T(-1), a + (i + nb) * rs + i * cs, rs, cs, b + i * ldb, ldb, 1,
+                                  T(1), b + (i + nb) * ldb, ldb, 1, policy);
+            }
+        }
+
+        /// B = A^-1 B for an upper triangular A, same as solve_lower() from the last block up
+        template <typename T>
+        void solve_upper(size_t n, size_t m, const T *a, ptrdiff_t rs, ptrdiff_t cs, bool unit, T *b, ptrdiff_t ldb,
+                         const parallel::Policy &policy = parallel::global_policy())
+        {
+            if (m == 1)
+                return upper_vector(n, a, rs, cs, unit, b, ldb);
+            for (size_t end = n; end > 0;)
+            {
+                const size_t i = end > BLOCK ? end - BLOCK : 0;
+                const size_t nb = end - i;
+                parallel::for_chunks(policy, m, 64, [&](size_t c0, size_t c1) {
+                    upper_rows(i, end, a, rs, cs, unit, b, ldb, c0, c1);
+                }, nb * nb / 2);
+                if (i > 0)
+                    gemm::gemm<T>(i, m, nb, T(-1), a + i * cs, rs, cs, b + i * ldb, ldb, 1, T(1), b, ldb, 1, policy);
+                end = i;
+            }
+        }
+
+        template <bool LOWER, typename A, typename B>
+        void solve(const A &a, B &b, const parallel::Policy &policy)
+        {
+            using T = typename expr::Leaf<A>::Type;
+            using LA = expr::Leaf<A>;
+            using LB = expr::Leaf<B>;
+            static_assert(std::is_floating_point<T>::value && std::is_same<typename LB::Type, T>::value,
+                          "Triangular solves need floating point operands of the same type");
+            static_assert(LA::STRIDED && LB::STRIDED, "Triangular solves need dense operands");
+            const size_t n = LA::rows(a);
+            const size_t m = LB::cols(b);
+            if (LA::cols(a) != n || LB::rows(b) != n)
+                PANIC("Incompatible matrix dimensions: ", n, 'x', LA::cols(a), " \\ ", LB::rows(b), 'x', m);
+            // a single column may have any stride, the blocked solve works on whole rows of b
+            const ptrdiff_t ldb = LB::row_stride(b);
+            if (m != 1 && LB::col_stride(b) != 1)
+                PANIC("Triangular solves need the rows of the right hand sides stored contiguously");
+            if (LOWER)
+                solve_lower(n, m, LA::data(a), LA::row_stride(a), LA::col_stride(a), false, LB::data_mut(b), ldb, policy);
+            else
+                solve_upper(n, m, LA::data(a), LA::row_stride(a), LA::col_stride(a), false, LB::data_mut(b), ldb, policy);
+        }
+    } // namespace triangular
+} // namespace internal
+
+/// b = a^-1 b in place for a lower triangular a and n x m right hand sides b, see the top of the file
+template <typename A, typename B, typename BB = typename std::decay<B>::type,
+          typename = typename std::enable_if<expr::Leaf<A>::IS_LEAF && expr::Leaf<BB>::IS_LEAF>::type>
+void solve_lower(const A &a, B &&b, const parallel::Policy &policy = parallel::global_policy())
+{
+    internal::triangular::solve<true>(a, b, policy);
+}
+
+/// b = a^-1 b in place for an upper triangular a
+template <typename A, typename B, typename BB = typename std::decay<B>::type,
+          typename = typename std::enable_if<expr::Leaf<A>::IS_LEAF && expr::Leaf<BB>::IS_LEAF>::type>
+void solve_upper(const A &a, B &&b, const parallel::Policy &policy = parallel::global_policy())
+{
+    internal::triangular::solve<false>(a, b, policy);
+}
+
+#endif // TRIANGULAR_H
@@ -0,0 +1,492 @@
+#if !defined(VIEW_H)
+#define VIEW_H
+
+#include <cstddef> // ptrdiff_t
+#include <type_traits>
+
+#include "util.h"
+#include "Format.h"
+#include "Range.h"
+#include "Gemm.h"
+#include "Expr.h"
+#include "Profile.h"
+#include "Accumulate.h"
+#include "Functional.h"
+
+/* Zero-copy strided views into dense matrices
+
+A view is a base pointer, a shape and a row and a column stride: element (i, j) lives at
+data + i * row_stride + j * col_stride. Slicing a matrix or a view and transposing a view only compute new
+strides, no element is copied. Views write through to the matrix they look at and can be used wherever a
+matrix can, in elementwise expressions (Expr.h), matrix products and dot products. Example:
+    auto m = DynMat<double>(100, 100);
+    auto block = m.slice(10, 19, 10, 19);   // 10x10 view of rows and columns 10 to 19
+    block = 2.0 * block;                    // doubles the block inside m
+    auto odd = m.slice(1, 99, 0, 99, 2);    // every second row
+    DynMat<double> p = odd.transpose() * odd;
+A view doesn't own anything, so it must not outlive its matrix. DynMatView<const T> is a read only view.
+Just like pointers a const view still allows writing the elements, only the view itself can't be changed.
+*/
+
+namespace internal
+{
+    template <typename T, template <class> typename MemBuf>
+    class AbstractDynMat;
+
+    /// Number of elements of start, start + step, ... up to and including stop, PANICs if that leaves the extent
+    inline size_t slice_length(size_t start, size_t stop, size_t step, size_t extent)
+    {
+        if (stop >= extent || start > stop)
+            PANIC("Invalid slice, tried to take ", start, " to ", stop, " of ", extent);
+        if (step == 0)
+            PANIC("Invalid slice, step has to be positive");
+        return (stop - start) / step + 1;
+    }
+
+    /// Base pointer and strides shared by DynMatView and MatView
+    template <typename T>
+    class StridedView
+    {
+    protected:
+        T *data_;
+        ptrdiff_t row_stride_;
+        ptrdiff_t col_stride_;
+
+        inline StridedView(T *data, ptrdiff_t row_stride, ptrdiff_t col_stride)
+            : data_(data), row_stride_(row_stride), col_stride_(col_stride) {}
+
+        inline T *address(size_t i, size_t j) const
+        {
+            return data_ + ptrdiff_t(i) * row_stride_ + ptrdiff_t(j) * col_stride_;
+        }
+
+    public:
+        inline T *data() const { return data_; }
+        inline ptrdiff_t row_stride() const { return row_stride_; }
+        inline ptrdiff_t col_stride() const { return col_stride_; }
+    };
+
+    template <typename View>
+    String show_view(const View &v)
+    {
+        auto s = ::format::to_string(v, ::format::Options::show());
+        if (!s.empty())
+            s.pop_back();
+        return s;
+    }
+} // namespace internal
+
+template <typename T>
+class DynBuffer;
+
+template <typename T>
+class DynMatView : public internal::StridedView<T>
+{
+private:
+    using Base = internal::StridedView<T>;
+
+public:
+    using Type = typename std::remove_const<T>::type;
+
+    const size_t SIZE;
+    const size_t ROWS_;
+    const size_t COLS_;
+
+    inline DynMatView(T *data, size_t rows, size_t cols, ptrdiff_t row_stride, ptrdiff_t col_stride)
+        : Base(data, row_stride, col_stride), SIZE(rows * cols), ROWS_(rows), COLS_(cols) {}
+
+    inline DynMatView(const DynMatView &other) = default;
+
+    // A mutable view converts to a read only one
+    template <typename U, typename = typename std::enable_if<std::is_same<const U, T>::value && !std::is_same<U, T>::value>::type>
+    inline DynMatView(const DynMatView<U> &other)
+        : DynMatView(other.data(), other.ROWS_, other.COLS_, other.row_stride(), other.col_stride()) {}
+
+    // Copies the elements of other into the viewed ones
+    inline DynMatView &operator=(const DynMatView &other)
+    {
+        expr::assign(*this, expr::Operand<DynMatView>::wrap(other));
+        return *this;
+    }
+
+    // Writes a matrix, view or elementwise expression of the same shape into the viewed elements
+    // (views that partially overlap this one, e.g. its own transpose, aren't safe)
+    template <typename X, typename = expr::enable_operand<X>>
+    inline DynMatView &operator=(const X &x)
+    {
+        expr::assign(*this, expr::Operand<X>::wrap(x));
+        return *this;
+    }
+
+    inline DynMatView &operator=(const Type scalar)
+    {
+        for (auto &&i : Range(ROWS_))
+            for (auto &&j : Range(COLS_))
+                *this->address(i, j) = scalar;
+        return *this;
+    }
+
+    inline size_t rows() const { return ROWS_; }
+    inline size_t cols() const { return COLS_; }
+
+    inline T &operator()(size_t i, size_t j) const
+    {
+        if constexpr (BOUNDS_CHECKED)
+        {
+            if (i >= ROWS_)
+                PANIC("Invalid Matrix index, tried to access row: ", i);
+            if (j >= COLS_)
+                PANIC("Invalid Matrix index, tried to access column: ", j);
+        }
+        return *this->address(i, j);
+    }
+
+    /// Element i in row major order of the view
+    inline T &operator[](size_t i) const
+    {
+        if constexpr (BOUNDS_CHECKED)
+        {
+            if (i >= SIZE)
+                PANIC("Invalid Matrix index, tried to access index: ", i);
+        }
+        return *this->address(i / COLS_, i % COLS_);
+    }
+
+    /// Element (i, j) without bounds checking in any build mode, for loops that stay within the shape
+    inline T &unchecked(size_t i, size_t j) const { return *this->address(i, j); }
+
+    /// View of rows start_row, start_row + step_row, ... up to and including stop_row, same for the columns
+    inline DynMatView slice(size_t start_row, size_t stop_row, size_t start_col, size_t stop_col, size_t step_row = 1, size_t step_col = 1) const
+    {
+        const size_t rows = internal::slice_length(start_row, stop_row, step_row, ROWS_);
+        const size_t cols = internal::slice_length(start_col, stop_col, step_col, COLS_);
+        const auto scope = ::profile::Scope(::profile::Op::Slice, rows * cols, 0);
+        return DynMatView(this->address(start_row, start_col), rows, cols,
+                          this->row_stride_ * ptrdiff_t(step_row), this->col_stride_ * ptrdiff_t(step_col));
+    }
+
+    inline DynMatView row(size_t row) const { return slice(row, row, 0, COLS_ - 1); }
+    inline DynMatView column(size_t column) const { return slice(0, ROWS_ - 1, column, column); }
+
+    /// The transposed view, rows and columns just swap their strides
+    inline DynMatView transpose() const
+    {
+        return DynMatView(this->data_, COLS_, ROWS_, this->col_stride_, this->row_stride_);
+    }
+
+    /// Copies the viewed elements into a new matrix
+    inline internal::AbstractDynMat<Type, DynBuffer> to_owned() const
+    {
+        const auto scope = ::profile::Scope(::profile::Op::Slice, ROWS_ * COLS_, 0);
+        auto m = internal::AbstractDynMat<Type, DynBuffer>(ROWS_, COLS_);
+        expr::assign(m, expr::Terminal<DynMatView>(*this));
+        return m;
+    }
+
+    /// New matrix of f(x) for every viewed element x, f is any callable and U defaults to its result
+    template <typename U = void, typename F>
+    internal::AbstractDynMat<internal::functional::result_t<U, F, Type>, DynBuffer> map(const F &f) const
+    {
+        auto m = internal::AbstractDynMat<internal::functional::result_t<U, F, Type>, DynBuffer>(ROWS_, COLS_);
+        auto *out = m.as_raw_mut();
+        for (auto &&i : Range(ROWS_))
+            for (auto &&j : Range(COLS_))
+                out[i * COLS_ + j] = f(*this->address(i, j));
+        return m;
+    }
+
+    inline String show() const { return internal::show_view(*this); }
+};
+
+template <typename T, size_t _ROWS, size_t _COLS>
+class MatView : public internal::StridedView<T>
+{
+private:
+    using Base = internal::StridedView<T>;
+
+public:
+    using Type = typename std::remove_const<T>::type;
+
+    constexpr static const size_t SIZE = _ROWS * _COLS;
+    static const size_t ROWS = _ROWS;
+    static const size_t COLS = _COLS;
+
+    inline MatView(T *data, ptrdiff_t row_stride, ptrdiff_t col_stride) : Base(data, row_stride, col_stride) {}
+
+    inline MatView(const MatView &other) = default;
+
+    template <typename U, typename = typename std::enable_if<std::is_same<const U, T>::value && !std::is_same<U, T>::value>::type>
+    inline MatView(const MatView<U, ROWS, COLS> &other) : MatView(other.data(), other.row_stride(), other.col_stride()) {}
+
+    // The same view with its shape only known at runtime
+    inline operator DynMatView<T>() const
+    {
+        return DynMatView<T>(this->data_, ROWS, COLS, this->row_stride_, this->col_stride_);
+    }
+
+    // Copies the elements of other into the viewed ones
+    inline MatView &operator=(const MatView &other)
+    {
+        expr::assign(*this, expr::Operand<MatView>::wrap(other));
+        return *this;
+    }
+
+    // Writes a matrix, view or elementwise expression of the same shape into the viewed elements
+    // (views that partially overlap this one, e.g. its own transpose, aren't safe)
+    template <typename X, typename = expr::enable_operand<X>>
+    inline MatView &operator=(const X &x)
+    {
+        expr::assign(*this, expr::Operand<X>::wrap(x));
+        return *this;
+    }
+
+    inline MatView &operator=(const Type scalar)
+    {
+        for (auto &&i : Range(ROWS))
+            for (auto &&j : Range(COLS))
+                *this->address(i, j) = scalar;
+        return *this;
+    }
+
+    inline static constexpr size_t rows() { return ROWS; }
+    inline static constexpr size_t cols() { return COLS; }
+
+    inline T &operator()(size_t i, size_t j) const
+    {
+        if constexpr (BOUNDS_CHECKED)
+        {
+            if (i >= ROWS)
+                PANIC("Invalid Matrix index, tried to access row: ", i);
+            if (j >= COLS)
+                PANIC("Invalid Matrix index, tried to access column: ", j);
+        }
+        return *this->address(i, j);
+    }
+
+    /// Element i in row major order of the view
+    inline T &operator[](size_t i) const
+    {
+        if constexpr (BOUNDS_CHECKED)
+        {
+            if (i >= SIZE)
+                PANIC("Invalid Matrix index, tried to access index: ", i);
+        }
+        return *this->address(i / COLS, i % COLS);
+    }
+
+    /// Element (i, j) without bounds checking in any build mode, for loops that stay within the shape
+    inline T &unchecked(size_t i, size_t j) const { return *this->address(i, j); }
+
+    /// View of rows START_ROW, START_ROW + STEP_ROW, ... up to and including STOP_ROW, same for the columns
+    template <size_t START_ROW, size_t STOP_ROW, size_t START_COL, size_t STOP_COL, size_t STEP_ROW = 1, size_t STEP_COL = 1>
+    inline MatView<T, (STOP_ROW - START_ROW) / STEP_ROW + 1, (STOP_COL - START_COL) / STEP_COL + 1> slice() const
+    {
+        static_assert(START_ROW <= STOP_ROW && STOP_ROW < ROWS && START_COL <= STOP_COL && STOP_COL < COLS, "Invalid slice");
+        static_assert(STEP_ROW > 0 && STEP_COL > 0, "Invalid slice, steps have to be positive");
+        return MatView<T, (STOP_ROW - START_ROW) / STEP_ROW + 1, (STOP_COL - START_COL) / STEP_COL + 1>(
+            this->address(START_ROW, START_COL), this->row_stride_ * ptrdiff_t(STEP_ROW), this->col_stride_ * ptrdiff_t(STEP_COL));
+    }
+
+    inline MatView<T, 1, COLS> row(size_t row) const
+    {
+        if (row >= ROWS)
+            PANIC("Invalid Matrix index, tried to access row: ", row);
+        return MatView<T, 1, COLS>(this->address(row, 0), this->row_stride_, this->col_stride_);
+    }
+
+    inline MatView<T, ROWS, 1> column(size_t column) const
+    {
+        if (column >= COLS)
+            PANIC("Invalid Matrix index, tried to access column: ", column);
+        return MatView<T, ROWS, 1>(this->address(0, column), this->row_stride_, this->col_stride_);
+    }
+
+    /// The transposed view, rows and columns just swap their strides
+    inline MatView<T, COLS, ROWS> transpose() const
+    {
+        return MatView<T, COLS, ROWS>(this->data_, this->col_stride_, this->row_stride_);
+    }
+
+    /// Copies the viewed elements into a new matrix
+    inline Mat<Type, ROWS, COLS> to_owned() const
+    {
+        auto m = Mat<Type, ROWS, COLS>();
+        expr::assign(m, expr::Terminal<MatView>(*this));
+        return m;
+    }
+
+    /// New matrix of f(x) for every viewed element x, f is any callable and U defaults to its result
+    template <typename U = void, typename F>
+    Mat<internal::functional::result_t<U, F, Type>, ROWS, COLS> map(const F &f) const
+    {
+        auto m = Mat<internal::functional::result_t<U, F, Type>, ROWS, COLS>();
+        for (auto &&i : Range(ROWS))
+            for (auto &&j : Range(COLS))
+                m(i, j) = f(*this->address(i, j));
+        return m;
+    }
+
+    inline String show() const { return internal::show_view(*this); }
+};
+
+namespace expr
+{
+    template <typename T>
+    struct Leaf<DynMatView<T>>
+    {
+        static const bool IS_LEAF = true;
+        static const bool STRIDED = true;
+        using Type = typename std::remove_const<T>::type;
+        using M = DynMatView<T>;
+        using Owned = internal::AbstractDynMat<Type, DynBuffer>;
+
+        static size_t rows(const M &m) { return m.ROWS_; }
+        static size_t cols(const M &m) { return m.COLS_; }
+        static ptrdiff_t row_stride(const M &m) { return m.row_stride(); }
+        static ptrdiff_t col_stride(const M &m) { return m.col_stride(); }
+        static const Type *data(const M &m) { return m.data(); }
+        static T *data_mut(M &m) { return m.data(); }
+    };
+
+    template <typename T, size_t ROWS, size_t COLS>
+    struct Leaf<MatView<T, ROWS, COLS>>
+    {
+        static const bool IS_LEAF = true;
+        static const bool STRIDED = true;
+        using Type = typename std::remove_const<T>::type;
+        using M = MatView<T, ROWS, COLS>;
+        using Owned = Mat<Type, ROWS, COLS>;
+
+        static size_t rows(const M &) { return ROWS; }
+        static size_t cols(const M &) { return COLS; }
+        static ptrdiff_t row_stride(const M &m) { return m.row_stride(); }
+        static ptrdiff_t col_stride(const M &m) { return m.col_stride(); }
+        static const Type *data(const M &m) { return m.data(); }
+        static T *data_mut(M &m) { return m.data(); }
+    };
+} // namespace expr
+
+namespace internal
+{
+    template <typename X>
+    struct is_view : std::false_type
+    {
+    };
+
+    template <typename T>
+    struct is_view<DynMatView<T>> : std::true_type
+    {
+    };
+
+    template <typename T, size_t ROWS, size_t COLS>
+    struct is_view<MatView<T, ROWS, COLS>> : std::true_type
+    {
+    };
+
+    /// Shape known at compile time, for Mat and MatView
+    template <typename X>
+    struct StaticShape
+    {
+        static const bool KNOWN = false;
+    };
+
+    template <typename T, size_t _ROWS, size_t _COLS>
+    struct StaticShape<Mat<T, _ROWS, _COLS>>
+    {
+        static const bool KNOWN = true;
+        static const size_t ROWS = _ROWS;
+        static const size_t COLS = _COLS;
+    };
+
+    template <typename T, size_t _ROWS, size_t _COLS>
+    struct StaticShape<MatView<T, _ROWS, _COLS>>
+    {
+        static const bool KNOWN = true;
+        static const size_t ROWS = _ROWS;
+        static const size_t COLS = _COLS;
+    };
+
+    /// Products with a view use this result type: a Mat if both shapes are static, a DynMat otherwise
+    template <typename L, typename R, typename T, bool = StaticShape<L>::KNOWN && StaticShape<R>::KNOWN>
+    struct ProductResult
+    {
+        using Type = AbstractDynMat<T, DynBuffer>;
+        static Type make(size_t rows, size_t cols) { return Type(rows, cols); }
+    };
+
+    template <typename L, typename R, typename T>
+    struct ProductResult<L, R, T, true>
+    {
+        using Type = Mat<T, StaticShape<L>::ROWS, StaticShape<R>::COLS>;
+        static Type make(size_t, size_t) { return Type(); }
+    };
+
+    template <typename L, typename R>
+    using enable_view_product = typename std::enable_if<
+        (is_view<L>::value || is_view<R>::value) && expr::Leaf<L>::IS_LEAF && expr::Leaf<R>::IS_LEAF &&
+        std::is_same<typename expr::Leaf<L>::Type, typename expr::Leaf<R>::Type>::value>::type;
+} // namespace internal
+
+// Matrix multiplication with a view operand, strided operands go straight into the GEMM kernel
+template <typename L, typename R, typename = internal::enable_view_product<L, R>>
+auto operator*(const L &l, const R &r)
+{
+    using T = typename expr::Leaf<L>::Type;
+    using LL = expr::Leaf<L>;
+    using LR = expr::Leaf<R>;
+    const size_t m = LL::rows(l);
+    const size_t k = LL::cols(l);
+    const size_t n = LR::cols(r);
+    if (LR::rows(r) != k)
+        PANIC("Incompatible matrix dimensions: ", m, 'x', k, " * ", LR::rows(r), 'x', n);
+    const auto scope = ::profile::Scope(::profile::Op::Gemm, m * n, 2 * m * n * k);
+    using Result = internal::ProductResult<L, R, T>;
+    auto m3 = Result::make(m, n);
+    T *out = m3.as_raw_mut();
+    if constexpr (std::is_floating_point<T>::value && LL::STRIDED && LR::STRIDED)
+    {
+        internal::gemm::gemm<T>(m, n, k, T(1),
+                                LL::data(l), LL::row_stride(l), LL::col_stride(l),
+                                LR::data(r), LR::row_stride(r), LR::col_stride(r),
+                                T(), out, n, 1, parallel::global_policy());
+        return m3;
+    }
+    const auto a = expr::Terminal<L>(l);
+    const auto b = expr::Terminal<R>(r);
+    for (size_t i = 0; i < m; ++i)
+        for (size_t j = 0; j < n; ++j)
+        {
+            T sum = T();
+            for (size_t p = 0; p < k; ++p)
+                sum += a.at(i, p) * b.at(p, j);
+            out[i * n + j] = sum;
+        }
+    return m3;
+}
+
+// Dot product of two vectors of the same length, at least one of them a view (row or column alike), accumulated under Acc
+template <typename Acc = accumulate::Native, typename L, typename R, typename = internal::enable_view_product<L, R>>
+accumulate::result_t<Acc, typename expr::Leaf<L>::Type> dot(const L &l, const R &r)
+{
+    using T = typename expr::Leaf<L>::Type;
+    const auto a = expr::Terminal<L>(l);
+    const auto b = expr::Terminal<R>(r);
+    if ((a.rows() != 1 && a.cols() != 1) || (b.rows() != 1 && b.cols() != 1) || a.rows() * a.cols() != b.rows() * b.cols())
+        PANIC("Incompatible matrix dimensions: ", a.rows(), 'x', a.cols(), " . ", b.rows(), 'x', b.cols());
+    const size_t n = a.rows() * a.cols();
+    if constexpr (simd::is_vectorizable<T>::value && expr::Leaf<L>::STRIDED && expr::Leaf<R>::STRIDED)
+    {
+        // vectors are contiguous if the stride along their long side is 1
+        const auto unit = [](auto leaf, const auto &x) {
+            return decltype(leaf)::rows(x) == 1 ? decltype(leaf)::col_stride(x) == 1 : decltype(leaf)::row_stride(x) == 1;
+        };
+        if (unit(expr::Leaf<L>(), l) && unit(expr::Leaf<R>(), r))
+            return accumulate::dot<Acc>(expr::Leaf<L>::data(l), expr::Leaf<R>::data(r), n);
+    }
+    auto acc = accumulate::Accumulator<Acc, T>();
+    for (size_t i = 0; i < n; ++i)
+        acc.add_product(a.rows() == 1 ? a.at(0, i) : a.at(i, 0), b.rows() == 1 ? b.at(0, i) : b.at(i, 0));
+    return acc.value();
+}
+
+#endif // VIEW_H
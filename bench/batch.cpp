@@ -0,0 +1,115 @@
+// Batch benchmark: MatBatch (structure of arrays) against loops over std::vector<Mat>, in ns per matrix
+// Build: g++ -std=c++17 -O3 -march=native -DNDEBUG -I.. batch.cpp -o batch -pthread
+// Usage: ./batch [count] [threads]   (defaults to 10000 matrices on 1 thread)
+// Batches that don't fit into the caches are bound by memory bandwidth either way, e.g. 1000000 4x4 doubles are 128 MB.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "../Batch.h"
+
+using Clock = std::chrono::steady_clock;
+
+template <typename T, size_t N>
+std::vector<Mat<T, N, N>> random_mats(size_t count)
+{
+    auto ms = std::vector<Mat<T, N, N>>(count);
+    for (auto &&m : ms)
+    {
+        for (size_t i = 0; i < N * N; ++i)
+            m.as_raw_mut()[i] = static_cast<T>(rand()) / RAND_MAX - T(0.5);
+        // diagonally dominant, so every one of them is invertible
+        for (size_t i = 0; i < N; ++i)
+            m(i, i) += T(N);
+    }
+    return ms;
+}
+
+// Runs f at least 3 times and for at least 0.2s, returns the best time in seconds
+template <typename F>
+double best_of(F f)
+{
+    double best = 1e300;
+    double total = 0;
+    for (int r = 0; r < 3 || total < 0.2; ++r)
+    {
+        auto t0 = Clock::now();
+        f();
+        double t = std::chrono::duration<double>(Clock::now() - t0).count();
+        best = std::min(best, t);
+        total += t;
+    }
+    return best;
+}
+
+template <typename T, size_t N>
+void run(const char *type, size_t count, const parallel::Policy &policy)
+{
+    const auto a = random_mats<T, N>(count);
+    const auto b = random_mats<T, N>(count);
+    auto c = std::vector<Mat<T, N, N>>(count);
+    const double ns = 1e9 / count;
+
+    std::cout << type << ' ' << N << 'x' << N;
+    nl();
+
+    double t_gather = best_of([&] { auto x = MatBatch<T, N, N>(a, policy); (void)x; });
+    const auto ba = MatBatch<T, N, N>(a, policy);
+    const auto bb = MatBatch<T, N, N>(b, policy);
+    double t_scatter = best_of([&] { ba.scatter(c.data(), policy); });
+    std::cout << "  gather: " << t_gather * ns << " ns  scatter: " << t_scatter * ns << " ns";
+    nl();
+
+    double fast = best_of([&] { auto x = multiply(ba, bb, policy); (void)x; });
+    double loop = best_of([&] { for (size_t i = 0; i < count; ++i) c[i] = a[i] * b[i]; });
+    std::cout << "  multiply: " << fast * ns << " ns  vector<Mat>: " << loop * ns << " ns  speedup: " << loop / fast << 'x';
+    nl();
+
+    auto v = MatBatch<T, N, 1>(count);
+    auto vs = std::vector<Mat<T, N, 1>>(count);
+    fast = best_of([&] { auto x = transform(ba, v, policy); (void)x; });
+    loop = best_of([&] { for (size_t i = 0; i < count; ++i) vs[i] = a[i] * vs[i]; });
+    std::cout << "  transform: " << fast * ns << " ns  vector<Mat>: " << loop * ns << " ns  speedup: " << loop / fast << 'x';
+    nl();
+
+    fast = best_of([&] { auto x = ba.inverse(policy); (void)x; });
+    loop = best_of([&] { for (size_t i = 0; i < count; ++i) c[i] = a[i].inverse(); });
+    std::cout << "  inverse: " << fast * ns << " ns  vector<Mat>: " << loop * ns << " ns  speedup: " << loop / fast << 'x';
+    nl();
+
+    fast = best_of([&] { auto x = ba.add(bb, policy); (void)x; });
+    loop = best_of([&] { for (size_t i = 0; i < count; ++i) c[i] = a[i] + b[i]; });
+    std::cout << "  add: " << fast * ns << " ns  vector<Mat>: " << loop * ns << " ns  speedup: " << loop / fast << 'x';
+    nl();
+
+    // sanity check, the batched results have to match the Mat ones
+    const auto prod = multiply(ba, bb, policy).to_vector(policy);
+    const auto inv = ba.inverse(policy);
+    T err = T();
+    for (size_t i = 0; i < count; ++i)
+    {
+        const auto p = a[i] * b[i];
+        const auto q = inv.get(i);
+        const auto r = a[i].inverse();
+        for (size_t k = 0; k < N * N; ++k)
+            err = std::max({err, std::abs(prod[i].as_raw()[k] - p.as_raw()[k]), std::abs(q.as_raw()[k] - r.as_raw()[k])});
+    }
+    std::cout << "  max abs difference to Mat: " << err;
+    nl();
+}
+
+int main(int argc, char **argv)
+{
+    const size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+    if (argc > 2)
+        parallel::set_threads(std::strtoul(argv[2], nullptr, 10));
+    const auto &policy = parallel::global_policy();
+    run<double, 2>("double", count, policy);
+    run<double, 3>("double", count, policy);
+    run<double, 4>("double", count, policy);
+    run<float, 2>("float ", count, policy);
+    run<float, 3>("float ", count, policy);
+    run<float, 4>("float ", count, policy);
+}
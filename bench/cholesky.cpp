@@ -0,0 +1,120 @@
+// Cholesky benchmark: blocked factorization against the textbook triple loop written with operator(),
+// triangular solves and rank one updates against refactoring
+// Build: g++ -std=c++17 -O3 -march=native -DNDEBUG -I.. cholesky.cpp -o cholesky -pthread
+// Usage: ./cholesky [sizes...]   (defaults to 500 1000 2000 5000, the naive loop is skipped above 2000)
+// Set MATRAC_THREADS=n to run the GEMM updates and the solves on n threads.
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "../Cholesky.h"
+
+using Clock = std::chrono::steady_clock;
+
+template <typename T>
+DynMat<T> random_mat(size_t rows, size_t cols)
+{
+    auto m = DynMat<T>(rows, cols);
+    for (size_t i = 0; i < m.SIZE; ++i)
+        m[i] = static_cast<T>(rand()) / RAND_MAX - T(0.5);
+    return m;
+}
+
+// G G^T + n I is comfortably positive definite
+template <typename T>
+DynMat<T> random_spd(size_t n)
+{
+    const auto g = random_mat<T>(n, n);
+    DynMat<T> a = g * g.transpose();
+    for (size_t i = 0; i < n; ++i)
+        a(i, i) += T(n);
+    return a;
+}
+
+// The Cholesky-Banachiewicz loop as one would write it with the element accessors, kept as a baseline
+template <typename T>
+DynMat<T> naive_cholesky(const DynMat<T> &a)
+{
+    const size_t n = a.ROWS_;
+    auto l = DynMat<T>(n, n);
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = 0; j <= i; ++j)
+        {
+            T sum = a(i, j);
+            for (size_t k = 0; k < j; ++k)
+                sum -= l(i, k) * l(j, k);
+            l(i, j) = i == j ? std::sqrt(sum) : sum / l(j, j);
+        }
+    return l;
+}
+
+// Runs f at least `reps` times and for at least 0.2s, returns the best time in seconds
+template <typename F>
+double best_of(F f, int reps)
+{
+    double best = 1e300;
+    double total = 0;
+    for (int r = 0; r < reps || total < 0.2; ++r)
+    {
+        auto t0 = Clock::now();
+        f();
+        double t = std::chrono::duration<double>(Clock::now() - t0).count();
+        best = std::min(best, t);
+        total += t;
+    }
+    return best;
+}
+
+template <typename T>
+void run(const char *type, size_t n)
+{
+    const auto a = random_spd<T>(n);
+    const double flops = 1.0 / 3.0 * n * n * n;
+
+    double t_blocked = best_of([&] { auto f = Cholesky<T>(a); (void)f; }, 3);
+    std::cout << type << " n=" << n << "  blocked: " << t_blocked * 1e3 << " ms " << flops / t_blocked * 1e-9 << " GFLOP/s";
+    if (n <= 2000)
+    {
+        double t_naive = best_of([&] { auto l = naive_cholesky(a); (void)l; }, 1);
+        std::cout << "  naive: " << flops / t_naive * 1e-9 << " GFLOP/s  speedup: " << t_naive / t_blocked << 'x';
+    }
+
+    auto f = Cholesky<T>(a);
+    const auto b = random_mat<T>(n, 1);
+    auto x = b;
+    double t_solve = best_of([&] { x = b; f.solve_in_place(x); }, 10);
+    const auto bs = random_mat<T>(n, 64);
+    auto xs = bs;
+    double t_solve64 = best_of([&] { xs = bs; f.solve_in_place(xs); }, 3);
+    std::cout << "  solve: " << t_solve * 1e6 << " us  64 rhs: " << t_solve64 * 1e3 << " ms";
+
+    // an update followed by a downdate with the same vector leaves the factor where it was
+    const auto v = random_mat<T>(n, 1);
+    double t_update = best_of([&] { f.update(v); f.downdate(v); }, 3) / 2;
+    std::cout << "  rank one update: " << t_update * 1e3 << " ms  refactor / update: " << t_blocked / t_update << 'x';
+
+    // sanity checks, the residual of the solve and the factor after all the updates
+    const auto r = multiply(a, f.solve(b), parallel::global_policy());
+    T err = T();
+    for (size_t i = 0; i < n; ++i)
+        err = std::max(err, std::abs(r[i] - b[i]));
+    std::cout << "  max residual: " << err;
+    nl();
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(std::strtoul(argv[i], nullptr, 10));
+    if (sizes.empty())
+        sizes = {500, 1000, 2000, 5000};
+    for (auto n : sizes)
+    {
+        run<double>("double", n);
+        run<float>("float ", n);
+    }
+}
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Compares two matrac_bench JSON results, e.g. of the main branch and of a change.
+
+Usage: bench/compare.py baseline.json current.json [--threshold 0.05] [--filter substring]
+
+Prints the time ratio (current / baseline) of every benchmark present in both files and flags
+the ones that got slower by more than the threshold or allocate more per iteration than before.
+Exits with 1 if any benchmark regressed, so it can gate CI.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    return data, {r["name"]: r for r in data["results"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=0.05,
+                        help="relative slowdown that counts as a regression (default 0.05)")
+    parser.add_argument("--filter", action="append", default=[],
+                        help="only compare benchmarks whose name contains the substring")
+    args = parser.parse_args()
+
+    base_info, base = load(args.baseline)
+    cur_info, cur = load(args.current)
+    for key in ("isa", "threads"):
+        if base_info.get(key) != cur_info.get(key):
+            print(f"warning: {key} differs: {base_info.get(key)} vs {cur_info.get(key)}")
+
+    regressions = 0
+    print(f"{'benchmark':36} {'baseline [ns]':>14} {'current [ns]':>14} {'ratio':>8} {'allocs':>14}")
+    for name, c in cur.items():
+        if args.filter and not any(f in name for f in args.filter):
+            continue
+        b = base.get(name)
+        if b is None:
+            continue
+        ratio = c["time_ns"] / b["time_ns"]
+        allocs = f"{b['allocations']:.2f}->{c['allocations']:.2f}"
+        flags = []
+        if ratio > 1 + args.threshold:
+            flags.append("SLOWER")
+        elif ratio < 1 - args.threshold:
+            flags.append("faster")
+        # fractional allocation counts come from the calibration runs, only whole ones are real
+        if c["allocations"] >= b["allocations"] + 1:
+            flags.append("MORE ALLOCATIONS")
+        if "SLOWER" in flags or "MORE ALLOCATIONS" in flags:
+            regressions += 1
+        print(f"{name:36} {b['time_ns']:14.1f} {c['time_ns']:14.1f} {ratio:8.3f} {allocs:>14} {' '.join(flags)}")
+
+    missing = sorted(set(base) - set(cur))
+    if missing and not args.filter:
+        print(f"not in {args.current}: {', '.join(missing)}")
+    print(f"{regressions} regression(s) at a threshold of {args.threshold:.0%}")
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
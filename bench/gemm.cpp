@@ -0,0 +1,95 @@
+// GEMM benchmark: packed and blocked DynMat operator* against the plain i-j-k loop
+// Build: g++ -std=c++17 -O3 -march=native -I.. gemm.cpp -o gemm
+// Usage: ./gemm [sizes...]   (defaults to 128 256 512 1024 2048)
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "../DynMat.h"
+
+using Clock = std::chrono::steady_clock;
+
+// The multiplication as it was before the blocked kernel, kept as a baseline
+template <typename T>
+DynMat<T> naive_multiply(const DynMat<T> &a, const DynMat<T> &b)
+{
+    auto c = DynMat<T>(a.ROWS_, b.COLS_);
+    for (auto &&i : Range(a.ROWS_))
+        for (auto &&j : Range(b.COLS_))
+        {
+            T sum = T();
+            for (auto &&k : Range(a.COLS_))
+                sum += a(i, k) * b(k, j);
+            c(i, j) = sum;
+        }
+    return c;
+}
+
+template <typename T>
+DynMat<T> random_mat(size_t rows, size_t cols)
+{
+    auto m = DynMat<T>(rows, cols);
+    for (size_t i = 0; i < m.SIZE; ++i)
+        m[i] = static_cast<T>(rand()) / RAND_MAX - T(0.5);
+    return m;
+}
+
+// Runs f at least `reps` times and for at least 0.2s, returns the best time in seconds
+template <typename F>
+double best_of(F f, int reps)
+{
+    double best = 1e300;
+    double total = 0;
+    for (int r = 0; r < reps || total < 0.2; ++r)
+    {
+        auto t0 = Clock::now();
+        f();
+        double t = std::chrono::duration<double>(Clock::now() - t0).count();
+        best = std::min(best, t);
+        total += t;
+    }
+    return best;
+}
+
+template <typename T>
+void run(const char *type, size_t n)
+{
+    auto a = random_mat<T>(n, n);
+    auto b = random_mat<T>(n, n);
+    const double flops = 2.0 * n * n * n;
+
+    double t_fast = best_of([&] { auto c = a * b; (void)c; }, 3);
+    std::cout << type << " n=" << n << "  blocked: " << flops / t_fast * 1e-9 << " GFLOP/s";
+
+    // the naive loop gets prohibitively slow, only time it for moderate sizes
+    if (n <= 1024)
+    {
+        double t_naive = best_of([&] { auto c = naive_multiply(a, b); (void)c; }, 1);
+        std::cout << "  naive: " << flops / t_naive * 1e-9 << " GFLOP/s  speedup: " << t_naive / t_fast << 'x';
+
+        // sanity check against the reference
+        auto c1 = a * b;
+        auto c2 = naive_multiply(a, b);
+        double err = 0;
+        for (size_t i = 0; i < c1.SIZE; ++i)
+            err = std::max(err, std::abs(static_cast<double>(c1[i] - c2[i])));
+        std::cout << "  max abs diff: " << err;
+    }
+    nl();
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(std::strtoul(argv[i], nullptr, 10));
+    if (sizes.empty())
+        sizes = {128, 256, 512, 1024, 2048};
+    for (auto n : sizes)
+    {
+        run<double>("double", n);
+        run<float>("float ", n);
+    }
+}
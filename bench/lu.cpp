@@ -0,0 +1,83 @@
+// LU benchmark: blocked LU factorization against the unblocked one, plus the cost of re-solving with a factorization
+// Build: g++ -std=c++17 -O3 -march=native -DNDEBUG -I.. lu.cpp -o lu -pthread
+// Usage: ./lu [sizes...]   (defaults to 256 512 1024 2048)
+// Set MATRAC_THREADS=n to run the GEMM updates and the solves on n threads.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "../Lu.h"
+
+using Clock = std::chrono::steady_clock;
+
+template <typename T>
+DynMat<T> random_mat(size_t rows, size_t cols)
+{
+    auto m = DynMat<T>(rows, cols);
+    for (size_t i = 0; i < m.SIZE; ++i)
+        m[i] = static_cast<T>(rand()) / RAND_MAX - T(0.5);
+    return m;
+}
+
+// Runs f at least `reps` times and for at least 0.2s, returns the best time in seconds
+template <typename F>
+double best_of(F f, int reps)
+{
+    double best = 1e300;
+    double total = 0;
+    for (int r = 0; r < reps || total < 0.2; ++r)
+    {
+        auto t0 = Clock::now();
+        f();
+        double t = std::chrono::duration<double>(Clock::now() - t0).count();
+        best = std::min(best, t);
+        total += t;
+    }
+    return best;
+}
+
+template <typename T>
+void run(const char *type, size_t n)
+{
+    const auto a = random_mat<T>(n, n);
+    const auto b = random_mat<T>(n, 1);
+    const double flops = 2.0 / 3.0 * n * n * n;
+
+    double t_blocked = best_of([&] { auto f = Lu<T>(a); (void)f; }, 3);
+    std::cout << type << " n=" << n << "  blocked: " << flops / t_blocked * 1e-9 << " GFLOP/s";
+
+    // the whole matrix as one panel is the textbook elimination, one row operation at a time
+    auto piv = std::vector<size_t>(n);
+    double t_plain = best_of([&] { auto c = a; internal::lu::panel(c.as_raw_mut(), n, 0, n, piv.data()); }, 1);
+    std::cout << "  unblocked: " << flops / t_plain * 1e-9 << " GFLOP/s  speedup: " << t_plain / t_blocked << 'x';
+
+    // factorize once, solve many times
+    const auto f = Lu<T>(a);
+    auto x = b;
+    double t_solve = best_of([&] { x = b; f.solve_in_place(x); }, 10);
+    std::cout << "  solve: " << t_solve * 1e6 << " us";
+
+    // sanity check, the residual of the solve relative to b
+    const auto r = multiply(a, f.solve(b), parallel::global_policy());
+    T err = T();
+    for (size_t i = 0; i < n; ++i)
+        err = std::max(err, std::abs(r[i] - b[i]));
+    std::cout << "  max residual: " << err;
+    nl();
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(std::strtoul(argv[i], nullptr, 10));
+    if (sizes.empty())
+        sizes = {256, 512, 1024, 2048};
+    for (auto n : sizes)
+    {
+        run<double>("double", n);
+        run<float>("float ", n);
+    }
+}
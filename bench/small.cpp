@@ -0,0 +1,143 @@
+// Small matrix benchmark: unrolled 2x2 / 3x3 / 4x4 Mat kernels against the generic loops, in ns per operation
+// Build: g++ -std=c++17 -O3 -march=native -I.. small.cpp -o small
+// (without -DNDEBUG the baseline pays for bounds checks like it did before)
+// Usage: ./small
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "../DynMat.h"
+
+using Clock = std::chrono::steady_clock;
+
+// Matrices per pass, enough to not fit the whole pass into registers but still stay in L1 / L2
+const size_t COUNT = 1024;
+
+template <typename T, size_t N>
+std::vector<Mat<T, N, N>> random_mats()
+{
+    auto ms = std::vector<Mat<T, N, N>>(COUNT);
+    for (auto &&m : ms)
+    {
+        for (size_t i = 0; i < N * N; ++i)
+            m.as_raw_mut()[i] = static_cast<T>(rand()) / RAND_MAX - T(0.5);
+        // diagonally dominant, so every one of them is invertible
+        for (size_t i = 0; i < N; ++i)
+            m(i, i) += T(N);
+    }
+    return ms;
+}
+
+// Products and transposes as Mat did them before the unrolled kernels, kept as a baseline
+template <typename T, size_t N>
+Mat<T, N, N> generic_multiply(const Mat<T, N, N> &self, const Mat<T, N, N> &other)
+{
+    auto m3 = Mat<T, N, N>();
+    for (auto &&i : Range(N))
+        for (auto &&j : Range(N))
+        {
+            T sum = T();
+            for (auto &&k : Range(N))
+                sum += self(static_cast<size_t>(i), static_cast<size_t>(k)) *
+                       other(static_cast<size_t>(k), static_cast<size_t>(j));
+            m3(i, j) = sum;
+        }
+    return m3;
+}
+
+template <typename T, size_t N>
+Mat<T, N, N> generic_transpose(const Mat<T, N, N> &m)
+{
+    auto m1 = m;
+    auto m2 = Mat<T, N, N>();
+    for (auto &&i : Range(N))
+        for (auto &&j : Range(N))
+            m2(j, i) = m1(i, j);
+    return m2;
+}
+
+// Mat had no inverse / determinant before, they're compared against the elimination used for other sizes
+template <typename T, size_t N>
+Mat<T, N, N> generic_inverse(const Mat<T, N, N> &a)
+{
+    auto c = Mat<T, N, N>();
+    internal::small::generic_inverse(a.as_raw(), c.as_raw_mut(), N);
+    return c;
+}
+
+// Runs f over all matrices for at least 0.2s, returns the best time per matrix in nanoseconds
+template <typename F>
+double ns_per_op(F f)
+{
+    double best = 1e300;
+    double total = 0;
+    for (int r = 0; r < 5 || total < 0.2; ++r)
+    {
+        auto t0 = Clock::now();
+        for (size_t i = 0; i < COUNT; ++i)
+            f(i);
+        double t = std::chrono::duration<double>(Clock::now() - t0).count();
+        best = std::min(best, t);
+        total += t;
+    }
+    return best / COUNT * 1e9;
+}
+
+void report(const char *op, double fast, double generic)
+{
+    std::cout << "  " << op << ": " << fast << " ns  generic: " << generic << " ns  speedup: " << generic / fast << 'x';
+    nl();
+}
+
+template <typename T, size_t N>
+void run(const char *type)
+{
+    const auto a = random_mats<T, N>();
+    const auto b = random_mats<T, N>();
+    auto c = std::vector<Mat<T, N, N>>(COUNT);
+    volatile T sink = T();
+
+    std::cout << type << ' ' << N << 'x' << N;
+    nl();
+
+    // chained like transform compositions, every product depends on the previous one
+    double fast = ns_per_op([&](size_t i) { c[i] = a[i] * b[i] * a[(i + 1) % COUNT]; });
+    double generic = ns_per_op([&](size_t i) { c[i] = generic_multiply(generic_multiply(a[i], b[i]), a[(i + 1) % COUNT]); });
+    report("2 multiplies", fast, generic);
+
+    fast = ns_per_op([&](size_t i) { c[i] = a[i].transpose(); });
+    generic = ns_per_op([&](size_t i) { c[i] = generic_transpose(a[i]); });
+    report("transpose", fast, generic);
+
+    fast = ns_per_op([&](size_t i) { c[i] = a[i].inverse(); });
+    generic = ns_per_op([&](size_t i) { c[i] = generic_inverse(a[i]); });
+    report("inverse", fast, generic);
+
+    fast = ns_per_op([&](size_t i) { sink = a[i].determinant(); });
+    generic = ns_per_op([&](size_t i) { sink = internal::small::generic_determinant(a[i].as_raw(), N); });
+    report("determinant", fast, generic);
+
+    // sanity check, a * a^-1 has to be the identity
+    T err = T();
+    for (size_t i = 0; i < COUNT; ++i)
+    {
+        auto id = a[i] * a[i].inverse();
+        for (size_t r = 0; r < N; ++r)
+            for (size_t s = 0; s < N; ++s)
+                err = std::max(err, std::abs(id(r, s) - T(r == s)));
+    }
+    std::cout << "  max abs error of a * a^-1: " << err;
+    nl();
+}
+
+int main()
+{
+    run<double, 2>("double");
+    run<double, 3>("double");
+    run<double, 4>("double");
+    run<float, 2>("float ");
+    run<float, 3>("float ");
+    run<float, 4>("float ");
+}
@@ -0,0 +1,186 @@
+// Dense DynMat kernels: GEMM, elementwise expressions, dot products, transpose, slices, map and the other callable kernels, reductions
+
+#include <cstdlib>
+#include <functional> // plus
+#include <string>
+
+#include "harness.h"
+#include "../../DynMat.h"
+#include "../../Reductions.h"
+
+namespace
+{
+    template <typename T>
+    DynMat<T> random_mat(size_t rows, size_t cols)
+    {
+        auto m = DynMat<T>(rows, cols);
+        for (size_t i = 0; i < m.SIZE; ++i)
+            m[i] = static_cast<T>(rand() % 2000) / T(1000) - T(1);
+        return m;
+    }
+
+    template <typename T>
+    T square_plus_one(T x) { return x * x + T(1); }
+
+    template <typename T>
+    bool register_type()
+    {
+        const char *type = bench::type_name<T>();
+        const double s = sizeof(T);
+        for (size_t n : {64, 128, 256, 512})
+        {
+            const double nn = double(n) * n;
+            bench::add("gemm", type, std::to_string(n), 2 * nn * n, 3 * nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                const auto b = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(a * b); });
+            });
+            bench::add("multiply_add", type, std::to_string(n), 2 * nn * n, 3 * nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                const auto b = random_mat<T>(n, n);
+                auto c = DynMat<T>(n, n);
+                return bench::Body([=]() mutable {
+                    multiply_add(c, T(0.5), a, b);
+                    bench::keep(c);
+                });
+            });
+        }
+        for (size_t n : {256, 1024, 2048})
+        {
+            const double nn = double(n) * n;
+            const auto size = std::to_string(n);
+            bench::add("add", type, size, nn, 3 * nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                const auto b = random_mat<T>(n, n);
+                auto c = DynMat<T>(n, n);
+                return bench::Body([=]() mutable {
+                    c = a + b;
+                    bench::keep(c);
+                });
+            });
+            bench::add("fused", type, size, 3 * nn, 4 * nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                const auto b = random_mat<T>(n, n);
+                const auto c = random_mat<T>(n, n);
+                auto d = DynMat<T>(n, n);
+                return bench::Body([=]() mutable {
+                    d = a + b - T(2) * c;
+                    bench::keep(d);
+                });
+            });
+            bench::add("add_alloc", type, size, nn, 3 * nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                const auto b = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(DynMat<T>(a + b)); });
+            });
+            bench::add("scale_in_place", type, size, nn, 2 * nn * s, [n] {
+                auto a = random_mat<T>(n, n);
+                return bench::Body([=]() mutable {
+                    a *= T(1);
+                    bench::keep(a);
+                });
+            });
+            bench::add("map", type, size, 2 * nn, 2 * nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(a.template map<T>(square_plus_one<T>)); });
+            });
+            bench::add("map_lambda", type, size, 2 * nn, 2 * nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                const T shift = T(1);
+                return bench::Body([=] { bench::keep(a.map([shift](T x) { return x * x + shift; })); });
+            });
+            bench::add("zip_with", type, size, nn, 3 * nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                const auto b = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(a.zip_with(b, [](T x, T y) { return x < y ? y : x; })); });
+            });
+            bench::add("transform_reduce", type, size, 2 * nn, nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(a.transform_reduce(T(0), std::plus<>(), [](T x) { return x * x; })); });
+            });
+            bench::add("sum", type, size, nn, nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(reduction::sum(a)); });
+            });
+            bench::add("sum_compensated", type, size, nn, nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(reduction::sum<accumulate::Compensated>(a)); });
+            });
+            bench::add("argmax", type, size, nn, nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(reduction::argmax(a)); });
+            });
+            bench::add("row_sums", type, size, nn, nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(reduction::row_sums(a)); });
+            });
+            bench::add("col_sums", type, size, nn, nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(reduction::col_sums(a)); });
+            });
+            bench::add("norm_1", type, size, 2 * nn, nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(reduction::norm_1(a)); });
+            });
+            bench::add("transpose", type, size, 0, 2 * nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(a.transpose()); });
+            });
+            bench::add("transpose_in_place", type, size, 0, 2 * nn * s, [n] {
+                auto a = random_mat<T>(n, n);
+                return bench::Body([=]() mutable {
+                    a.transpose_in_place();
+                    bench::keep(a);
+                });
+            });
+            // the inner half of the matrix, through a view into an existing matrix
+            bench::add("slice", type, size, nn / 4, 2 * nn / 4 * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                auto c = DynMat<T>(n / 2, n / 2);
+                return bench::Body([=]() mutable {
+                    c = a.slice(n / 4, n / 4 + n / 2 - 1, n / 4, n / 4 + n / 2 - 1) + c;
+                    bench::keep(c);
+                });
+            });
+            bench::add("dot", type, std::to_string(n * n), 2 * nn, 2 * nn * s, [nn] {
+                const auto a = random_mat<T>(1, size_t(nn));
+                const auto b = random_mat<T>(size_t(nn), 1);
+                return bench::Body([=] { bench::keep(dot(a, b)); });
+            });
+            bench::add("dot_widened", type, std::to_string(n * n), 2 * nn, 2 * nn * s, [nn] {
+                const auto a = random_mat<T>(1, size_t(nn));
+                const auto b = random_mat<T>(size_t(nn), 1);
+                return bench::Body([=] { bench::keep(dot<accumulate::Widened>(a, b)); });
+            });
+            bench::add("dot_compensated", type, std::to_string(n * n), 2 * nn, 2 * nn * s, [nn] {
+                const auto a = random_mat<T>(1, size_t(nn));
+                const auto b = random_mat<T>(size_t(nn), 1);
+                return bench::Body([=] { bench::keep(dot<accumulate::Compensated>(a, b)); });
+            });
+        }
+        return true;
+    }
+
+    const bool registered = register_type<float>() && register_type<double>() && [] {
+        // integer elements take the generic loops
+        for (size_t n : {256, 1024})
+        {
+            const double nn = double(n) * n;
+            bench::add("add", "int", std::to_string(n), nn, 3 * nn * sizeof(int), [n] {
+                const auto a = random_mat<int>(n, n);
+                const auto b = random_mat<int>(n, n);
+                auto c = DynMat<int>(n, n);
+                return bench::Body([=]() mutable {
+                    c = a + b;
+                    bench::keep(c);
+                });
+            });
+            bench::add("gemm", "int", std::to_string(n / 4), 2 * nn * n / 64, 3 * nn / 16 * sizeof(int), [n] {
+                const auto a = random_mat<int>(n / 4, n / 4);
+                const auto b = random_mat<int>(n / 4, n / 4);
+                return bench::Body([=] { bench::keep(a * b); });
+            });
+        }
+        return true;
+    }();
+} // namespace
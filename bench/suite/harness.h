@@ -0,0 +1,137 @@
+#if !defined(BENCH_HARNESS_H)
+#define BENCH_HARNESS_H
+
+/* The benchmark registry and runner behind matrac_bench
+
+Every source file of the suite registers its cases at static initialization:
+    static const bool registered = bench::add("gemm", "double", "256", flops, bytes, [=] {
+        auto a = ...;                      // setup, not timed
+        return [=]() mutable { ... };      // the timed body, one iteration
+    });
+The runner calls a body until a sample lasts min_time / SAMPLES, takes SAMPLES samples and reports the
+median time per iteration. Allocations are counted by the global operator new of main.cpp.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+    using Body = std::function<void()>;
+
+    struct Case
+    {
+        std::string kernel;
+        std::string type;
+        std::string size;
+        double flops; // per iteration, 0 if it doesn't make sense
+        double bytes; // read and written per iteration
+        std::function<Body()> setup;
+
+        inline std::string name() const { return kernel + "/" + type + "/" + size; }
+    };
+
+    struct Result
+    {
+        const Case *c;
+        size_t iterations;
+        double seconds; // per iteration, median of the samples
+        double allocations;
+        double allocated_bytes;
+    };
+
+    const size_t SAMPLES = 5;
+
+    inline std::vector<Case> &registry()
+    {
+        static std::vector<Case> cases;
+        return cases;
+    }
+
+    /// Registers a case, returns true so it can initialize a static
+    inline bool add(std::string kernel, std::string type, std::string size, double flops, double bytes, std::function<Body()> setup)
+    {
+        registry().push_back(Case{std::move(kernel), std::move(type), std::move(size), flops, bytes, std::move(setup)});
+        return true;
+    }
+
+    // Counted by the replaced operator new in main.cpp
+    inline std::atomic<size_t> allocations{0};
+    inline std::atomic<size_t> allocated_bytes{0};
+
+    /// Keeps the compiler from optimizing away a value the benchmark only computes
+    template <typename T>
+    inline void keep(const T &value)
+    {
+        asm volatile("" : : "r"(&value) : "memory");
+    }
+
+    /// Name of an element type for the results
+    template <typename T>
+    const char *type_name();
+    template <>
+    inline const char *type_name<float>() { return "float"; }
+    template <>
+    inline const char *type_name<double>() { return "double"; }
+    template <>
+    inline const char *type_name<int>() { return "int"; }
+
+    inline Result run(const Case &c, double min_time)
+    {
+        using Clock = std::chrono::steady_clock;
+        auto body = c.setup();
+        body();
+        // enough iterations per sample to last min_time / SAMPLES
+        size_t iterations = 1;
+        for (;;)
+        {
+            const auto start = Clock::now();
+            for (size_t i = 0; i < iterations; ++i)
+                body();
+            const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            if (elapsed >= min_time / SAMPLES || iterations >= (size_t(1) << 30))
+                break;
+            iterations = elapsed <= 0 ? iterations * 10
+                                      : std::max(iterations + 1, size_t(iterations * 1.2 * min_time / SAMPLES / elapsed));
+        }
+        auto times = std::vector<double>();
+        const size_t allocations_before = allocations.load();
+        const size_t bytes_before = allocated_bytes.load();
+        for (size_t s = 0; s < SAMPLES; ++s)
+        {
+            const auto start = Clock::now();
+            for (size_t i = 0; i < iterations; ++i)
+                body();
+            times.push_back(std::chrono::duration<double>(Clock::now() - start).count() / iterations);
+        }
+        const double total = double(iterations * SAMPLES);
+        std::sort(times.begin(), times.end());
+        return Result{&c, iterations, times[SAMPLES / 2], (allocations.load() - allocations_before) / total,
+                      (allocated_bytes.load() - bytes_before) / total};
+    }
+
+    inline void write_json(std::FILE *out, const std::vector<Result> &results, const char *isa, size_t threads)
+    {
+        std::fprintf(out, "{\n  \"version\": 1,\n  \"isa\": \"%s\",\n  \"threads\": %zu,\n  \"results\": [", isa, threads);
+        for (size_t k = 0; k < results.size(); ++k)
+        {
+            const auto &r = results[k];
+            std::fprintf(out,
+                         "%s\n    {\"name\": \"%s\", \"kernel\": \"%s\", \"type\": \"%s\", \"size\": \"%s\", "
+                         "\"iterations\": %zu, \"time_ns\": %.3f, \"gflops\": %.4f, \"bytes_per_second\": %.6e, "
+                         "\"allocations\": %.3f, \"allocated_bytes\": %.1f}",
+                         k == 0 ? "" : ",", r.c->name().c_str(), r.c->kernel.c_str(), r.c->type.c_str(), r.c->size.c_str(),
+                         r.iterations * SAMPLES, r.seconds * 1e9, r.c->flops / r.seconds * 1e-9, r.c->bytes / r.seconds,
+                         r.allocations, r.allocated_bytes);
+        }
+        std::fprintf(out, "\n  ]\n}\n");
+    }
+} // namespace bench
+
+#endif // BENCH_HARNESS_H
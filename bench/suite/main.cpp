@@ -0,0 +1,119 @@
+// matrac_bench: runs every registered benchmark case, prints a table and optionally writes JSON
+// Build: cmake -S . -B build && cmake --build build --target matrac_bench
+// Usage: ./matrac_bench [--json results.json] [--filter substring] [--min-time seconds] [--list]
+// Compare two runs with bench/compare.py baseline.json results.json. MATRAC_THREADS=n runs the
+// parallel kernels on n threads, MATRAC_SIMD=avx2 (sse2, scalar) caps the instruction set.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "harness.h"
+#include "../../Profile.h"
+#include "../../Simd.h"
+#include "../../ThreadPool.h"
+
+// Every allocation of the process is counted, including the ones of the pooled AlignedBuffers that miss the pool
+
+void *operator new(size_t bytes)
+{
+    bench::allocations.fetch_add(1, std::memory_order_relaxed);
+    bench::allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    if (void *p = std::malloc(bytes == 0 ? 1 : bytes))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t bytes, std::align_val_t alignment)
+{
+    bench::allocations.fetch_add(1, std::memory_order_relaxed);
+    bench::allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    const size_t a = static_cast<size_t>(alignment);
+    if (void *p = std::aligned_alloc(a, (bytes + a - 1) / a * a))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t bytes) { return operator new(bytes); }
+void *operator new[](size_t bytes, std::align_val_t alignment) { return operator new(bytes, alignment); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept { std::free(p); }
+
+int main(int argc, char **argv)
+{
+    const char *json = nullptr;
+    auto filters = std::vector<std::string>();
+    double min_time = 0.25;
+    bool list = false;
+    for (int k = 1; k < argc; ++k)
+    {
+        if (std::strcmp(argv[k], "--json") == 0 && k + 1 < argc)
+            json = argv[++k];
+        else if (std::strcmp(argv[k], "--filter") == 0 && k + 1 < argc)
+            filters.push_back(argv[++k]);
+        else if (std::strcmp(argv[k], "--min-time") == 0 && k + 1 < argc)
+            min_time = std::atof(argv[++k]);
+        else if (std::strcmp(argv[k], "--list") == 0)
+            list = true;
+        else
+        {
+            std::fprintf(stderr, "Usage: %s [--json results.json] [--filter substring] [--min-time seconds] [--list]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    const auto &policy = parallel::global_policy();
+    const size_t threads = policy.pool == nullptr ? 1 : policy.pool->size();
+    const char *isa = simd::isa_name(simd::active_isa());
+    std::printf("%-36s %12s %10s %14s %10s\n", "benchmark", "time [ns]", "GFLOP/s", "bytes/s", "allocs");
+    auto results = std::vector<bench::Result>();
+    for (auto &&c : bench::registry())
+    {
+        const auto name = c.name();
+        bool selected = filters.empty();
+        for (auto &&f : filters)
+            selected = selected || name.find(f) != std::string::npos;
+        if (!selected)
+            continue;
+        if (list)
+        {
+            std::printf("%s\n", name.c_str());
+            continue;
+        }
+        results.push_back(bench::run(c, min_time));
+        const auto &r = results.back();
+        std::printf("%-36s %12.1f %10.3f %14.4g %10.2f\n", name.c_str(), r.seconds * 1e9, c.flops / r.seconds * 1e-9,
+                    c.bytes / r.seconds, r.allocations);
+        std::fflush(stdout);
+    }
+    std::printf("isa: %s, threads: %zu\n", isa, threads);
+    // with -DMATRAC_PROFILE=ON, what the library itself counted over all runs
+    if (PROFILED && !list)
+    {
+        std::fflush(stdout);
+        profile::write_report(std::cout, profile::report());
+    }
+
+    if (json != nullptr && !list)
+    {
+        std::FILE *out = std::fopen(json, "w");
+        if (out == nullptr)
+        {
+            std::perror(json);
+            return 1;
+        }
+        bench::write_json(out, results, isa, threads);
+        std::fclose(out);
+    }
+    return 0;
+}
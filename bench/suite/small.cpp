@@ -0,0 +1,88 @@
+// Small matrix kernels: Mat 2x2 / 3x3 / 4x4 products, inverses, determinants and transposes, and MatBatch
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "harness.h"
+#include "../../Batch.h"
+
+namespace
+{
+    // Mats per iteration, so one iteration is long enough to time
+    const size_t COUNT = 1024;
+
+    template <typename T, size_t N>
+    std::vector<Mat<T, N, N>> random_mats()
+    {
+        auto v = std::vector<Mat<T, N, N>>(COUNT);
+        for (auto &&m : v)
+        {
+            for (size_t i = 0; i < N; ++i)
+                for (size_t j = 0; j < N; ++j)
+                    m(i, j) = static_cast<T>(rand() % 2000) / T(1000) - T(1);
+            // diagonally dominant, so the inverses exist
+            for (size_t i = 0; i < N; ++i)
+                m(i, i) += T(N);
+        }
+        return v;
+    }
+
+    template <typename T, size_t N>
+    bool register_size()
+    {
+        const char *type = bench::type_name<T>();
+        const auto size = std::to_string(N) + "x" + std::to_string(N) + "*" + std::to_string(COUNT);
+        const double s = sizeof(T) * N * N * COUNT;
+        bench::add("mat_multiply", type, size, 2.0 * N * N * N * COUNT, 3 * s, [] {
+            const auto a = random_mats<T, N>();
+            const auto b = random_mats<T, N>();
+            auto c = std::vector<Mat<T, N, N>>(COUNT);
+            return bench::Body([=]() mutable {
+                for (size_t k = 0; k < COUNT; ++k)
+                    c[k] = a[k] * b[k];
+                bench::keep(c);
+            });
+        });
+        bench::add("mat_inverse", type, size, 0, 2 * s, [] {
+            const auto a = random_mats<T, N>();
+            auto c = std::vector<Mat<T, N, N>>(COUNT);
+            return bench::Body([=]() mutable {
+                for (size_t k = 0; k < COUNT; ++k)
+                    c[k] = a[k].inverse();
+                bench::keep(c);
+            });
+        });
+        bench::add("mat_determinant", type, size, 0, s, [] {
+            const auto a = random_mats<T, N>();
+            return bench::Body([=] {
+                T sum = T();
+                for (size_t k = 0; k < COUNT; ++k)
+                    sum += a[k].determinant();
+                bench::keep(sum);
+            });
+        });
+        bench::add("mat_transpose", type, size, 0, 2 * s, [] {
+            const auto a = random_mats<T, N>();
+            auto c = std::vector<Mat<T, N, N>>(COUNT);
+            return bench::Body([=]() mutable {
+                for (size_t k = 0; k < COUNT; ++k)
+                    c[k] = a[k].transpose();
+                bench::keep(c);
+            });
+        });
+        bench::add("batch_multiply", type, size, 2.0 * N * N * N * COUNT, 3 * s, [] {
+            const auto a = MatBatch<T, N, N>(random_mats<T, N>());
+            const auto b = MatBatch<T, N, N>(random_mats<T, N>());
+            return bench::Body([=] { bench::keep(a * b); });
+        });
+        bench::add("batch_inverse", type, size, 0, 2 * s, [] {
+            const auto a = MatBatch<T, N, N>(random_mats<T, N>());
+            return bench::Body([=] { bench::keep(a.inverse()); });
+        });
+        return true;
+    }
+
+    const bool registered = register_size<float, 2>() && register_size<float, 3>() && register_size<float, 4>() &&
+                            register_size<double, 2>() && register_size<double, 3>() && register_size<double, 4>();
+} // namespace
@@ -0,0 +1,158 @@
+// Factorizations, triangular and iterative solves, and text / binary output
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+#include "harness.h"
+#include "../../Cholesky.h"
+#include "../../Format.h"
+#include "../../Krylov.h"
+#include "../../Lu.h"
+#include "../../MatrixMarket.h"
+
+namespace
+{
+    template <typename T>
+    DynMat<T> random_mat(size_t rows, size_t cols)
+    {
+        auto m = DynMat<T>(rows, cols);
+        for (size_t i = 0; i < m.SIZE; ++i)
+            m[i] = static_cast<T>(rand() % 2000) / T(1000) - T(1);
+        return m;
+    }
+
+    // diagonally dominant, so it's symmetric positive definite
+    template <typename T>
+    DynMat<T> random_spd(size_t n)
+    {
+        auto a = random_mat<T>(n, n);
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = 0; j < i; ++j)
+                a(j, i) = a(i, j);
+        for (size_t i = 0; i < n; ++i)
+            a(i, i) += T(n);
+        return a;
+    }
+
+    // the 5 point Laplacian on a g x g grid
+    template <typename T>
+    CsrMat<T> poisson(size_t g)
+    {
+        auto b = TripletBuilder<T>(g * g, g * g);
+        for (size_t i = 0; i < g; ++i)
+            for (size_t j = 0; j < g; ++j)
+            {
+                const size_t k = i * g + j;
+                b.add(k, k, T(4));
+                if (i > 0)
+                    b.add(k, k - g, T(-1));
+                if (i + 1 < g)
+                    b.add(k, k + g, T(-1));
+                if (j > 0)
+                    b.add(k, k - 1, T(-1));
+                if (j + 1 < g)
+                    b.add(k, k + 1, T(-1));
+            }
+        return b.finalize();
+    }
+
+    template <typename T>
+    bool register_type()
+    {
+        const char *type = bench::type_name<T>();
+        const double s = sizeof(T);
+        for (size_t n : {128, 256, 512})
+        {
+            const double nn = double(n) * n;
+            const auto size = std::to_string(n);
+            bench::add("lu", type, size, 2.0 / 3 * nn * n, 2 * nn * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(Lu<T>(a)); });
+            });
+            bench::add("cholesky", type, size, 1.0 / 3 * nn * n, 2 * nn * s, [n] {
+                const auto a = random_spd<T>(n);
+                return bench::Body([=] { bench::keep(Cholesky<T>(a)); });
+            });
+            bench::add("lu_solve", type, size + "*1", 2 * nn, nn * s, [n] {
+                const auto f = Lu<T>(random_mat<T>(n, n));
+                const auto b = random_mat<T>(n, 1);
+                auto x = b;
+                return bench::Body([=]() mutable {
+                    x = b;
+                    f.solve_in_place(x);
+                    bench::keep(x);
+                });
+            });
+            bench::add("solve_lower", type, size + "*" + size, nn * n, 2 * nn * s, [n] {
+                const auto l = Cholesky<T>(random_spd<T>(n)).factor();
+                const auto b = random_mat<T>(n, n);
+                auto x = b;
+                return bench::Body([=]() mutable {
+                    x = b;
+                    solve_lower(l, x);
+                    bench::keep(x);
+                });
+            });
+        }
+        for (size_t g : {64, 256})
+        {
+            const size_t n = g * g;
+            const size_t ITERATIONS = 50;
+            const auto size = std::to_string(g) + "^2*" + std::to_string(ITERATIONS);
+            // a fixed number of iterations, so the work doesn't depend on the convergence
+            auto options = krylov::Options();
+            options.tolerance = 0;
+            options.max_iterations = ITERATIONS;
+            options.history = false;
+            bench::add("cg", type, size, ITERATIONS * 19.0 * n, ITERATIONS * n * (5 * (s + 8) + 8 * s), [=] {
+                const auto a = poisson<T>(g);
+                auto b = DynMat<T>(n, 1);
+                for (size_t i = 0; i < n; ++i)
+                    b[i] = T(1);
+                auto x = DynMat<T>(n, 1);
+                auto workspace = krylov::Workspace<T>();
+                return bench::Body([=]() mutable {
+                    x *= T(0);
+                    bench::keep(krylov::cg(a, b.as_raw(), x.as_raw_mut(), krylov::Identity<T>(), options, workspace));
+                });
+            });
+            bench::add("gmres_ilu0", type, size, 0, ITERATIONS * n * (5 * (s + 8) + 30 * s), [=] {
+                const auto a = poisson<T>(g);
+                const auto m = krylov::Ilu0<T>(a);
+                auto b = DynMat<T>(n, 1);
+                for (size_t i = 0; i < n; ++i)
+                    b[i] = T(1);
+                auto x = DynMat<T>(n, 1);
+                auto workspace = krylov::Workspace<T>();
+                return bench::Body([=]() mutable {
+                    x *= T(0);
+                    bench::keep(krylov::gmres(a, b.as_raw(), x.as_raw_mut(), m, options, workspace));
+                });
+            });
+        }
+        {
+            const size_t n = 512;
+            bench::add("format", type, std::to_string(n), 0, double(n) * n * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(format::to_string(a)); });
+            });
+            bench::add("show", type, std::to_string(n), 0, double(n) * n * s, [n] {
+                const auto a = random_mat<T>(n, n);
+                return bench::Body([=] { bench::keep(a.show()); });
+            });
+            bench::add("matrix_market_write", type, "poisson256", 0, 5.0 * 65536 * (s + 16), [] {
+                const auto a = poisson<T>(256);
+                return bench::Body([=] {
+                    auto out = std::ostringstream();
+                    matrix_market::write(out, a);
+                    bench::keep(out);
+                });
+            });
+        }
+        return true;
+    }
+
+    const bool registered = register_type<float>() && register_type<double>();
+} // namespace
@@ -0,0 +1,116 @@
+// Sparse kernels: SparseMat element access, triplet assembly, conversions, sparse times dense products and reductions
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "harness.h"
+#include "../../Sparse.h"
+#include "../../Reductions.h"
+
+namespace
+{
+    // about `per_row` nonzeros in every row of an n x n matrix, at pseudo random columns
+    template <typename T>
+    std::vector<typename TripletBuilder<T>::Triplet> triplets(size_t n, size_t per_row)
+    {
+        auto t = std::vector<typename TripletBuilder<T>::Triplet>();
+        t.reserve(n * per_row);
+        for (size_t i = 0; i < n; ++i)
+            for (size_t k = 0; k < per_row; ++k)
+                t.push_back({i, (i * 7919 + k * 104729) % n, T(1) + T(k)});
+        return t;
+    }
+
+    template <typename T>
+    CsrMat<T> random_csr(size_t n, size_t per_row)
+    {
+        auto b = TripletBuilder<T>(n, n);
+        b.add(triplets<T>(n, per_row));
+        return b.finalize();
+    }
+
+    template <typename T>
+    bool register_type()
+    {
+        const char *type = bench::type_name<T>();
+        const double s = sizeof(T);
+        const size_t per_row = 16;
+        for (size_t n : {1000, 10000, 100000})
+        {
+            const double nnz = double(n) * per_row;
+            const auto size = std::to_string(n) + "x" + std::to_string(per_row);
+            bench::add("triplet_assembly", type, size, 0, nnz * (s + 16), [=] {
+                const auto t = triplets<T>(n, per_row);
+                return bench::Body([=] {
+                    auto b = TripletBuilder<T>(n, n);
+                    b.add(t.data(), t.size());
+                    bench::keep(b.finalize());
+                });
+            });
+            bench::add("spmv", type, size, 2 * nnz, nnz * (s + 8) + 2 * n * s, [=] {
+                const auto a = random_csr<T>(n, per_row);
+                auto x = DynMat<T>(n, 1);
+                for (size_t i = 0; i < n; ++i)
+                    x[i] = T(i % 7);
+                return bench::Body([=] { bench::keep(a * x); });
+            });
+            bench::add("spmm", type, size + "*8", 16 * nnz, nnz * (s + 8) + 16 * n * s, [=] {
+                const auto a = random_csr<T>(n, per_row);
+                const auto x = DynMat<T>::identity(n, 8);
+                return bench::Body([=] { bench::keep(a * x); });
+            });
+            bench::add("csr_sum", type, size, nnz, nnz * s, [=] {
+                const auto a = random_csr<T>(n, per_row);
+                return bench::Body([=] { bench::keep(reduction::sum(a)); });
+            });
+            bench::add("csr_row_sums", type, size, nnz, nnz * s + n * 8, [=] {
+                const auto a = random_csr<T>(n, per_row);
+                return bench::Body([=] { bench::keep(reduction::row_sums(a)); });
+            });
+            bench::add("csr_norm_1", type, size, 2 * nnz, nnz * (s + 8), [=] {
+                const auto a = random_csr<T>(n, per_row);
+                return bench::Body([=] { bench::keep(reduction::norm_1(a)); });
+            });
+            bench::add("csr_to_csc", type, size, 0, 2 * nnz * (s + 8), [=] {
+                const auto a = random_csr<T>(n, per_row);
+                return bench::Body([=] { bench::keep(to_csc(a)); });
+            });
+        }
+        for (size_t n : {1000, 10000})
+        {
+            const double nnz = double(n) * 8;
+            const auto size = std::to_string(n) + "x8";
+            const auto t = triplets<T>(n, 8);
+            bench::add("sparse_set", type, size, 0, nnz * s, [=] {
+                return bench::Body([=] {
+                    auto m = SparseMat<T>(n, n);
+                    for (auto &&e : t)
+                        m(e.row, e.col) = e.value;
+                    bench::keep(m);
+                });
+            });
+            bench::add("sparse_get", type, size, 0, nnz * s, [=] {
+                auto m = SparseMat<T>(n, n);
+                for (auto &&e : t)
+                    m(e.row, e.col) = e.value;
+                const auto c = m;
+                return bench::Body([=] {
+                    T sum = T();
+                    for (auto &&e : t)
+                        sum += c(e.row, e.col);
+                    bench::keep(sum);
+                });
+            });
+            bench::add("sparse_to_csr", type, size, 0, nnz * (s + 8), [=] {
+                auto m = SparseMat<T>(n, n);
+                for (auto &&e : t)
+                    m(e.row, e.col) = e.value;
+                return bench::Body([=] { bench::keep(to_csr(m)); });
+            });
+        }
+        return true;
+    }
+
+    const bool registered = register_type<float>() && register_type<double>();
+} // namespace
@@ -0,0 +1,116 @@
+// Transpose benchmark: tiled out of place and in place DynMat transposes against the plain double loop
+// Build: g++ -std=c++17 -O3 -march=native -I.. transpose.cpp -o transpose
+// Usage: ./transpose [sizes...]   (defaults to 1024 2048 4096 8192 16384)
+// An n x n double matrix is 8n^2 bytes, n=16384 needs about 5 GB for source, result and the n x n/2 case.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "../DynMat.h"
+
+using Clock = std::chrono::steady_clock;
+
+// The transpose as it was before the tiled kernel, kept as a baseline
+template <typename T>
+DynMat<T> naive_transpose(const DynMat<T> &a)
+{
+    auto m = DynMat<T>(a.COLS_, a.ROWS_);
+    for (auto &&i : Range(a.ROWS_))
+        for (auto &&j : Range(a.COLS_))
+            m(j, i) = a(i, j);
+    return m;
+}
+
+template <typename T>
+DynMat<T> random_mat(size_t rows, size_t cols)
+{
+    auto m = DynMat<T>(rows, cols);
+    for (size_t i = 0; i < m.SIZE; ++i)
+        m[i] = static_cast<T>(rand()) / RAND_MAX - T(0.5);
+    return m;
+}
+
+// Runs f at least `reps` times and for at least 0.2s, returns the best time in seconds
+template <typename F>
+double best_of(F f, int reps)
+{
+    double best = 1e300;
+    double total = 0;
+    for (int r = 0; r < reps || total < 0.2; ++r)
+    {
+        auto t0 = Clock::now();
+        f();
+        double t = std::chrono::duration<double>(Clock::now() - t0).count();
+        best = std::min(best, t);
+        total += t;
+    }
+    return best;
+}
+
+template <typename T>
+bool is_transpose(const DynMat<T> &t, const DynMat<T> &a)
+{
+    if (t.ROWS_ != a.COLS_ || t.COLS_ != a.ROWS_)
+        return false;
+    for (size_t i = 0; i < a.ROWS_; ++i)
+        for (size_t j = 0; j < a.COLS_; ++j)
+            if (t.as_raw()[j * a.ROWS_ + i] != a.as_raw()[i * a.COLS_ + j])
+                return false;
+    return true;
+}
+
+template <typename T>
+void run(const char *type, size_t n)
+{
+    auto a = random_mat<T>(n, n);
+    // every element is read once and written once
+    const double bytes = 2.0 * n * n * sizeof(T);
+
+    double t_tiled = best_of([&] { auto t = a.transpose(); (void)t; }, 3);
+    std::cout << type << " n=" << n << "  tiled: " << bytes / t_tiled * 1e-9 << " GB/s";
+
+    // the result comes from the pool after the first run, without the page faults of a fresh allocation
+    auto p = AlignedMat<T>(n, n);
+    std::copy(a.as_raw(), a.as_raw() + a.SIZE, p.as_raw_mut());
+    double t_pooled = best_of([&] { auto t = p.transpose(); (void)t; }, 3);
+    std::cout << "  tiled, pooled: " << bytes / t_pooled * 1e-9 << " GB/s";
+
+    double t_square = best_of([&] { a.transpose_in_place(); }, 3);
+    std::cout << "  in place: " << bytes / t_square * 1e-9 << " GB/s";
+
+    // n x n/2 goes through the cycle following path
+    auto r = random_mat<T>(n, n / 2);
+    double t_cycles = best_of([&] { r.transpose_in_place(); }, 1);
+    std::cout << "  in place " << n << 'x' << n / 2 << ": " << bytes / 2 / t_cycles * 1e-9 << " GB/s";
+
+    double t_naive = best_of([&] { auto t = naive_transpose(a); (void)t; }, 1);
+    std::cout << "  naive: " << bytes / t_naive * 1e-9 << " GB/s  speedup: " << t_naive / t_tiled << 'x';
+
+    // sanity checks against the reference, one copy alive at a time
+    bool ok = is_transpose(a.transpose(), a);
+    auto s = a;
+    s.transpose_in_place();
+    ok = ok && is_transpose(s, a);
+    s = r;
+    s.transpose_in_place();
+    ok = ok && is_transpose(s, r);
+    std::cout << (ok ? "  ok" : "  MISMATCH");
+    nl();
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(std::strtoul(argv[i], nullptr, 10));
+    if (sizes.empty())
+        sizes = {1024, 2048, 4096, 8192, 16384};
+    memory::set_cache_limit(size_t(4) << 30);
+    for (auto n : sizes)
+    {
+        run<double>("double", n);
+        run<float>("float ", n);
+    }
+}
@@ -0,0 +1,185 @@
+/* Round trips through the binary format, and corrupt files that have to PANIC instead of being loaded
+Every corrupt file is loaded in a child process, which has to die by abort().
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <signal.h>   // SIGABRT
+#include <sys/wait.h> // waitpid
+#include <unistd.h>   // fork
+
+#include "Binary.h"
+
+static int failures = 0;
+
+#define CHECK(condition)                                                          \
+    do                                                                            \
+    {                                                                             \
+        if (!(condition))                                                         \
+        {                                                                         \
+            std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++failures;                                                           \
+        }                                                                         \
+    } while (false)
+
+static std::string temporary(const char *name)
+{
+    const char *dir = std::getenv("TMPDIR");
+    return std::string(dir != nullptr ? dir : "/tmp") + "/matrac_test_" + std::to_string(::getpid()) + "_" + name;
+}
+
+static std::vector<char> read_file(const std::string &path)
+{
+    auto in = std::ifstream(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void write_file(const std::string &path, const std::vector<char> &bytes)
+{
+    auto out = std::ofstream(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+/// Runs load in a child process, true if it aborted
+template <typename F>
+static bool aborts(const F &load)
+{
+    std::fflush(stdout);
+    const pid_t pid = ::fork();
+    if (pid == 0)
+    {
+        // the PANIC message would only clutter the test output
+        std::freopen("/dev/null", "w", stdout);
+        load();
+        std::_Exit(0);
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    return WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+
+/// Overwrites the uint64 at byte offset of a copy of bytes, and writes that to path
+static void corrupt(const std::string &path, std::vector<char> bytes, size_t offset, uint64_t value)
+{
+    std::memcpy(bytes.data() + offset, &value, sizeof(value));
+    write_file(path, bytes);
+}
+
+static void dense()
+{
+    const auto path = temporary("dense.mat");
+    auto a = DynMat<double>(3, 5);
+    for (size_t i = 0; i < a.SIZE; ++i)
+        a.unchecked(i / 5, i % 5) = 0.5 * static_cast<double>(i) - 3.0;
+    binary::write(path, a);
+
+    const auto h = binary::info(path);
+    CHECK(h.rows == 3 && h.cols == 5 && h.nnz == 15 && h.layout == binary::Layout::Dense);
+
+    const MappedMat<double> m = binary::map<double>(path, binary::Mapping::ReadOnly);
+    CHECK(m.ROWS_ == 3 && m.COLS_ == 5);
+    CHECK(std::memcmp(m.as_raw(), a.as_raw(), a.SIZE * sizeof(double)) == 0);
+
+    // the default mapping is writable and never changes the file
+    auto w = binary::map<double>(path);
+    w.unchecked(0, 0) = 42.0;
+    CHECK(binary::map<double>(path).as_raw()[0] == a.as_raw()[0]);
+
+    const auto bytes = read_file(path);
+    const auto bad = temporary("dense_bad.mat");
+    // rows * cols wraps around to the nonzero count
+    auto h_bad = h;
+    h_bad.rows = uint64_t(1) << 61;
+    h_bad.cols = 8;
+    h_bad.nnz = 0;
+    auto wrapped = bytes;
+    std::memcpy(wrapped.data(), &h_bad, sizeof(h_bad));
+    write_file(bad, wrapped);
+    CHECK(aborts([&] { binary::map<double>(bad); }));
+    // more elements than the file holds
+    corrupt(bad, bytes, offsetof(binary::Header, rows), 4);
+    CHECK(aborts([&] { binary::map<double>(bad); }));
+    corrupt(bad, bytes, offsetof(binary::Header, nnz), 16);
+    CHECK(aborts([&] { binary::map<double>(bad); }));
+    // truncated
+    write_file(bad, std::vector<char>(bytes.begin(), bytes.end() - 8));
+    CHECK(aborts([&] { binary::map<double>(bad); }));
+    // another element type
+    CHECK(aborts([&] { binary::map<float>(path); }));
+
+    std::remove(path.c_str());
+    std::remove(bad.c_str());
+}
+
+static CsrMat<double> example()
+{
+    // 4x6 with an empty row
+    auto b = TripletBuilder<double>(4, 6);
+    b.add(0, 1, 1.0);
+    b.add(0, 5, 2.0);
+    b.add(2, 0, 3.0);
+    b.add(2, 3, 4.0);
+    b.add(3, 2, 5.0);
+    return b.finalize();
+}
+
+static bool equal(const CsrMat<double> &a, const CsrMat<double> &b)
+{
+    return a.ROWS_ == b.ROWS_ && a.COLS_ == b.COLS_ && a.buffer().pointers() == b.buffer().pointers() &&
+           a.buffer().indices() == b.buffer().indices() && a.buffer().values() == b.buffer().values();
+}
+
+static void sparse()
+{
+    const auto path = temporary("sparse.mat");
+    const auto a = example();
+    binary::write(path, a);
+    CHECK(equal(binary::load_csr<double>(path), a));
+    CHECK(equal(to_csr(binary::load_csc<double>(path)), a));
+
+    const auto csc_path = temporary("sparse_csc.mat");
+    binary::write(csc_path, to_csc(a));
+    CHECK(equal(binary::load_csr<double>(csc_path), a));
+
+    // header, then 5 pointers at 64, padded to the indices at 128
+    const auto bytes = read_file(path);
+    const size_t pointers = sizeof(binary::Header);
+    const size_t indices = 128;
+    const auto bad = temporary("sparse_bad.mat");
+    // a pointer array that decreases, but still ends at nnz
+    corrupt(bad, bytes, pointers + 1 * 8, 3);
+    CHECK(aborts([&] { binary::load_csr<double>(bad); }));
+    // a pointer past nnz
+    corrupt(bad, bytes, pointers + 2 * 8, 9);
+    CHECK(aborts([&] { binary::load_csr<double>(bad); }));
+    // a column index past the last column
+    corrupt(bad, bytes, indices + 1 * 8, 6);
+    CHECK(aborts([&] { binary::load_csr<double>(bad); }));
+    // column indices out of order within a row
+    corrupt(bad, bytes, indices + 0 * 8, 5);
+    CHECK(aborts([&] { binary::load_csr<double>(bad); }));
+    // a row count whose pointer array is far larger than the file
+    corrupt(bad, bytes, offsetof(binary::Header, rows), uint64_t(1) << 62);
+    CHECK(aborts([&] { binary::load_csr<double>(bad); }));
+    // a nonzero count whose arrays wrap around
+    corrupt(bad, bytes, offsetof(binary::Header, nnz), uint64_t(1) << 61);
+    CHECK(aborts([&] { binary::load_csr<double>(bad); }));
+
+    std::remove(path.c_str());
+    std::remove(csc_path.c_str());
+    std::remove(bad.c_str());
+}
+
+int main()
+{
+    dense();
+    sparse();
+    if (failures != 0)
+        std::printf("%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+/* Krylov solvers on a threaded policy: they converge, and once a Workspace has been through one solve the
+next solve allocates nothing, neither in the dot products nor in the pool
+*/
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "Krylov.h"
+
+static std::atomic<size_t> allocations(0);
+
+void *operator new(size_t bytes)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(bytes == 0 ? 1 : bytes))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+static int failures = 0;
+
+#define CHECK(condition)                                                              \
+    do                                                                                \
+    {                                                                                 \
+        if (!(condition))                                                             \
+        {                                                                             \
+            std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++failures;                                                               \
+        }                                                                             \
+    } while (false)
+
+/// The n x n tridiagonal (-1, 4, -1), symmetric positive definite and well conditioned
+static CsrMat<double> tridiagonal(size_t n)
+{
+    auto b = TripletBuilder<double>(n, n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (i > 0)
+            b.add(i, i - 1, -1.0);
+        b.add(i, i, 4.0);
+        if (i + 1 < n)
+            b.add(i, i + 1, -1.0);
+    }
+    return b.finalize();
+}
+
+/// Solves twice with one workspace, checks the solution and that the second solve didn't allocate
+template <typename Solve>
+static void solve(const char *name, const CsrMat<double> &a, const parallel::Policy &policy, const Solve &solver)
+{
+    const size_t n = a.ROWS_;
+    auto b = std::vector<double>(n, 1.0);
+    auto x = std::vector<double>(n);
+    auto options = krylov::Options();
+    options.tolerance = 1e-10;
+    options.history = false;
+    auto workspace = krylov::Workspace<double>();
+    solver(a, b.data(), x.data(), options, workspace, policy);
+
+    std::fill(x.begin(), x.end(), 0.0);
+    const size_t before = allocations.load();
+    const auto result = solver(a, b.data(), x.data(), options, workspace, policy);
+    const size_t during = allocations.load() - before;
+    if (!result.converged || during != 0)
+        std::printf("%s: converged %d after %zu iterations, %zu allocations\n", name, int(result.converged),
+                    result.iterations, during);
+    CHECK(result.converged);
+    CHECK(during == 0);
+
+    // ||b - A x|| / ||b||, a little above the tolerance for the rounding of the solvers' own residuals
+    double r2 = 0, b2 = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double ax = 4.0 * x[i] - (i > 0 ? x[i - 1] : 0.0) - (i + 1 < n ? x[i + 1] : 0.0);
+        r2 += (b[i] - ax) * (b[i] - ax);
+        b2 += b[i] * b[i];
+    }
+    CHECK(std::sqrt(r2 / b2) < 1e-9);
+}
+
+int main()
+{
+    const auto a = tridiagonal(200000);
+    auto pool = ThreadPool(4);
+    auto threaded = parallel::Policy();
+    threaded.pool = &pool;
+    threaded.serial_cutoff = 4096;
+    auto deterministic = parallel::Policy();
+    deterministic.deterministic = true;
+
+    for (const auto &policy : {threaded, deterministic})
+    {
+        const auto jacobi = krylov::Jacobi<double>(a);
+        const auto identity = krylov::Identity<double>(a.ROWS_);
+        solve("cg", a, policy, [&](const CsrMat<double> &m, const double *b, double *x, const krylov::Options &o,
+                                   krylov::Workspace<double> &w, const parallel::Policy &p) {
+            return krylov::cg(m, b, x, jacobi, o, w, p);
+        });
+        solve("bicgstab", a, policy, [&](const CsrMat<double> &m, const double *b, double *x, const krylov::Options &o,
+                                         krylov::Workspace<double> &w, const parallel::Policy &p) {
+            return krylov::bicgstab(m, b, x, identity, o, w, p);
+        });
+        solve("gmres", a, policy, [&](const CsrMat<double> &m, const double *b, double *x, const krylov::Options &o,
+                                      krylov::Workspace<double> &w, const parallel::Policy &p) {
+            return krylov::gmres(m, b, x, jacobi, o, w, p);
+        });
+    }
+    if (failures != 0)
+        std::printf("%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
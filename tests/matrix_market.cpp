@@ -0,0 +1,251 @@
+/* Round trips through Matrix Market files, the banners the reader understands, and malformed files that
+have to PANIC instead of being loaded
+Every malformed file is loaded in a child process, which has to die by abort().
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+#include <signal.h>   // SIGABRT
+#include <sys/wait.h> // waitpid
+#include <unistd.h>   // fork
+
+#include "MatrixMarket.h"
+
+static int failures = 0;
+
+#define CHECK(condition)                                                          \
+    do                                                                            \
+    {                                                                             \
+        if (!(condition))                                                         \
+        {                                                                         \
+            std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++failures;                                                           \
+        }                                                                         \
+    } while (false)
+
+static std::string temporary(const char *name)
+{
+    const char *dir = std::getenv("TMPDIR");
+    return std::string(dir != nullptr ? dir : "/tmp") + "/matrac_test_" + std::to_string(::getpid()) + "_" + name;
+}
+
+static void write_file(const std::string &path, const std::string &text)
+{
+    auto out = std::ofstream(path, std::ios::binary | std::ios::trunc);
+    out << text;
+}
+
+/// Runs load in a child process, true if it aborted
+template <typename F>
+static bool aborts(const F &load)
+{
+    std::fflush(stdout);
+    const pid_t pid = ::fork();
+    if (pid == 0)
+    {
+        // the PANIC message would only clutter the test output
+        std::freopen("/dev/null", "w", stdout);
+        load();
+        std::_Exit(0);
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    return WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+
+static CsrMat<double> example()
+{
+    // 4x6 with an empty row and values that need all their digits
+    auto b = TripletBuilder<double>(4, 6);
+    b.add(0, 1, 0.1);
+    b.add(0, 5, -2.0);
+    b.add(2, 0, 1.0 / 3.0);
+    b.add(2, 3, 4e-300);
+    b.add(3, 2, 5e10);
+    return b.finalize();
+}
+
+static bool equal(const CsrMat<double> &a, const CsrMat<double> &b)
+{
+    return a.ROWS_ == b.ROWS_ && a.COLS_ == b.COLS_ && a.buffer().pointers() == b.buffer().pointers() &&
+           a.buffer().indices() == b.buffer().indices() && a.buffer().values() == b.buffer().values();
+}
+
+template <typename T, template <class> typename MemBuf>
+static bool equal(const internal::AbstractDynMat<T, MemBuf> &a, const DynMat<T> &b)
+{
+    if (a.ROWS_ != b.ROWS_ || a.COLS_ != b.COLS_)
+        return false;
+    for (size_t i = 0; i < a.ROWS_; ++i)
+        for (size_t j = 0; j < a.COLS_; ++j)
+            if (a.unchecked(i, j) != b.unchecked(i, j))
+                return false;
+    return true;
+}
+
+static void round_trips()
+{
+    const auto path = temporary("sparse.mtx");
+    const auto a = example();
+    const auto dense = to_dense(a);
+    matrix_market::write(path, a);
+    const auto i = matrix_market::info(path);
+    CHECK(i.format == matrix_market::Format::Coordinate && i.field == matrix_market::Field::Real);
+    CHECK(i.symmetry == matrix_market::Symmetry::General && i.rows == 4 && i.cols == 6 && i.entries == 5);
+    CHECK(equal(matrix_market::read_csr<double>(path), a));
+    CHECK(equal(to_csr(matrix_market::read_csc<double>(path)), a));
+    CHECK(equal(matrix_market::read_sparse<double>(path), dense));
+    CHECK(equal(matrix_market::read_dense<double>(path), dense));
+
+    matrix_market::write(path, to_csc(a));
+    CHECK(equal(matrix_market::read_csr<double>(path), a));
+    matrix_market::write(path, matrix_market::read_sparse<double>(path));
+    CHECK(equal(matrix_market::read_csr<double>(path), a));
+
+    // dense matrices go through array files, in column major order
+    const auto array_path = temporary("dense.mtx");
+    matrix_market::write(array_path, dense);
+    CHECK(matrix_market::info(array_path).format == matrix_market::Format::Array);
+    CHECK(equal(matrix_market::read_dense<double>(array_path), dense));
+    CHECK(equal(matrix_market::read_csr<double>(array_path), a));
+
+    auto n = DynMat<int>(3, 2);
+    for (size_t k = 0; k < n.SIZE; ++k)
+        n.unchecked(k / 2, k % 2) = static_cast<int>(k) * 7 - 20;
+    matrix_market::write(array_path, n);
+    CHECK(matrix_market::info(array_path).field == matrix_market::Field::Integer);
+    CHECK(equal(matrix_market::read_dense<int>(array_path), n));
+
+    // enough entries to be parsed and formatted in pieces on a pool
+    auto pool = ThreadPool(4);
+    auto policy = parallel::Policy();
+    policy.pool = &pool;
+    policy.serial_cutoff = 256;
+    auto b = TripletBuilder<double>(500, 400);
+    for (size_t k = 0; k < 20000; ++k)
+        b.add(k * 7919 % 500, k * 104729 % 400, static_cast<double>(k) / 7.0 - 1000.0);
+    const auto big = b.finalize();
+    matrix_market::write(path, big, policy);
+    CHECK(equal(matrix_market::read_csr<double>(path, policy), big));
+    matrix_market::write(array_path, to_dense(big), policy);
+    CHECK(equal(matrix_market::read_dense<double>(array_path, policy), to_dense(big)));
+
+    std::remove(path.c_str());
+    std::remove(array_path.c_str());
+}
+
+static DynMat<double> dense(size_t rows, size_t cols, std::initializer_list<double> values)
+{
+    auto d = DynMat<double>(rows, cols);
+    size_t k = 0;
+    for (auto &&v : values)
+    {
+        d.unchecked(k / cols, k % cols) = v;
+        ++k;
+    }
+    return d;
+}
+
+static void banners()
+{
+    const auto path = temporary("banner.mtx");
+
+    write_file(path, "%%MatrixMarket matrix coordinate real symmetric\n"
+                     "% lower triangle\n"
+                     "3 3 3\n"
+                     "1 1 1.5\n"
+                     "3 1 -2\n"
+                     "3 2 4\n");
+    CHECK(matrix_market::info(path).symmetry == matrix_market::Symmetry::Symmetric);
+    CHECK(equal(matrix_market::read_dense<double>(path), dense(3, 3, {1.5, 0, -2, 0, 0, 4, -2, 4, 0})));
+    CHECK(equal(to_dense(matrix_market::read_csr<double>(path)), dense(3, 3, {1.5, 0, -2, 0, 0, 4, -2, 4, 0})));
+
+    write_file(path, "%%MatrixMarket matrix coordinate integer skew-symmetric\n"
+                     "3 3 2\n"
+                     "2 1 5\n"
+                     "3 2 -1\n");
+    CHECK(matrix_market::info(path).symmetry == matrix_market::Symmetry::SkewSymmetric);
+    CHECK(equal(matrix_market::read_dense<double>(path), dense(3, 3, {0, -5, 0, 5, 0, 1, 0, -1, 0})));
+
+    write_file(path, "%%MatrixMarket matrix coordinate pattern general\n"
+                     "2 3 3\n"
+                     "1 3\n"
+                     "2 1\n"
+                     "2 2\n");
+    CHECK(matrix_market::info(path).field == matrix_market::Field::Pattern);
+    CHECK(equal(matrix_market::read_dense<double>(path), dense(2, 3, {0, 0, 1, 1, 1, 0})));
+
+    // column major, with blank lines, comments and \r\n line ends between the values
+    write_file(path, "%%MatrixMarket matrix array real general\r\n"
+                     "2 3\r\n"
+                     "1\r\n"
+                     "4\r\n"
+                     "\r\n"
+                     "% the second column\n"
+                     "2\n"
+                     "5\n"
+                     "3\n"
+                     "6\n");
+    CHECK(matrix_market::info(path).entries == 6);
+    CHECK(equal(matrix_market::read_dense<double>(path), dense(2, 3, {1, 2, 3, 4, 5, 6})));
+
+    // the lower triangle by columns
+    write_file(path, "%%MatrixMarket matrix array real symmetric\n"
+                     "3 3\n"
+                     "1\n2\n3\n4\n5\n6\n");
+    CHECK(matrix_market::info(path).entries == 6);
+    CHECK(equal(matrix_market::read_dense<double>(path), dense(3, 3, {1, 2, 3, 2, 4, 5, 3, 5, 6})));
+
+    // the strict lower triangle, the diagonal is zero
+    write_file(path, "%%MatrixMarket matrix array integer skew-symmetric\n"
+                     "3 3\n"
+                     "1\n2\n3\n");
+    CHECK(matrix_market::info(path).entries == 3);
+    CHECK(equal(matrix_market::read_dense<double>(path), dense(3, 3, {0, -1, -2, 1, 0, -3, 2, 3, 0})));
+
+    std::remove(path.c_str());
+}
+
+static void malformed()
+{
+    const auto path = temporary("malformed.mtx");
+    const auto rejects = [&](const char *text) {
+        write_file(path, text);
+        return aborts([&] { matrix_market::read_csr<double>(path); }) &&
+               aborts([&] { matrix_market::read_dense<double>(path); });
+    };
+
+    // the file as it should be, then with one thing wrong
+    CHECK(!rejects("%%MatrixMarket matrix coordinate integer general\n2 2 2\n1 1 1\n2 2 7\n"));
+    // trailing fields
+    CHECK(rejects("%%MatrixMarket matrix coordinate integer general\n2 2 2\n1 1 1.5\n2 2 7\n"));
+    CHECK(rejects("%%MatrixMarket matrix coordinate integer general\n2 2 2\n1 1 1\n2 2 7 junk\n"));
+    CHECK(rejects("%%MatrixMarket matrix coordinate pattern general\n2 2 2\n1 1\n2 2 7\n"));
+    CHECK(rejects("%%MatrixMarket matrix array real general\n2 1\n4 5\n6\n"));
+    // entry counts that don't match the size line
+    CHECK(rejects("%%MatrixMarket matrix coordinate integer general\n2 2 3\n1 1 1\n2 2 7\n"));
+    CHECK(rejects("%%MatrixMarket matrix coordinate integer general\n2 2 1\n1 1 1\n2 2 7\n"));
+    CHECK(rejects("%%MatrixMarket matrix array real general\n2 2\n1\n2\n3\n"));
+    CHECK(rejects("%%MatrixMarket matrix array real general\n2 2\n1\n2\n3\n4\n5\n"));
+    CHECK(rejects("%%MatrixMarket matrix array real symmetric\n2 2\n1\n2\n"));
+    // and everything else the header or an entry can get wrong
+    CHECK(rejects("%%MatrixMarket matrix coordinate complex general\n1 1 1\n1 1 1 0\n"));
+    CHECK(rejects("%%MatrixMarket matrix coordinate real symmetric\n2 3 0\n"));
+    CHECK(rejects("%%MatrixMarket matrix coordinate real general\n2 2 1\n3 1 1\n"));
+    CHECK(rejects("%%MatrixMarket matrix coordinate real general\n2 2 1\n0 1 1\n"));
+
+    std::remove(path.c_str());
+}
+
+int main()
+{
+    round_trips();
+    banners();
+    malformed();
+    if (failures != 0)
+        std::printf("%d checks failed\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -3,9 +3,29 @@
 
 #include <iostream>
 #include <string>
+#include <memory>
+#include <type_traits>
+#include <utility> // declval
 
 #define PANIC(...) std::cout << "Panicked at " << __FILE__ << "/" << __LINE__ << std::endl, panic(__VA_ARGS__);
 
+/* Bounds checking policy
+With MATRAC_BOUNDS_CHECK set to 1 every element access through operator() / operator[] is checked, with 0
+only shapes are, at the boundaries of operations (products, elementwise operations, slices, ...). It
+defaults to 1 and to 0 if NDEBUG is defined, so debug builds check everything and release builds only
+shapes; -DMATRAC_BOUNDS_CHECK=0/1 overrides that. The library's own loops use the never checked
+unchecked(i, j) accessors in either mode, they index within shapes they already validated.
+*/
+#if !defined(MATRAC_BOUNDS_CHECK)
+#if defined(NDEBUG)
+#define MATRAC_BOUNDS_CHECK 0
+#else
+#define MATRAC_BOUNDS_CHECK 1
+#endif
+#endif
+
+constexpr bool BOUNDS_CHECKED = MATRAC_BOUNDS_CHECK != 0;
+
 using String = std::string;
 
 inline void nl()
@@ -13,7 +33,7 @@ inline void nl()
     std::cout << std::endl;
 }
 
-void panic()
+inline void panic()
 {
     std::cout << std::endl;
     abort();
@@ -84,4 +104,20 @@ struct to_raw_pointer<Elem *>
     using Element = Elem;
     using Raw = Elem *;
 };
+
+/*Detects MemBufs that store their elements in a single contiguous block, exposed through data()
+Kernels use this to work on raw pointers instead of going through operator[].
+Example:
+    is_contiguous<DynBuffer<double>>::value; // true
+    is_contiguous<SparseBuffer<double>>::value; // false
+*/
+template <typename Buf, typename = void>
+struct is_contiguous : std::false_type
+{
+};
+
+template <typename Buf>
+struct is_contiguous<Buf, decltype(static_cast<void>(std::declval<Buf &>().data()))> : std::true_type
+{
+};
 #endif // UTIL_H